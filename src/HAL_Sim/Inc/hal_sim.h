@@ -0,0 +1,334 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+#ifndef HAL_SIM_H_
+#define HAL_SIM_H_
+
+#ifdef HAL_SIMULATION
+
+#include "stm32f4xx_hal.h"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Host simulation of the STM32F4 HAL.
+ *
+ * The simulation replaces HAL_Driver/Src: the firmware (Hardware, MyApplication, the
+ * stm32async library and its drivers) is compiled unmodified for the host and linked
+ * against HAL_Sim/Src. The simulation consists of:
+ *
+ * - The peripheral and core register blocks, mapped as plain memory at their target
+ *   addresses, so register macros like __HAL_TIM_GET_COUNTER or DWT->CYCCNT still work.
+ *   Only a store to GPIO_BSRR is applied at once, see Inc/stm32f4xx.h.
+ * - A virtual clock in nanoseconds. It only advances when the firmware calls into the HAL,
+ *   executes __NOP/__WFI or waits for a bus transfer. Every HAL call costs HAL_CALL_CYCLES
+ *   CPU cycles at the current SystemCoreClock, a bus transfer takes the time given by the
+ *   configured baud rate or clock divider. A run is therefore fully deterministic. A loop
+ *   that only polls a variable, like "while (device.isOccupied()) {}", does not advance
+ *   the clock and never ends; it needs a __NOP() or a HAL call in its body.
+ * - An NVIC with enable, pending and priority state. The interrupt handlers of the
+ *   firmware (SysTick_Handler, DMA2_Stream7_IRQHandler, ...) are called at HAL call
+ *   boundaries, a handler of a higher priority preempts a running one.
+ * - GPIO, EXTI, DMA, UART, SPI, I2C, I2S, SDIO, TIM, RTC, ADC and DAC models that complete
+ *   the transfers by the same interrupt and callback chain as the hardware.
+ * - Scripted input (pin levels, encoder counts, UART input, SD card insertion), simple
+ *   device models (SPI EEPROM, I2C register file, SD card image) and a trace of all
+ *   GPIO output changes and bus transfers.
+ *
+ * The scenario is given either by the C++ interface below or by a script file that is
+ * named in the environment variable HAL_SIM_SCRIPT and executed by HAL_Init(). The trace
+ * is written to the file named in HAL_SIM_TRACE. A script has one command per line,
+ * prefixed by the virtual time in milliseconds; '#' starts a comment:
+ *
+ *     0      eeprom SPI1 PC4 512          # 25AA040A at SPI1, chip select PC4
+ *     0      i2c I2C2 0x88 16             # 16 registers at address 0x88 (TDA7439)
+ *     0      sdcard card.img              # SD card image, "sdcard none" removes it
+ *     0      sdfault 2                    # the next two SD transfers fail with a CRC error
+ *     0      irqdrop USART1 1             # the next USART1 interrupt request is lost
+ *     0      i2s SPI2 out.raw             # record the I2S output
+ *     0      console off                  # do not echo the UART output to stdout
+ *     500    pin PB15 0                   # drive an input pin
+ *     500    pulse PB14 0 120             # drive a pin for 120 ms, then restore the level
+ *     800    encoder TIM1 4               # move an encoder by four counts (one detent)
+ *     900    uart USART2 "AT\r\n"         # send characters to a UART
+ *     900    adc ADC1 3 2048              # set an analog input
+ *     5000   end                          # finish the simulation
+ *
+ * Host build: HAL_Sim/Makefile compiles the firmware sources (without startup/, src/syscalls.c,
+ * HAL_Driver/Src and the FatFS code pages option/cc*.c) together with the sources in
+ * HAL_Sim/Src for the host; "make test" runs the host tests and scenarios in HAL_Sim/Tests.
+ * HAL_Sim/Src/hal_sim_dsp.cpp replaces the CMSIS-DSP library of the target.
+ */
+namespace HalSim
+{
+
+/**
+ * @brief CPU cycles charged for every call into the simulated HAL.
+ */
+static constexpr uint32_t HAL_CALL_CYCLES = 16;
+
+/**
+ * @brief CPU cycles charged for the entry into an interrupt handler.
+ */
+static constexpr uint32_t IRQ_ENTRY_CYCLES = 12;
+
+/************************************************************************
+ * Virtual clock
+ ************************************************************************/
+
+/**
+ * @brief Returns the virtual time since the simulated reset, in nanoseconds.
+ */
+uint64_t getTime ();
+
+/**
+ * @brief Lets the given time pass without CPU activity; the events and interrupts that
+ *        are due meanwhile are processed.
+ */
+void advance (uint64_t ns);
+
+/**
+ * @brief Calls an action at the given virtual time. The action runs in the simulator
+ *        context: it may change pin levels or raise interrupts, but it does not preempt
+ *        a running interrupt handler.
+ *
+ * @param owner key used by cancel(), may be NULL.
+ */
+void schedule (uint64_t time, std::function<void ()> action, const void * owner = NULL);
+
+/**
+ * @brief Removes all scheduled actions of an owner.
+ */
+void cancel (const void * owner);
+
+/**
+ * @brief Returns the number of calls of an interrupt or exception handler.
+ */
+uint32_t getIrqCount (IRQn_Type irqn);
+
+/**
+ * @brief Lets the given number of the following requests of an interrupt or exception get
+ *        lost, like a missed completion interrupt.
+ */
+void dropIrqs (IRQn_Type irqn, uint32_t count);
+
+/**
+ * @brief Flushes the trace and terminates the process.
+ */
+void finish (int exitCode = 0);
+
+/************************************************************************
+ * Scripted input
+ ************************************************************************/
+
+/**
+ * @brief Drives the external level of input pins. EXTI lines of the pins trigger on
+ *        the configured edges.
+ */
+void setPin (GPIO_TypeDef * port, uint16_t pins, bool level);
+
+/**
+ * @brief Returns the level at a pin: the output data for an output, otherwise the
+ *        external level.
+ */
+bool getPin (GPIO_TypeDef * port, uint16_t pin);
+
+/**
+ * @brief Moves the counter of a timer in encoder mode by the given number of counts.
+ */
+void moveEncoder (TIM_TypeDef * timer, int32_t counts);
+
+/**
+ * @brief Queues characters that arrive at a UART with its configured baud rate.
+ */
+void receiveUart (USART_TypeDef * usart, const std::string & data);
+
+/**
+ * @brief Sets the value that an ADC converts at the given channel.
+ */
+void setAnalogInput (ADC_TypeDef * adc, uint32_t channel, uint16_t value);
+
+/************************************************************************
+ * Device models
+ ************************************************************************/
+
+/**
+ * @brief A device at a SPI bus selected by a chip select pin (active low).
+ */
+class SpiDevice
+{
+public:
+
+    virtual ~SpiDevice () = default;
+    virtual void select (bool active) = 0;
+    virtual uint8_t exchange (uint8_t mosi) = 0;
+};
+
+/**
+ * @brief A device at an I2C bus. A device that returns false does not acknowledge.
+ */
+class I2cDevice
+{
+public:
+
+    virtual ~I2cDevice () = default;
+    virtual bool write (const uint8_t * data, uint16_t n) = 0;
+    virtual bool read (uint8_t * data, uint16_t n) = 0;
+};
+
+/**
+ * @brief Microchip 25xx serial EEPROM with 16-byte pages: READ, WRITE, WREN, WRDI, RDSR
+ *        and WRSR. The ninth address bit of the 25xx040 is taken from the instruction.
+ *        The memory is loaded from the given file and saved back by the destructor.
+ */
+class SpiEepRom : public SpiDevice
+{
+public:
+
+    SpiEepRom (uint32_t size, const char * fileName = NULL);
+
+    virtual ~SpiEepRom ();
+    virtual void select (bool active) override;
+    virtual uint8_t exchange (uint8_t mosi) override;
+
+    inline std::vector<uint8_t> & getMemory ()
+    {
+        return memory;
+    }
+
+private:
+
+    static constexpr uint32_t PAGE_SIZE = 16;
+    static constexpr uint64_t WRITE_CYCLE = 5000000; // 5 ms
+    std::vector<uint8_t> memory;
+    std::string fileName;
+    uint8_t instruction, status;
+    uint32_t position, address;
+    bool writeEnabled, modified;
+    uint64_t busyUntil;
+};
+
+/**
+ * @brief Register file device: the first written byte selects the register, the further
+ *        bytes are written to or read from the consecutive registers.
+ */
+class I2cRegisterFile : public I2cDevice
+{
+public:
+
+    explicit I2cRegisterFile (uint32_t size);
+
+    virtual bool write (const uint8_t * data, uint16_t n) override;
+    virtual bool read (uint8_t * data, uint16_t n) override;
+
+    inline std::vector<uint8_t> & getRegisters ()
+    {
+        return registers;
+    }
+
+private:
+
+    std::vector<uint8_t> registers;
+    uint32_t pointer;
+};
+
+/**
+ * @brief Connects a device to a SPI bus. The simulation does not take the ownership.
+ */
+void attachSpiDevice (SPI_TypeDef * spi, GPIO_TypeDef * csPort, uint16_t csPin, SpiDevice * device);
+
+/**
+ * @brief Connects a device to an I2C bus at the given (8-bit) address.
+ */
+void attachI2cDevice (I2C_TypeDef * i2c, uint16_t address, I2cDevice * device);
+
+/**
+ * @brief Inserts an SD card backed by an image file, the capacity is the file size.
+ */
+bool insertSdCard (const char * fileName);
+
+/**
+ * @brief Pulls the SD card; a transfer in progress ends with a data timeout.
+ */
+void removeSdCard ();
+
+/**
+ * @brief Lets the given number of the following SD transfers fail with a CRC error.
+ */
+void injectSdErrors (uint32_t count);
+
+/**
+ * @brief Receives the 16-bit DMA items shifted out by an I2S transmitter, in the order of
+ *        their output: a buffer of a normal mode transfer when it is complete, a half of
+ *        a circular buffer when it is consumed.
+ */
+typedef std::function<void (const uint16_t * items, uint32_t n)> I2sSink;
+
+/**
+ * @brief Connects a sink to an I2S transmitter, an empty function disconnects it.
+ */
+void captureI2s (SPI_TypeDef * spi, I2sSink sink);
+
+/**
+ * @brief Writes the frames sent by an I2S transmitter to a raw file.
+ */
+bool recordI2s (SPI_TypeDef * spi, const char * fileName);
+
+/************************************************************************
+ * Script and trace
+ ************************************************************************/
+
+struct TraceRecord
+{
+    uint64_t time;
+    std::string bus;
+    std::string text;
+};
+
+/**
+ * @brief Schedules the commands of a script file, see the description above.
+ */
+bool loadScript (const char * fileName);
+
+/**
+ * @brief Executes a single script command immediately.
+ */
+bool executeCommand (const std::string & command);
+
+/**
+ * @brief Writes the trace records to the given file as they occur.
+ */
+bool openTrace (const char * fileName);
+
+const std::vector<TraceRecord> & getTrace ();
+
+void clearTrace ();
+
+/**
+ * @brief Enables the echo of the UART output on stdout (enabled by default).
+ */
+void setConsole (bool enabled);
+
+} // end of namespace HalSim
+
+#endif
+#endif
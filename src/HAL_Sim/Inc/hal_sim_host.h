@@ -0,0 +1,385 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+/*
+ * Host replacement of the target toolchain parts that the firmware relies on.
+ *
+ * CMSIS/core/cmsis_gcc.h implements the core and SIMD intrinsics with Cortex-M inline
+ * assembly. This header provides the same functions in portable C and is force-included
+ * into every translation unit of the host build (gcc -include hal_sim_host.h), so the
+ * include guard of cmsis_gcc.h is already set when core_cm4.h pulls it in. It also
+ * declares the newlib extensions that are missing in the host C library.
+ *
+ * The interrupt mask functions are forwarded to the simulated NVIC, and __NOP, __WFI and
+ * __WFE let the virtual clock run: a busy loop or an idle loop of the firmware therefore
+ * also advances the simulated time.
+ */
+
+#ifndef HAL_SIM_HOST_H_
+#define HAL_SIM_HOST_H_
+
+#ifdef HAL_SIMULATION
+
+#define __CMSIS_GCC_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Implemented by the simulated NVIC and the virtual clock, see hal_sim_core.cpp */
+void halSimSetPrimask (uint32_t priMask);
+uint32_t halSimGetPrimask (void);
+void halSimSetBasepri (uint32_t basePri);
+uint32_t halSimGetBasepri (void);
+uint32_t halSimGetIpsr (void);
+void halSimCycles (uint32_t cycles);
+void halSimWaitForInterrupt (void);
+
+/* GE flags of the APSR, set by the SIMD additions and subtractions and used by __SEL */
+extern uint32_t halSimApsrGe;
+
+/* newlib extension, see hal_sim_core.cpp */
+char * __itoa (int value, char * str, int base);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define __HAL_SIM_INLINE __attribute__((always_inline, unused)) static inline
+
+/* Core function access */
+
+__HAL_SIM_INLINE void __enable_irq (void)                 { halSimSetPrimask(0); }
+__HAL_SIM_INLINE void __disable_irq (void)                { halSimSetPrimask(1); }
+__HAL_SIM_INLINE uint32_t __get_CONTROL (void)            { return 0; }
+__HAL_SIM_INLINE void __set_CONTROL (uint32_t control)    { (void) control; }
+__HAL_SIM_INLINE uint32_t __get_IPSR (void)               { return halSimGetIpsr(); }
+__HAL_SIM_INLINE uint32_t __get_APSR (void)               { return 0; }
+__HAL_SIM_INLINE uint32_t __get_xPSR (void)               { return halSimGetIpsr(); }
+__HAL_SIM_INLINE uint32_t __get_PSP (void)                { return 0; }
+__HAL_SIM_INLINE void __set_PSP (uint32_t topOfProcStack) { (void) topOfProcStack; }
+__HAL_SIM_INLINE uint32_t __get_MSP (void)                { return 0; }
+__HAL_SIM_INLINE void __set_MSP (uint32_t topOfMainStack) { (void) topOfMainStack; }
+__HAL_SIM_INLINE uint32_t __get_PRIMASK (void)            { return halSimGetPrimask(); }
+__HAL_SIM_INLINE void __set_PRIMASK (uint32_t priMask)    { halSimSetPrimask(priMask & 1); }
+__HAL_SIM_INLINE void __enable_fault_irq (void)           { }
+__HAL_SIM_INLINE void __disable_fault_irq (void)          { }
+__HAL_SIM_INLINE uint32_t __get_BASEPRI (void)            { return halSimGetBasepri(); }
+__HAL_SIM_INLINE void __set_BASEPRI (uint32_t value)      { halSimSetBasepri(value & 0xFF); }
+__HAL_SIM_INLINE void __set_BASEPRI_MAX (uint32_t value)
+{
+    uint32_t current = halSimGetBasepri();
+    if (value != 0 && (current == 0 || (value & 0xFF) < current))
+    {
+        halSimSetBasepri(value & 0xFF);
+    }
+}
+__HAL_SIM_INLINE uint32_t __get_FAULTMASK (void)          { return 0; }
+__HAL_SIM_INLINE void __set_FAULTMASK (uint32_t faultMask) { (void) faultMask; }
+__HAL_SIM_INLINE uint32_t __get_FPSCR (void)              { return 0; }
+__HAL_SIM_INLINE void __set_FPSCR (uint32_t fpscr)        { (void) fpscr; }
+
+/* Core instruction access */
+
+__HAL_SIM_INLINE void __NOP (void)                        { halSimCycles(1); }
+__HAL_SIM_INLINE void __WFI (void)                        { halSimWaitForInterrupt(); }
+__HAL_SIM_INLINE void __WFE (void)                        { halSimWaitForInterrupt(); }
+__HAL_SIM_INLINE void __SEV (void)                        { }
+__HAL_SIM_INLINE void __ISB (void)                        { __atomic_thread_fence(__ATOMIC_SEQ_CST); }
+__HAL_SIM_INLINE void __DSB (void)                        { __atomic_thread_fence(__ATOMIC_SEQ_CST); }
+__HAL_SIM_INLINE void __DMB (void)                        { __atomic_thread_fence(__ATOMIC_SEQ_CST); }
+__HAL_SIM_INLINE uint32_t __REV (uint32_t value)          { return __builtin_bswap32(value); }
+__HAL_SIM_INLINE uint32_t __REV16 (uint32_t value)
+{
+    return ((value & 0x00FF00FFu) << 8) | ((value & 0xFF00FF00u) >> 8);
+}
+__HAL_SIM_INLINE int32_t __REVSH (int32_t value)
+{
+    return (int32_t) (int16_t) __builtin_bswap16((uint16_t) value);
+}
+__HAL_SIM_INLINE uint32_t __ROR (uint32_t op1, uint32_t op2)
+{
+    op2 &= 31;
+    return (op2 == 0) ? op1 : (op1 >> op2) | (op1 << (32 - op2));
+}
+#define __BKPT(value)       __builtin_trap()
+__HAL_SIM_INLINE uint32_t __RBIT (uint32_t value)
+{
+    uint32_t result = 0;
+    for (int i = 0; i < 32; ++i, value >>= 1)
+    {
+        result = (result << 1) | (value & 1);
+    }
+    return result;
+}
+#define __CLZ(value)        ((uint8_t) ((value) == 0 ? 32 : __builtin_clz(value)))
+__HAL_SIM_INLINE uint8_t __LDREXB (volatile uint8_t * addr)   { return *addr; }
+__HAL_SIM_INLINE uint16_t __LDREXH (volatile uint16_t * addr) { return *addr; }
+__HAL_SIM_INLINE uint32_t __LDREXW (volatile uint32_t * addr) { return *addr; }
+__HAL_SIM_INLINE uint32_t __STREXB (uint8_t value, volatile uint8_t * addr)   { *addr = value; return 0; }
+__HAL_SIM_INLINE uint32_t __STREXH (uint16_t value, volatile uint16_t * addr) { *addr = value; return 0; }
+__HAL_SIM_INLINE uint32_t __STREXW (uint32_t value, volatile uint32_t * addr) { *addr = value; return 0; }
+__HAL_SIM_INLINE void __CLREX (void)                      { }
+
+__HAL_SIM_INLINE int32_t __halSimSsat (int32_t value, uint32_t sat)
+{
+    const int32_t max = (int32_t) ((1u << (sat - 1)) - 1);
+    return (value > max) ? max : (value < -max - 1) ? -max - 1 : value;
+}
+__HAL_SIM_INLINE uint32_t __halSimUsat (int32_t value, uint32_t sat)
+{
+    const int32_t max = (int32_t) ((1u << sat) - 1);
+    return (uint32_t) ((value > max) ? max : (value < 0) ? 0 : value);
+}
+#define __SSAT(ARG1, ARG2)  __halSimSsat((int32_t) (ARG1), (ARG2))
+#define __USAT(ARG1, ARG2)  __halSimUsat((int32_t) (ARG1), (ARG2))
+__HAL_SIM_INLINE uint32_t __RRX (uint32_t value)          { return value >> 1; }
+__HAL_SIM_INLINE uint8_t __LDRBT (volatile uint8_t * addr)    { return *addr; }
+__HAL_SIM_INLINE uint16_t __LDRHT (volatile uint16_t * addr)  { return *addr; }
+__HAL_SIM_INLINE uint32_t __LDRT (volatile uint32_t * addr)   { return *addr; }
+__HAL_SIM_INLINE void __STRBT (uint8_t value, volatile uint8_t * addr)    { *addr = value; }
+__HAL_SIM_INLINE void __STRHT (uint16_t value, volatile uint16_t * addr)  { *addr = value; }
+__HAL_SIM_INLINE void __STRT (uint32_t value, volatile uint32_t * addr)   { *addr = value; }
+
+/* SIMD intrinsics: each instruction is applied to the byte or half-word lanes of the operands */
+
+#define __HAL_SIM_LANES8(name, expr)                                           \
+__HAL_SIM_INLINE uint32_t name (uint32_t op1, uint32_t op2)                    \
+{                                                                              \
+    uint32_t result = 0;                                                       \
+    for (int i = 0; i < 32; i += 8)                                            \
+    {                                                                          \
+        const int32_t a = (int32_t) (int8_t) (op1 >> i), b = (int32_t) (int8_t) (op2 >> i); \
+        const uint32_t ua = (op1 >> i) & 0xFF, ub = (op2 >> i) & 0xFF;         \
+        (void) a; (void) b; (void) ua; (void) ub;                              \
+        result |= ((uint32_t) (expr) & 0xFF) << i;                             \
+    }                                                                          \
+    return result;                                                             \
+}
+
+#define __HAL_SIM_LANES16(name, exprLo, exprHi)                                \
+__HAL_SIM_INLINE uint32_t name (uint32_t op1, uint32_t op2)                    \
+{                                                                              \
+    const int32_t a0 = (int16_t) op1, a1 = (int16_t) (op1 >> 16);              \
+    const int32_t b0 = (int16_t) op2, b1 = (int16_t) (op2 >> 16);              \
+    const uint32_t ua0 = op1 & 0xFFFF, ua1 = op1 >> 16;                        \
+    const uint32_t ub0 = op2 & 0xFFFF, ub1 = op2 >> 16;                        \
+    (void) a0; (void) a1; (void) b0; (void) b1;                                \
+    (void) ua0; (void) ua1; (void) ub0; (void) ub1;                            \
+    return ((uint32_t) (exprLo) & 0xFFFF) | (((uint32_t) (exprHi) & 0xFFFF) << 16); \
+}
+
+/* The same for the instructions that set a GE flag per byte of the result */
+#define __HAL_SIM_LANES8_GE(name, expr, ge)                                    \
+__HAL_SIM_INLINE uint32_t name (uint32_t op1, uint32_t op2)                    \
+{                                                                              \
+    uint32_t result = 0, flags = 0;                                            \
+    for (int i = 0; i < 32; i += 8)                                            \
+    {                                                                          \
+        const int32_t a = (int32_t) (int8_t) (op1 >> i), b = (int32_t) (int8_t) (op2 >> i); \
+        const uint32_t ua = (op1 >> i) & 0xFF, ub = (op2 >> i) & 0xFF;         \
+        const int32_t r = (int32_t) (expr);                                    \
+        (void) a; (void) b; (void) ua; (void) ub;                              \
+        result |= ((uint32_t) r & 0xFF) << i;                                  \
+        flags |= (uint32_t) (ge) << (i / 8);                                   \
+    }                                                                          \
+    halSimApsrGe = flags;                                                      \
+    return result;                                                             \
+}
+
+/* The same for the instructions that set two GE flags per half-word of the result */
+#define __HAL_SIM_LANES16_GE(name, exprLo, exprHi, geLo, geHi)                 \
+__HAL_SIM_INLINE uint32_t name (uint32_t op1, uint32_t op2)                    \
+{                                                                              \
+    const int32_t a0 = (int16_t) op1, a1 = (int16_t) (op1 >> 16);              \
+    const int32_t b0 = (int16_t) op2, b1 = (int16_t) (op2 >> 16);              \
+    const uint32_t ua0 = op1 & 0xFFFF, ua1 = op1 >> 16;                        \
+    const uint32_t ub0 = op2 & 0xFFFF, ub1 = op2 >> 16;                        \
+    const int32_t r0 = (int32_t) (exprLo), r1 = (int32_t) (exprHi);            \
+    (void) a0; (void) a1; (void) b0; (void) b1;                                \
+    (void) ua0; (void) ua1; (void) ub0; (void) ub1;                            \
+    halSimApsrGe = ((geLo) ? 0x3u : 0) | ((geHi) ? 0xCu : 0);                  \
+    return ((uint32_t) r0 & 0xFFFF) | (((uint32_t) r1 & 0xFFFF) << 16);        \
+}
+
+#define __HAL_SIM_SAT8(v)   ((v) > 127 ? 127 : (v) < -128 ? -128 : (v))
+#define __HAL_SIM_USAT8(v)  ((v) > 255 ? 255 : (v) < 0 ? 0 : (v))
+#define __HAL_SIM_SAT16(v)  ((v) > 32767 ? 32767 : (v) < -32768 ? -32768 : (v))
+#define __HAL_SIM_USAT16(v) ((v) > 65535 ? 65535 : (v) < 0 ? 0 : (v))
+
+__HAL_SIM_LANES8_GE(__SADD8, a + b, r >= 0)
+__HAL_SIM_LANES8(__QADD8, __HAL_SIM_SAT8(a + b))
+__HAL_SIM_LANES8(__SHADD8, (a + b) >> 1)
+__HAL_SIM_LANES8_GE(__UADD8, ua + ub, r >= 0x100)
+__HAL_SIM_LANES8(__UQADD8, __HAL_SIM_USAT8((int32_t) (ua + ub)))
+__HAL_SIM_LANES8(__UHADD8, (ua + ub) >> 1)
+__HAL_SIM_LANES8_GE(__SSUB8, a - b, r >= 0)
+__HAL_SIM_LANES8(__QSUB8, __HAL_SIM_SAT8(a - b))
+__HAL_SIM_LANES8(__SHSUB8, (a - b) >> 1)
+__HAL_SIM_LANES8_GE(__USUB8, ua - ub, r >= 0)
+__HAL_SIM_LANES8(__UQSUB8, __HAL_SIM_USAT8((int32_t) ua - (int32_t) ub))
+__HAL_SIM_LANES8(__UHSUB8, ((int32_t) ua - (int32_t) ub) >> 1)
+
+__HAL_SIM_LANES16_GE(__SADD16, a0 + b0, a1 + b1, r0 >= 0, r1 >= 0)
+__HAL_SIM_LANES16(__QADD16, __HAL_SIM_SAT16(a0 + b0), __HAL_SIM_SAT16(a1 + b1))
+__HAL_SIM_LANES16(__SHADD16, (a0 + b0) >> 1, (a1 + b1) >> 1)
+__HAL_SIM_LANES16_GE(__UADD16, ua0 + ub0, ua1 + ub1, r0 >= 0x10000, r1 >= 0x10000)
+__HAL_SIM_LANES16(__UQADD16, __HAL_SIM_USAT16((int32_t) (ua0 + ub0)), __HAL_SIM_USAT16((int32_t) (ua1 + ub1)))
+__HAL_SIM_LANES16(__UHADD16, (ua0 + ub0) >> 1, (ua1 + ub1) >> 1)
+__HAL_SIM_LANES16_GE(__SSUB16, a0 - b0, a1 - b1, r0 >= 0, r1 >= 0)
+__HAL_SIM_LANES16(__QSUB16, __HAL_SIM_SAT16(a0 - b0), __HAL_SIM_SAT16(a1 - b1))
+__HAL_SIM_LANES16(__SHSUB16, (a0 - b0) >> 1, (a1 - b1) >> 1)
+__HAL_SIM_LANES16_GE(__USUB16, ua0 - ub0, ua1 - ub1, r0 >= 0, r1 >= 0)
+__HAL_SIM_LANES16(__UQSUB16, __HAL_SIM_USAT16((int32_t) ua0 - (int32_t) ub0),
+                  __HAL_SIM_USAT16((int32_t) ua1 - (int32_t) ub1))
+__HAL_SIM_LANES16(__UHSUB16, ((int32_t) ua0 - (int32_t) ub0) >> 1, ((int32_t) ua1 - (int32_t) ub1) >> 1)
+__HAL_SIM_LANES16_GE(__SASX, a0 - b1, a1 + b0, r0 >= 0, r1 >= 0)
+__HAL_SIM_LANES16(__QASX, __HAL_SIM_SAT16(a0 - b1), __HAL_SIM_SAT16(a1 + b0))
+__HAL_SIM_LANES16(__SHASX, (a0 - b1) >> 1, (a1 + b0) >> 1)
+__HAL_SIM_LANES16_GE(__UASX, ua0 - ub1, ua1 + ub0, r0 >= 0, r1 >= 0x10000)
+__HAL_SIM_LANES16(__UQASX, __HAL_SIM_USAT16((int32_t) ua0 - (int32_t) ub1), __HAL_SIM_USAT16((int32_t) (ua1 + ub0)))
+__HAL_SIM_LANES16(__UHASX, ((int32_t) ua0 - (int32_t) ub1) >> 1, (ua1 + ub0) >> 1)
+__HAL_SIM_LANES16_GE(__SSAX, a0 + b1, a1 - b0, r0 >= 0, r1 >= 0)
+__HAL_SIM_LANES16(__QSAX, __HAL_SIM_SAT16(a0 + b1), __HAL_SIM_SAT16(a1 - b0))
+__HAL_SIM_LANES16(__SHSAX, (a0 + b1) >> 1, (a1 - b0) >> 1)
+__HAL_SIM_LANES16_GE(__USAX, ua0 + ub1, ua1 - ub0, r0 >= 0x10000, r1 >= 0)
+__HAL_SIM_LANES16(__UQSAX, __HAL_SIM_USAT16((int32_t) (ua0 + ub1)), __HAL_SIM_USAT16((int32_t) ua1 - (int32_t) ub0))
+__HAL_SIM_LANES16(__UHSAX, (ua0 + ub1) >> 1, ((int32_t) ua1 - (int32_t) ub0) >> 1)
+
+__HAL_SIM_INLINE uint32_t __USAD8 (uint32_t op1, uint32_t op2)
+{
+    uint32_t result = 0;
+    for (int i = 0; i < 32; i += 8)
+    {
+        const int32_t d = (int32_t) ((op1 >> i) & 0xFF) - (int32_t) ((op2 >> i) & 0xFF);
+        result += (uint32_t) (d < 0 ? -d : d);
+    }
+    return result;
+}
+__HAL_SIM_INLINE uint32_t __USADA8 (uint32_t op1, uint32_t op2, uint32_t op3) { return __USAD8(op1, op2) + op3; }
+__HAL_SIM_INLINE uint32_t __UXTB16 (uint32_t op1)         { return op1 & 0x00FF00FFu; }
+__HAL_SIM_INLINE uint32_t __UXTAB16 (uint32_t op1, uint32_t op2)
+{
+    // Unlike UADD16, the extending additions do not set the GE flags
+    return ((op1 + (op2 & 0xFF)) & 0xFFFF) | (((op1 >> 16) + ((op2 >> 16) & 0xFF)) << 16);
+}
+__HAL_SIM_INLINE uint32_t __SXTB16 (uint32_t op1)
+{
+    return ((uint32_t) (int32_t) (int8_t) op1 & 0xFFFF) | ((uint32_t) (int32_t) (int8_t) (op1 >> 16) << 16);
+}
+__HAL_SIM_INLINE uint32_t __SXTAB16 (uint32_t op1, uint32_t op2)
+{
+    return ((op1 + (uint32_t) (int32_t) (int8_t) op2) & 0xFFFF)
+           | (((op1 >> 16) + (uint32_t) (int32_t) (int8_t) (op2 >> 16)) << 16);
+}
+
+#define __HAL_SIM_LO(op)    ((int32_t) (int16_t) (op))
+#define __HAL_SIM_HI(op)    ((int32_t) (int16_t) ((op) >> 16))
+
+__HAL_SIM_INLINE uint32_t __SMUAD (uint32_t op1, uint32_t op2)
+{
+    return (uint32_t) (__HAL_SIM_LO(op1) * __HAL_SIM_LO(op2) + __HAL_SIM_HI(op1) * __HAL_SIM_HI(op2));
+}
+__HAL_SIM_INLINE uint32_t __SMUADX (uint32_t op1, uint32_t op2)
+{
+    return (uint32_t) (__HAL_SIM_LO(op1) * __HAL_SIM_HI(op2) + __HAL_SIM_HI(op1) * __HAL_SIM_LO(op2));
+}
+__HAL_SIM_INLINE uint32_t __SMLAD (uint32_t op1, uint32_t op2, uint32_t op3)
+{
+    return __SMUAD(op1, op2) + op3;
+}
+__HAL_SIM_INLINE uint32_t __SMLADX (uint32_t op1, uint32_t op2, uint32_t op3)
+{
+    return __SMUADX(op1, op2) + op3;
+}
+__HAL_SIM_INLINE uint64_t __SMLALD (uint32_t op1, uint32_t op2, uint64_t acc)
+{
+    return acc + (uint64_t) ((int64_t) __HAL_SIM_LO(op1) * __HAL_SIM_LO(op2)
+                             + (int64_t) __HAL_SIM_HI(op1) * __HAL_SIM_HI(op2));
+}
+__HAL_SIM_INLINE uint64_t __SMLALDX (uint32_t op1, uint32_t op2, uint64_t acc)
+{
+    return acc + (uint64_t) ((int64_t) __HAL_SIM_LO(op1) * __HAL_SIM_HI(op2)
+                             + (int64_t) __HAL_SIM_HI(op1) * __HAL_SIM_LO(op2));
+}
+__HAL_SIM_INLINE uint32_t __SMUSD (uint32_t op1, uint32_t op2)
+{
+    return (uint32_t) (__HAL_SIM_LO(op1) * __HAL_SIM_LO(op2) - __HAL_SIM_HI(op1) * __HAL_SIM_HI(op2));
+}
+__HAL_SIM_INLINE uint32_t __SMUSDX (uint32_t op1, uint32_t op2)
+{
+    return (uint32_t) (__HAL_SIM_LO(op1) * __HAL_SIM_HI(op2) - __HAL_SIM_HI(op1) * __HAL_SIM_LO(op2));
+}
+__HAL_SIM_INLINE uint32_t __SMLSD (uint32_t op1, uint32_t op2, uint32_t op3)
+{
+    return __SMUSD(op1, op2) + op3;
+}
+__HAL_SIM_INLINE uint32_t __SMLSDX (uint32_t op1, uint32_t op2, uint32_t op3)
+{
+    return __SMUSDX(op1, op2) + op3;
+}
+__HAL_SIM_INLINE uint64_t __SMLSLD (uint32_t op1, uint32_t op2, uint64_t acc)
+{
+    return acc + (uint64_t) ((int64_t) __HAL_SIM_LO(op1) * __HAL_SIM_LO(op2)
+                             - (int64_t) __HAL_SIM_HI(op1) * __HAL_SIM_HI(op2));
+}
+__HAL_SIM_INLINE uint64_t __SMLSLDX (uint32_t op1, uint32_t op2, uint64_t acc)
+{
+    return acc + (uint64_t) ((int64_t) __HAL_SIM_LO(op1) * __HAL_SIM_HI(op2)
+                             - (int64_t) __HAL_SIM_HI(op1) * __HAL_SIM_LO(op2));
+}
+__HAL_SIM_INLINE uint32_t __SEL (uint32_t op1, uint32_t op2)
+{
+    uint32_t result = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+        result |= (((halSimApsrGe >> i) & 1) ? op1 : op2) & (0xFFu << (8 * i));
+    }
+    return result;
+}
+__HAL_SIM_INLINE int32_t __QADD (int32_t op1, int32_t op2)
+{
+    const int64_t r = (int64_t) op1 + op2;
+    return (int32_t) (r > INT32_MAX ? INT32_MAX : r < INT32_MIN ? INT32_MIN : r);
+}
+__HAL_SIM_INLINE int32_t __QSUB (int32_t op1, int32_t op2)
+{
+    const int64_t r = (int64_t) op1 - op2;
+    return (int32_t) (r > INT32_MAX ? INT32_MAX : r < INT32_MIN ? INT32_MIN : r);
+}
+#define __SSAT16(ARG1, ARG2) \
+    ((uint32_t) (__halSimSsat(__HAL_SIM_LO(ARG1), (ARG2)) & 0xFFFF) | \
+     ((uint32_t) __halSimSsat(__HAL_SIM_HI(ARG1), (ARG2)) << 16))
+#define __USAT16(ARG1, ARG2) \
+    (__halSimUsat(__HAL_SIM_LO(ARG1), (ARG2)) | (__halSimUsat(__HAL_SIM_HI(ARG1), (ARG2)) << 16))
+#define __PKHBT(ARG1, ARG2, ARG3) \
+    (((uint32_t) (ARG1) & 0x0000FFFFu) | (((uint32_t) (ARG2) << (ARG3)) & 0xFFFF0000u))
+#define __PKHTB(ARG1, ARG2, ARG3) \
+    (((uint32_t) (ARG1) & 0xFFFF0000u) | ((uint32_t) ((int32_t) (ARG2) >> (ARG3)) & 0x0000FFFFu))
+__HAL_SIM_INLINE uint32_t __SMMLA (int32_t op1, int32_t op2, int32_t op3)
+{
+    return (uint32_t) (op3 + (int32_t) (((int64_t) op1 * op2) >> 32));
+}
+
+#endif /* HAL_SIMULATION */
+
+#endif /* HAL_SIM_HOST_H_ */
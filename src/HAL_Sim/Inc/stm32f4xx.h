@@ -0,0 +1,88 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+/*
+ * Host wrapper of CMSIS/device/stm32f4xx.h, found first since HAL_Sim/Inc precedes the
+ * CMSIS directories in the include path.
+ *
+ * The register blocks are plain memory, which the simulation reads when the clock advances.
+ * This does not work for the write-only GPIO_BSRR: a second store before the next sync
+ * would overwrite the first one. In C++, the BSRR member of GPIO_TypeDef is therefore a
+ * register object whose store is applied to ODR at once, as done by the hardware. The
+ * layout of GPIO_TypeDef is not changed; the C units of the host build keep the CMSIS type.
+ */
+
+#ifndef HAL_SIM_STM32F4XX_H_
+#define HAL_SIM_STM32F4XX_H_
+
+#if defined(__cplusplus) && defined(HAL_SIMULATION)
+
+// The device header is included before the HAL headers that use GPIO_TypeDef
+#define GPIO_TypeDef HalSimCmsisGpio
+#include_next "stm32f405xx.h"
+#undef GPIO_TypeDef
+
+#include <cstddef>
+
+extern "C" void halSimStoreBsrr (volatile uint32_t * bsrr, uint32_t value);
+
+/**
+ * @brief GPIO_BSRR: a store sets and resets the pins at once, a load returns 0.
+ */
+class HalSimBsrr
+{
+public:
+
+    inline HalSimBsrr & operator= (uint32_t value)
+    {
+        halSimStoreBsrr(&reg, value);
+        return *this;
+    }
+
+    inline operator uint32_t () const
+    {
+        return 0;
+    }
+
+private:
+
+    volatile uint32_t reg;
+};
+
+typedef struct
+{
+    __IO uint32_t MODER;
+    __IO uint32_t OTYPER;
+    __IO uint32_t OSPEEDR;
+    __IO uint32_t PUPDR;
+    __IO uint32_t IDR;
+    __IO uint32_t ODR;
+    HalSimBsrr BSRR;
+    __IO uint32_t LCKR;
+    __IO uint32_t AFR[2];
+} GPIO_TypeDef;
+
+static_assert(sizeof(GPIO_TypeDef) == sizeof(HalSimCmsisGpio) && offsetof(GPIO_TypeDef, BSRR) == 0x18,
+              "GPIO_TypeDef differs from the CMSIS layout");
+
+#endif
+
+#include_next "stm32f4xx.h"
+
+#endif
@@ -0,0 +1,528 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#ifdef HAL_SIMULATION
+
+#include "hal_sim_internal.h"
+
+#include <array>
+
+using namespace HalSim;
+
+namespace
+{
+
+constexpr uint32_t ADC_CHANNELS = 19;
+
+/**
+ * @brief Analog inputs and the position in the regular sequence of a converter.
+ */
+struct Converter
+{
+    std::array<uint16_t, ADC_CHANNELS> inputs {};
+    uint32_t rank = 0;
+};
+
+std::map<ADC_TypeDef *, Converter> & getConverters ()
+{
+    static std::map<ADC_TypeDef *, Converter> converters;
+    return converters;
+}
+
+/**
+ * @brief Returns the channel at a position (from zero) of the regular sequence.
+ */
+uint32_t getSequenceChannel (const ADC_TypeDef * adc, uint32_t rank)
+{
+    const uint32_t shift = 5 * (rank % 6);
+    const uint32_t sqr = (rank < 6) ? adc->SQR3 : ((rank < 12) ? adc->SQR2 : adc->SQR1);
+    return (sqr >> shift) & 0x1F;
+}
+
+inline uint32_t getSequenceLength (const ADC_TypeDef * adc)
+{
+    return ((adc->SQR1 & ADC_SQR1_L) >> ADC_SQR1_L_Pos) + 1;
+}
+
+/**
+ * @brief Duration of a conversion at ADCCLK = PCLK2 / (2, 4, 6 or 8): the sampling time
+ *        and one cycle per bit of the resolution.
+ */
+uint64_t getConversionTime (const ADC_TypeDef * adc, uint32_t channel)
+{
+    static const uint32_t SAMPLE_CYCLES[] = { 3, 15, 28, 56, 84, 112, 144, 480 };
+    const uint32_t prescaler = 2 * (((ADC123_COMMON->CCR & ADC_CCR_ADCPRE) >> ADC_CCR_ADCPRE_Pos) + 1);
+    const uint32_t smpr = (channel < 10) ? adc->SMPR2 : adc->SMPR1;
+    const uint32_t smp = (smpr >> (3 * (channel % 10))) & 0x7;
+    const uint32_t bits = 12 - 2 * ((adc->CR1 & ADC_CR1_RES) >> ADC_CR1_RES_Pos);
+    return nsForBits(SAMPLE_CYCLES[smp] + bits, HAL_RCC_GetPCLK2Freq() / prescaler);
+}
+
+/**
+ * @brief Converts the next channel of the sequence, the input is given in 12 bits.
+ */
+uint32_t convert (ADC_TypeDef * adc)
+{
+    Converter & c = getConverters()[adc];
+    const uint32_t channel = getSequenceChannel(adc, c.rank);
+    c.rank = (c.rank + 1) % getSequenceLength(adc);
+    const uint32_t shift = 2 * ((adc->CR1 & ADC_CR1_RES) >> ADC_CR1_RES_Pos);
+    const uint32_t value = (channel < ADC_CHANNELS ? c.inputs[channel] : 0) >> shift;
+    return (adc->CR2 & ADC_CR2_ALIGN) ? value << (4 + shift) : value;
+}
+
+void scheduleConversion (ADC_HandleTypeDef * hadc)
+{
+    ADC_TypeDef * adc = hadc->Instance;
+    Converter & c = getConverters()[adc];
+    schedule(getTime() + getConversionTime(adc, getSequenceChannel(adc, c.rank)), [hadc] ()
+    {
+        ADC_TypeDef * adc = hadc->Instance;
+        if (adc->SR & ADC_SR_EOC)
+        {
+            adc->SR |= ADC_SR_OVR;
+        }
+        adc->DR = convert(adc);
+        adc->SR |= ADC_SR_EOC;
+        if (adc->CR1 & ADC_CR1_EOCIE)
+        {
+            raiseIrq(ADC_IRQn);
+        }
+        if (hadc->Init.ContinuousConvMode == ENABLE || getConverters()[adc].rank != 0)
+        {
+            scheduleConversion(hadc);
+        }
+    }, &c);
+}
+
+void adcDmaHalfConvCplt (DMA_HandleTypeDef * hdma)
+{
+    HAL_ADC_ConvHalfCpltCallback((ADC_HandleTypeDef *) hdma->Parent);
+}
+
+void adcDmaConvCplt (DMA_HandleTypeDef * hdma)
+{
+    ADC_HandleTypeDef * hadc = (ADC_HandleTypeDef *) hdma->Parent;
+    hadc->State |= HAL_ADC_STATE_REG_EOC;
+    if (hadc->Init.ContinuousConvMode == DISABLE)
+    {
+        hadc->State &= ~HAL_ADC_STATE_REG_BUSY;
+        hadc->State |= HAL_ADC_STATE_READY;
+    }
+    HAL_ADC_ConvCpltCallback(hadc);
+}
+
+void adcDmaError (DMA_HandleTypeDef * hdma)
+{
+    ADC_HandleTypeDef * hadc = (ADC_HandleTypeDef *) hdma->Parent;
+    hadc->State = HAL_ADC_STATE_ERROR_DMA;
+    hadc->ErrorCode |= HAL_ADC_ERROR_DMA;
+    HAL_ADC_ErrorCallback(hadc);
+}
+
+inline uint32_t getDacShift (uint32_t Channel)
+{
+    return (Channel == DAC_CHANNEL_2) ? 16 : 0;
+}
+
+} // end of anonymous namespace
+
+/************************************************************************
+ * Simulation interface
+ ************************************************************************/
+
+void HalSim::setAnalogInput (ADC_TypeDef * adc, uint32_t channel, uint16_t value)
+{
+    if (channel < ADC_CHANNELS)
+    {
+        getConverters()[adc].inputs[channel] = value & 0xFFF;
+        trace(getName(adc), "IN%lu %u", (unsigned long) channel, value & 0xFFF);
+    }
+}
+
+/************************************************************************
+ * HAL: ADC
+ ************************************************************************/
+
+HAL_StatusTypeDef HAL_ADC_Init (ADC_HandleTypeDef * hadc)
+{
+    halCall();
+    if (hadc == NULL)
+    {
+        return HAL_ERROR;
+    }
+    if (hadc->State == HAL_ADC_STATE_RESET)
+    {
+        hadc->ErrorCode = HAL_ADC_ERROR_NONE;
+        hadc->Lock = HAL_UNLOCKED;
+        HAL_ADC_MspInit(hadc);
+    }
+    ADC_TypeDef * adc = hadc->Instance;
+    ADC123_COMMON->CCR = (ADC123_COMMON->CCR & ~ADC_CCR_ADCPRE) | hadc->Init.ClockPrescaler;
+    adc->CR1 = (hadc->Init.ScanConvMode << 8) | hadc->Init.Resolution;
+    adc->CR2 = hadc->Init.DataAlign | (hadc->Init.ContinuousConvMode << 1) | (hadc->Init.DMAContinuousRequests << 9);
+    if (hadc->Init.ExternalTrigConv != ADC_SOFTWARE_START)
+    {
+        adc->CR2 |= hadc->Init.ExternalTrigConv | hadc->Init.ExternalTrigConvEdge;
+    }
+    if (hadc->Init.EOCSelection == ADC_EOC_SINGLE_CONV)
+    {
+        adc->CR2 |= ADC_CR2_EOCS;
+    }
+    adc->SQR1 = (adc->SQR1 & ~ADC_SQR1_L) | ((hadc->Init.NbrOfConversion - 1) << ADC_SQR1_L_Pos);
+    getConverters()[adc].rank = 0;
+    hadc->ErrorCode = HAL_ADC_ERROR_NONE;
+    hadc->State = HAL_ADC_STATE_READY;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_ADC_DeInit (ADC_HandleTypeDef * hadc)
+{
+    halCall();
+    if (hadc == NULL)
+    {
+        return HAL_ERROR;
+    }
+    cancel(&getConverters()[hadc->Instance]);
+    hadc->Instance->CR1 = hadc->Instance->CR2 = 0;
+    hadc->Instance->SR = 0;
+    HAL_ADC_MspDeInit(hadc);
+    hadc->ErrorCode = HAL_ADC_ERROR_NONE;
+    hadc->State = HAL_ADC_STATE_RESET;
+    __HAL_UNLOCK(hadc);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_ADC_ConfigChannel (ADC_HandleTypeDef * hadc, ADC_ChannelConfTypeDef * sConfig)
+{
+    halCall();
+    ADC_TypeDef * adc = hadc->Instance;
+    const uint32_t channel = sConfig->Channel & 0x1F;
+    if (channel >= ADC_CHANNELS || sConfig->Rank < 1 || sConfig->Rank > 16)
+    {
+        return HAL_ERROR;
+    }
+    volatile uint32_t & smpr = (channel < 10) ? adc->SMPR2 : adc->SMPR1;
+    const uint32_t smpShift = 3 * (channel % 10);
+    smpr = (smpr & ~(0x7U << smpShift)) | (sConfig->SamplingTime << smpShift);
+
+    const uint32_t rank = sConfig->Rank - 1;
+    volatile uint32_t & sqr = (rank < 6) ? adc->SQR3 : ((rank < 12) ? adc->SQR2 : adc->SQR1);
+    const uint32_t sqShift = 5 * (rank % 6);
+    sqr = (sqr & ~(0x1FU << sqShift)) | (channel << sqShift);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_ADC_Start (ADC_HandleTypeDef * hadc)
+{
+    halCall();
+    ADC_TypeDef * adc = hadc->Instance;
+    if ((adc->CR2 & ADC_CR2_ADON) == 0)
+    {
+        adc->CR2 |= ADC_CR2_ADON;
+        // tSTAB of the ADC
+        busyWait(3000);
+    }
+    hadc->State = (hadc->State & ~(HAL_ADC_STATE_READY | HAL_ADC_STATE_REG_EOC | HAL_ADC_STATE_REG_OVR))
+                  | HAL_ADC_STATE_REG_BUSY;
+    hadc->ErrorCode = HAL_ADC_ERROR_NONE;
+    adc->SR &= ~(ADC_SR_EOC | ADC_SR_OVR);
+    cancel(&getConverters()[adc]);
+    getConverters()[adc].rank = 0;
+    if ((adc->CR2 & ADC_CR2_EXTEN) == 0)
+    {
+        // Software start; an external trigger is not modeled and never fires
+        scheduleConversion(hadc);
+    }
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_ADC_Stop (ADC_HandleTypeDef * hadc)
+{
+    halCall();
+    cancel(&getConverters()[hadc->Instance]);
+    hadc->Instance->CR2 &= ~ADC_CR2_ADON;
+    hadc->State = (hadc->State & ~(HAL_ADC_STATE_REG_BUSY | HAL_ADC_STATE_INJ_BUSY)) | HAL_ADC_STATE_READY;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_ADC_Start_IT (ADC_HandleTypeDef * hadc)
+{
+    hadc->Instance->CR1 |= ADC_CR1_EOCIE | ADC_CR1_OVRIE;
+    return HAL_ADC_Start(hadc);
+}
+
+HAL_StatusTypeDef HAL_ADC_Stop_IT (ADC_HandleTypeDef * hadc)
+{
+    hadc->Instance->CR1 &= ~(ADC_CR1_EOCIE | ADC_CR1_OVRIE);
+    return HAL_ADC_Stop(hadc);
+}
+
+HAL_StatusTypeDef HAL_ADC_PollForConversion (ADC_HandleTypeDef * hadc, uint32_t Timeout)
+{
+    halCall();
+    ADC_TypeDef * adc = hadc->Instance;
+    if (!waitFor([adc] () { return (adc->SR & ADC_SR_EOC) != 0; }, Timeout))
+    {
+        hadc->State |= HAL_ADC_STATE_TIMEOUT;
+        return HAL_TIMEOUT;
+    }
+    adc->SR &= ~(ADC_SR_STRT | ADC_SR_EOC);
+    hadc->State |= HAL_ADC_STATE_REG_EOC;
+    if (hadc->Init.ContinuousConvMode == DISABLE)
+    {
+        hadc->State = (hadc->State & ~HAL_ADC_STATE_REG_BUSY) | HAL_ADC_STATE_READY;
+    }
+    return HAL_OK;
+}
+
+uint32_t HAL_ADC_GetValue (ADC_HandleTypeDef * hadc)
+{
+    halCall();
+    // Reading the data register clears the end of conversion flag
+    hadc->Instance->SR &= ~ADC_SR_EOC;
+    return hadc->Instance->DR;
+}
+
+HAL_StatusTypeDef HAL_ADC_Start_DMA (ADC_HandleTypeDef * hadc, uint32_t * pData, uint32_t Length)
+{
+    halCall();
+    if (pData == NULL || Length == 0 || hadc->DMA_Handle == NULL)
+    {
+        return HAL_ERROR;
+    }
+    __HAL_LOCK(hadc);
+    ADC_TypeDef * adc = hadc->Instance;
+    adc->CR2 |= ADC_CR2_ADON | ADC_CR2_DMA;
+    hadc->State = (hadc->State & ~(HAL_ADC_STATE_READY | HAL_ADC_STATE_REG_EOC | HAL_ADC_STATE_REG_OVR))
+                  | HAL_ADC_STATE_REG_BUSY;
+    hadc->ErrorCode = HAL_ADC_ERROR_NONE;
+    cancel(&getConverters()[adc]);
+    getConverters()[adc].rank = 0;
+
+    DMA_HandleTypeDef * hdma = hadc->DMA_Handle;
+    hdma->XferHalfCpltCallback = adcDmaHalfConvCplt;
+    hdma->XferCpltCallback = adcDmaConvCplt;
+    hdma->XferErrorCallback = adcDmaError;
+    hdma->Instance->NDTR = Length;
+    const bool word = (hdma->Init.MemDataAlignment == DMA_MDATAALIGN_WORD);
+    const uint64_t duration = Length * getConversionTime(adc, getSequenceChannel(adc, 0));
+    startDma(hdma, duration, [adc, hdma, pData, Length, word] (bool full)
+    {
+        const uint32_t half = Length / 2;
+        const bool circular = (hdma->Init.Mode == DMA_CIRCULAR);
+        for (uint32_t i = (full && circular) ? half : 0; i < (full ? Length : half); ++i)
+        {
+            const uint32_t value = convert(adc);
+            if (word)
+            {
+                pData[i] = value;
+            }
+            else
+            {
+                ((uint16_t *) pData)[i] = (uint16_t) value;
+            }
+            adc->DR = value;
+        }
+    });
+    __HAL_UNLOCK(hadc);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_ADC_Stop_DMA (ADC_HandleTypeDef * hadc)
+{
+    halCall();
+    __HAL_LOCK(hadc);
+    ADC_TypeDef * adc = hadc->Instance;
+    adc->CR2 &= ~(ADC_CR2_ADON | ADC_CR2_DMA);
+    cancel(&getConverters()[adc]);
+    if (hadc->DMA_Handle != NULL)
+    {
+        HAL_DMA_Abort(hadc->DMA_Handle);
+    }
+    hadc->State = (hadc->State & ~(HAL_ADC_STATE_REG_BUSY | HAL_ADC_STATE_INJ_BUSY)) | HAL_ADC_STATE_READY;
+    __HAL_UNLOCK(hadc);
+    return HAL_OK;
+}
+
+void HAL_ADC_IRQHandler (ADC_HandleTypeDef * hadc)
+{
+    halCall();
+    ADC_TypeDef * adc = hadc->Instance;
+    if ((adc->SR & ADC_SR_EOC) && (adc->CR1 & ADC_CR1_EOCIE))
+    {
+        hadc->State |= HAL_ADC_STATE_REG_EOC;
+        if (hadc->Init.ContinuousConvMode == DISABLE && getConverters()[adc].rank == 0)
+        {
+            adc->CR1 &= ~ADC_CR1_EOCIE;
+            hadc->State = (hadc->State & ~HAL_ADC_STATE_REG_BUSY) | HAL_ADC_STATE_READY;
+        }
+        HAL_ADC_ConvCpltCallback(hadc);
+        adc->SR &= ~(ADC_SR_STRT | ADC_SR_EOC);
+    }
+    if ((adc->SR & ADC_SR_OVR) && (adc->CR1 & ADC_CR1_OVRIE))
+    {
+        adc->SR &= ~ADC_SR_OVR;
+        hadc->State |= HAL_ADC_STATE_REG_OVR;
+        hadc->ErrorCode |= HAL_ADC_ERROR_OVR;
+        HAL_ADC_ErrorCallback(hadc);
+    }
+}
+
+uint32_t HAL_ADC_GetState (ADC_HandleTypeDef * hadc)
+{
+    return hadc->State;
+}
+
+uint32_t HAL_ADC_GetError (ADC_HandleTypeDef * hadc)
+{
+    return hadc->ErrorCode;
+}
+
+__weak void HAL_ADC_MspInit (ADC_HandleTypeDef * hadc)
+{
+    // empty
+}
+
+__weak void HAL_ADC_MspDeInit (ADC_HandleTypeDef * hadc)
+{
+    // empty
+}
+
+__weak void HAL_ADC_ConvCpltCallback (ADC_HandleTypeDef * hadc)
+{
+    // empty
+}
+
+__weak void HAL_ADC_ConvHalfCpltCallback (ADC_HandleTypeDef * hadc)
+{
+    // empty
+}
+
+__weak void HAL_ADC_ErrorCallback (ADC_HandleTypeDef * hadc)
+{
+    // empty
+}
+
+/************************************************************************
+ * HAL: DAC
+ ************************************************************************/
+
+HAL_StatusTypeDef HAL_DAC_Init (DAC_HandleTypeDef * hdac)
+{
+    halCall();
+    if (hdac == NULL)
+    {
+        return HAL_ERROR;
+    }
+    if (hdac->State == HAL_DAC_STATE_RESET)
+    {
+        hdac->Lock = HAL_UNLOCKED;
+        HAL_DAC_MspInit(hdac);
+    }
+    hdac->ErrorCode = HAL_DAC_ERROR_NONE;
+    hdac->State = HAL_DAC_STATE_READY;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_DAC_DeInit (DAC_HandleTypeDef * hdac)
+{
+    halCall();
+    if (hdac == NULL)
+    {
+        return HAL_ERROR;
+    }
+    hdac->Instance->CR = 0;
+    HAL_DAC_MspDeInit(hdac);
+    hdac->ErrorCode = HAL_DAC_ERROR_NONE;
+    hdac->State = HAL_DAC_STATE_RESET;
+    __HAL_UNLOCK(hdac);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_DAC_ConfigChannel (DAC_HandleTypeDef * hdac, DAC_ChannelConfTypeDef * sConfig,
+                                         uint32_t Channel)
+{
+    halCall();
+    const uint32_t shift = getDacShift(Channel);
+    hdac->Instance->CR = (hdac->Instance->CR & ~((DAC_CR_MAMP1 | DAC_CR_WAVE1 | DAC_CR_TSEL1 | DAC_CR_TEN1
+                                                  | DAC_CR_BOFF1) << shift))
+                         | ((sConfig->DAC_Trigger | sConfig->DAC_OutputBuffer) << shift);
+    hdac->State = HAL_DAC_STATE_READY;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_DAC_Start (DAC_HandleTypeDef * hdac, uint32_t Channel)
+{
+    halCall();
+    hdac->Instance->CR |= DAC_CR_EN1 << getDacShift(Channel);
+    hdac->State = HAL_DAC_STATE_READY;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_DAC_Stop (DAC_HandleTypeDef * hdac, uint32_t Channel)
+{
+    halCall();
+    hdac->Instance->CR &= ~(DAC_CR_EN1 << getDacShift(Channel));
+    hdac->State = HAL_DAC_STATE_READY;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_DAC_SetValue (DAC_HandleTypeDef * hdac, uint32_t Channel, uint32_t Alignment, uint32_t Data)
+{
+    halCall();
+    const bool second = (Channel == DAC_CHANNEL_2);
+    volatile uint32_t * dhr = second ? &hdac->Instance->DHR12R2 : &hdac->Instance->DHR12R1;
+    dhr[Alignment / 4] = Data;
+
+    // Without a trigger, DHR is moved to DOR one APB1 cycle later
+    uint32_t value = Data;
+    switch (Alignment)
+    {
+    case DAC_ALIGN_12B_L:
+        value = Data >> 4;
+        break;
+    case DAC_ALIGN_8B_R:
+        value = (Data & 0xFF) << 4;
+        break;
+    default:
+        break;
+    }
+    *(volatile uint32_t *) (second ? &hdac->Instance->DOR2 : &hdac->Instance->DOR1) = value & 0xFFF;
+    trace("DAC", "OUT%d %lu", second ? 2 : 1, (unsigned long) (value & 0xFFF));
+    return HAL_OK;
+}
+
+uint32_t HAL_DAC_GetValue (DAC_HandleTypeDef * hdac, uint32_t Channel)
+{
+    halCall();
+    return (Channel == DAC_CHANNEL_2) ? hdac->Instance->DOR2 : hdac->Instance->DOR1;
+}
+
+__weak void HAL_DAC_MspInit (DAC_HandleTypeDef * hdac)
+{
+    // empty
+}
+
+__weak void HAL_DAC_MspDeInit (DAC_HandleTypeDef * hdac)
+{
+    // empty
+}
+
+#endif
@@ -0,0 +1,1144 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#ifdef HAL_SIMULATION
+
+#include "hal_sim_internal.h"
+
+#include <sys/mman.h>
+#include <algorithm>
+#include <cstdarg>
+#include <cstdlib>
+#include <cstring>
+
+using namespace HalSim;
+
+/* The HAL tick, declared by the HAL as a global variable */
+__IO uint32_t uwTick;
+
+/* The prescaler table of stm32f4xx_hal_rcc.c, shared by the AHB and APB dividers */
+const uint8_t APBAHBPrescTable[16] = { 0U, 0U, 0U, 0U, 1U, 2U, 3U, 4U, 1U, 2U, 3U, 4U, 6U, 7U, 8U, 9U };
+
+/************************************************************************
+ * Register memory
+ ************************************************************************/
+
+namespace
+{
+
+struct Region
+{
+    uintptr_t base;
+    size_t size;
+};
+
+const Region REGIONS[] =
+{
+    { PERIPH_BASE, 0x10061000 }, // APB1, APB2, AHB1 and AHB2 peripherals
+    { SCS_BASE & 0xFFF00000, 0x100000 } // Private peripheral bus: ITM, DWT, SCB, NVIC, SysTick, DBGMCU
+};
+
+/**
+ * @brief Maps the register blocks before any static constructor of the firmware runs.
+ */
+__attribute__((constructor(101))) void mapRegisters ()
+{
+    for (const Region & r : REGIONS)
+    {
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+        #ifdef MAP_FIXED_NOREPLACE
+        flags |= MAP_FIXED_NOREPLACE;
+        #endif
+        void * p = ::mmap((void *) r.base, r.size, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (p != (void *) r.base)
+        {
+            ::fprintf(stderr, "HAL_Sim: can not map the registers at 0x%08lx\n", (unsigned long) r.base);
+            ::exit(1);
+        }
+    }
+
+    // Reset values read by the firmware
+    DBGMCU->IDCODE = 0x10016413; // STM32F405, revision Z
+    RCC->CR = RCC_CR_HSION | RCC_CR_HSIRDY;
+    RCC->PLLCFGR = 0x24003010;
+    *(volatile uint32_t *) &SCB->CPUID = 0x410FC241; // Cortex-M4 r0p1
+}
+
+/************************************************************************
+ * Core state
+ ************************************************************************/
+
+struct Event
+{
+    const void * owner;
+    std::function<void ()> action;
+};
+
+struct Core
+{
+    uint64_t now = 0;
+    uint64_t cycleRest = 0, dwtRest = 0;
+    std::multimap<uint64_t, Event> events;
+
+    // NVIC: the enable and pending state of the IRQs is kept here and mirrored to the
+    // registers, since CMSIS writes the set/clear registers by plain assignments
+    uint32_t enabled[3] = { 0 }, pending[3] = { 0 };
+    bool exceptionPending[16] = { false };
+    uint32_t counts[VECTOR_COUNT] = { 0 };
+    uint32_t dropped[VECTOR_COUNT] = { 0 };
+    uint32_t taken = 0;
+    std::vector<int> active;
+    uint32_t primask = 0, basepri = 0;
+    bool tickScheduled = false;
+
+    // Trace
+    std::vector<TraceRecord> records;
+    FILE * traceFile = NULL;
+    bool console = true;
+    bool environmentLoaded = false;
+};
+
+Core & core ()
+{
+    static Core c;
+    return c;
+}
+
+inline bool isIrq (int index)
+{
+    return index >= 16;
+}
+
+inline bool testBit (const uint32_t * words, int irq)
+{
+    return (words[irq >> 5] >> (irq & 31)) & 1;
+}
+
+inline void setBit (uint32_t * words, int irq, bool value)
+{
+    if (value)
+    {
+        words[irq >> 5] |= 1U << (irq & 31);
+    }
+    else
+    {
+        words[irq >> 5] &= ~(1U << (irq & 31));
+    }
+}
+
+void syncNvic ()
+{
+    Core & c = core();
+    for (int i = 0; i < 3; ++i)
+    {
+        c.enabled[i] = (c.enabled[i] | NVIC->ISER[i]) & ~NVIC->ICER[i];
+        c.pending[i] = (c.pending[i] | NVIC->ISPR[i]) & ~NVIC->ICPR[i];
+        NVIC->ISER[i] = c.enabled[i];
+        NVIC->ISPR[i] = c.pending[i];
+        NVIC->ICER[i] = 0;
+        NVIC->ICPR[i] = 0;
+    }
+}
+
+/**
+ * @brief Priority of an exception as in the register (8 bit), the fixed priorities of
+ *        reset, NMI and hard fault are negative.
+ */
+int getPriority (int index)
+{
+    if (index < 4)
+    {
+        return index - 4;
+    }
+    return isIrq(index) ? NVIC->IP[index - 16] : SCB->SHP[index - 4];
+}
+
+inline uint32_t getBinaryPoint ()
+{
+    return ((SCB->AIRCR & SCB_AIRCR_PRIGROUP_Msk) >> SCB_AIRCR_PRIGROUP_Pos) + 1;
+}
+
+inline int getGroupPriority (int index)
+{
+    const int p = getPriority(index);
+    return p < 0 ? p : p >> getBinaryPoint();
+}
+
+/**
+ * @brief The group priority below that an exception preempts the current execution.
+ */
+int getExecutionPriority ()
+{
+    const Core & c = core();
+    int level = 256;
+    if (!c.active.empty())
+    {
+        level = getGroupPriority(c.active.back());
+    }
+    if (c.basepri != 0)
+    {
+        level = std::min(level, (int) (c.basepri >> getBinaryPoint()));
+    }
+    if (c.primask != 0)
+    {
+        level = std::min(level, 0);
+    }
+    return level;
+}
+
+bool isPending (int index)
+{
+    const Core & c = core();
+    if (isIrq(index))
+    {
+        return testBit(c.pending, index - 16) && testBit(c.enabled, index - 16);
+    }
+    return c.exceptionPending[index];
+}
+
+void clearPending (int index)
+{
+    Core & c = core();
+    if (isIrq(index))
+    {
+        setBit(c.pending, index - 16, false);
+        NVIC->ISPR[(index - 16) >> 5] = c.pending[(index - 16) >> 5];
+    }
+    else
+    {
+        c.exceptionPending[index] = false;
+    }
+}
+
+/**
+ * @brief Returns the pending exception of the highest priority that may preempt, or -1.
+ */
+int selectException ()
+{
+    const int level = getExecutionPriority();
+    int selected = -1, selectedPriority = 0;
+    for (int i = 1; i < VECTOR_COUNT; ++i)
+    {
+        if (!isPending(i) || getGroupPriority(i) >= level)
+        {
+            continue;
+        }
+        const int p = getPriority(i);
+        if (selected < 0 || p < selectedPriority)
+        {
+            selected = i;
+            selectedPriority = p;
+        }
+    }
+    return selected;
+}
+
+void takeInterrupts ()
+{
+    Core & c = core();
+    for (int index = selectException(); index >= 0; index = selectException())
+    {
+        clearPending(index);
+        c.active.push_back(index);
+        ++c.counts[index];
+        ++c.taken;
+        chargeCycles(IRQ_ENTRY_CYCLES);
+        IrqHandler handler = VECTOR_TABLE[index];
+        if (handler == NULL)
+        {
+            ::fprintf(stderr, "HAL_Sim: no handler for exception %d (IRQn %d)\n", index, index - 16);
+            finish(3);
+        }
+        // The exception entry stacks the xPSR with the GE flags
+        const uint32_t apsrGe = halSimApsrGe;
+        handler();
+        halSimApsrGe = apsrGe;
+        c.active.pop_back();
+    }
+}
+
+void setNow (uint64_t time)
+{
+    Core & c = core();
+    if (time <= c.now)
+    {
+        return;
+    }
+    if (DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk)
+    {
+        const unsigned __int128 scaled = (unsigned __int128) (time - c.now) * SystemCoreClock + c.dwtRest;
+        DWT->CYCCNT += (uint32_t) (uint64_t) (scaled / 1000000000U);
+        c.dwtRest = (uint64_t) (scaled % 1000000000U);
+    }
+    c.now = time;
+}
+
+void onSysTick ();
+
+void scheduleSysTick ()
+{
+    Core & c = core();
+    const uint64_t clock = (SysTick->CTRL & SysTick_CTRL_CLKSOURCE_Msk) ? SystemCoreClock : SystemCoreClock / 8;
+    const uint64_t period = std::max((uint64_t) 1, ((uint64_t) SysTick->LOAD + 1) * 1000000000U / clock);
+    c.tickScheduled = true;
+    schedule(c.now + period, onSysTick, &c.tickScheduled);
+}
+
+void onSysTick ()
+{
+    Core & c = core();
+    c.tickScheduled = false;
+    if (SysTick->CTRL & SysTick_CTRL_ENABLE_Msk)
+    {
+        SysTick->CTRL |= SysTick_CTRL_COUNTFLAG_Msk;
+        if (SysTick->CTRL & SysTick_CTRL_TICKINT_Msk)
+        {
+            raiseIrq(SysTick_IRQn);
+        }
+        scheduleSysTick();
+    }
+}
+
+void syncRegisters ()
+{
+    syncNvic();
+    syncGpio();
+    syncSdio();
+    syncTimers();
+    if ((SysTick->CTRL & SysTick_CTRL_ENABLE_Msk) && !core().tickScheduled)
+    {
+        scheduleSysTick();
+    }
+}
+
+/**
+ * @brief Processes the events up to the given time, interrupts are taken in between.
+ */
+void advanceTo (uint64_t target)
+{
+    Core & c = core();
+    syncRegisters();
+    takeInterrupts();
+    for (;;)
+    {
+        auto it = c.events.begin();
+        if (it == c.events.end() || it->first > target)
+        {
+            break;
+        }
+        setNow(it->first);
+        Event e = std::move(it->second);
+        c.events.erase(it);
+        e.action();
+        syncRegisters();
+        takeInterrupts();
+    }
+    setNow(target);
+}
+
+void loadEnvironment ()
+{
+    Core & c = core();
+    if (c.environmentLoaded)
+    {
+        return;
+    }
+    c.environmentLoaded = true;
+    const char * traceName = ::getenv("HAL_SIM_TRACE");
+    if (traceName != NULL && !openTrace(traceName))
+    {
+        ::fprintf(stderr, "HAL_Sim: can not open trace file %s\n", traceName);
+        ::exit(1);
+    }
+    const char * scriptName = ::getenv("HAL_SIM_SCRIPT");
+    if (scriptName != NULL && !loadScript(scriptName))
+    {
+        ::fprintf(stderr, "HAL_Sim: can not load script %s\n", scriptName);
+        ::exit(1);
+    }
+}
+
+/************************************************************************
+ * Peripheral table
+ ************************************************************************/
+
+const Peripheral PERIPHERALS[] =
+{
+    { "GPIOA", GPIOA_BASE, NonMaskableInt_IRQn, 0 },
+    { "GPIOB", GPIOB_BASE, NonMaskableInt_IRQn, 0 },
+    { "GPIOC", GPIOC_BASE, NonMaskableInt_IRQn, 0 },
+    { "GPIOD", GPIOD_BASE, NonMaskableInt_IRQn, 0 },
+    { "GPIOE", GPIOE_BASE, NonMaskableInt_IRQn, 0 },
+    { "GPIOF", GPIOF_BASE, NonMaskableInt_IRQn, 0 },
+    { "GPIOG", GPIOG_BASE, NonMaskableInt_IRQn, 0 },
+    { "GPIOH", GPIOH_BASE, NonMaskableInt_IRQn, 0 },
+    { "GPIOI", GPIOI_BASE, NonMaskableInt_IRQn, 0 },
+    { "USART1", USART1_BASE, USART1_IRQn, 2 },
+    { "USART2", USART2_BASE, USART2_IRQn, 1 },
+    { "USART3", USART3_BASE, USART3_IRQn, 1 },
+    { "UART4", UART4_BASE, UART4_IRQn, 1 },
+    { "UART5", UART5_BASE, UART5_IRQn, 1 },
+    { "USART6", USART6_BASE, USART6_IRQn, 2 },
+    { "SPI1", SPI1_BASE, SPI1_IRQn, 2 },
+    { "SPI2", SPI2_BASE, SPI2_IRQn, 1 },
+    { "SPI3", SPI3_BASE, SPI3_IRQn, 1 },
+    { "I2C1", I2C1_BASE, I2C1_EV_IRQn, 1 },
+    { "I2C2", I2C2_BASE, I2C2_EV_IRQn, 1 },
+    { "I2C3", I2C3_BASE, I2C3_EV_IRQn, 1 },
+    { "TIM1", TIM1_BASE, TIM1_UP_TIM10_IRQn, 2 },
+    { "TIM2", TIM2_BASE, TIM2_IRQn, 1 },
+    { "TIM3", TIM3_BASE, TIM3_IRQn, 1 },
+    { "TIM4", TIM4_BASE, TIM4_IRQn, 1 },
+    { "TIM5", TIM5_BASE, TIM5_IRQn, 1 },
+    { "TIM6", TIM6_BASE, TIM6_DAC_IRQn, 1 },
+    { "TIM7", TIM7_BASE, TIM7_IRQn, 1 },
+    { "TIM8", TIM8_BASE, TIM8_UP_TIM13_IRQn, 2 },
+    { "TIM9", TIM9_BASE, TIM1_BRK_TIM9_IRQn, 2 },
+    { "TIM10", TIM10_BASE, TIM1_UP_TIM10_IRQn, 2 },
+    { "TIM11", TIM11_BASE, TIM1_TRG_COM_TIM11_IRQn, 2 },
+    { "TIM12", TIM12_BASE, TIM8_BRK_TIM12_IRQn, 1 },
+    { "TIM13", TIM13_BASE, TIM8_UP_TIM13_IRQn, 1 },
+    { "TIM14", TIM14_BASE, TIM8_TRG_COM_TIM14_IRQn, 1 },
+    { "ADC1", ADC1_BASE, ADC_IRQn, 2 },
+    { "ADC2", ADC2_BASE, ADC_IRQn, 2 },
+    { "ADC3", ADC3_BASE, ADC_IRQn, 2 },
+    { "DAC", DAC_BASE, TIM6_DAC_IRQn, 1 },
+    { "SDIO", SDIO_BASE, SDIO_IRQn, 2 },
+    { "RTC", RTC_BASE, RTC_WKUP_IRQn, 1 }
+};
+
+} // end of anonymous namespace
+
+/************************************************************************
+ * Peripheral map
+ ************************************************************************/
+
+const Peripheral * HalSim::findPeripheral (const volatile void * instance)
+{
+    for (const Peripheral & p : PERIPHERALS)
+    {
+        if (p.base == (uintptr_t) instance)
+        {
+            return &p;
+        }
+    }
+    return NULL;
+}
+
+const Peripheral * HalSim::findPeripheral (const std::string & name)
+{
+    for (const Peripheral & p : PERIPHERALS)
+    {
+        if (name == p.name)
+        {
+            return &p;
+        }
+    }
+    return NULL;
+}
+
+const char * HalSim::getName (const volatile void * instance)
+{
+    const Peripheral * p = findPeripheral(instance);
+    return p == NULL ? "?" : p->name;
+}
+
+uint32_t HalSim::getBusClock (const volatile void * instance)
+{
+    const Peripheral * p = findPeripheral(instance);
+    if (p == NULL || p->apb == 0)
+    {
+        return HAL_RCC_GetHCLKFreq();
+    }
+    return p->apb == 1 ? HAL_RCC_GetPCLK1Freq() : HAL_RCC_GetPCLK2Freq();
+}
+
+uint32_t HalSim::getTimerClock (const volatile void * instance)
+{
+    // The timers run at twice the APB clock if the APB prescaler is not 1
+    const uint32_t pclk = getBusClock(instance);
+    return pclk == HAL_RCC_GetHCLKFreq() ? pclk : 2 * pclk;
+}
+
+/************************************************************************
+ * Virtual clock and NVIC
+ ************************************************************************/
+
+uint64_t HalSim::getTime ()
+{
+    return core().now;
+}
+
+void HalSim::advance (uint64_t ns)
+{
+    advanceTo(core().now + ns);
+}
+
+void HalSim::schedule (uint64_t time, std::function<void ()> action, const void * owner)
+{
+    core().events.insert(std::make_pair(time, Event { owner, std::move(action) }));
+}
+
+void HalSim::cancel (const void * owner)
+{
+    auto & events = core().events;
+    for (auto it = events.begin(); it != events.end();)
+    {
+        it = (it->second.owner == owner) ? events.erase(it) : std::next(it);
+    }
+}
+
+uint32_t HalSim::getIrqCount (IRQn_Type irqn)
+{
+    return core().counts[irqn + 16];
+}
+
+void HalSim::chargeCycles (uint32_t cycles)
+{
+    Core & c = core();
+    const uint32_t clock = std::max(SystemCoreClock, (uint32_t) 1);
+    c.cycleRest += (uint64_t) cycles * 1000000000U;
+    const uint64_t ns = c.cycleRest / clock;
+    c.cycleRest %= clock;
+    advanceTo(c.now + ns);
+}
+
+void HalSim::busyWait (uint64_t ns)
+{
+    advanceTo(core().now + ns);
+}
+
+bool HalSim::waitFor (const std::function<bool ()> & condition, uint32_t timeout)
+{
+    const uint32_t start = uwTick;
+    while (!condition())
+    {
+        if (timeout != HAL_MAX_DELAY && uwTick - start > timeout)
+        {
+            return false;
+        }
+        idle();
+    }
+    return true;
+}
+
+uint64_t HalSim::getNextEventTime ()
+{
+    const auto & events = core().events;
+    return events.empty() ? UINT64_MAX : events.begin()->first;
+}
+
+void HalSim::dropIrqs (IRQn_Type irqn, uint32_t count)
+{
+    core().dropped[irqn + 16] = count;
+}
+
+void HalSim::raiseIrq (IRQn_Type irqn)
+{
+    Core & c = core();
+    const int index = irqn + 16;
+    if (c.dropped[index] > 0)
+    {
+        --c.dropped[index];
+        trace("NVIC", "IRQ %d dropped", (int) irqn);
+        return;
+    }
+    if (isIrq(index))
+    {
+        setBit(c.pending, irqn, true);
+        NVIC->ISPR[irqn >> 5] = c.pending[irqn >> 5];
+    }
+    else
+    {
+        c.exceptionPending[index] = true;
+    }
+}
+
+uint64_t HalSim::nsForBits (uint32_t bits, uint32_t bitRate)
+{
+    return bitRate == 0 ? 0 : (uint64_t) bits * 1000000000U / bitRate;
+}
+
+void HalSim::idle ()
+{
+    Core & c = core();
+    const uint64_t next = getNextEventTime();
+    if (next == UINT64_MAX)
+    {
+        ::fprintf(stderr, "HAL_Sim: the CPU waits but no event is pending\n");
+        finish(2);
+    }
+    advanceTo(std::max(next, c.now));
+}
+
+void HalSim::finish (int exitCode)
+{
+    Core & c = core();
+    trace("SIM", "finish %d", exitCode);
+    if (c.traceFile != NULL)
+    {
+        ::fclose(c.traceFile);
+        c.traceFile = NULL;
+    }
+    ::fflush(stdout);
+    ::fprintf(stderr, "HAL_Sim: finished at %llu.%06llu ms with code %d, %u interrupts taken\n",
+              (unsigned long long) (c.now / 1000000), (unsigned long long) (c.now % 1000000), exitCode, c.taken);
+    ::exit(exitCode);
+}
+
+/************************************************************************
+ * Trace
+ ************************************************************************/
+
+void HalSim::trace (const char * bus, const char * format, ...)
+{
+    Core & c = core();
+    char text[512];
+    va_list args;
+    va_start(args, format);
+    ::vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    c.records.push_back(TraceRecord { c.now, bus, text });
+    if (c.traceFile != NULL)
+    {
+        ::fprintf(c.traceFile, "%8llu.%06llu %-7s %s\n", (unsigned long long) (c.now / 1000000),
+                  (unsigned long long) (c.now % 1000000), bus, text);
+    }
+}
+
+std::string HalSim::formatBytes (const uint8_t * data, size_t n)
+{
+    static constexpr size_t MAX_BYTES = 32;
+    std::string s;
+    char hex[4];
+    for (size_t i = 0; i < std::min(n, MAX_BYTES); ++i)
+    {
+        ::snprintf(hex, sizeof(hex), i == 0 ? "%02X" : " %02X", data[i]);
+        s += hex;
+    }
+    if (n > MAX_BYTES)
+    {
+        s += " ... (" + std::to_string(n) + " bytes)";
+    }
+    return s;
+}
+
+void HalSim::writeConsole (const uint8_t * data, size_t n)
+{
+    if (!core().console)
+    {
+        return;
+    }
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (data[i] != '\r')
+        {
+            ::fputc(data[i], stdout);
+        }
+    }
+    ::fflush(stdout);
+}
+
+bool HalSim::openTrace (const char * fileName)
+{
+    Core & c = core();
+    if (c.traceFile != NULL)
+    {
+        ::fclose(c.traceFile);
+    }
+    c.traceFile = ::fopen(fileName, "w");
+    return c.traceFile != NULL;
+}
+
+const std::vector<TraceRecord> & HalSim::getTrace ()
+{
+    return core().records;
+}
+
+void HalSim::clearTrace ()
+{
+    core().records.clear();
+}
+
+void HalSim::setConsole (bool enabled)
+{
+    core().console = enabled;
+}
+
+/************************************************************************
+ * Core intrinsics, see hal_sim_host.h
+ ************************************************************************/
+
+extern "C"
+{
+
+void halSimSetPrimask (uint32_t priMask)
+{
+    core().primask = priMask;
+    if (priMask == 0)
+    {
+        takeInterrupts();
+    }
+}
+
+uint32_t halSimGetPrimask (void)
+{
+    return core().primask;
+}
+
+void halSimSetBasepri (uint32_t basePri)
+{
+    const uint32_t previous = core().basepri;
+    core().basepri = basePri;
+    if (basePri == 0 || basePri > previous)
+    {
+        takeInterrupts();
+    }
+}
+
+uint32_t halSimGetBasepri (void)
+{
+    return core().basepri;
+}
+
+uint32_t halSimGetIpsr (void)
+{
+    const Core & c = core();
+    return c.active.empty() ? 0 : c.active.back();
+}
+
+uint32_t halSimApsrGe = 0;
+
+void halSimCycles (uint32_t cycles)
+{
+    chargeCycles(cycles);
+}
+
+void halSimWaitForInterrupt (void)
+{
+    // The core sleeps until an exception is taken or, with masked interrupts, is pending
+    Core & c = core();
+    const uint32_t taken = c.taken;
+    while (c.taken == taken)
+    {
+        idle();
+        if (c.primask != 0)
+        {
+            bool any = false;
+            for (int i = 1; i < VECTOR_COUNT && !any; ++i)
+            {
+                any = isPending(i);
+            }
+            if (any)
+            {
+                break;
+            }
+        }
+    }
+}
+
+char * __itoa (int value, char * str, int base)
+{
+    if (base < 2 || base > 36)
+    {
+        str[0] = 0;
+        return str;
+    }
+    // Like newlib, only base 10 is signed
+    unsigned int v = (base == 10 && value < 0) ? -(unsigned int) value : (unsigned int) value;
+    char digits[33];
+    int n = 0;
+    do
+    {
+        const unsigned int d = v % base;
+        digits[n++] = (char) (d < 10 ? '0' + d : 'a' + d - 10);
+        v /= base;
+    }
+    while (v != 0);
+    char * p = str;
+    if (base == 10 && value < 0)
+    {
+        *p++ = '-';
+    }
+    while (n > 0)
+    {
+        *p++ = digits[--n];
+    }
+    *p = 0;
+    return str;
+}
+
+} // extern "C"
+
+/************************************************************************
+ * HAL: common functions
+ ************************************************************************/
+
+HAL_StatusTypeDef HAL_Init (void)
+{
+    HAL_NVIC_SetPriorityGrouping(NVIC_PRIORITYGROUP_4);
+    HAL_InitTick(TICK_INT_PRIORITY);
+    HAL_MspInit();
+    loadEnvironment();
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_DeInit (void)
+{
+    halCall();
+    HAL_MspDeInit();
+    return HAL_OK;
+}
+
+__weak void HAL_MspInit (void)
+{
+    // empty
+}
+
+__weak void HAL_MspDeInit (void)
+{
+    // empty
+}
+
+__weak HAL_StatusTypeDef HAL_InitTick (uint32_t TickPriority)
+{
+    HAL_SYSTICK_Config(HAL_RCC_GetHCLKFreq() / 1000U);
+    HAL_NVIC_SetPriority(SysTick_IRQn, TickPriority, 0U);
+    return HAL_OK;
+}
+
+void HAL_IncTick (void)
+{
+    uwTick++;
+}
+
+uint32_t HAL_GetTick (void)
+{
+    halCall();
+    return uwTick;
+}
+
+void HAL_Delay (__IO uint32_t Delay)
+{
+    halCall();
+    const uint32_t start = uwTick;
+    uint32_t wait = Delay;
+    if (wait < HAL_MAX_DELAY)
+    {
+        wait++;
+    }
+    while (uwTick - start < wait)
+    {
+        idle();
+    }
+}
+
+void HAL_SuspendTick (void)
+{
+    SysTick->CTRL &= ~SysTick_CTRL_TICKINT_Msk;
+}
+
+void HAL_ResumeTick (void)
+{
+    SysTick->CTRL |= SysTick_CTRL_TICKINT_Msk;
+}
+
+uint32_t HAL_GetHalVersion (void)
+{
+    return 0x01040400; // The version of HAL_Driver
+}
+
+uint32_t HAL_GetREVID (void)
+{
+    return DBGMCU->IDCODE >> 16U;
+}
+
+uint32_t HAL_GetDEVID (void)
+{
+    return DBGMCU->IDCODE & 0xFFFU;
+}
+
+/************************************************************************
+ * HAL: Cortex
+ ************************************************************************/
+
+void HAL_NVIC_SetPriorityGrouping (uint32_t PriorityGroup)
+{
+    halCall();
+    NVIC_SetPriorityGrouping(PriorityGroup);
+}
+
+void HAL_NVIC_SetPriority (IRQn_Type IRQn, uint32_t PreemptPriority, uint32_t SubPriority)
+{
+    halCall();
+    NVIC_SetPriority(IRQn, NVIC_EncodePriority(NVIC_GetPriorityGrouping(), PreemptPriority, SubPriority));
+}
+
+void HAL_NVIC_EnableIRQ (IRQn_Type IRQn)
+{
+    syncNvic();
+    setBit(core().enabled, IRQn, true);
+    syncNvic();
+    halCall();
+}
+
+void HAL_NVIC_DisableIRQ (IRQn_Type IRQn)
+{
+    syncNvic();
+    setBit(core().enabled, IRQn, false);
+    syncNvic();
+    halCall();
+}
+
+void HAL_NVIC_SystemReset (void)
+{
+    ::fprintf(stderr, "HAL_Sim: system reset requested\n");
+    finish(4);
+}
+
+uint32_t HAL_SYSTICK_Config (uint32_t TicksNumb)
+{
+    halCall();
+    core().tickScheduled = false;
+    cancel(&core().tickScheduled);
+    return SysTick_Config(TicksNumb);
+}
+
+uint32_t HAL_NVIC_GetPriorityGrouping (void)
+{
+    return NVIC_GetPriorityGrouping();
+}
+
+void HAL_NVIC_GetPriority (IRQn_Type IRQn, uint32_t PriorityGroup, uint32_t * pPreemptPriority,
+                           uint32_t * pSubPriority)
+{
+    NVIC_DecodePriority(NVIC_GetPriority(IRQn), PriorityGroup, pPreemptPriority, pSubPriority);
+}
+
+void HAL_NVIC_SetPendingIRQ (IRQn_Type IRQn)
+{
+    raiseIrq(IRQn);
+    halCall();
+}
+
+uint32_t HAL_NVIC_GetPendingIRQ (IRQn_Type IRQn)
+{
+    syncNvic();
+    return testBit(core().pending, IRQn);
+}
+
+void HAL_NVIC_ClearPendingIRQ (IRQn_Type IRQn)
+{
+    clearPending(IRQn + 16);
+}
+
+uint32_t HAL_NVIC_GetActive (IRQn_Type IRQn)
+{
+    const auto & active = core().active;
+    return std::find(active.begin(), active.end(), IRQn + 16) != active.end();
+}
+
+void HAL_SYSTICK_CLKSourceConfig (uint32_t CLKSource)
+{
+    if (CLKSource == SYSTICK_CLKSOURCE_HCLK)
+    {
+        SysTick->CTRL |= SYSTICK_CLKSOURCE_HCLK;
+    }
+    else
+    {
+        SysTick->CTRL &= ~SYSTICK_CLKSOURCE_HCLK;
+    }
+}
+
+void HAL_SYSTICK_IRQHandler (void)
+{
+    HAL_SYSTICK_Callback();
+}
+
+__weak void HAL_SYSTICK_Callback (void)
+{
+    // empty
+}
+
+/************************************************************************
+ * HAL: RCC
+ ************************************************************************/
+
+void HAL_RCC_DeInit (void)
+{
+    halCall();
+    RCC->CR = RCC_CR_HSION | RCC_CR_HSIRDY;
+    RCC->CFGR = 0;
+    RCC->PLLCFGR = 0x24003010;
+    RCC->PLLI2SCFGR = 0x20003000;
+    SystemCoreClock = HSI_VALUE;
+    HAL_InitTick(TICK_INT_PRIORITY);
+}
+
+HAL_StatusTypeDef HAL_RCC_OscConfig (RCC_OscInitTypeDef * RCC_OscInitStruct)
+{
+    halCall();
+    const uint32_t type = RCC_OscInitStruct->OscillatorType;
+    if (type & RCC_OSCILLATORTYPE_HSE)
+    {
+        if (RCC_OscInitStruct->HSEState == RCC_HSE_OFF)
+        {
+            RCC->CR &= ~(RCC_CR_HSEON | RCC_CR_HSERDY | RCC_CR_HSEBYP);
+        }
+        else
+        {
+            RCC->CR |= RCC_OscInitStruct->HSEState | RCC_CR_HSERDY;
+        }
+    }
+    if (type & RCC_OSCILLATORTYPE_HSI)
+    {
+        if (RCC_OscInitStruct->HSIState == RCC_HSI_OFF)
+        {
+            RCC->CR &= ~(RCC_CR_HSION | RCC_CR_HSIRDY);
+        }
+        else
+        {
+            RCC->CR |= RCC_CR_HSION | RCC_CR_HSIRDY;
+        }
+    }
+    if (type & RCC_OSCILLATORTYPE_LSE)
+    {
+        if (RCC_OscInitStruct->LSEState == RCC_LSE_OFF)
+        {
+            RCC->BDCR &= ~(RCC_BDCR_LSEON | RCC_BDCR_LSERDY | RCC_BDCR_LSEBYP);
+        }
+        else
+        {
+            RCC->BDCR |= RCC_OscInitStruct->LSEState | RCC_BDCR_LSERDY;
+        }
+    }
+    if (type & RCC_OSCILLATORTYPE_LSI)
+    {
+        if (RCC_OscInitStruct->LSIState == RCC_LSI_OFF)
+        {
+            RCC->CSR &= ~(RCC_CSR_LSION | RCC_CSR_LSIRDY);
+        }
+        else
+        {
+            RCC->CSR |= RCC_CSR_LSION | RCC_CSR_LSIRDY;
+        }
+    }
+    if (RCC_OscInitStruct->PLL.PLLState == RCC_PLL_ON)
+    {
+        const RCC_PLLInitTypeDef & pll = RCC_OscInitStruct->PLL;
+        RCC->PLLCFGR = pll.PLLSource | pll.PLLM | (pll.PLLN << RCC_PLLCFGR_PLLN_Pos)
+                       | (((pll.PLLP >> 1U) - 1U) << RCC_PLLCFGR_PLLP_Pos) | (pll.PLLQ << RCC_PLLCFGR_PLLQ_Pos);
+        RCC->CR |= RCC_CR_PLLON | RCC_CR_PLLRDY;
+    }
+    else if (RCC_OscInitStruct->PLL.PLLState == RCC_PLL_OFF)
+    {
+        RCC->CR &= ~(RCC_CR_PLLON | RCC_CR_PLLRDY);
+    }
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_RCC_ClockConfig (RCC_ClkInitTypeDef * RCC_ClkInitStruct, uint32_t FLatency)
+{
+    halCall();
+    MODIFY_REG(FLASH->ACR, FLASH_ACR_LATENCY, FLatency);
+    const uint32_t type = RCC_ClkInitStruct->ClockType;
+    if (type & RCC_CLOCKTYPE_HCLK)
+    {
+        MODIFY_REG(RCC->CFGR, RCC_CFGR_HPRE, RCC_ClkInitStruct->AHBCLKDivider);
+    }
+    if (type & RCC_CLOCKTYPE_SYSCLK)
+    {
+        const uint32_t source = RCC_ClkInitStruct->SYSCLKSource & RCC_CFGR_SW;
+        MODIFY_REG(RCC->CFGR, RCC_CFGR_SW | RCC_CFGR_SWS, source | (source << 2));
+    }
+    // The dividers are masked like in the HAL: a value that is not a RCC_HCLK_DIVx constant
+    // results in a different divider
+    if (type & RCC_CLOCKTYPE_PCLK1)
+    {
+        MODIFY_REG(RCC->CFGR, RCC_CFGR_PPRE1, RCC_ClkInitStruct->APB1CLKDivider);
+    }
+    if (type & RCC_CLOCKTYPE_PCLK2)
+    {
+        MODIFY_REG(RCC->CFGR, RCC_CFGR_PPRE2, RCC_ClkInitStruct->APB2CLKDivider << 3U);
+    }
+    SystemCoreClock = HAL_RCC_GetSysClockFreq() >> AHBPrescTable[(RCC->CFGR & RCC_CFGR_HPRE) >> RCC_CFGR_HPRE_Pos];
+    trace("RCC", "SYSCLK %lu HCLK %lu PCLK1 %lu PCLK2 %lu", (unsigned long) HAL_RCC_GetSysClockFreq(),
+          (unsigned long) SystemCoreClock, (unsigned long) HAL_RCC_GetPCLK1Freq(),
+          (unsigned long) HAL_RCC_GetPCLK2Freq());
+    HAL_InitTick(TICK_INT_PRIORITY);
+    return HAL_OK;
+}
+
+void HAL_RCC_MCOConfig (uint32_t RCC_MCOx, uint32_t RCC_MCOSource, uint32_t RCC_MCODiv)
+{
+    halCall();
+}
+
+uint32_t HAL_RCC_GetSysClockFreq (void)
+{
+    switch (RCC->CFGR & RCC_CFGR_SWS)
+    {
+    case RCC_CFGR_SWS_HSE:
+        return HSE_VALUE;
+    case RCC_CFGR_SWS_PLL:
+    {
+        const uint32_t pllm = RCC->PLLCFGR & RCC_PLLCFGR_PLLM;
+        const uint32_t plln = (RCC->PLLCFGR & RCC_PLLCFGR_PLLN) >> RCC_PLLCFGR_PLLN_Pos;
+        const uint32_t pllp = ((((RCC->PLLCFGR & RCC_PLLCFGR_PLLP) >> RCC_PLLCFGR_PLLP_Pos) + 1U) * 2U);
+        const uint64_t input = (RCC->PLLCFGR & RCC_PLLCFGR_PLLSRC_HSE) ? HSE_VALUE : HSI_VALUE;
+        return pllm == 0 ? 0 : (uint32_t) (input * plln / pllm / pllp);
+    }
+    default:
+        return HSI_VALUE;
+    }
+}
+
+uint32_t HAL_RCC_GetHCLKFreq (void)
+{
+    return SystemCoreClock;
+}
+
+uint32_t HAL_RCC_GetPCLK1Freq (void)
+{
+    return SystemCoreClock >> APBAHBPrescTable[(RCC->CFGR & RCC_CFGR_PPRE1) >> RCC_CFGR_PPRE1_Pos];
+}
+
+uint32_t HAL_RCC_GetPCLK2Freq (void)
+{
+    return SystemCoreClock >> APBAHBPrescTable[(RCC->CFGR & RCC_CFGR_PPRE2) >> RCC_CFGR_PPRE2_Pos];
+}
+
+HAL_StatusTypeDef HAL_RCCEx_PeriphCLKConfig (RCC_PeriphCLKInitTypeDef * PeriphClkInit)
+{
+    halCall();
+    if (PeriphClkInit->PeriphClockSelection & RCC_PERIPHCLK_I2S)
+    {
+        RCC->PLLI2SCFGR = (PeriphClkInit->PLLI2S.PLLI2SN << RCC_PLLI2SCFGR_PLLI2SN_Pos)
+                          | (PeriphClkInit->PLLI2S.PLLI2SR << RCC_PLLI2SCFGR_PLLI2SR_Pos);
+        RCC->CR |= RCC_CR_PLLI2SON | RCC_CR_PLLI2SRDY;
+    }
+    if (PeriphClkInit->PeriphClockSelection & RCC_PERIPHCLK_RTC)
+    {
+        MODIFY_REG(RCC->BDCR, RCC_BDCR_RTCSEL, PeriphClkInit->RTCClockSelection & RCC_BDCR_RTCSEL);
+        RCC->BDCR |= RCC_BDCR_RTCEN;
+    }
+    return HAL_OK;
+}
+
+#endif
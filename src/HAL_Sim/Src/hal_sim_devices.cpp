@@ -0,0 +1,201 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#ifdef HAL_SIMULATION
+
+#include "hal_sim_internal.h"
+
+using namespace HalSim;
+
+namespace
+{
+
+enum EepRomInstruction : uint8_t
+{
+    WRSR = 0x01,
+    WRITE = 0x02,
+    READ = 0x03,
+    WRDI = 0x04,
+    RDSR = 0x05,
+    WREN = 0x06
+};
+
+constexpr uint8_t STATUS_WIP = 0x01;
+constexpr uint8_t STATUS_WEL = 0x02;
+constexpr uint8_t STATUS_BP = 0x0C;
+
+} // end of anonymous namespace
+
+/************************************************************************
+ * Class SpiEepRom
+ ************************************************************************/
+
+SpiEepRom::SpiEepRom (uint32_t size, const char * _fileName) :
+    memory(size, 0xFF),
+    fileName { _fileName != NULL ? _fileName : "" },
+    instruction { 0 },
+    status { 0 },
+    position { 0 },
+    address { 0 },
+    writeEnabled { false },
+    modified { false },
+    busyUntil { 0 }
+{
+    if (!fileName.empty())
+    {
+        FILE * f = ::fopen(fileName.c_str(), "rb");
+        if (f != NULL)
+        {
+            if (::fread(memory.data(), 1, memory.size(), f) != memory.size())
+            {
+                trace("EEPROM", "%s is shorter than %lu bytes", fileName.c_str(), (unsigned long) memory.size());
+            }
+            ::fclose(f);
+        }
+    }
+}
+
+SpiEepRom::~SpiEepRom ()
+{
+    if (modified && !fileName.empty())
+    {
+        FILE * f = ::fopen(fileName.c_str(), "wb");
+        if (f != NULL)
+        {
+            ::fwrite(memory.data(), 1, memory.size(), f);
+            ::fclose(f);
+        }
+    }
+}
+
+void SpiEepRom::select (bool active)
+{
+    if (active)
+    {
+        position = 0;
+        return;
+    }
+    // A write sequence is completed by the rising chip select
+    if ((instruction & 0x07) == WRITE && position > 2 && writeEnabled)
+    {
+        writeEnabled = false;
+        busyUntil = getTime() + WRITE_CYCLE;
+    }
+    instruction = 0;
+}
+
+uint8_t SpiEepRom::exchange (uint8_t mosi)
+{
+    const bool busy = getTime() < busyUntil;
+    const uint32_t n = position++;
+    if (n == 0)
+    {
+        instruction = mosi;
+        if (busy && (instruction & 0x07) != RDSR)
+        {
+            // Only the status is accessible during the write cycle
+            instruction = 0;
+        }
+        else if (instruction == WREN)
+        {
+            writeEnabled = true;
+        }
+        else if (instruction == WRDI)
+        {
+            writeEnabled = false;
+        }
+        return 0xFF;
+    }
+
+    switch (instruction & 0x07)
+    {
+    case RDSR:
+        return (uint8_t) (status | (writeEnabled ? STATUS_WEL : 0) | (busy ? STATUS_WIP : 0));
+    case WRSR:
+        if (n == 1 && writeEnabled)
+        {
+            status = mosi & STATUS_BP;
+            writeEnabled = false;
+            busyUntil = getTime() + WRITE_CYCLE;
+        }
+        return 0xFF;
+    case READ:
+    case WRITE:
+        if (n == 1)
+        {
+            // The 25xx040 takes the address bit A8 from the bit 3 of the instruction
+            address = mosi | ((instruction & 0x08) << 5);
+            return 0xFF;
+        }
+        if ((instruction & 0x07) == READ)
+        {
+            return memory[address++ % memory.size()];
+        }
+        else
+        {
+            const uint32_t protectedFrom = ((status & STATUS_BP) == 0) ? memory.size()
+                                           : memory.size() - (memory.size() >> (3 - ((status & STATUS_BP) >> 2)));
+            // The address wraps within the page
+            const uint32_t target = (address & ~(PAGE_SIZE - 1)) + ((address + n - 2) & (PAGE_SIZE - 1));
+            if (writeEnabled && target < protectedFrom)
+            {
+                memory[target % memory.size()] = mosi;
+                modified = true;
+            }
+            return 0xFF;
+        }
+    default:
+        return 0xFF;
+    }
+}
+
+/************************************************************************
+ * Class I2cRegisterFile
+ ************************************************************************/
+
+I2cRegisterFile::I2cRegisterFile (uint32_t size) :
+    registers(size, 0),
+    pointer { 0 }
+{
+    // empty
+}
+
+bool I2cRegisterFile::write (const uint8_t * data, uint16_t n)
+{
+    if (n > 0)
+    {
+        pointer = data[0];
+    }
+    for (uint16_t i = 1; i < n; ++i)
+    {
+        registers[pointer++ % registers.size()] = data[i];
+    }
+    return true;
+}
+
+bool I2cRegisterFile::read (uint8_t * data, uint16_t n)
+{
+    for (uint16_t i = 0; i < n; ++i)
+    {
+        data[i] = registers[pointer++ % registers.size()];
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,262 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#ifdef HAL_SIMULATION
+
+#include "hal_sim_internal.h"
+
+#include <cstring>
+
+using namespace HalSim;
+
+namespace
+{
+
+/**
+ * @brief Interrupt flags of a stream, set by the transfer events and consumed by
+ *        HAL_DMA_IRQHandler like the LISR/HISR bits.
+ */
+struct Stream
+{
+    bool half = false, full = false, error = false;
+    uint64_t duration = 0;
+    std::function<void (bool)> onData;
+};
+
+std::map<DMA_HandleTypeDef *, Stream> & getStreams ()
+{
+    static std::map<DMA_HandleTypeDef *, Stream> streams;
+    return streams;
+}
+
+IRQn_Type getStreamIrq (const DMA_Stream_TypeDef * instance)
+{
+    static const IRQn_Type DMA1_IRQS[] = { DMA1_Stream0_IRQn, DMA1_Stream1_IRQn, DMA1_Stream2_IRQn,
+                                           DMA1_Stream3_IRQn, DMA1_Stream4_IRQn, DMA1_Stream5_IRQn,
+                                           DMA1_Stream6_IRQn, DMA1_Stream7_IRQn };
+    static const IRQn_Type DMA2_IRQS[] = { DMA2_Stream0_IRQn, DMA2_Stream1_IRQn, DMA2_Stream2_IRQn,
+                                           DMA2_Stream3_IRQn, DMA2_Stream4_IRQn, DMA2_Stream5_IRQn,
+                                           DMA2_Stream6_IRQn, DMA2_Stream7_IRQn };
+    const uintptr_t address = (uintptr_t) instance;
+    const bool dma2 = address >= DMA2_BASE;
+    const uint32_t n = (address - (dma2 ? DMA2_BASE : DMA1_BASE) - 0x10) / 0x18;
+    return dma2 ? DMA2_IRQS[n & 7] : DMA1_IRQS[n & 7];
+}
+
+void schedulePeriod (DMA_HandleTypeDef * hdma)
+{
+    Stream & s = getStreams()[hdma];
+    const uint64_t start = getTime();
+    schedule(start + s.duration / 2, [hdma] ()
+    {
+        Stream & s = getStreams()[hdma];
+        if (hdma->Init.Mode == DMA_CIRCULAR)
+        {
+            s.onData(false);
+        }
+        s.half = true;
+        raiseIrq(getStreamIrq(hdma->Instance));
+    }, &s);
+    schedule(start + s.duration, [hdma] ()
+    {
+        Stream & s = getStreams()[hdma];
+        s.onData(true);
+        s.full = true;
+        if (hdma->Init.Mode == DMA_CIRCULAR)
+        {
+            schedulePeriod(hdma);
+        }
+        else
+        {
+            hdma->Instance->NDTR = 0;
+        }
+        raiseIrq(getStreamIrq(hdma->Instance));
+    }, &s);
+}
+
+void disableStream (DMA_HandleTypeDef * hdma)
+{
+    Stream & s = getStreams()[hdma];
+    cancel(&s);
+    s.half = s.full = s.error = false;
+    hdma->Instance->CR &= ~DMA_SxCR_EN;
+}
+
+} // end of anonymous namespace
+
+/************************************************************************
+ * Simulation interface
+ ************************************************************************/
+
+void HalSim::startDma (DMA_HandleTypeDef * hdma, uint64_t duration, std::function<void (bool full)> onData)
+{
+    disableStream(hdma);
+    Stream & s = getStreams()[hdma];
+    s.duration = std::max(duration, (uint64_t) 2);
+    s.onData = std::move(onData);
+    hdma->State = HAL_DMA_STATE_BUSY;
+    hdma->ErrorCode = HAL_DMA_ERROR_NONE;
+    hdma->Instance->CR |= DMA_SxCR_EN;
+    schedulePeriod(hdma);
+}
+
+void HalSim::failDma (DMA_HandleTypeDef * hdma)
+{
+    disableStream(hdma);
+    getStreams()[hdma].error = true;
+    raiseIrq(getStreamIrq(hdma->Instance));
+}
+
+void HalSim::stopDma (DMA_HandleTypeDef * hdma)
+{
+    disableStream(hdma);
+}
+
+/************************************************************************
+ * HAL: DMA
+ ************************************************************************/
+
+HAL_StatusTypeDef HAL_DMA_Init (DMA_HandleTypeDef * hdma)
+{
+    halCall();
+    if (hdma == NULL)
+    {
+        return HAL_ERROR;
+    }
+    hdma->Instance->CR = hdma->Init.Channel | hdma->Init.Direction | hdma->Init.PeriphInc | hdma->Init.MemInc
+                         | hdma->Init.PeriphDataAlignment | hdma->Init.MemDataAlignment | hdma->Init.Mode
+                         | hdma->Init.Priority;
+    disableStream(hdma);
+    hdma->ErrorCode = HAL_DMA_ERROR_NONE;
+    hdma->State = HAL_DMA_STATE_READY;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_DMA_DeInit (DMA_HandleTypeDef * hdma)
+{
+    halCall();
+    if (hdma == NULL)
+    {
+        return HAL_ERROR;
+    }
+    if (hdma->State == HAL_DMA_STATE_BUSY)
+    {
+        return HAL_BUSY;
+    }
+    disableStream(hdma);
+    getStreams().erase(hdma);
+    hdma->Instance->CR = 0;
+    hdma->ErrorCode = HAL_DMA_ERROR_NONE;
+    hdma->State = HAL_DMA_STATE_RESET;
+    __HAL_UNLOCK(hdma);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_DMA_Start_IT (DMA_HandleTypeDef * hdma, uint32_t SrcAddress, uint32_t DstAddress,
+                                    uint32_t DataLength)
+{
+    halCall();
+    if (hdma->State != HAL_DMA_STATE_READY)
+    {
+        return HAL_BUSY;
+    }
+    // Only memory-to-memory transfers are meaningful without a peripheral model; the
+    // addresses are 32 bits wide on the target and can not hold host pointers
+    hdma->Instance->NDTR = DataLength;
+    const uint32_t size = 1U << ((hdma->Init.MemDataAlignment & DMA_SxCR_MSIZE) >> DMA_SxCR_MSIZE_Pos);
+    startDma(hdma, nsForBits(4 * DataLength, HAL_RCC_GetHCLKFreq()), [hdma, SrcAddress, DstAddress, DataLength, size] (bool)
+    {
+        if (hdma->Init.Direction == DMA_MEMORY_TO_MEMORY)
+        {
+            ::memmove((void *) (uintptr_t) DstAddress, (const void *) (uintptr_t) SrcAddress, DataLength * size);
+        }
+    });
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_DMA_Start (DMA_HandleTypeDef * hdma, uint32_t SrcAddress, uint32_t DstAddress,
+                                 uint32_t DataLength)
+{
+    return HAL_DMA_Start_IT(hdma, SrcAddress, DstAddress, DataLength);
+}
+
+HAL_StatusTypeDef HAL_DMA_Abort (DMA_HandleTypeDef * hdma)
+{
+    halCall();
+    disableStream(hdma);
+    __HAL_UNLOCK(hdma);
+    hdma->State = HAL_DMA_STATE_READY;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_DMA_Abort_IT (DMA_HandleTypeDef * hdma)
+{
+    return HAL_DMA_Abort(hdma);
+}
+
+void HAL_DMA_IRQHandler (DMA_HandleTypeDef * hdma)
+{
+    halCall();
+    Stream & s = getStreams()[hdma];
+    if (s.error)
+    {
+        s.error = false;
+        hdma->ErrorCode |= HAL_DMA_ERROR_TE;
+        hdma->State = HAL_DMA_STATE_READY;
+        __HAL_UNLOCK(hdma);
+        if (hdma->XferErrorCallback != NULL)
+        {
+            hdma->XferErrorCallback(hdma);
+        }
+    }
+    if (s.half)
+    {
+        s.half = false;
+        if (hdma->XferHalfCpltCallback != NULL)
+        {
+            hdma->XferHalfCpltCallback(hdma);
+        }
+    }
+    if (s.full)
+    {
+        s.full = false;
+        if (hdma->Init.Mode != DMA_CIRCULAR)
+        {
+            hdma->Instance->CR &= ~DMA_SxCR_EN;
+            hdma->State = HAL_DMA_STATE_READY;
+            __HAL_UNLOCK(hdma);
+        }
+        if (hdma->XferCpltCallback != NULL)
+        {
+            hdma->XferCpltCallback(hdma);
+        }
+    }
+}
+
+HAL_DMA_StateTypeDef HAL_DMA_GetState (DMA_HandleTypeDef * hdma)
+{
+    return hdma->State;
+}
+
+uint32_t HAL_DMA_GetError (DMA_HandleTypeDef * hdma)
+{
+    return hdma->ErrorCode;
+}
+
+#endif
@@ -0,0 +1,168 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#ifdef HAL_SIMULATION
+
+#include "hal_sim_internal.h"
+
+#ifndef ARM_MATH_CM4
+#define ARM_MATH_CM4
+#endif
+#include "arm_math.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace HalSim;
+
+/*
+ * Host implementation of the CMSIS-DSP functions used by the firmware. The target links
+ * the prebuilt libarm_cortexM4lf_math; the host build uses these portable functions with
+ * the same fixed-point formats instead:
+ *
+ * - arm_biquad_cascade_df1_fast_q31 rounds every product to 32 bits like the fast Cortex-M4
+ *   implementation, so the output is bit-exact for the same coefficients.
+ * - arm_rfft_q15 computes the transform in double precision and returns it in the output
+ *   format of CMSIS-DSP (the result is scaled down by the transform length). It differs
+ *   from the target only by the rounding of the intermediate stages.
+ *
+ * Both functions charge the CPU cycles of the target implementation to the virtual clock,
+ * so a DWT measurement around them gives a realistic estimate.
+ */
+
+namespace
+{
+
+/**
+ * @brief Estimated Cortex-M4 cycles per sample and stage of arm_biquad_cascade_df1_fast_q31.
+ */
+constexpr uint32_t BIQUAD_CYCLES = 9;
+
+/**
+ * @brief Estimated Cortex-M4 cycles per point and radix-2 pass of arm_rfft_q15.
+ */
+constexpr uint32_t RFFT_CYCLES = 6;
+
+constexpr uint32_t RFFT_MIN_LENGTH = 32;
+constexpr uint32_t RFFT_MAX_LENGTH = 8192;
+
+inline q31_t multiplyAccumulate (q31_t acc, q31_t x, q31_t y)
+{
+    return (q31_t) (((((q63_t) acc) << 32) + (q63_t) x * y + 0x80000000LL) >> 32);
+}
+
+inline q15_t saturate (double value)
+{
+    const double rounded = std::floor(value + 0.5);
+    return (q15_t) ((rounded > 32767.0) ? 32767 : (rounded < -32768.0) ? -32768 : rounded);
+}
+
+} // end of anonymous namespace
+
+void arm_biquad_cascade_df1_init_q31 (arm_biquad_casd_df1_inst_q31 * S, uint8_t numStages,
+                                      q31_t * pCoeffs, q31_t * pState, int8_t postShift)
+{
+    S->numStages = numStages;
+    S->pCoeffs = pCoeffs;
+    S->pState = pState;
+    S->postShift = postShift;
+    std::fill(pState, pState + 4 * numStages, 0);
+}
+
+void arm_biquad_cascade_df1_fast_q31 (const arm_biquad_casd_df1_inst_q31 * S, q31_t * pSrc,
+                                      q31_t * pDst, uint32_t blockSize)
+{
+    const q31_t * input = pSrc;
+    const q31_t * coeffs = S->pCoeffs;
+    q31_t * state = S->pState;
+    const uint32_t shift = S->postShift + 1;
+    for (uint32_t stage = 0; stage < S->numStages; ++stage, coeffs += 5, state += 4)
+    {
+        q31_t x1 = state[0], x2 = state[1], y1 = state[2], y2 = state[3];
+        for (uint32_t i = 0; i < blockSize; ++i)
+        {
+            const q31_t x = input[i];
+            q31_t acc = multiplyAccumulate(0, coeffs[1], x1);
+            acc = multiplyAccumulate(acc, coeffs[0], x);
+            acc = multiplyAccumulate(acc, coeffs[2], x2);
+            acc = multiplyAccumulate(acc, coeffs[3], y1);
+            acc = multiplyAccumulate(acc, coeffs[4], y2);
+            const q31_t y = (q31_t) ((uint32_t) acc << shift);
+            x2 = x1;
+            x1 = x;
+            y2 = y1;
+            y1 = y;
+            pDst[i] = y;
+        }
+        state[0] = x1;
+        state[1] = x2;
+        state[2] = y1;
+        state[3] = y2;
+        input = pDst;
+    }
+    chargeCycles(BIQUAD_CYCLES * S->numStages * blockSize);
+}
+
+arm_status arm_rfft_init_q15 (arm_rfft_instance_q15 * S, uint32_t fftLenReal, uint32_t ifftFlagR,
+                              uint32_t bitReverseFlag)
+{
+    // Only the forward transform is used by the firmware
+    if (fftLenReal < RFFT_MIN_LENGTH || fftLenReal > RFFT_MAX_LENGTH || (fftLenReal & (fftLenReal - 1)) != 0
+        || ifftFlagR != 0)
+    {
+        return ARM_MATH_ARGUMENT_ERROR;
+    }
+    S->fftLenReal = fftLenReal;
+    S->ifftFlagR = (uint8_t) ifftFlagR;
+    S->bitReverseFlagR = (uint8_t) bitReverseFlag;
+    S->twidCoefRModifier = RFFT_MAX_LENGTH / fftLenReal;
+    S->pTwiddleAReal = NULL;
+    S->pTwiddleBReal = NULL;
+    S->pCfft = NULL;
+    return ARM_MATH_SUCCESS;
+}
+
+void arm_rfft_q15 (const arm_rfft_instance_q15 * S, q15_t * pSrc, q15_t * pDst)
+{
+    // Forward transform: n real samples give n complex bins (the upper half is the
+    // conjugate mirror of the lower one), scaled by 1/n
+    const uint32_t n = S->fftLenReal;
+    std::vector<double> cosine(n), sine(n);
+    for (uint32_t i = 0; i < n; ++i)
+    {
+        cosine[i] = std::cos(2.0 * M_PI * (double) i / (double) n);
+        sine[i] = std::sin(2.0 * M_PI * (double) i / (double) n);
+    }
+    for (uint32_t k = 0; k < n; ++k)
+    {
+        double re = 0.0, im = 0.0;
+        for (uint32_t i = 0; i < n; ++i)
+        {
+            const uint32_t phase = (uint32_t) ((uint64_t) k * i % n);
+            re += (double) pSrc[i] * cosine[phase];
+            im -= (double) pSrc[i] * sine[phase];
+        }
+        pDst[2 * k] = saturate(re / (double) n);
+        pDst[2 * k + 1] = saturate(im / (double) n);
+    }
+    chargeCycles(RFFT_CYCLES * n * (31 - __builtin_clz(n)));
+}
+
+#endif
@@ -0,0 +1,327 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#ifdef HAL_SIMULATION
+
+#include "hal_sim_internal.h"
+
+using namespace HalSim;
+
+namespace
+{
+
+// Encoding of GPIO_InitTypeDef::Mode, private to the HAL GPIO driver
+constexpr uint32_t GPIO_MODE = 0x00000003U;
+constexpr uint32_t EXTI_MODE = 0x10000000U;
+constexpr uint32_t GPIO_MODE_IT_BIT = 0x00010000U;
+constexpr uint32_t GPIO_MODE_EVT_BIT = 0x00020000U;
+constexpr uint32_t RISING_EDGE = 0x00100000U;
+constexpr uint32_t FALLING_EDGE = 0x00200000U;
+constexpr uint32_t GPIO_OUTPUT_TYPE = 0x00000010U;
+
+constexpr uint32_t PORTS = 9;
+
+/**
+ * @brief The external side of the pins and the output state seen by the last sync.
+ */
+struct PortState
+{
+    uint16_t external = 0;  // level driven from outside
+    uint16_t driven = 0;    // pins with a driven level, the others follow the pull resistor
+    uint16_t outputs = 0;   // pins in output mode
+    uint16_t levels = 0;    // output levels
+};
+
+PortState * getPorts ()
+{
+    static PortState ports[PORTS];
+    return ports;
+}
+
+inline uint32_t getIndex (const GPIO_TypeDef * port)
+{
+    return ((uintptr_t) port - GPIOA_BASE) / (GPIOB_BASE - GPIOA_BASE);
+}
+
+inline GPIO_TypeDef * getPort (uint32_t index)
+{
+    return (GPIO_TypeDef *) (uintptr_t) (GPIOA_BASE + index * (GPIOB_BASE - GPIOA_BASE));
+}
+
+inline uint32_t getPosition (uint16_t pin)
+{
+    return pin == 0 ? 0 : __builtin_ctz(pin);
+}
+
+uint16_t getOutputMask (const GPIO_TypeDef * port)
+{
+    uint16_t mask = 0;
+    for (uint32_t i = 0; i < 16; ++i)
+    {
+        if (((port->MODER >> (2 * i)) & 3) == GPIO_MODE_OUTPUT_PP)
+        {
+            mask |= 1 << i;
+        }
+    }
+    return mask;
+}
+
+/**
+ * @brief The level of the pins that are not outputs: external or given by the pull resistor.
+ */
+uint16_t getInputLevels (const GPIO_TypeDef * port, const PortState & s)
+{
+    uint16_t pullUp = 0;
+    for (uint32_t i = 0; i < 16; ++i)
+    {
+        if (((port->PUPDR >> (2 * i)) & 3) == GPIO_PULLUP)
+        {
+            pullUp |= 1 << i;
+        }
+    }
+    return (s.external & s.driven) | (pullUp & ~s.driven);
+}
+
+IRQn_Type getExtiIrq (uint32_t line)
+{
+    static const IRQn_Type LOW_LINES[] = { EXTI0_IRQn, EXTI1_IRQn, EXTI2_IRQn, EXTI3_IRQn, EXTI4_IRQn };
+    return line < 5 ? LOW_LINES[line] : (line < 10 ? EXTI9_5_IRQn : EXTI15_10_IRQn);
+}
+
+/**
+ * @brief Sets the EXTI pending bits for the input edges of a port.
+ */
+void triggerExti (uint32_t index, uint16_t previous, uint16_t current)
+{
+    const uint16_t changed = previous ^ current;
+    for (uint32_t line = 0; line < 16; ++line)
+    {
+        const uint32_t bit = 1U << line;
+        if (!(changed & bit) || ((SYSCFG->EXTICR[line >> 2] >> (4 * (line & 3))) & 0xF) != index)
+        {
+            continue;
+        }
+        const bool rising = (current & bit) != 0;
+        if ((rising && (EXTI->RTSR & bit)) || (!rising && (EXTI->FTSR & bit)))
+        {
+            EXTI->PR |= bit;
+            if (EXTI->IMR & bit)
+            {
+                raiseIrq(getExtiIrq(line));
+            }
+        }
+    }
+}
+
+} // end of anonymous namespace
+
+/************************************************************************
+ * Simulation interface
+ ************************************************************************/
+
+void HalSim::syncGpio ()
+{
+    PortState * ports = getPorts();
+    for (uint32_t index = 0; index < PORTS; ++index)
+    {
+        GPIO_TypeDef * port = getPort(index);
+        PortState & s = ports[index];
+        const uint16_t outputs = getOutputMask(port);
+        const uint16_t levels = port->ODR & outputs;
+        const uint16_t changed = (levels ^ s.levels) | (outputs & ~s.outputs);
+        s.outputs = outputs;
+        s.levels = levels;
+        for (uint32_t i = 0; i < 16 && changed != 0; ++i)
+        {
+            const uint16_t pin = 1 << i;
+            if (changed & pin)
+            {
+                const bool level = (levels & pin) != 0;
+                trace("GPIO", "%s %d", getPinName(port, pin).c_str(), level);
+                onChipSelect(port, pin, level);
+            }
+        }
+        port->IDR = levels | (getInputLevels(port, s) & ~outputs);
+    }
+}
+
+bool HalSim::parsePin (const std::string & name, GPIO_TypeDef *& port, uint16_t & pin)
+{
+    if (name.size() < 3 || name[0] != 'P' || name[1] < 'A' || name[1] >= (char) ('A' + PORTS))
+    {
+        return false;
+    }
+    char * end = NULL;
+    const long n = ::strtol(name.c_str() + 2, &end, 10);
+    if (*end != 0 || n < 0 || n > 15)
+    {
+        return false;
+    }
+    port = getPort(name[1] - 'A');
+    pin = 1 << n;
+    return true;
+}
+
+std::string HalSim::getPinName (GPIO_TypeDef * port, uint16_t pin)
+{
+    return std::string("P") + (char) ('A' + getIndex(port)) + std::to_string(getPosition(pin));
+}
+
+void HalSim::setPin (GPIO_TypeDef * port, uint16_t pins, bool level)
+{
+    const uint32_t index = getIndex(port);
+    PortState & s = getPorts()[index];
+    const uint16_t previous = getInputLevels(port, s);
+    s.driven |= pins;
+    s.external = level ? (s.external | pins) : (s.external & ~pins);
+    const uint16_t current = getInputLevels(port, s);
+    trace("PIN", "%s %d", getPinName(port, pins).c_str(), level);
+    triggerExti(index, previous, current);
+    syncGpio();
+}
+
+bool HalSim::getPin (GPIO_TypeDef * port, uint16_t pin)
+{
+    const PortState & s = getPorts()[getIndex(port)];
+    return ((getOutputMask(port) & pin) ? port->ODR : getInputLevels(port, s)) & pin;
+}
+
+/************************************************************************
+ * GPIO_BSRR (Inc/stm32f4xx.h)
+ ************************************************************************/
+
+void halSimStoreBsrr (volatile uint32_t * bsrr, uint32_t value)
+{
+    GPIO_TypeDef * port = (GPIO_TypeDef *) ((uintptr_t) bsrr - offsetof(GPIO_TypeDef, BSRR));
+    // The set bits take priority over the reset bits
+    port->ODR = (port->ODR & ~(value >> 16)) | (value & 0xFFFF);
+    syncGpio();
+}
+
+/************************************************************************
+ * HAL: GPIO
+ ************************************************************************/
+
+void HAL_GPIO_Init (GPIO_TypeDef * GPIOx, GPIO_InitTypeDef * GPIO_Init)
+{
+    halCall();
+    const uint32_t mode = GPIO_Init->Mode;
+    for (uint32_t position = 0; position < 16; ++position)
+    {
+        const uint32_t bit = 1U << position;
+        if (!(GPIO_Init->Pin & bit))
+        {
+            continue;
+        }
+        if ((mode & GPIO_MODE) == GPIO_MODE_AF_PP)
+        {
+            MODIFY_REG(GPIOx->AFR[position >> 3], 0xFU << (4 * (position & 7)),
+                       GPIO_Init->Alternate << (4 * (position & 7)));
+        }
+        MODIFY_REG(GPIOx->MODER, 3U << (2 * position), (mode & GPIO_MODE) << (2 * position));
+        if ((mode & GPIO_MODE) == GPIO_MODE_OUTPUT_PP || (mode & GPIO_MODE) == GPIO_MODE_AF_PP)
+        {
+            MODIFY_REG(GPIOx->OSPEEDR, 3U << (2 * position), GPIO_Init->Speed << (2 * position));
+            MODIFY_REG(GPIOx->OTYPER, bit, ((mode & GPIO_OUTPUT_TYPE) >> 4) << position);
+        }
+        MODIFY_REG(GPIOx->PUPDR, 3U << (2 * position), GPIO_Init->Pull << (2 * position));
+
+        if (mode & EXTI_MODE)
+        {
+            MODIFY_REG(SYSCFG->EXTICR[position >> 2], 0xFU << (4 * (position & 3)),
+                       getIndex(GPIOx) << (4 * (position & 3)));
+            EXTI->IMR = (mode & GPIO_MODE_IT_BIT) ? (EXTI->IMR | bit) : (EXTI->IMR & ~bit);
+            EXTI->EMR = (mode & GPIO_MODE_EVT_BIT) ? (EXTI->EMR | bit) : (EXTI->EMR & ~bit);
+            EXTI->RTSR = (mode & RISING_EDGE) ? (EXTI->RTSR | bit) : (EXTI->RTSR & ~bit);
+            EXTI->FTSR = (mode & FALLING_EDGE) ? (EXTI->FTSR | bit) : (EXTI->FTSR & ~bit);
+        }
+    }
+    syncGpio();
+}
+
+void HAL_GPIO_DeInit (GPIO_TypeDef * GPIOx, uint32_t GPIO_Pin)
+{
+    halCall();
+    for (uint32_t position = 0; position < 16; ++position)
+    {
+        const uint32_t bit = 1U << position;
+        if (!(GPIO_Pin & bit))
+        {
+            continue;
+        }
+        if (((SYSCFG->EXTICR[position >> 2] >> (4 * (position & 3))) & 0xF) == getIndex(GPIOx))
+        {
+            SYSCFG->EXTICR[position >> 2] &= ~(0xFU << (4 * (position & 3)));
+            EXTI->IMR &= ~bit;
+            EXTI->EMR &= ~bit;
+            EXTI->RTSR &= ~bit;
+            EXTI->FTSR &= ~bit;
+        }
+        GPIOx->MODER &= ~(3U << (2 * position));
+        GPIOx->AFR[position >> 3] &= ~(0xFU << (4 * (position & 7)));
+        GPIOx->OSPEEDR &= ~(3U << (2 * position));
+        GPIOx->OTYPER &= ~bit;
+        GPIOx->PUPDR &= ~(3U << (2 * position));
+    }
+    syncGpio();
+}
+
+GPIO_PinState HAL_GPIO_ReadPin (GPIO_TypeDef * GPIOx, uint16_t GPIO_Pin)
+{
+    halCall();
+    return (GPIOx->IDR & GPIO_Pin) ? GPIO_PIN_SET : GPIO_PIN_RESET;
+}
+
+void HAL_GPIO_WritePin (GPIO_TypeDef * GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState)
+{
+    halCall();
+    GPIOx->BSRR = (PinState != GPIO_PIN_RESET) ? GPIO_Pin : (uint32_t) GPIO_Pin << 16U;
+}
+
+void HAL_GPIO_TogglePin (GPIO_TypeDef * GPIOx, uint16_t GPIO_Pin)
+{
+    halCall();
+    GPIOx->ODR ^= GPIO_Pin;
+    syncGpio();
+}
+
+HAL_StatusTypeDef HAL_GPIO_LockPin (GPIO_TypeDef * GPIOx, uint16_t GPIO_Pin)
+{
+    halCall();
+    GPIOx->LCKR |= GPIO_LCKR_LCKK | GPIO_Pin;
+    return HAL_OK;
+}
+
+void HAL_GPIO_EXTI_IRQHandler (uint16_t GPIO_Pin)
+{
+    halCall();
+    // The pending register is write-one-to-clear on the hardware
+    if (EXTI->PR & GPIO_Pin)
+    {
+        EXTI->PR &= ~(uint32_t) GPIO_Pin;
+        HAL_GPIO_EXTI_Callback(GPIO_Pin);
+    }
+}
+
+__weak void HAL_GPIO_EXTI_Callback (uint16_t GPIO_Pin)
+{
+    // empty
+}
+
+#endif
@@ -0,0 +1,392 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#ifdef HAL_SIMULATION
+
+#include "hal_sim_internal.h"
+
+#include <memory>
+
+using namespace HalSim;
+
+namespace
+{
+
+std::map<SPI_TypeDef *, I2sSink> & getSinks ()
+{
+    static std::map<SPI_TypeDef *, I2sSink> sinks;
+    return sinks;
+}
+
+/**
+ * @brief I2SCLK of the PLLI2S: (PLL input / PLLM) * PLLI2SN / PLLI2SR.
+ */
+uint64_t getI2sClock ()
+{
+    const uint32_t pllm = RCC->PLLCFGR & RCC_PLLCFGR_PLLM;
+    const uint32_t plln = (RCC->PLLI2SCFGR & RCC_PLLI2SCFGR_PLLI2SN) >> RCC_PLLI2SCFGR_PLLI2SN_Pos;
+    const uint32_t pllr = (RCC->PLLI2SCFGR & RCC_PLLI2SCFGR_PLLI2SR) >> RCC_PLLI2SCFGR_PLLI2SR_Pos;
+    const uint64_t input = (RCC->PLLCFGR & RCC_PLLCFGR_PLLSRC_HSE) ? HSE_VALUE : HSI_VALUE;
+    return (pllm == 0 || pllr == 0) ? 0 : input * plln / pllm / pllr;
+}
+
+inline bool isExtendedFormat (const I2S_HandleTypeDef * hi2s)
+{
+    return hi2s->Init.DataFormat != I2S_DATAFORMAT_16B;
+}
+
+/**
+ * @brief The sample rate given by the I2SPR prescaler, like the hardware derives it; the
+ *        configured audio frequency if the PLLI2S is off.
+ */
+uint32_t getSampleRate (const I2S_HandleTypeDef * hi2s)
+{
+    const uint64_t clock = getI2sClock();
+    const uint32_t i2spr = hi2s->Instance->I2SPR;
+    const uint32_t div = 2 * (i2spr & SPI_I2SPR_I2SDIV) + ((i2spr & SPI_I2SPR_ODD) ? 1 : 0);
+    if (clock == 0 || div < 4)
+    {
+        return hi2s->Init.AudioFreq;
+    }
+    const uint32_t frameBits = (i2spr & SPI_I2SPR_MCKOE) ? 256 : (isExtendedFormat(hi2s) ? 64 : 32);
+    return (uint32_t) ((clock + frameBits * div / 2) / (frameBits * div));
+}
+
+/**
+ * @brief Duration of a DMA buffer: the 16-bit DMA items form stereo frames of two
+ *        (16-bit data) or four (24- and 32-bit data) items.
+ */
+uint64_t getBufferTime (const I2S_HandleTypeDef * hi2s, uint32_t items)
+{
+    const uint32_t frames = items / (isExtendedFormat(hi2s) ? 4 : 2);
+    return (uint64_t) frames * 1000000000ULL / std::max(getSampleRate(hi2s), (uint32_t) 1);
+}
+
+I2S_HandleTypeDef * findI2s (DMA_HandleTypeDef * hdma)
+{
+    return (I2S_HandleTypeDef *) hdma->Parent;
+}
+
+void i2sDmaTxHalfCplt (DMA_HandleTypeDef * hdma)
+{
+    HAL_I2S_TxHalfCpltCallback(findI2s(hdma));
+}
+
+void i2sDmaTxCplt (DMA_HandleTypeDef * hdma)
+{
+    I2S_HandleTypeDef * hi2s = findI2s(hdma);
+    if (hdma->Init.Mode != DMA_CIRCULAR)
+    {
+        hi2s->Instance->CR2 &= ~SPI_CR2_TXDMAEN;
+        hi2s->TxXferCount = 0;
+        hi2s->State = HAL_I2S_STATE_READY;
+    }
+    HAL_I2S_TxCpltCallback(hi2s);
+}
+
+void i2sDmaRxHalfCplt (DMA_HandleTypeDef * hdma)
+{
+    HAL_I2S_RxHalfCpltCallback(findI2s(hdma));
+}
+
+void i2sDmaRxCplt (DMA_HandleTypeDef * hdma)
+{
+    I2S_HandleTypeDef * hi2s = findI2s(hdma);
+    if (hdma->Init.Mode != DMA_CIRCULAR)
+    {
+        hi2s->Instance->CR2 &= ~SPI_CR2_RXDMAEN;
+        hi2s->RxXferCount = 0;
+        hi2s->State = HAL_I2S_STATE_READY;
+    }
+    HAL_I2S_RxCpltCallback(hi2s);
+}
+
+void i2sDmaError (DMA_HandleTypeDef * hdma)
+{
+    I2S_HandleTypeDef * hi2s = findI2s(hdma);
+    hi2s->Instance->CR2 &= ~(SPI_CR2_TXDMAEN | SPI_CR2_RXDMAEN);
+    hi2s->TxXferCount = 0;
+    hi2s->RxXferCount = 0;
+    hi2s->State = HAL_I2S_STATE_READY;
+    hi2s->ErrorCode |= HAL_I2S_ERROR_DMA;
+    HAL_I2S_ErrorCallback(hi2s);
+}
+
+/**
+ * @brief Passes the half of the buffer that was just shifted out to the sink.
+ */
+void recordFrames (I2S_HandleTypeDef * hi2s, const uint16_t * buffer, uint32_t items, bool full)
+{
+    auto it = getSinks().find(hi2s->Instance);
+    if (it == getSinks().end())
+    {
+        return;
+    }
+    const uint32_t half = items / 2;
+    if (hi2s->hdmatx->Init.Mode == DMA_CIRCULAR)
+    {
+        it->second(buffer + (full ? half : 0), full ? items - half : half);
+    }
+    else if (full)
+    {
+        it->second(buffer, items);
+    }
+}
+
+} // end of anonymous namespace
+
+/************************************************************************
+ * Simulation interface
+ ************************************************************************/
+
+void HalSim::captureI2s (SPI_TypeDef * spi, I2sSink sink)
+{
+    if (sink)
+    {
+        getSinks()[spi] = sink;
+    }
+    else
+    {
+        getSinks().erase(spi);
+    }
+}
+
+bool HalSim::recordI2s (SPI_TypeDef * spi, const char * fileName)
+{
+    // The file is closed when the sink is replaced or destroyed at the exit
+    std::shared_ptr<FILE> file(::fopen(fileName, "wb"), [] (FILE * f)
+    {
+        if (f != NULL)
+        {
+            ::fclose(f);
+        }
+    });
+    if (file == NULL)
+    {
+        captureI2s(spi, nullptr);
+        return false;
+    }
+    captureI2s(spi, [file] (const uint16_t * items, uint32_t n)
+    {
+        ::fwrite(items, sizeof(uint16_t), n, file.get());
+    });
+    return true;
+}
+
+/************************************************************************
+ * HAL: I2S
+ ************************************************************************/
+
+HAL_StatusTypeDef HAL_I2S_Init (I2S_HandleTypeDef * hi2s)
+{
+    halCall();
+    if (hi2s == NULL)
+    {
+        return HAL_ERROR;
+    }
+    if (hi2s->State == HAL_I2S_STATE_RESET)
+    {
+        hi2s->Lock = HAL_UNLOCKED;
+        HAL_I2S_MspInit(hi2s);
+    }
+    hi2s->State = HAL_I2S_STATE_BUSY;
+
+    // The prescaler is computed like in the HAL, with the rounding to the nearest divider
+    const uint64_t clock = getI2sClock();
+    uint32_t i2spr = 2;
+    if (clock != 0 && hi2s->Init.AudioFreq != I2S_AUDIOFREQ_DEFAULT)
+    {
+        const uint32_t frameBits = (hi2s->Init.MCLKOutput == I2S_MCLKOUTPUT_ENABLE) ? 256
+                                   : (isExtendedFormat(hi2s) ? 64 : 32);
+        const uint32_t tmp = (uint32_t) ((clock * 10 / (frameBits * hi2s->Init.AudioFreq) + 5) / 10);
+        const uint32_t i2sdiv = tmp / 2;
+        if (i2sdiv < 2 || i2sdiv > 0xFF)
+        {
+            i2spr = 2;
+        }
+        else
+        {
+            i2spr = i2sdiv | ((tmp & 1U) << 8);
+        }
+    }
+    hi2s->Instance->I2SPR = i2spr | hi2s->Init.MCLKOutput;
+    hi2s->Instance->I2SCFGR = SPI_I2SCFGR_I2SMOD | hi2s->Init.Mode | hi2s->Init.Standard | hi2s->Init.DataFormat
+                              | hi2s->Init.CPOL;
+
+    hi2s->ErrorCode = HAL_I2S_ERROR_NONE;
+    hi2s->State = HAL_I2S_STATE_READY;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2S_DeInit (I2S_HandleTypeDef * hi2s)
+{
+    halCall();
+    if (hi2s == NULL)
+    {
+        return HAL_ERROR;
+    }
+    hi2s->State = HAL_I2S_STATE_BUSY;
+    HAL_I2S_DMAStop(hi2s);
+    HAL_I2S_MspDeInit(hi2s);
+    hi2s->Instance->I2SCFGR = 0;
+    hi2s->ErrorCode = HAL_I2S_ERROR_NONE;
+    hi2s->State = HAL_I2S_STATE_RESET;
+    __HAL_UNLOCK(hi2s);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2S_Transmit_DMA (I2S_HandleTypeDef * hi2s, uint16_t * pData, uint16_t Size)
+{
+    halCall();
+    if (pData == NULL || Size == 0)
+    {
+        return HAL_ERROR;
+    }
+    if (hi2s->State != HAL_I2S_STATE_READY)
+    {
+        return HAL_BUSY;
+    }
+    __HAL_LOCK(hi2s);
+    const uint32_t items = isExtendedFormat(hi2s) ? (uint32_t) Size << 1 : Size;
+    hi2s->pTxBuffPtr = pData;
+    hi2s->TxXferSize = hi2s->TxXferCount = (uint16_t) items;
+    hi2s->ErrorCode = HAL_I2S_ERROR_NONE;
+    hi2s->State = HAL_I2S_STATE_BUSY_TX;
+
+    hi2s->hdmatx->XferHalfCpltCallback = i2sDmaTxHalfCplt;
+    hi2s->hdmatx->XferCpltCallback = i2sDmaTxCplt;
+    hi2s->hdmatx->XferErrorCallback = i2sDmaError;
+    hi2s->hdmatx->Instance->NDTR = items;
+    startDma(hi2s->hdmatx, getBufferTime(hi2s, items), [hi2s, pData, items] (bool full)
+    {
+        recordFrames(hi2s, pData, items, full);
+    });
+    hi2s->Instance->I2SCFGR |= SPI_I2SCFGR_I2SE;
+    hi2s->Instance->CR2 |= SPI_CR2_TXDMAEN;
+    trace(getName(hi2s->Instance), "TX %lu items at %lu Hz", (unsigned long) items,
+          (unsigned long) getSampleRate(hi2s));
+    __HAL_UNLOCK(hi2s);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2S_Receive_DMA (I2S_HandleTypeDef * hi2s, uint16_t * pData, uint16_t Size)
+{
+    halCall();
+    if (pData == NULL || Size == 0)
+    {
+        return HAL_ERROR;
+    }
+    if (hi2s->State != HAL_I2S_STATE_READY)
+    {
+        return HAL_BUSY;
+    }
+    __HAL_LOCK(hi2s);
+    const uint32_t items = isExtendedFormat(hi2s) ? (uint32_t) Size << 1 : Size;
+    hi2s->pRxBuffPtr = pData;
+    hi2s->RxXferSize = hi2s->RxXferCount = (uint16_t) items;
+    hi2s->ErrorCode = HAL_I2S_ERROR_NONE;
+    hi2s->State = HAL_I2S_STATE_BUSY_RX;
+
+    hi2s->hdmarx->XferHalfCpltCallback = i2sDmaRxHalfCplt;
+    hi2s->hdmarx->XferCpltCallback = i2sDmaRxCplt;
+    hi2s->hdmarx->XferErrorCallback = i2sDmaError;
+    hi2s->hdmarx->Instance->NDTR = items;
+    // No source is connected: the receiver samples silence
+    startDma(hi2s->hdmarx, getBufferTime(hi2s, items), [pData, items] (bool full)
+    {
+        const uint32_t half = items / 2;
+        std::fill(pData + (full ? half : 0), pData + (full ? items : half), 0);
+    });
+    hi2s->Instance->I2SCFGR |= SPI_I2SCFGR_I2SE;
+    hi2s->Instance->CR2 |= SPI_CR2_RXDMAEN;
+    trace(getName(hi2s->Instance), "RX %lu items at %lu Hz", (unsigned long) items,
+          (unsigned long) getSampleRate(hi2s));
+    __HAL_UNLOCK(hi2s);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2S_DMAStop (I2S_HandleTypeDef * hi2s)
+{
+    halCall();
+    if (hi2s->hdmatx != NULL)
+    {
+        stopDma(hi2s->hdmatx);
+    }
+    if (hi2s->hdmarx != NULL)
+    {
+        stopDma(hi2s->hdmarx);
+    }
+    hi2s->Instance->CR2 &= ~(SPI_CR2_TXDMAEN | SPI_CR2_RXDMAEN);
+    hi2s->Instance->I2SCFGR &= ~SPI_I2SCFGR_I2SE;
+    hi2s->State = HAL_I2S_STATE_READY;
+    return HAL_OK;
+}
+
+void HAL_I2S_IRQHandler (I2S_HandleTypeDef * hi2s)
+{
+    // The transfers are done by DMA only, no SPI interrupt is raised
+    halCall();
+}
+
+HAL_I2S_StateTypeDef HAL_I2S_GetState (I2S_HandleTypeDef * hi2s)
+{
+    return hi2s->State;
+}
+
+uint32_t HAL_I2S_GetError (I2S_HandleTypeDef * hi2s)
+{
+    return hi2s->ErrorCode;
+}
+
+__weak void HAL_I2S_MspInit (I2S_HandleTypeDef * hi2s)
+{
+    // empty
+}
+
+__weak void HAL_I2S_MspDeInit (I2S_HandleTypeDef * hi2s)
+{
+    // empty
+}
+
+__weak void HAL_I2S_TxHalfCpltCallback (I2S_HandleTypeDef * hi2s)
+{
+    // empty
+}
+
+__weak void HAL_I2S_TxCpltCallback (I2S_HandleTypeDef * hi2s)
+{
+    // empty
+}
+
+__weak void HAL_I2S_RxHalfCpltCallback (I2S_HandleTypeDef * hi2s)
+{
+    // empty
+}
+
+__weak void HAL_I2S_RxCpltCallback (I2S_HandleTypeDef * hi2s)
+{
+    // empty
+}
+
+__weak void HAL_I2S_ErrorCallback (I2S_HandleTypeDef * hi2s)
+{
+    // empty
+}
+
+#endif
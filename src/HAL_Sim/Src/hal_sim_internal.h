@@ -0,0 +1,159 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+#ifndef HAL_SIM_INTERNAL_H_
+#define HAL_SIM_INTERNAL_H_
+
+#ifdef HAL_SIMULATION
+
+#include "hal_sim.h"
+
+#include <cstdio>
+#include <map>
+
+/*
+ * Interfaces between the modules of the simulation; not to be used by the firmware.
+ */
+namespace HalSim
+{
+
+/************************************************************************
+ * Peripheral map (hal_sim_core.cpp)
+ ************************************************************************/
+
+struct Peripheral
+{
+    const char * name;
+    uintptr_t base;
+    IRQn_Type irqn;
+    uint8_t apb; // 0 for AHB
+};
+
+const Peripheral * findPeripheral (const volatile void * instance);
+const Peripheral * findPeripheral (const std::string & name);
+const char * getName (const volatile void * instance);
+uint32_t getBusClock (const volatile void * instance);
+uint32_t getTimerClock (const volatile void * instance);
+
+/************************************************************************
+ * Clock and NVIC (hal_sim_core.cpp)
+ ************************************************************************/
+
+/**
+ * @brief CPU activity: advances the clock by the given cycles and takes pending interrupts.
+ */
+void chargeCycles (uint32_t cycles);
+
+/**
+ * @brief Charged at the entry of every simulated HAL function.
+ */
+inline void halCall ()
+{
+    chargeCycles(HAL_CALL_CYCLES);
+}
+
+/**
+ * @brief Busy wait of the CPU, interrupts are taken meanwhile.
+ */
+void busyWait (uint64_t ns);
+
+/**
+ * @brief Busy wait until the condition holds or the timeout (ms, HAL tick) expires.
+ *
+ * @return false on timeout.
+ */
+bool waitFor (const std::function<bool ()> & condition, uint32_t timeout);
+
+/**
+ * @brief Returns the time of the next scheduled action or UINT64_MAX.
+ */
+uint64_t getNextEventTime ();
+
+void raiseIrq (IRQn_Type irqn);
+uint64_t nsForBits (uint32_t bits, uint32_t bitRate);
+
+/**
+ * @brief Idle CPU: jumps to the next scheduled action, finishes the run if there is none.
+ */
+void idle ();
+
+/************************************************************************
+ * Vector table (hal_sim_vectors.cpp), indexed by IRQn + 16
+ ************************************************************************/
+
+typedef void (*IrqHandler) ();
+static constexpr int VECTOR_COUNT = 98;
+extern const IrqHandler VECTOR_TABLE[VECTOR_COUNT];
+
+/************************************************************************
+ * Trace (hal_sim_core.cpp)
+ ************************************************************************/
+
+void trace (const char * bus, const char * format, ...) __attribute__((format(printf, 2, 3)));
+std::string formatBytes (const uint8_t * data, size_t n);
+void writeConsole (const uint8_t * data, size_t n);
+
+/************************************************************************
+ * GPIO (hal_sim_gpio.cpp)
+ ************************************************************************/
+
+void syncGpio ();
+bool parsePin (const std::string & name, GPIO_TypeDef *& port, uint16_t & pin);
+std::string getPinName (GPIO_TypeDef * port, uint16_t pin);
+
+/************************************************************************
+ * DMA (hal_sim_dma.cpp)
+ ************************************************************************/
+
+/**
+ * @brief Runs a DMA transfer of the given duration. For a circular stream, onData is
+ *        called with false at the half and with true at the end of every period, for a
+ *        normal stream once with true. The stream interrupt is raised after onData.
+ */
+void startDma (DMA_HandleTypeDef * hdma, uint64_t duration, std::function<void (bool full)> onData);
+
+/**
+ * @brief Raises the error interrupt of a stream.
+ */
+void failDma (DMA_HandleTypeDef * hdma);
+
+void stopDma (DMA_HandleTypeDef * hdma);
+
+/************************************************************************
+ * Bus models (hal_sim_serial.cpp, hal_sim_sd.cpp)
+ ************************************************************************/
+
+void onChipSelect (GPIO_TypeDef * port, uint16_t pin, bool level);
+void syncSdio ();
+
+/************************************************************************
+ * Timers (hal_sim_tim.cpp)
+ ************************************************************************/
+
+/**
+ * @brief Updates the counter registers of the running timers and takes the counter and
+ *        auto-reload values written by the firmware.
+ */
+void syncTimers ();
+
+} // end of namespace HalSim
+
+#endif
+#endif
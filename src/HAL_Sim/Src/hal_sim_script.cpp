@@ -0,0 +1,287 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#ifdef HAL_SIMULATION
+
+#include "hal_sim_internal.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+using namespace HalSim;
+
+namespace
+{
+
+/**
+ * @brief The devices created by the script, destroyed (and saved) at the exit.
+ */
+std::vector<std::unique_ptr<SpiDevice>> & getSpiDevices ()
+{
+    static std::vector<std::unique_ptr<SpiDevice>> devices;
+    return devices;
+}
+
+std::vector<std::unique_ptr<I2cDevice>> & getI2cDevices ()
+{
+    static std::vector<std::unique_ptr<I2cDevice>> devices;
+    return devices;
+}
+
+/**
+ * @brief Splits a command into words. A word in double quotes may contain spaces and
+ *        the escapes \r, \n, \t, \\, \" and \xNN.
+ */
+bool splitWords (const std::string & command, std::vector<std::string> & words)
+{
+    size_t i = 0;
+    while (i < command.size())
+    {
+        if (::isspace((unsigned char) command[i]))
+        {
+            ++i;
+            continue;
+        }
+        if (command[i] == '#')
+        {
+            break;
+        }
+        std::string word;
+        if (command[i] != '"')
+        {
+            while (i < command.size() && !::isspace((unsigned char) command[i]))
+            {
+                word += command[i++];
+            }
+            words.push_back(word);
+            continue;
+        }
+        for (++i; i < command.size() && command[i] != '"'; ++i)
+        {
+            if (command[i] != '\\' || i + 1 >= command.size())
+            {
+                word += command[i];
+                continue;
+            }
+            switch (command[++i])
+            {
+            case 'r':
+                word += '\r';
+                break;
+            case 'n':
+                word += '\n';
+                break;
+            case 't':
+                word += '\t';
+                break;
+            case 'x':
+                word += (char) ::strtoul(command.substr(i + 1, 2).c_str(), NULL, 16);
+                i += 2;
+                break;
+            default:
+                word += command[i];
+                break;
+            }
+        }
+        if (i >= command.size())
+        {
+            return false;
+        }
+        ++i;
+        words.push_back(word);
+    }
+    return true;
+}
+
+bool parseNumber (const std::string & word, long & value)
+{
+    char * end = NULL;
+    value = ::strtol(word.c_str(), &end, 0);
+    return !word.empty() && *end == 0;
+}
+
+template<typename T> T * findInstance (const std::string & name)
+{
+    const Peripheral * p = findPeripheral(name);
+    return p == NULL ? NULL : (T *) p->base;
+}
+
+} // end of anonymous namespace
+
+/************************************************************************
+ * Script
+ ************************************************************************/
+
+bool HalSim::executeCommand (const std::string & command)
+{
+    std::vector<std::string> w;
+    if (!splitWords(command, w))
+    {
+        return false;
+    }
+    if (w.empty())
+    {
+        return true;
+    }
+    trace("SCRIPT", "%s", command.c_str());
+    const std::string & name = w[0];
+    long a = 0, b = 0;
+    GPIO_TypeDef * port = NULL;
+    uint16_t pin = 0;
+
+    if (name == "eeprom" && (w.size() == 4 || w.size() == 5) && findInstance<SPI_TypeDef>(w[1]) != NULL
+        && parsePin(w[2], port, pin) && parseNumber(w[3], a) && a > 0)
+    {
+        getSpiDevices().emplace_back(new SpiEepRom((uint32_t) a, w.size() == 5 ? w[4].c_str() : NULL));
+        attachSpiDevice(findInstance<SPI_TypeDef>(w[1]), port, pin, getSpiDevices().back().get());
+        return true;
+    }
+    if (name == "i2c" && w.size() == 4 && findInstance<I2C_TypeDef>(w[1]) != NULL && parseNumber(w[2], a)
+        && parseNumber(w[3], b) && b > 0)
+    {
+        getI2cDevices().emplace_back(new I2cRegisterFile((uint32_t) b));
+        attachI2cDevice(findInstance<I2C_TypeDef>(w[1]), (uint16_t) a, getI2cDevices().back().get());
+        return true;
+    }
+    if (name == "sdcard" && w.size() == 2)
+    {
+        if (w[1] == "none")
+        {
+            removeSdCard();
+            return true;
+        }
+        return insertSdCard(w[1].c_str());
+    }
+    if (name == "sdfault" && w.size() == 2 && parseNumber(w[1], a) && a >= 0)
+    {
+        injectSdErrors((uint32_t) a);
+        return true;
+    }
+    if (name == "irqdrop" && w.size() == 3 && parseNumber(w[2], b) && b >= 0)
+    {
+        // The interrupt is given by the name of a peripheral or by its number
+        const Peripheral * p = findPeripheral(w[1]);
+        if (p == NULL && !parseNumber(w[1], a))
+        {
+            return false;
+        }
+        dropIrqs(p != NULL ? p->irqn : (IRQn_Type) a, (uint32_t) b);
+        return true;
+    }
+    if (name == "i2s" && w.size() == 3 && findInstance<SPI_TypeDef>(w[1]) != NULL)
+    {
+        return recordI2s(findInstance<SPI_TypeDef>(w[1]), w[2].c_str());
+    }
+    if (name == "console" && w.size() == 2 && (w[1] == "on" || w[1] == "off"))
+    {
+        setConsole(w[1] == "on");
+        return true;
+    }
+    if (name == "pin" && w.size() == 3 && parsePin(w[1], port, pin) && parseNumber(w[2], a))
+    {
+        setPin(port, pin, a != 0);
+        return true;
+    }
+    if (name == "pulse" && w.size() == 4 && parsePin(w[1], port, pin) && parseNumber(w[2], a)
+        && parseNumber(w[3], b) && b >= 0)
+    {
+        const bool previous = getPin(port, pin);
+        setPin(port, pin, a != 0);
+        schedule(getTime() + (uint64_t) b * 1000000, [port, pin, previous] ()
+        {
+            setPin(port, pin, previous);
+        });
+        return true;
+    }
+    if (name == "encoder" && w.size() == 3 && findInstance<TIM_TypeDef>(w[1]) != NULL && parseNumber(w[2], a))
+    {
+        moveEncoder(findInstance<TIM_TypeDef>(w[1]), (int32_t) a);
+        return true;
+    }
+    if (name == "uart" && w.size() == 3 && findInstance<USART_TypeDef>(w[1]) != NULL)
+    {
+        receiveUart(findInstance<USART_TypeDef>(w[1]), w[2]);
+        return true;
+    }
+    if (name == "adc" && w.size() == 4 && findInstance<ADC_TypeDef>(w[1]) != NULL && parseNumber(w[2], a)
+        && parseNumber(w[3], b))
+    {
+        setAnalogInput(findInstance<ADC_TypeDef>(w[1]), (uint32_t) a, (uint16_t) b);
+        return true;
+    }
+    if (name == "end" && w.size() <= 2)
+    {
+        finish(w.size() == 2 ? ::atoi(w[1].c_str()) : 0);
+    }
+    return false;
+}
+
+bool HalSim::loadScript (const char * fileName)
+{
+    FILE * f = ::fopen(fileName, "r");
+    if (f == NULL)
+    {
+        return false;
+    }
+    char line[1024];
+    uint32_t lineNumber = 0;
+    bool valid = true;
+    while (::fgets(line, sizeof(line), f) != NULL)
+    {
+        ++lineNumber;
+        char * command = NULL;
+        const double ms = ::strtod(line, &command);
+        if (command == line)
+        {
+            // Only an empty line or a comment may come without the time
+            const char * s = line + ::strspn(line, " \t\r\n");
+            if (*s != 0 && *s != '#')
+            {
+                ::fprintf(stderr, "HAL_Sim: %s:%u: the time is missing\n", fileName, lineNumber);
+                valid = false;
+            }
+            continue;
+        }
+        std::string text = command;
+        text.erase(text.find_last_not_of(" \t\r\n") + 1);
+        text.erase(0, text.find_first_not_of(" \t"));
+        const uint64_t time = (uint64_t) (ms * 1000000.0);
+        auto action = [text, fileName = std::string(fileName), lineNumber] ()
+        {
+            if (!executeCommand(text))
+            {
+                ::fprintf(stderr, "HAL_Sim: %s:%u: invalid command:%s\n", fileName.c_str(), lineNumber, text.c_str());
+                finish(1);
+            }
+        };
+        if (time <= getTime())
+        {
+            action();
+        }
+        else
+        {
+            schedule(time, action);
+        }
+    }
+    ::fclose(f);
+    return valid;
+}
+
+#endif
@@ -0,0 +1,553 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#ifdef HAL_SIMULATION
+
+#include "hal_sim_internal.h"
+
+#include <cstring>
+
+using namespace HalSim;
+
+namespace
+{
+
+constexpr uint32_t BLOCK_SIZE = 512;
+
+// Time from a read command to the first data block; the SDHC limit is 100 ms, a usual card
+// needs a few hundred microseconds
+constexpr uint64_t READ_ACCESS_TIME = 200000;
+constexpr uint32_t STATIC_FLAGS = SDIO_FLAG_CCRCFAIL | SDIO_FLAG_DCRCFAIL | SDIO_FLAG_CTIMEOUT | SDIO_FLAG_DTIMEOUT
+                                  | SDIO_FLAG_TXUNDERR | SDIO_FLAG_RXOVERR | SDIO_FLAG_CMDREND | SDIO_FLAG_CMDSENT
+                                  | SDIO_FLAG_DATAEND | SDIO_FLAG_DBCKEND;
+constexpr uint32_t TRANSFER_IRQS = SDIO_IT_DCRCFAIL | SDIO_IT_DTIMEOUT | SDIO_IT_DATAEND | SDIO_IT_RXOVERR
+                                   | SDIO_IT_TXUNDERR | SDIO_IT_STBITERR;
+
+/**
+ * @brief SDHC card backed by an image file.
+ */
+struct SdCard
+{
+    FILE * image = NULL;
+    std::string fileName;
+    uint64_t capacity = 0;
+    uint32_t serial = 0;
+    uint32_t faults = 0;
+    uint32_t insertions = 0; // identifies the card of a pending transfer
+};
+
+/**
+ * @brief SDIO_STA is read-only for the firmware, the card model changes it behind the scenes.
+ */
+inline volatile uint32_t & getStatusRegister (SD_HandleTypeDef * hsd)
+{
+    return *(volatile uint32_t *) &hsd->Instance->STA;
+}
+
+SdCard & getCard ()
+{
+    static SdCard card;
+    return card;
+}
+
+/**
+ * @brief SDIOCLK is the 48 MHz output of the main PLL (VCO / PLLQ).
+ */
+uint32_t getAdapterClock ()
+{
+    const uint32_t pllm = RCC->PLLCFGR & RCC_PLLCFGR_PLLM;
+    const uint32_t plln = (RCC->PLLCFGR & RCC_PLLCFGR_PLLN) >> RCC_PLLCFGR_PLLN_Pos;
+    const uint32_t pllq = (RCC->PLLCFGR & RCC_PLLCFGR_PLLQ) >> RCC_PLLCFGR_PLLQ_Pos;
+    const uint64_t input = (RCC->PLLCFGR & RCC_PLLCFGR_PLLSRC_HSE) ? HSE_VALUE : HSI_VALUE;
+    return (pllm == 0 || pllq == 0) ? 48000000U : (uint32_t) (input * plln / pllm / pllq);
+}
+
+/**
+ * @brief Duration of a block transfer with the current bus width and clock divider: the
+ *        command and its response, then every block with its CRC and the end bit.
+ */
+uint64_t getTransferTime (const SD_HandleTypeDef * hsd, uint32_t blocks)
+{
+    const uint32_t width = (hsd->Instance->CLKCR & SDIO_CLKCR_WIDBUS_0) ? 4 : 1;
+    const uint32_t clock = getAdapterClock() / ((hsd->Instance->CLKCR & SDIO_CLKCR_CLKDIV) + 2);
+    return nsForBits(2 * 48 + blocks * (BLOCK_SIZE * 8 / width + 16 + 2), clock);
+}
+
+/**
+ * @brief Duration of a data transfer: a read waits for the access time of the card first,
+ *        so a multi-block read pays it once for all blocks.
+ */
+inline uint64_t getDataTime (const SD_HandleTypeDef * hsd, bool write, uint32_t blocks)
+{
+    return (write ? 0 : READ_ACCESS_TIME) + getTransferTime(hsd, blocks);
+}
+
+inline uint64_t getCommandTime (const SD_HandleTypeDef * hsd)
+{
+    return getTransferTime(hsd, 0);
+}
+
+HAL_SD_ErrorTypedef checkAccess (SD_HandleTypeDef * hsd, uint64_t address, uint32_t blocks)
+{
+    const SdCard & card = getCard();
+    if (card.image == NULL)
+    {
+        return SD_CMD_RSP_TIMEOUT;
+    }
+    if (address % BLOCK_SIZE != 0 || address + (uint64_t) blocks * BLOCK_SIZE > card.capacity)
+    {
+        return SD_ADDR_OUT_OF_RANGE;
+    }
+    return SD_OK;
+}
+
+/**
+ * @brief Reads or writes the image; returns false if a fault is injected for this transfer.
+ */
+bool accessImage (bool write, uint32_t * data, uint64_t address, uint32_t blocks)
+{
+    SdCard & card = getCard();
+    trace("SDIO", "%s %llu +%lu%s", write ? "W" : "R", (unsigned long long) (address / BLOCK_SIZE),
+          (unsigned long) blocks, card.faults > 0 ? " CRC" : "");
+    if (card.faults > 0)
+    {
+        --card.faults;
+        return false;
+    }
+    ::fseek(card.image, (long) address, SEEK_SET);
+    if (write)
+    {
+        ::fwrite(data, BLOCK_SIZE, blocks, card.image);
+        ::fflush(card.image);
+    }
+    else if (::fread(data, BLOCK_SIZE, blocks, card.image) != blocks)
+    {
+        ::memset(data, 0, blocks * BLOCK_SIZE);
+    }
+    return true;
+}
+
+void fillCardInfo (SD_HandleTypeDef * hsd, HAL_SD_CardInfoTypedef * pCardInfo)
+{
+    const SdCard & card = getCard();
+    ::memset(pCardInfo, 0, sizeof(HAL_SD_CardInfoTypedef));
+    pCardInfo->SD_csd.CSDStruct = 1;
+    pCardInfo->SD_csd.CardComdClasses = 0x5B5;
+    pCardInfo->SD_csd.RdBlockLen = 9;
+    pCardInfo->SD_csd.DeviceSize = (uint32_t) (card.capacity / BLOCK_SIZE / 1024) - 1;
+    pCardInfo->SD_csd.MaxWrBlockLen = 9;
+    pCardInfo->SD_cid.ManufacturerID = 0x03;
+    pCardInfo->SD_cid.OEM_AppliID = 0x5344;
+    pCardInfo->SD_cid.ProdName1 = 0x53494D53; // "SIMSD"
+    pCardInfo->SD_cid.ProdName2 = 0x44;
+    pCardInfo->SD_cid.ProdSN = card.serial;
+    pCardInfo->CardCapacity = card.capacity;
+    pCardInfo->CardBlockSize = BLOCK_SIZE;
+    pCardInfo->RCA = hsd->RCA;
+    pCardInfo->CardType = hsd->CardType;
+}
+
+SD_HandleTypeDef * findSd (DMA_HandleTypeDef * hdma)
+{
+    return (SD_HandleTypeDef *) hdma->Parent;
+}
+
+void sdDmaRxCplt (DMA_HandleTypeDef * hdma)
+{
+    SD_HandleTypeDef * hsd = findSd(hdma);
+    hsd->DmaTransferCplt = 1U;
+    waitFor([hsd] () { return hsd->SdTransferCplt != 0U; }, HAL_MAX_DELAY);
+    HAL_DMA_Abort(hdma);
+    HAL_SD_DMA_RxCpltCallback(hsd->hdmarx);
+}
+
+void sdDmaRxError (DMA_HandleTypeDef * hdma)
+{
+    HAL_SD_DMA_RxErrorCallback(findSd(hdma)->hdmarx);
+}
+
+void sdDmaTxCplt (DMA_HandleTypeDef * hdma)
+{
+    SD_HandleTypeDef * hsd = findSd(hdma);
+    hsd->DmaTransferCplt = 1U;
+    waitFor([hsd] () { return hsd->SdTransferCplt != 0U; }, HAL_MAX_DELAY);
+    HAL_DMA_Abort(hdma);
+    HAL_SD_DMA_TxCpltCallback(hsd->hdmatx);
+}
+
+void sdDmaTxError (DMA_HandleTypeDef * hdma)
+{
+    HAL_SD_DMA_TxErrorCallback(findSd(hdma)->hdmatx);
+}
+
+/**
+ * @brief Starts a DMA block transfer. The data path ends with DATAEND (or DCRCFAIL for an
+ *        injected fault) at the SDIO interrupt, the DMA stream completes right after it.
+ */
+HAL_SD_ErrorTypedef startTransfer (SD_HandleTypeDef * hsd, bool write, uint32_t * pData, uint64_t address,
+                                   uint32_t blocks)
+{
+    const HAL_SD_ErrorTypedef status = checkAccess(hsd, address, blocks);
+    if (status != SD_OK)
+    {
+        return status;
+    }
+    DMA_HandleTypeDef * hdma = write ? hsd->hdmatx : hsd->hdmarx;
+    hsd->SdTransferCplt = 0U;
+    hsd->DmaTransferCplt = 0U;
+    hsd->SdTransferErr = SD_OK;
+    if (write)
+    {
+        hsd->SdOperation = blocks > 1 ? SD_WRITE_MULTIPLE_BLOCK : SD_WRITE_SINGLE_BLOCK;
+        hdma->XferCpltCallback = sdDmaTxCplt;
+        hdma->XferErrorCallback = sdDmaTxError;
+    }
+    else
+    {
+        hsd->SdOperation = blocks > 1 ? SD_READ_MULTIPLE_BLOCK : SD_READ_SINGLE_BLOCK;
+        hdma->XferCpltCallback = sdDmaRxCplt;
+        hdma->XferErrorCallback = sdDmaRxError;
+    }
+    hdma->XferHalfCpltCallback = NULL;
+    hsd->Instance->MASK |= TRANSFER_IRQS;
+    hsd->Instance->DCTRL |= SDIO_DCTRL_DMAEN;
+
+    const uint64_t duration = getDataTime(hsd, write, blocks);
+    startDma(hdma, duration + 1, [] (bool) { });
+    const uint32_t insertion = getCard().insertions;
+    schedule(getTime() + duration, [hsd, hdma, write, pData, address, blocks, insertion] ()
+    {
+        const SdCard & card = getCard();
+        if (card.image == NULL || card.insertions != insertion)
+        {
+            // The card was pulled meanwhile: no data arrive until the data timeout, which
+            // is signalled at the end of the transfer for simplicity
+            getStatusRegister(hsd) |= SDIO_STA_DTIMEOUT;
+            stopDma(hdma);
+        }
+        else if (accessImage(write, pData, address, blocks))
+        {
+            getStatusRegister(hsd) |= SDIO_STA_DATAEND;
+        }
+        else
+        {
+            // The stream waits for data that never come
+            getStatusRegister(hsd) |= SDIO_STA_DCRCFAIL;
+            stopDma(hdma);
+        }
+        if (hsd->Instance->MASK & TRANSFER_IRQS)
+        {
+            raiseIrq(SDIO_IRQn);
+        }
+    }, &getCard());
+    return SD_OK;
+}
+
+HAL_SD_ErrorTypedef transferBlocking (SD_HandleTypeDef * hsd, bool write, uint32_t * pData, uint64_t address,
+                                      uint32_t blocks)
+{
+    const HAL_SD_ErrorTypedef status = checkAccess(hsd, address, blocks);
+    if (status != SD_OK)
+    {
+        return status;
+    }
+    busyWait(getDataTime(hsd, write, blocks));
+    return accessImage(write, pData, address, blocks) ? SD_OK : SD_DATA_CRC_FAIL;
+}
+
+} // end of anonymous namespace
+
+/************************************************************************
+ * Simulation interface
+ ************************************************************************/
+
+bool HalSim::insertSdCard (const char * fileName)
+{
+    removeSdCard();
+    SdCard & card = getCard();
+    card.image = ::fopen(fileName, "r+b");
+    if (card.image == NULL)
+    {
+        return false;
+    }
+    ::fseek(card.image, 0, SEEK_END);
+    card.capacity = (uint64_t) ::ftell(card.image) / BLOCK_SIZE * BLOCK_SIZE;
+    card.fileName = fileName;
+    ++card.insertions;
+    // The serial number is derived from the name, so a card keeps it between the runs
+    card.serial = 2166136261U;
+    for (char c : card.fileName)
+    {
+        card.serial = (card.serial ^ (uint8_t) c) * 16777619U;
+    }
+    trace("SDIO", "insert %s (%llu bytes)", fileName, (unsigned long long) card.capacity);
+    return true;
+}
+
+void HalSim::removeSdCard ()
+{
+    SdCard & card = getCard();
+    if (card.image != NULL)
+    {
+        // A pending transfer ends with a data timeout
+        ::fclose(card.image);
+        card.image = NULL;
+        trace("SDIO", "remove %s", card.fileName.c_str());
+    }
+}
+
+void HalSim::injectSdErrors (uint32_t count)
+{
+    getCard().faults = count;
+}
+
+void HalSim::syncSdio ()
+{
+    // SDIO_ICR is write-one-to-clear for the static flags of SDIO_STA
+    if (SDIO->ICR != 0)
+    {
+        *(volatile uint32_t *) &SDIO->STA &= ~SDIO->ICR;
+        SDIO->ICR = 0;
+    }
+}
+
+/************************************************************************
+ * HAL: SD
+ ************************************************************************/
+
+HAL_SD_ErrorTypedef HAL_SD_Init (SD_HandleTypeDef * hsd, HAL_SD_CardInfoTypedef * SDCardInfo)
+{
+    halCall();
+    HAL_SD_MspInit(hsd);
+    hsd->Instance->CLKCR = hsd->Init.ClockEdge | hsd->Init.ClockBypass | hsd->Init.ClockPowerSave
+                           | hsd->Init.BusWide | hsd->Init.HardwareFlowControl | SDIO_CLKCR_CLKEN;
+    hsd->Instance->POWER = SDIO_POWER_PWRCTRL;
+
+    // Card identification at 400 kHz: 74 clocks and about 20 commands with response
+    busyWait(nsForBits(74 + 20 * 2 * 48, 400000));
+    if (getCard().image == NULL)
+    {
+        trace("SDIO", "init: no card");
+        return SD_CMD_RSP_TIMEOUT;
+    }
+    hsd->CardType = HIGH_CAPACITY_SD_CARD;
+    hsd->RCA = 1;
+    fillCardInfo(hsd, SDCardInfo);
+    MODIFY_REG(hsd->Instance->CLKCR, SDIO_CLKCR_CLKDIV, hsd->Init.ClockDiv);
+    trace("SDIO", "init: card %08lX, clock divider %lu", (unsigned long) getCard().serial,
+          (unsigned long) hsd->Init.ClockDiv);
+    return SD_OK;
+}
+
+HAL_StatusTypeDef HAL_SD_DeInit (SD_HandleTypeDef * hsd)
+{
+    halCall();
+    hsd->Instance->POWER = 0;
+    hsd->Instance->CLKCR = 0;
+    HAL_SD_MspDeInit(hsd);
+    return HAL_OK;
+}
+
+HAL_SD_ErrorTypedef HAL_SD_Get_CardInfo (SD_HandleTypeDef * hsd, HAL_SD_CardInfoTypedef * pCardInfo)
+{
+    halCall();
+    if (getCard().image == NULL)
+    {
+        return SD_CMD_RSP_TIMEOUT;
+    }
+    fillCardInfo(hsd, pCardInfo);
+    return SD_OK;
+}
+
+HAL_SD_ErrorTypedef HAL_SD_WideBusOperation_Config (SD_HandleTypeDef * hsd, uint32_t WideMode)
+{
+    halCall();
+    if (getCard().image == NULL)
+    {
+        return SD_CMD_RSP_TIMEOUT;
+    }
+    busyWait(2 * getCommandTime(hsd));
+    hsd->Init.BusWide = WideMode;
+    MODIFY_REG(hsd->Instance->CLKCR, SDIO_CLKCR_WIDBUS, WideMode);
+    return SD_OK;
+}
+
+HAL_SD_ErrorTypedef HAL_SD_GetCardStatus (SD_HandleTypeDef * hsd, HAL_SD_CardStatusTypedef * pCardStatus)
+{
+    halCall();
+    if (getCard().image == NULL)
+    {
+        return SD_CMD_RSP_TIMEOUT;
+    }
+    busyWait(getTransferTime(hsd, 0) + nsForBits(512, 400000));
+    ::memset(pCardStatus, 0, sizeof(HAL_SD_CardStatusTypedef));
+    pCardStatus->DAT_BUS_WIDTH = (hsd->Init.BusWide == SDIO_BUS_WIDE_4B) ? 2 : 0;
+    pCardStatus->SPEED_CLASS = 2; // class 4
+    pCardStatus->AU_SIZE = 9; // 4 MB
+    return SD_OK;
+}
+
+HAL_SD_TransferStateTypedef HAL_SD_GetStatus (SD_HandleTypeDef * hsd)
+{
+    halCall();
+    return getCard().image != NULL ? SD_TRANSFER_OK : SD_TRANSFER_ERROR;
+}
+
+HAL_SD_ErrorTypedef HAL_SD_ReadBlocks (SD_HandleTypeDef * hsd, uint32_t * pReadBuffer, uint64_t ReadAddr,
+                                       uint32_t BlockSize, uint32_t NumberOfBlocks)
+{
+    halCall();
+    return transferBlocking(hsd, false, pReadBuffer, ReadAddr, NumberOfBlocks);
+}
+
+HAL_SD_ErrorTypedef HAL_SD_WriteBlocks (SD_HandleTypeDef * hsd, uint32_t * pWriteBuffer, uint64_t WriteAddr,
+                                        uint32_t BlockSize, uint32_t NumberOfBlocks)
+{
+    halCall();
+    return transferBlocking(hsd, true, pWriteBuffer, WriteAddr, NumberOfBlocks);
+}
+
+HAL_SD_ErrorTypedef HAL_SD_ReadBlocks_DMA (SD_HandleTypeDef * hsd, uint32_t * pReadBuffer, uint64_t ReadAddr,
+                                           uint32_t BlockSize, uint32_t NumberOfBlocks)
+{
+    halCall();
+    return startTransfer(hsd, false, pReadBuffer, ReadAddr, NumberOfBlocks);
+}
+
+HAL_SD_ErrorTypedef HAL_SD_WriteBlocks_DMA (SD_HandleTypeDef * hsd, uint32_t * pWriteBuffer, uint64_t WriteAddr,
+                                            uint32_t BlockSize, uint32_t NumberOfBlocks)
+{
+    halCall();
+    return startTransfer(hsd, true, pWriteBuffer, WriteAddr, NumberOfBlocks);
+}
+
+HAL_SD_ErrorTypedef HAL_SD_CheckReadOperation (SD_HandleTypeDef * hsd, uint32_t Timeout)
+{
+    halCall();
+    waitFor([hsd] () { return (hsd->DmaTransferCplt != 0U && hsd->SdTransferCplt != 0U)
+                              || hsd->SdTransferErr != SD_OK; }, Timeout);
+    HAL_SD_ErrorTypedef status = SD_OK;
+    if (hsd->SdOperation == SD_READ_MULTIPLE_BLOCK)
+    {
+        status = HAL_SD_StopTransfer(hsd);
+    }
+    hsd->Instance->ICR = STATIC_FLAGS;
+    syncSdio();
+    return hsd->SdTransferErr != SD_OK ? (HAL_SD_ErrorTypedef) hsd->SdTransferErr : status;
+}
+
+HAL_SD_ErrorTypedef HAL_SD_CheckWriteOperation (SD_HandleTypeDef * hsd, uint32_t Timeout)
+{
+    halCall();
+    // Like the HAL, the wait ends with the first of both completion flags; the timeout is a
+    // loop counter there and is taken as a number of CPU cycles here
+    const uint64_t deadline = getTime() + nsForBits(Timeout, HAL_RCC_GetHCLKFreq());
+    while (hsd->DmaTransferCplt == 0U && hsd->SdTransferCplt == 0U && hsd->SdTransferErr == SD_OK
+           && getTime() < deadline)
+    {
+        busyWait(std::min(getNextEventTime(), deadline) - getTime());
+    }
+    HAL_SD_ErrorTypedef status = SD_OK;
+    if (hsd->SdOperation == SD_WRITE_MULTIPLE_BLOCK)
+    {
+        status = HAL_SD_StopTransfer(hsd);
+    }
+    if (getTime() >= deadline && status == SD_OK)
+    {
+        status = SD_DATA_TIMEOUT;
+    }
+    hsd->Instance->ICR = STATIC_FLAGS;
+    syncSdio();
+    return hsd->SdTransferErr != SD_OK ? (HAL_SD_ErrorTypedef) hsd->SdTransferErr : status;
+}
+
+HAL_SD_ErrorTypedef HAL_SD_StopTransfer (SD_HandleTypeDef * hsd)
+{
+    halCall();
+    busyWait(getCommandTime(hsd));
+    return getCard().image != NULL ? SD_OK : SD_CMD_RSP_TIMEOUT;
+}
+
+void HAL_SD_IRQHandler (SD_HandleTypeDef * hsd)
+{
+    halCall();
+    const uint32_t sta = hsd->Instance->STA;
+    if (sta & SDIO_IT_DATAEND)
+    {
+        getStatusRegister(hsd) &= ~SDIO_STA_DATAEND;
+        hsd->SdTransferCplt = 1U;
+        hsd->SdTransferErr = SD_OK;
+        HAL_SD_XferCpltCallback(hsd);
+    }
+    else if (sta & SDIO_IT_DCRCFAIL)
+    {
+        getStatusRegister(hsd) &= ~SDIO_STA_DCRCFAIL;
+        hsd->SdTransferErr = SD_DATA_CRC_FAIL;
+        HAL_SD_XferErrorCallback(hsd);
+    }
+    else if (sta & SDIO_IT_DTIMEOUT)
+    {
+        getStatusRegister(hsd) &= ~SDIO_STA_DTIMEOUT;
+        hsd->SdTransferErr = SD_DATA_TIMEOUT;
+        HAL_SD_XferErrorCallback(hsd);
+    }
+    hsd->Instance->MASK &= ~(TRANSFER_IRQS | SDIO_IT_TXFIFOHE | SDIO_IT_RXFIFOHF);
+}
+
+__weak void HAL_SD_MspInit (SD_HandleTypeDef * hsd)
+{
+    // empty
+}
+
+__weak void HAL_SD_MspDeInit (SD_HandleTypeDef * hsd)
+{
+    // empty
+}
+
+__weak void HAL_SD_XferCpltCallback (SD_HandleTypeDef * hsd)
+{
+    // empty
+}
+
+__weak void HAL_SD_XferErrorCallback (SD_HandleTypeDef * hsd)
+{
+    // empty
+}
+
+__weak void HAL_SD_DMA_RxCpltCallback (DMA_HandleTypeDef * hdma)
+{
+    // empty
+}
+
+__weak void HAL_SD_DMA_RxErrorCallback (DMA_HandleTypeDef * hdma)
+{
+    // empty
+}
+
+__weak void HAL_SD_DMA_TxCpltCallback (DMA_HandleTypeDef * hdma)
+{
+    // empty
+}
+
+__weak void HAL_SD_DMA_TxErrorCallback (DMA_HandleTypeDef * hdma)
+{
+    // empty
+}
+
+#endif
@@ -0,0 +1,1173 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#ifdef HAL_SIMULATION
+
+#include "hal_sim_internal.h"
+
+#include <deque>
+
+using namespace HalSim;
+
+/************************************************************************
+ * UART
+ ************************************************************************/
+
+namespace
+{
+
+/**
+ * @brief Received characters and the pending interrupt events of an UART. The received
+ *        characters are buffered until the firmware reads them, overruns are not simulated.
+ */
+struct UartState
+{
+    UART_HandleTypeDef * handle = NULL;
+    std::deque<uint8_t> received;
+    uint64_t lastArrival = 0;
+    bool txEnd = false;
+    uint32_t rxDmaCount = 0;
+    std::vector<uint8_t> txFetched;
+};
+
+std::map<const USART_TypeDef *, UartState> & getUarts ()
+{
+    static std::map<const USART_TypeDef *, UartState> uarts;
+    return uarts;
+}
+
+uint64_t getFrameTime (const UART_HandleTypeDef * huart)
+{
+    const uint32_t bits = 1 + (huart->Init.WordLength == UART_WORDLENGTH_9B ? 9 : 8)
+                          + (huart->Init.StopBits == UART_STOPBITS_2 ? 2 : 1);
+    return nsForBits(bits, huart->Init.BaudRate);
+}
+
+std::string escapeText (const uint8_t * data, size_t n)
+{
+    std::string s;
+    char hex[8];
+    for (size_t i = 0; i < n; ++i)
+    {
+        switch (data[i])
+        {
+        case '\r':
+            s += "\\r";
+            break;
+        case '\n':
+            s += "\\n";
+            break;
+        default:
+            if (data[i] >= 0x20 && data[i] < 0x7F)
+            {
+                s += (char) data[i];
+            }
+            else
+            {
+                ::snprintf(hex, sizeof(hex), "\\x%02X", data[i]);
+                s += hex;
+            }
+        }
+    }
+    return s;
+}
+
+void outputUart (UART_HandleTypeDef * huart, const uint8_t * data, size_t n)
+{
+    trace(getName(huart->Instance), "TX \"%s\"", escapeText(data, n).c_str());
+    writeConsole(data, n);
+}
+
+UART_HandleTypeDef * findUart (DMA_HandleTypeDef * hdma)
+{
+    return (UART_HandleTypeDef *) hdma->Parent;
+}
+
+void uartDmaTransmitCplt (DMA_HandleTypeDef * hdma)
+{
+    UART_HandleTypeDef * huart = findUart(hdma);
+    huart->TxXferCount = 0;
+    if (hdma->Init.Mode == DMA_CIRCULAR)
+    {
+        HAL_UART_TxCpltCallback(huart);
+        return;
+    }
+    // The transmission ends with the transfer complete interrupt of the UART
+    getUarts()[huart->Instance].txEnd = true;
+    raiseIrq(findPeripheral(huart->Instance)->irqn);
+}
+
+void uartDmaTxHalfCplt (DMA_HandleTypeDef * hdma)
+{
+    HAL_UART_TxHalfCpltCallback(findUart(hdma));
+}
+
+void uartDmaReceiveCplt (DMA_HandleTypeDef * hdma)
+{
+    UART_HandleTypeDef * huart = findUart(hdma);
+    huart->RxXferCount = 0;
+    if (hdma->Init.Mode != DMA_CIRCULAR)
+    {
+        huart->RxState = HAL_UART_STATE_READY;
+    }
+    HAL_UART_RxCpltCallback(huart);
+}
+
+void uartDmaRxHalfCplt (DMA_HandleTypeDef * hdma)
+{
+    HAL_UART_RxHalfCpltCallback(findUart(hdma));
+}
+
+void uartDmaError (DMA_HandleTypeDef * hdma)
+{
+    UART_HandleTypeDef * huart = findUart(hdma);
+    huart->gState = HAL_UART_STATE_READY;
+    huart->RxState = HAL_UART_STATE_READY;
+    huart->ErrorCode |= HAL_UART_ERROR_DMA;
+    HAL_UART_ErrorCallback(huart);
+}
+
+/**
+ * @brief Hands the buffered characters to a running interrupt or DMA reception.
+ */
+void deliverUart (UartState & s)
+{
+    UART_HandleTypeDef * huart = s.handle;
+    if (huart == NULL || huart->RxState != HAL_UART_STATE_BUSY_RX || s.received.empty())
+    {
+        return;
+    }
+    if (huart->hdmarx != NULL && (huart->Instance->CR3 & USART_CR3_DMAR))
+    {
+        while (!s.received.empty() && s.rxDmaCount < huart->RxXferSize)
+        {
+            huart->pRxBuffPtr[s.rxDmaCount++] = s.received.front();
+            s.received.pop_front();
+        }
+        if (s.rxDmaCount == huart->RxXferSize)
+        {
+            s.rxDmaCount = 0;
+            if (huart->hdmarx->Init.Mode != DMA_CIRCULAR)
+            {
+                huart->Instance->CR3 &= ~USART_CR3_DMAR;
+            }
+            startDma(huart->hdmarx, 0, [] (bool) { });
+        }
+    }
+    else if (huart->Instance->CR1 & USART_CR1_RXNEIE)
+    {
+        raiseIrq(findPeripheral(huart->Instance)->irqn);
+    }
+}
+
+} // end of anonymous namespace
+
+void HalSim::receiveUart (USART_TypeDef * usart, const std::string & data)
+{
+    UartState & s = getUarts()[usart];
+    const uint64_t frame = s.handle != NULL ? getFrameTime(s.handle) : nsForBits(10, 115200);
+    s.lastArrival = std::max(s.lastArrival, getTime());
+    trace(getName(usart), "RX \"%s\"", escapeText((const uint8_t *) data.data(), data.size()).c_str());
+    for (char c : data)
+    {
+        s.lastArrival += frame;
+        schedule(s.lastArrival, [usart, c] ()
+        {
+            UartState & s = getUarts()[usart];
+            s.received.push_back((uint8_t) c);
+            deliverUart(s);
+        }, &s);
+    }
+}
+
+HAL_StatusTypeDef HAL_UART_Init (UART_HandleTypeDef * huart)
+{
+    halCall();
+    if (huart == NULL)
+    {
+        return HAL_ERROR;
+    }
+    if (huart->gState == HAL_UART_STATE_RESET)
+    {
+        huart->Lock = HAL_UNLOCKED;
+        HAL_UART_MspInit(huart);
+    }
+    huart->Instance->BRR = getBusClock(huart->Instance) / std::max(huart->Init.BaudRate, (uint32_t) 1);
+    huart->Instance->CR1 |= USART_CR1_UE | huart->Init.Mode;
+    getUarts()[huart->Instance].handle = huart;
+    huart->ErrorCode = HAL_UART_ERROR_NONE;
+    huart->gState = HAL_UART_STATE_READY;
+    huart->RxState = HAL_UART_STATE_READY;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_DeInit (UART_HandleTypeDef * huart)
+{
+    halCall();
+    if (huart == NULL)
+    {
+        return HAL_ERROR;
+    }
+    UartState & s = getUarts()[huart->Instance];
+    cancel(&s);
+    cancel(&s.txFetched);
+    s.handle = NULL;
+    s.received.clear();
+    s.txEnd = false;
+    huart->Instance->CR1 = huart->Instance->CR3 = 0;
+    HAL_UART_MspDeInit(huart);
+    huart->ErrorCode = HAL_UART_ERROR_NONE;
+    huart->gState = HAL_UART_STATE_RESET;
+    huart->RxState = HAL_UART_STATE_RESET;
+    __HAL_UNLOCK(huart);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit (UART_HandleTypeDef * huart, uint8_t * pData, uint16_t Size, uint32_t Timeout)
+{
+    halCall();
+    if (huart->gState != HAL_UART_STATE_READY)
+    {
+        return HAL_BUSY;
+    }
+    if (pData == NULL || Size == 0)
+    {
+        return HAL_ERROR;
+    }
+    huart->gState = HAL_UART_STATE_BUSY_TX;
+    busyWait(Size * getFrameTime(huart));
+    outputUart(huart, pData, Size);
+    huart->gState = HAL_UART_STATE_READY;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit_IT (UART_HandleTypeDef * huart, uint8_t * pData, uint16_t Size)
+{
+    halCall();
+    if (huart->gState != HAL_UART_STATE_READY)
+    {
+        return HAL_BUSY;
+    }
+    if (pData == NULL || Size == 0)
+    {
+        return HAL_ERROR;
+    }
+    huart->pTxBuffPtr = pData;
+    huart->TxXferSize = huart->TxXferCount = Size;
+    huart->ErrorCode = HAL_UART_ERROR_NONE;
+    huart->gState = HAL_UART_STATE_BUSY_TX;
+    UartState & s = getUarts()[huart->Instance];
+    schedule(getTime() + Size * getFrameTime(huart), [huart] ()
+    {
+        outputUart(huart, huart->pTxBuffPtr, huart->TxXferSize);
+        huart->TxXferCount = 0;
+        getUarts()[huart->Instance].txEnd = true;
+        raiseIrq(findPeripheral(huart->Instance)->irqn);
+    }, &s);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit_DMA (UART_HandleTypeDef * huart, uint8_t * pData, uint16_t Size)
+{
+    halCall();
+    if (huart->gState != HAL_UART_STATE_READY)
+    {
+        return HAL_BUSY;
+    }
+    if (pData == NULL || Size == 0 || huart->hdmatx == NULL)
+    {
+        return HAL_ERROR;
+    }
+    huart->pTxBuffPtr = pData;
+    huart->TxXferSize = huart->TxXferCount = Size;
+    huart->ErrorCode = HAL_UART_ERROR_NONE;
+    huart->gState = HAL_UART_STATE_BUSY_TX;
+    huart->hdmatx->XferCpltCallback = uartDmaTransmitCplt;
+    huart->hdmatx->XferHalfCpltCallback = uartDmaTxHalfCplt;
+    huart->hdmatx->XferErrorCallback = uartDmaError;
+    huart->Instance->CR3 |= USART_CR3_DMAT;
+
+    // The stream refills the data register as soon as it is empty: the first two bytes are
+    // fetched at once (data and shift register), every further byte one frame later. A
+    // buffer that is released too early is therefore sent as corrupted as by the hardware.
+    const uint64_t frame = getFrameTime(huart);
+    const bool circular = (huart->hdmatx->Init.Mode == DMA_CIRCULAR);
+    UartState & s = getUarts()[huart->Instance];
+    cancel(&s.txFetched);
+    s.txFetched.assign(pData, pData + (circular ? 0 : std::min(Size, (uint16_t) 2)));
+    for (uint16_t k = 2; k < Size && !circular; ++k)
+    {
+        schedule(getTime() + (k - 1) * frame, [&s, pData, k] ()
+        {
+            s.txFetched.push_back(pData[k]);
+        }, &s.txFetched);
+    }
+    startDma(huart->hdmatx, Size * frame, [huart, pData, Size, circular, &s] (bool full)
+    {
+        if (!full)
+        {
+            return;
+        }
+        if (circular)
+        {
+            outputUart(huart, pData, Size);
+        }
+        else
+        {
+            outputUart(huart, s.txFetched.data(), s.txFetched.size());
+        }
+    });
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Receive (UART_HandleTypeDef * huart, uint8_t * pData, uint16_t Size, uint32_t Timeout)
+{
+    halCall();
+    if (huart->RxState != HAL_UART_STATE_READY)
+    {
+        return HAL_BUSY;
+    }
+    if (pData == NULL || Size == 0)
+    {
+        return HAL_ERROR;
+    }
+    huart->RxState = HAL_UART_STATE_BUSY_RX;
+    UartState & s = getUarts()[huart->Instance];
+    const uint32_t start = HAL_GetTick();
+    for (uint16_t i = 0; i < Size; ++i)
+    {
+        const uint32_t elapsed = HAL_GetTick() - start;
+        const uint32_t remaining = Timeout == HAL_MAX_DELAY ? HAL_MAX_DELAY : (elapsed < Timeout ? Timeout - elapsed : 0);
+        if (!waitFor([&s] () { return !s.received.empty(); }, remaining))
+        {
+            huart->RxState = HAL_UART_STATE_READY;
+            return HAL_TIMEOUT;
+        }
+        pData[i] = s.received.front();
+        s.received.pop_front();
+    }
+    huart->RxState = HAL_UART_STATE_READY;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Receive_IT (UART_HandleTypeDef * huart, uint8_t * pData, uint16_t Size)
+{
+    halCall();
+    if (huart->RxState != HAL_UART_STATE_READY)
+    {
+        return HAL_BUSY;
+    }
+    if (pData == NULL || Size == 0)
+    {
+        return HAL_ERROR;
+    }
+    huart->pRxBuffPtr = pData;
+    huart->RxXferSize = huart->RxXferCount = Size;
+    huart->ErrorCode = HAL_UART_ERROR_NONE;
+    huart->RxState = HAL_UART_STATE_BUSY_RX;
+    huart->Instance->CR1 |= USART_CR1_RXNEIE;
+    deliverUart(getUarts()[huart->Instance]);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Receive_DMA (UART_HandleTypeDef * huart, uint8_t * pData, uint16_t Size)
+{
+    halCall();
+    if (huart->RxState != HAL_UART_STATE_READY)
+    {
+        return HAL_BUSY;
+    }
+    if (pData == NULL || Size == 0 || huart->hdmarx == NULL)
+    {
+        return HAL_ERROR;
+    }
+    huart->pRxBuffPtr = pData;
+    huart->RxXferSize = Size;
+    huart->ErrorCode = HAL_UART_ERROR_NONE;
+    huart->RxState = HAL_UART_STATE_BUSY_RX;
+    huart->hdmarx->XferCpltCallback = uartDmaReceiveCplt;
+    huart->hdmarx->XferHalfCpltCallback = uartDmaRxHalfCplt;
+    huart->hdmarx->XferErrorCallback = uartDmaError;
+    huart->hdmarx->State = HAL_DMA_STATE_BUSY;
+    huart->Instance->CR3 |= USART_CR3_DMAR;
+    UartState & s = getUarts()[huart->Instance];
+    s.rxDmaCount = 0;
+    deliverUart(s);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_DMAStop (UART_HandleTypeDef * huart)
+{
+    halCall();
+    if (huart->hdmatx != NULL && (huart->Instance->CR3 & USART_CR3_DMAT))
+    {
+        stopDma(huart->hdmatx);
+        cancel(&getUarts()[huart->Instance].txFetched);
+        huart->hdmatx->State = HAL_DMA_STATE_READY;
+        huart->gState = HAL_UART_STATE_READY;
+    }
+    if (huart->hdmarx != NULL && (huart->Instance->CR3 & USART_CR3_DMAR))
+    {
+        stopDma(huart->hdmarx);
+        huart->hdmarx->State = HAL_DMA_STATE_READY;
+        huart->RxState = HAL_UART_STATE_READY;
+    }
+    huart->Instance->CR3 &= ~(USART_CR3_DMAT | USART_CR3_DMAR);
+    return HAL_OK;
+}
+
+void HAL_UART_IRQHandler (UART_HandleTypeDef * huart)
+{
+    halCall();
+    UartState & s = getUarts()[huart->Instance];
+
+    // Reception by interrupt: one character per interrupt
+    if (huart->RxState == HAL_UART_STATE_BUSY_RX && (huart->Instance->CR1 & USART_CR1_RXNEIE) && !s.received.empty())
+    {
+        *huart->pRxBuffPtr++ = s.received.front();
+        s.received.pop_front();
+        if (--huart->RxXferCount == 0)
+        {
+            huart->Instance->CR1 &= ~USART_CR1_RXNEIE;
+            huart->RxState = HAL_UART_STATE_READY;
+            HAL_UART_RxCpltCallback(huart);
+        }
+        else if (!s.received.empty())
+        {
+            raiseIrq(findPeripheral(huart->Instance)->irqn);
+        }
+    }
+
+    // End of a transmission by interrupt or DMA
+    if (s.txEnd)
+    {
+        s.txEnd = false;
+        huart->Instance->CR3 &= ~USART_CR3_DMAT;
+        huart->gState = HAL_UART_STATE_READY;
+        HAL_UART_TxCpltCallback(huart);
+    }
+}
+
+HAL_UART_StateTypeDef HAL_UART_GetState (UART_HandleTypeDef * huart)
+{
+    halCall();
+    return (HAL_UART_StateTypeDef) (huart->gState | huart->RxState);
+}
+
+uint32_t HAL_UART_GetError (UART_HandleTypeDef * huart)
+{
+    return huart->ErrorCode;
+}
+
+__weak void HAL_UART_MspInit (UART_HandleTypeDef * huart)
+{
+    // empty
+}
+
+__weak void HAL_UART_MspDeInit (UART_HandleTypeDef * huart)
+{
+    // empty
+}
+
+__weak void HAL_UART_TxCpltCallback (UART_HandleTypeDef * huart)
+{
+    // empty
+}
+
+__weak void HAL_UART_TxHalfCpltCallback (UART_HandleTypeDef * huart)
+{
+    // empty
+}
+
+__weak void HAL_UART_RxCpltCallback (UART_HandleTypeDef * huart)
+{
+    // empty
+}
+
+__weak void HAL_UART_RxHalfCpltCallback (UART_HandleTypeDef * huart)
+{
+    // empty
+}
+
+__weak void HAL_UART_ErrorCallback (UART_HandleTypeDef * huart)
+{
+    // empty
+}
+
+/************************************************************************
+ * SPI
+ ************************************************************************/
+
+namespace
+{
+
+struct SpiAttachment
+{
+    GPIO_TypeDef * csPort;
+    uint16_t csPin;
+    SpiDevice * device;
+    bool selected;
+};
+
+/**
+ * @brief Devices at a bus and the completion events of the interrupt transfers.
+ */
+struct SpiBus
+{
+    std::vector<SpiAttachment> devices;
+    bool itEnd = false;
+};
+
+std::map<const SPI_TypeDef *, SpiBus> & getSpiBuses ()
+{
+    static std::map<const SPI_TypeDef *, SpiBus> buses;
+    return buses;
+}
+
+uint64_t getByteTime (const SPI_HandleTypeDef * hspi)
+{
+    const uint32_t prescaler = 2U << ((hspi->Init.BaudRatePrescaler & SPI_CR1_BR) >> SPI_CR1_BR_Pos);
+    return nsForBits(8, getBusClock(hspi->Instance) / prescaler);
+}
+
+inline uint32_t getFrameBytes (const SPI_HandleTypeDef * hspi)
+{
+    return hspi->Init.DataSize == SPI_DATASIZE_16BIT ? 2 : 1;
+}
+
+/**
+ * @brief Full-duplex exchange with the selected devices; a bus without a selected device reads 0xFF.
+ */
+void exchangeSpi (SPI_HandleTypeDef * hspi, const uint8_t * tx, uint8_t * rx, uint32_t n)
+{
+    std::vector<uint8_t> mosi(n), miso(n);
+    SpiBus & bus = getSpiBuses()[hspi->Instance];
+    for (uint32_t i = 0; i < n; ++i)
+    {
+        // 16-bit frames are sent with the most significant byte first
+        const uint32_t index = (getFrameBytes(hspi) == 2) ? (i ^ 1) : i;
+        mosi[i] = tx != NULL ? tx[index] : 0xFF;
+        miso[i] = 0xFF;
+        for (SpiAttachment & a : bus.devices)
+        {
+            if (a.selected)
+            {
+                miso[i] &= a.device->exchange(mosi[i]);
+            }
+        }
+        if (rx != NULL)
+        {
+            rx[index] = miso[i];
+        }
+    }
+    if (tx != NULL)
+    {
+        trace(getName(hspi->Instance), "TX %s", formatBytes(mosi.data(), n).c_str());
+    }
+    if (rx != NULL)
+    {
+        trace(getName(hspi->Instance), "RX %s", formatBytes(miso.data(), n).c_str());
+    }
+}
+
+SPI_HandleTypeDef * findSpi (DMA_HandleTypeDef * hdma)
+{
+    return (SPI_HandleTypeDef *) hdma->Parent;
+}
+
+void spiDmaCplt (DMA_HandleTypeDef * hdma)
+{
+    SPI_HandleTypeDef * hspi = findSpi(hdma);
+    const HAL_SPI_StateTypeDef state = hspi->State;
+    if (hdma->Init.Mode != DMA_CIRCULAR)
+    {
+        hspi->Instance->CR2 &= ~(SPI_CR2_TXDMAEN | SPI_CR2_RXDMAEN);
+        hspi->TxXferCount = hspi->RxXferCount = 0;
+        hspi->State = HAL_SPI_STATE_READY;
+    }
+    if (state == HAL_SPI_STATE_BUSY_TX)
+    {
+        HAL_SPI_TxCpltCallback(hspi);
+    }
+    else if (state == HAL_SPI_STATE_BUSY_RX)
+    {
+        HAL_SPI_RxCpltCallback(hspi);
+    }
+    else
+    {
+        HAL_SPI_TxRxCpltCallback(hspi);
+    }
+}
+
+void spiDmaHalfCplt (DMA_HandleTypeDef * hdma)
+{
+    SPI_HandleTypeDef * hspi = findSpi(hdma);
+    if (hspi->State == HAL_SPI_STATE_BUSY_TX)
+    {
+        HAL_SPI_TxHalfCpltCallback(hspi);
+    }
+    else if (hspi->State == HAL_SPI_STATE_BUSY_RX)
+    {
+        HAL_SPI_RxHalfCpltCallback(hspi);
+    }
+    else
+    {
+        HAL_SPI_TxRxHalfCpltCallback(hspi);
+    }
+}
+
+void spiDmaError (DMA_HandleTypeDef * hdma)
+{
+    SPI_HandleTypeDef * hspi = findSpi(hdma);
+    hspi->Instance->CR2 &= ~(SPI_CR2_TXDMAEN | SPI_CR2_RXDMAEN);
+    hspi->ErrorCode |= HAL_SPI_ERROR_DMA;
+    hspi->State = HAL_SPI_STATE_READY;
+    HAL_SPI_ErrorCallback(hspi);
+}
+
+HAL_StatusTypeDef startSpi (SPI_HandleTypeDef * hspi, uint8_t * pTxData, uint8_t * pRxData, uint16_t Size,
+                            HAL_SPI_StateTypeDef state)
+{
+    if (hspi->State != HAL_SPI_STATE_READY)
+    {
+        return HAL_BUSY;
+    }
+    if ((pTxData == NULL && pRxData == NULL) || Size == 0)
+    {
+        return HAL_ERROR;
+    }
+    hspi->pTxBuffPtr = pTxData;
+    hspi->pRxBuffPtr = pRxData;
+    hspi->TxXferSize = hspi->TxXferCount = Size;
+    hspi->RxXferSize = hspi->RxXferCount = Size;
+    hspi->ErrorCode = HAL_SPI_ERROR_NONE;
+    hspi->State = state;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef transferSpiBlocking (SPI_HandleTypeDef * hspi, uint8_t * pTxData, uint8_t * pRxData,
+                                       uint16_t Size, HAL_SPI_StateTypeDef state)
+{
+    const HAL_StatusTypeDef status = startSpi(hspi, pTxData, pRxData, Size, state);
+    if (status != HAL_OK)
+    {
+        return status;
+    }
+    const uint32_t n = Size * getFrameBytes(hspi);
+    busyWait(n * getByteTime(hspi));
+    exchangeSpi(hspi, pTxData, pRxData, n);
+    hspi->TxXferCount = hspi->RxXferCount = 0;
+    hspi->State = HAL_SPI_STATE_READY;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef transferSpiDma (SPI_HandleTypeDef * hspi, uint8_t * pTxData, uint8_t * pRxData,
+                                  uint16_t Size, HAL_SPI_StateTypeDef state)
+{
+    // The transfer completes with the receive stream if data are received
+    DMA_HandleTypeDef * hdma = (state == HAL_SPI_STATE_BUSY_TX) ? hspi->hdmatx : hspi->hdmarx;
+    if (hdma == NULL)
+    {
+        return HAL_ERROR;
+    }
+    const HAL_StatusTypeDef status = startSpi(hspi, pTxData, pRxData, Size, state);
+    if (status != HAL_OK)
+    {
+        return status;
+    }
+    hdma->XferCpltCallback = spiDmaCplt;
+    hdma->XferHalfCpltCallback = spiDmaHalfCplt;
+    hdma->XferErrorCallback = spiDmaError;
+    hspi->Instance->CR2 |= (state == HAL_SPI_STATE_BUSY_TX) ? SPI_CR2_TXDMAEN : (SPI_CR2_TXDMAEN | SPI_CR2_RXDMAEN);
+    const uint32_t n = Size * getFrameBytes(hspi);
+    startDma(hdma, n * getByteTime(hspi), [hspi, pTxData, pRxData, n] (bool full)
+    {
+        if (full)
+        {
+            exchangeSpi(hspi, pTxData, pRxData, n);
+        }
+    });
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef transferSpiIt (SPI_HandleTypeDef * hspi, uint8_t * pTxData, uint8_t * pRxData,
+                                 uint16_t Size, HAL_SPI_StateTypeDef state)
+{
+    const HAL_StatusTypeDef status = startSpi(hspi, pTxData, pRxData, Size, state);
+    if (status != HAL_OK)
+    {
+        return status;
+    }
+    const uint32_t n = Size * getFrameBytes(hspi);
+    SpiBus & bus = getSpiBuses()[hspi->Instance];
+    schedule(getTime() + n * getByteTime(hspi), [hspi, pTxData, pRxData, n] ()
+    {
+        exchangeSpi(hspi, pTxData, pRxData, n);
+        getSpiBuses()[hspi->Instance].itEnd = true;
+        raiseIrq(findPeripheral(hspi->Instance)->irqn);
+    }, &bus);
+    return HAL_OK;
+}
+
+} // end of anonymous namespace
+
+void HalSim::attachSpiDevice (SPI_TypeDef * spi, GPIO_TypeDef * csPort, uint16_t csPin, SpiDevice * device)
+{
+    getSpiBuses()[spi].devices.push_back(SpiAttachment { csPort, csPin, device, !getPin(csPort, csPin) });
+}
+
+void HalSim::onChipSelect (GPIO_TypeDef * port, uint16_t pin, bool level)
+{
+    for (auto & bus : getSpiBuses())
+    {
+        for (SpiAttachment & a : bus.second.devices)
+        {
+            if (a.csPort == port && a.csPin == pin && a.selected == level)
+            {
+                a.selected = !level;
+                a.device->select(a.selected);
+            }
+        }
+    }
+}
+
+HAL_StatusTypeDef HAL_SPI_Init (SPI_HandleTypeDef * hspi)
+{
+    halCall();
+    if (hspi == NULL)
+    {
+        return HAL_ERROR;
+    }
+    if (hspi->State == HAL_SPI_STATE_RESET)
+    {
+        hspi->Lock = HAL_UNLOCKED;
+        HAL_SPI_MspInit(hspi);
+    }
+    hspi->Instance->CR1 = hspi->Init.Mode | hspi->Init.Direction | hspi->Init.DataSize | hspi->Init.CLKPolarity
+                          | hspi->Init.CLKPhase | (hspi->Init.NSS & SPI_CR1_SSM) | hspi->Init.BaudRatePrescaler
+                          | hspi->Init.FirstBit | hspi->Init.CRCCalculation;
+    hspi->ErrorCode = HAL_SPI_ERROR_NONE;
+    hspi->State = HAL_SPI_STATE_READY;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_DeInit (SPI_HandleTypeDef * hspi)
+{
+    halCall();
+    if (hspi == NULL)
+    {
+        return HAL_ERROR;
+    }
+    cancel(&getSpiBuses()[hspi->Instance]);
+    hspi->Instance->CR1 = hspi->Instance->CR2 = 0;
+    HAL_SPI_MspDeInit(hspi);
+    hspi->ErrorCode = HAL_SPI_ERROR_NONE;
+    hspi->State = HAL_SPI_STATE_RESET;
+    __HAL_UNLOCK(hspi);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Transmit (SPI_HandleTypeDef * hspi, uint8_t * pData, uint16_t Size, uint32_t Timeout)
+{
+    halCall();
+    return transferSpiBlocking(hspi, pData, NULL, Size, HAL_SPI_STATE_BUSY_TX);
+}
+
+HAL_StatusTypeDef HAL_SPI_Receive (SPI_HandleTypeDef * hspi, uint8_t * pData, uint16_t Size, uint32_t Timeout)
+{
+    halCall();
+    // Like the HAL in the full-duplex master mode, the buffer is sent while it is received
+    return transferSpiBlocking(hspi, pData, pData, Size, HAL_SPI_STATE_BUSY_RX);
+}
+
+HAL_StatusTypeDef HAL_SPI_TransmitReceive (SPI_HandleTypeDef * hspi, uint8_t * pTxData, uint8_t * pRxData,
+                                           uint16_t Size, uint32_t Timeout)
+{
+    halCall();
+    return transferSpiBlocking(hspi, pTxData, pRxData, Size, HAL_SPI_STATE_BUSY_TX_RX);
+}
+
+HAL_StatusTypeDef HAL_SPI_Transmit_IT (SPI_HandleTypeDef * hspi, uint8_t * pData, uint16_t Size)
+{
+    halCall();
+    return transferSpiIt(hspi, pData, NULL, Size, HAL_SPI_STATE_BUSY_TX);
+}
+
+HAL_StatusTypeDef HAL_SPI_Receive_IT (SPI_HandleTypeDef * hspi, uint8_t * pData, uint16_t Size)
+{
+    halCall();
+    return transferSpiIt(hspi, pData, pData, Size, HAL_SPI_STATE_BUSY_RX);
+}
+
+HAL_StatusTypeDef HAL_SPI_TransmitReceive_IT (SPI_HandleTypeDef * hspi, uint8_t * pTxData, uint8_t * pRxData,
+                                              uint16_t Size)
+{
+    halCall();
+    return transferSpiIt(hspi, pTxData, pRxData, Size, HAL_SPI_STATE_BUSY_TX_RX);
+}
+
+HAL_StatusTypeDef HAL_SPI_Transmit_DMA (SPI_HandleTypeDef * hspi, uint8_t * pData, uint16_t Size)
+{
+    halCall();
+    return transferSpiDma(hspi, pData, NULL, Size, HAL_SPI_STATE_BUSY_TX);
+}
+
+HAL_StatusTypeDef HAL_SPI_Receive_DMA (SPI_HandleTypeDef * hspi, uint8_t * pData, uint16_t Size)
+{
+    halCall();
+    return transferSpiDma(hspi, pData, pData, Size, HAL_SPI_STATE_BUSY_RX);
+}
+
+HAL_StatusTypeDef HAL_SPI_TransmitReceive_DMA (SPI_HandleTypeDef * hspi, uint8_t * pTxData, uint8_t * pRxData,
+                                               uint16_t Size)
+{
+    halCall();
+    return transferSpiDma(hspi, pTxData, pRxData, Size, HAL_SPI_STATE_BUSY_TX_RX);
+}
+
+HAL_StatusTypeDef HAL_SPI_DMAStop (SPI_HandleTypeDef * hspi)
+{
+    halCall();
+    if (hspi->hdmatx != NULL)
+    {
+        stopDma(hspi->hdmatx);
+        hspi->hdmatx->State = HAL_DMA_STATE_READY;
+    }
+    if (hspi->hdmarx != NULL)
+    {
+        stopDma(hspi->hdmarx);
+        hspi->hdmarx->State = HAL_DMA_STATE_READY;
+    }
+    hspi->Instance->CR2 &= ~(SPI_CR2_TXDMAEN | SPI_CR2_RXDMAEN);
+    hspi->State = HAL_SPI_STATE_READY;
+    return HAL_OK;
+}
+
+void HAL_SPI_IRQHandler (SPI_HandleTypeDef * hspi)
+{
+    halCall();
+    SpiBus & bus = getSpiBuses()[hspi->Instance];
+    if (!bus.itEnd)
+    {
+        return;
+    }
+    bus.itEnd = false;
+    const HAL_SPI_StateTypeDef state = hspi->State;
+    hspi->TxXferCount = hspi->RxXferCount = 0;
+    hspi->State = HAL_SPI_STATE_READY;
+    if (state == HAL_SPI_STATE_BUSY_TX)
+    {
+        HAL_SPI_TxCpltCallback(hspi);
+    }
+    else if (state == HAL_SPI_STATE_BUSY_RX)
+    {
+        HAL_SPI_RxCpltCallback(hspi);
+    }
+    else
+    {
+        HAL_SPI_TxRxCpltCallback(hspi);
+    }
+}
+
+HAL_SPI_StateTypeDef HAL_SPI_GetState (SPI_HandleTypeDef * hspi)
+{
+    halCall();
+    return hspi->State;
+}
+
+uint32_t HAL_SPI_GetError (SPI_HandleTypeDef * hspi)
+{
+    return hspi->ErrorCode;
+}
+
+__weak void HAL_SPI_MspInit (SPI_HandleTypeDef * hspi)
+{
+    // empty
+}
+
+__weak void HAL_SPI_MspDeInit (SPI_HandleTypeDef * hspi)
+{
+    // empty
+}
+
+__weak void HAL_SPI_TxCpltCallback (SPI_HandleTypeDef * hspi)
+{
+    // empty
+}
+
+__weak void HAL_SPI_RxCpltCallback (SPI_HandleTypeDef * hspi)
+{
+    // empty
+}
+
+__weak void HAL_SPI_TxRxCpltCallback (SPI_HandleTypeDef * hspi)
+{
+    // empty
+}
+
+__weak void HAL_SPI_TxHalfCpltCallback (SPI_HandleTypeDef * hspi)
+{
+    // empty
+}
+
+__weak void HAL_SPI_RxHalfCpltCallback (SPI_HandleTypeDef * hspi)
+{
+    // empty
+}
+
+__weak void HAL_SPI_TxRxHalfCpltCallback (SPI_HandleTypeDef * hspi)
+{
+    // empty
+}
+
+__weak void HAL_SPI_ErrorCallback (SPI_HandleTypeDef * hspi)
+{
+    // empty
+}
+
+/************************************************************************
+ * I2C
+ ************************************************************************/
+
+namespace
+{
+
+std::map<std::pair<const I2C_TypeDef *, uint16_t>, I2cDevice *> & getI2cDevices ()
+{
+    static std::map<std::pair<const I2C_TypeDef *, uint16_t>, I2cDevice *> devices;
+    return devices;
+}
+
+I2cDevice * findI2cDevice (const I2C_HandleTypeDef * hi2c, uint16_t address)
+{
+    auto it = getI2cDevices().find(std::make_pair(hi2c->Instance, (uint16_t) (address & 0xFE)));
+    return it == getI2cDevices().end() ? NULL : it->second;
+}
+
+/**
+ * @brief Duration of a transaction: start, address, data bytes with acknowledge, stop.
+ */
+uint64_t getTransactionTime (const I2C_HandleTypeDef * hi2c, uint32_t bytes)
+{
+    return nsForBits(2 + 9 * (bytes + 1), hi2c->Init.ClockSpeed);
+}
+
+HAL_StatusTypeDef startI2c (I2C_HandleTypeDef * hi2c, HAL_I2C_StateTypeDef state, HAL_I2C_ModeTypeDef mode)
+{
+    if (hi2c->State != HAL_I2C_STATE_READY)
+    {
+        return HAL_BUSY;
+    }
+    hi2c->State = state;
+    hi2c->Mode = mode;
+    hi2c->ErrorCode = HAL_I2C_ERROR_NONE;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef finishI2c (I2C_HandleTypeDef * hi2c, bool acknowledged)
+{
+    hi2c->State = HAL_I2C_STATE_READY;
+    hi2c->Mode = HAL_I2C_MODE_NONE;
+    if (!acknowledged)
+    {
+        hi2c->ErrorCode = HAL_I2C_ERROR_AF;
+        return HAL_ERROR;
+    }
+    return HAL_OK;
+}
+
+bool writeI2c (I2C_HandleTypeDef * hi2c, uint16_t address, const uint8_t * data, uint16_t n)
+{
+    I2cDevice * device = findI2cDevice(hi2c, address);
+    const bool acknowledged = device != NULL && device->write(data, n);
+    busyWait(getTransactionTime(hi2c, acknowledged ? n : 0));
+    trace(getName(hi2c->Instance), "W %02X: %s%s", address & 0xFE, formatBytes(data, n).c_str(),
+          acknowledged ? "" : " NACK");
+    return acknowledged;
+}
+
+bool readI2c (I2C_HandleTypeDef * hi2c, uint16_t address, uint8_t * data, uint16_t n)
+{
+    I2cDevice * device = findI2cDevice(hi2c, address);
+    const bool acknowledged = device != NULL && device->read(data, n);
+    busyWait(getTransactionTime(hi2c, acknowledged ? n : 0));
+    trace(getName(hi2c->Instance), "R %02X: %s", address & 0xFE,
+          acknowledged ? formatBytes(data, n).c_str() : "NACK");
+    return acknowledged;
+}
+
+std::vector<uint8_t> getMemAddress (uint16_t MemAddress, uint16_t MemAddSize)
+{
+    if (MemAddSize == I2C_MEMADD_SIZE_8BIT)
+    {
+        return std::vector<uint8_t> { (uint8_t) MemAddress };
+    }
+    return std::vector<uint8_t> { (uint8_t) (MemAddress >> 8), (uint8_t) MemAddress };
+}
+
+} // end of anonymous namespace
+
+void HalSim::attachI2cDevice (I2C_TypeDef * i2c, uint16_t address, I2cDevice * device)
+{
+    getI2cDevices()[std::make_pair(i2c, (uint16_t) (address & 0xFE))] = device;
+}
+
+HAL_StatusTypeDef HAL_I2C_Init (I2C_HandleTypeDef * hi2c)
+{
+    halCall();
+    if (hi2c == NULL)
+    {
+        return HAL_ERROR;
+    }
+    if (hi2c->State == HAL_I2C_STATE_RESET)
+    {
+        hi2c->Lock = HAL_UNLOCKED;
+        HAL_I2C_MspInit(hi2c);
+    }
+    hi2c->Instance->CR1 |= I2C_CR1_PE;
+    hi2c->ErrorCode = HAL_I2C_ERROR_NONE;
+    hi2c->State = HAL_I2C_STATE_READY;
+    hi2c->Mode = HAL_I2C_MODE_NONE;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2C_DeInit (I2C_HandleTypeDef * hi2c)
+{
+    halCall();
+    if (hi2c == NULL)
+    {
+        return HAL_ERROR;
+    }
+    hi2c->Instance->CR1 &= ~I2C_CR1_PE;
+    HAL_I2C_MspDeInit(hi2c);
+    hi2c->ErrorCode = HAL_I2C_ERROR_NONE;
+    hi2c->State = HAL_I2C_STATE_RESET;
+    hi2c->Mode = HAL_I2C_MODE_NONE;
+    __HAL_UNLOCK(hi2c);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2C_Master_Transmit (I2C_HandleTypeDef * hi2c, uint16_t DevAddress, uint8_t * pData,
+                                           uint16_t Size, uint32_t Timeout)
+{
+    halCall();
+    const HAL_StatusTypeDef status = startI2c(hi2c, HAL_I2C_STATE_BUSY_TX, HAL_I2C_MODE_MASTER);
+    return status != HAL_OK ? status : finishI2c(hi2c, writeI2c(hi2c, DevAddress, pData, Size));
+}
+
+HAL_StatusTypeDef HAL_I2C_Master_Receive (I2C_HandleTypeDef * hi2c, uint16_t DevAddress, uint8_t * pData,
+                                          uint16_t Size, uint32_t Timeout)
+{
+    halCall();
+    const HAL_StatusTypeDef status = startI2c(hi2c, HAL_I2C_STATE_BUSY_RX, HAL_I2C_MODE_MASTER);
+    return status != HAL_OK ? status : finishI2c(hi2c, readI2c(hi2c, DevAddress, pData, Size));
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Write (I2C_HandleTypeDef * hi2c, uint16_t DevAddress, uint16_t MemAddress,
+                                     uint16_t MemAddSize, uint8_t * pData, uint16_t Size, uint32_t Timeout)
+{
+    halCall();
+    const HAL_StatusTypeDef status = startI2c(hi2c, HAL_I2C_STATE_BUSY_TX, HAL_I2C_MODE_MEM);
+    if (status != HAL_OK)
+    {
+        return status;
+    }
+    std::vector<uint8_t> data = getMemAddress(MemAddress, MemAddSize);
+    data.insert(data.end(), pData, pData + Size);
+    return finishI2c(hi2c, writeI2c(hi2c, DevAddress, data.data(), data.size()));
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Read (I2C_HandleTypeDef * hi2c, uint16_t DevAddress, uint16_t MemAddress,
+                                    uint16_t MemAddSize, uint8_t * pData, uint16_t Size, uint32_t Timeout)
+{
+    halCall();
+    const HAL_StatusTypeDef status = startI2c(hi2c, HAL_I2C_STATE_BUSY_RX, HAL_I2C_MODE_MEM);
+    if (status != HAL_OK)
+    {
+        return status;
+    }
+    const std::vector<uint8_t> address = getMemAddress(MemAddress, MemAddSize);
+    const bool acknowledged = writeI2c(hi2c, DevAddress, address.data(), address.size())
+                              && readI2c(hi2c, DevAddress, pData, Size);
+    return finishI2c(hi2c, acknowledged);
+}
+
+HAL_StatusTypeDef HAL_I2C_IsDeviceReady (I2C_HandleTypeDef * hi2c, uint16_t DevAddress, uint32_t Trials,
+                                         uint32_t Timeout)
+{
+    halCall();
+    const HAL_StatusTypeDef status = startI2c(hi2c, HAL_I2C_STATE_BUSY, HAL_I2C_MODE_NONE);
+    if (status != HAL_OK)
+    {
+        return status;
+    }
+    const bool acknowledged = findI2cDevice(hi2c, DevAddress) != NULL;
+    busyWait(getTransactionTime(hi2c, 0) * (acknowledged ? 1 : std::max(Trials, (uint32_t) 1)));
+    return finishI2c(hi2c, acknowledged);
+}
+
+HAL_StatusTypeDef HAL_I2C_Slave_Receive (I2C_HandleTypeDef * hi2c, uint8_t * pData, uint16_t Size,
+                                         uint32_t Timeout)
+{
+    halCall();
+    // No bus master is simulated: the slave waits until the timeout
+    const HAL_StatusTypeDef status = startI2c(hi2c, HAL_I2C_STATE_BUSY_RX, HAL_I2C_MODE_SLAVE);
+    if (status != HAL_OK)
+    {
+        return status;
+    }
+    waitFor([] () { return false; }, Timeout);
+    hi2c->State = HAL_I2C_STATE_READY;
+    hi2c->Mode = HAL_I2C_MODE_NONE;
+    return HAL_TIMEOUT;
+}
+
+HAL_StatusTypeDef HAL_I2C_Slave_Transmit (I2C_HandleTypeDef * hi2c, uint8_t * pData, uint16_t Size,
+                                          uint32_t Timeout)
+{
+    return HAL_I2C_Slave_Receive(hi2c, pData, Size, Timeout);
+}
+
+HAL_I2C_StateTypeDef HAL_I2C_GetState (I2C_HandleTypeDef * hi2c)
+{
+    halCall();
+    return hi2c->State;
+}
+
+HAL_I2C_ModeTypeDef HAL_I2C_GetMode (I2C_HandleTypeDef * hi2c)
+{
+    return hi2c->Mode;
+}
+
+uint32_t HAL_I2C_GetError (I2C_HandleTypeDef * hi2c)
+{
+    return hi2c->ErrorCode;
+}
+
+__weak void HAL_I2C_MspInit (I2C_HandleTypeDef * hi2c)
+{
+    // empty
+}
+
+__weak void HAL_I2C_MspDeInit (I2C_HandleTypeDef * hi2c)
+{
+    // empty
+}
+
+#endif
@@ -0,0 +1,601 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#ifdef HAL_SIMULATION
+
+#include "hal_sim_internal.h"
+
+using namespace HalSim;
+
+namespace
+{
+
+/**
+ * @brief Counter of a running timer. The counter register is not updated at every
+ *        count: it is computed from the origin when the simulation syncs the registers,
+ *        the update events are scheduled at the overflows.
+ */
+struct Counter
+{
+    bool running = false;
+    uint64_t origin = 0;
+    uint32_t originCount = 0;
+    uint32_t lastCount = 0;
+    uint32_t arr = 0xFFFF, psc = 0;
+    uint32_t repetition = 0;
+};
+
+std::map<TIM_TypeDef *, Counter> & getCounters ()
+{
+    static std::map<TIM_TypeDef *, Counter> counters;
+    return counters;
+}
+
+inline bool isAdvanced (const TIM_TypeDef * instance)
+{
+    return instance == TIM1 || instance == TIM8;
+}
+
+inline bool isEncoder (const TIM_TypeDef * instance)
+{
+    const uint32_t sms = instance->SMCR & TIM_SMCR_SMS;
+    return sms >= TIM_ENCODERMODE_TI1 && sms <= TIM_ENCODERMODE_TI12;
+}
+
+/**
+ * @brief The number of counts since the origin.
+ */
+uint64_t getElapsedCounts (TIM_TypeDef * instance, const Counter & c, uint64_t time)
+{
+    const uint64_t clock = getTimerClock(instance);
+    return (uint64_t) ((unsigned __int128) (time - c.origin) * clock / ((uint64_t) (c.psc + 1) * 1000000000ULL));
+}
+
+/**
+ * @brief The time of the given count after the origin.
+ */
+uint64_t getCountTime (TIM_TypeDef * instance, const Counter & c, uint64_t counts)
+{
+    const uint64_t clock = std::max(getTimerClock(instance), (uint32_t) 1);
+    const unsigned __int128 ns = (unsigned __int128) counts * (c.psc + 1) * 1000000000ULL;
+    return c.origin + (uint64_t) ((ns + clock - 1) / clock);
+}
+
+/**
+ * @brief The counter as an up-counting value, the direction is applied at the register.
+ */
+uint32_t getUpCount (TIM_TypeDef * instance, const Counter & c)
+{
+    return (uint32_t) ((c.originCount + getElapsedCounts(instance, c, getTime())) % ((uint64_t) c.arr + 1));
+}
+
+inline uint32_t toRegister (TIM_TypeDef * instance, const Counter & c, uint32_t upCount)
+{
+    return (instance->CR1 & TIM_CR1_DIR) ? c.arr - upCount : upCount;
+}
+
+void scheduleOverflow (TIM_TypeDef * instance)
+{
+    Counter & c = getCounters()[instance];
+    cancel(&c);
+    if (!c.running || (instance->DIER & TIM_DIER_UIE) == 0)
+    {
+        return;
+    }
+    schedule(getCountTime(instance, c, (uint64_t) c.arr + 1 - c.originCount), [instance] ()
+    {
+        Counter & c = getCounters()[instance];
+        // The preloaded prescaler (and the buffered auto-reload) take effect at the update
+        c.origin = getTime();
+        c.originCount = 0;
+        c.psc = instance->PSC & 0xFFFF;
+        c.arr = std::max((uint32_t) instance->ARR, (uint32_t) 1);
+        instance->CNT = c.lastCount = toRegister(instance, c, 0);
+        if (c.repetition > 0)
+        {
+            --c.repetition;
+        }
+        else
+        {
+            c.repetition = isAdvanced(instance) ? instance->RCR & 0xFF : 0;
+            instance->SR |= TIM_SR_UIF;
+            if (instance->DIER & TIM_DIER_UIE)
+            {
+                raiseIrq(findPeripheral(instance)->irqn);
+            }
+        }
+        scheduleOverflow(instance);
+    }, &c);
+}
+
+/**
+ * @brief Restarts the counting from the current register values.
+ */
+void rebase (TIM_TypeDef * instance, uint32_t upCount)
+{
+    Counter & c = getCounters()[instance];
+    c.origin = getTime();
+    c.arr = std::max((uint32_t) instance->ARR, (uint32_t) 1);
+    c.psc = instance->PSC & 0xFFFF;
+    c.originCount = upCount % (c.arr + 1);
+    c.lastCount = instance->CNT = toRegister(instance, c, c.originCount);
+    scheduleOverflow(instance);
+}
+
+void startCounter (TIM_HandleTypeDef * htim, bool interrupt)
+{
+    TIM_TypeDef * instance = htim->Instance;
+    Counter & c = getCounters()[instance];
+    c.running = true;
+    c.repetition = isAdvanced(instance) ? instance->RCR & 0xFF : 0;
+    if (interrupt)
+    {
+        instance->DIER |= TIM_DIER_UIE;
+    }
+    instance->CR1 |= TIM_CR1_CEN;
+    const uint32_t upCount = (instance->CR1 & TIM_CR1_DIR) ? instance->ARR - instance->CNT : instance->CNT;
+    rebase(instance, upCount);
+    trace(getName(instance), "start at %lu Hz%s",
+          (unsigned long) (getTimerClock(instance) / (c.psc + 1) / (c.arr + 1)), interrupt ? ", update interrupt" : "");
+}
+
+void stopCounter (TIM_HandleTypeDef * htim, bool interrupt)
+{
+    TIM_TypeDef * instance = htim->Instance;
+    Counter & c = getCounters()[instance];
+    if (c.running)
+    {
+        instance->CNT = toRegister(instance, c, getUpCount(instance, c));
+    }
+    c.running = false;
+    cancel(&c);
+    if (interrupt)
+    {
+        instance->DIER &= ~TIM_DIER_UIE;
+    }
+    instance->CR1 &= ~TIM_CR1_CEN;
+}
+
+/**
+ * @brief Returns the RTCCLK selected in the backup domain.
+ */
+uint32_t getRtcClock ()
+{
+    switch (RCC->BDCR & RCC_BDCR_RTCSEL)
+    {
+    case RCC_BDCR_RTCSEL_0:
+        return LSE_VALUE;
+    case RCC_BDCR_RTCSEL_1:
+        return LSI_VALUE;
+    case RCC_BDCR_RTCSEL:
+        return HSE_VALUE / std::max((RCC->CFGR & RCC_CFGR_RTCPRE) >> RCC_CFGR_RTCPRE_Pos, (uint32_t) 2);
+    default:
+        return 0;
+    }
+}
+
+struct WakeUpTimer
+{
+    RTC_HandleTypeDef * handle = NULL;
+};
+
+WakeUpTimer & getWakeUpTimer ()
+{
+    static WakeUpTimer timer;
+    return timer;
+}
+
+void scheduleWakeUp (uint64_t period)
+{
+    WakeUpTimer & w = getWakeUpTimer();
+    schedule(getTime() + period, [period] ()
+    {
+        WakeUpTimer & w = getWakeUpTimer();
+        w.handle->Instance->ISR |= RTC_ISR_WUTF;
+        EXTI->PR |= RTC_EXTI_LINE_WAKEUPTIMER_EVENT;
+        if ((w.handle->Instance->CR & RTC_CR_WUTIE) && (EXTI->IMR & RTC_EXTI_LINE_WAKEUPTIMER_EVENT))
+        {
+            raiseIrq(RTC_WKUP_IRQn);
+        }
+        scheduleWakeUp(period);
+    }, &w);
+}
+
+} // end of anonymous namespace
+
+/************************************************************************
+ * Simulation interface
+ ************************************************************************/
+
+void HalSim::moveEncoder (TIM_TypeDef * timer, int32_t counts)
+{
+    trace(getName(timer), "encoder %+ld", (long) counts);
+    if ((timer->CR1 & TIM_CR1_CEN) == 0 || !isEncoder(timer))
+    {
+        return;
+    }
+    const int64_t modulo = (int64_t) timer->ARR + 1;
+    timer->CNT = (uint32_t) ((((int64_t) timer->CNT + counts) % modulo + modulo) % modulo);
+    if (counts < 0)
+    {
+        timer->CR1 |= TIM_CR1_DIR;
+    }
+    else
+    {
+        timer->CR1 &= ~TIM_CR1_DIR;
+    }
+}
+
+void HalSim::syncTimers ()
+{
+    for (auto & e : getCounters())
+    {
+        TIM_TypeDef * instance = e.first;
+        Counter & c = e.second;
+        if (!c.running)
+        {
+            continue;
+        }
+        if (instance->CNT != c.lastCount)
+        {
+            // Written by the firmware
+            rebase(instance, (instance->CR1 & TIM_CR1_DIR) ? instance->ARR - instance->CNT : instance->CNT);
+        }
+        else if (instance->ARR != c.arr && (instance->CR1 & TIM_CR1_ARPE) == 0)
+        {
+            rebase(instance, getUpCount(instance, c));
+        }
+        else
+        {
+            c.lastCount = instance->CNT = toRegister(instance, c, getUpCount(instance, c));
+        }
+    }
+}
+
+/************************************************************************
+ * HAL: TIM
+ ************************************************************************/
+
+HAL_StatusTypeDef HAL_TIM_Base_Init (TIM_HandleTypeDef * htim)
+{
+    halCall();
+    if (htim == NULL)
+    {
+        return HAL_ERROR;
+    }
+    if (htim->State == HAL_TIM_STATE_RESET)
+    {
+        htim->Lock = HAL_UNLOCKED;
+        HAL_TIM_Base_MspInit(htim);
+    }
+    htim->State = HAL_TIM_STATE_BUSY;
+    TIM_TypeDef * instance = htim->Instance;
+    instance->CR1 = (instance->CR1 & ~(TIM_CR1_DIR | TIM_CR1_CMS | TIM_CR1_CKD))
+                    | htim->Init.CounterMode | htim->Init.ClockDivision;
+    instance->ARR = htim->Init.Period;
+    instance->PSC = htim->Init.Prescaler;
+    if (isAdvanced(instance))
+    {
+        instance->RCR = htim->Init.RepetitionCounter;
+    }
+    // The update generation reloads the prescaler; the counter is not cleared by the HAL
+    instance->EGR = 0;
+    htim->State = HAL_TIM_STATE_READY;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_Base_DeInit (TIM_HandleTypeDef * htim)
+{
+    halCall();
+    htim->State = HAL_TIM_STATE_BUSY;
+    stopCounter(htim, true);
+    getCounters().erase(htim->Instance);
+    HAL_TIM_Base_MspDeInit(htim);
+    htim->State = HAL_TIM_STATE_RESET;
+    __HAL_UNLOCK(htim);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_Base_Start (TIM_HandleTypeDef * htim)
+{
+    halCall();
+    htim->State = HAL_TIM_STATE_BUSY;
+    startCounter(htim, false);
+    htim->State = HAL_TIM_STATE_READY;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_Base_Stop (TIM_HandleTypeDef * htim)
+{
+    halCall();
+    htim->State = HAL_TIM_STATE_BUSY;
+    stopCounter(htim, false);
+    htim->State = HAL_TIM_STATE_READY;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_Base_Start_IT (TIM_HandleTypeDef * htim)
+{
+    halCall();
+    startCounter(htim, true);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_Base_Stop_IT (TIM_HandleTypeDef * htim)
+{
+    halCall();
+    stopCounter(htim, true);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_Encoder_Init (TIM_HandleTypeDef * htim, TIM_Encoder_InitTypeDef * sConfig)
+{
+    halCall();
+    if (htim == NULL)
+    {
+        return HAL_ERROR;
+    }
+    if (htim->State == HAL_TIM_STATE_RESET)
+    {
+        htim->Lock = HAL_UNLOCKED;
+        HAL_TIM_Encoder_MspInit(htim);
+    }
+    htim->State = HAL_TIM_STATE_BUSY;
+    TIM_TypeDef * instance = htim->Instance;
+    instance->CR1 = (instance->CR1 & ~(TIM_CR1_DIR | TIM_CR1_CMS | TIM_CR1_CKD))
+                    | htim->Init.CounterMode | htim->Init.ClockDivision;
+    instance->ARR = htim->Init.Period;
+    instance->PSC = htim->Init.Prescaler;
+    instance->SMCR = (instance->SMCR & ~TIM_SMCR_SMS) | sConfig->EncoderMode;
+    instance->CCMR1 = sConfig->IC1Selection | (sConfig->IC2Selection << 8) | sConfig->IC1Prescaler
+                      | (sConfig->IC2Prescaler << 8) | (sConfig->IC1Filter << 4) | (sConfig->IC2Filter << 12);
+    instance->CCER = sConfig->IC1Polarity | (sConfig->IC2Polarity << 4);
+    htim->State = HAL_TIM_STATE_READY;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_Encoder_Start (TIM_HandleTypeDef * htim, uint32_t Channel)
+{
+    halCall();
+    switch (Channel)
+    {
+    case TIM_CHANNEL_1:
+        htim->Instance->CCER |= TIM_CCER_CC1E;
+        break;
+    case TIM_CHANNEL_2:
+        htim->Instance->CCER |= TIM_CCER_CC2E;
+        break;
+    default:
+        htim->Instance->CCER |= TIM_CCER_CC1E | TIM_CCER_CC2E;
+        break;
+    }
+    htim->Instance->CR1 |= TIM_CR1_CEN;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_Encoder_Stop (TIM_HandleTypeDef * htim, uint32_t Channel)
+{
+    halCall();
+    htim->Instance->CCER &= ~(TIM_CCER_CC1E | TIM_CCER_CC2E);
+    htim->Instance->CR1 &= ~TIM_CR1_CEN;
+    return HAL_OK;
+}
+
+void HAL_TIM_IRQHandler (TIM_HandleTypeDef * htim)
+{
+    halCall();
+    if ((htim->Instance->SR & TIM_SR_UIF) && (htim->Instance->DIER & TIM_DIER_UIE))
+    {
+        htim->Instance->SR &= ~TIM_SR_UIF;
+        HAL_TIM_PeriodElapsedCallback(htim);
+    }
+}
+
+HAL_TIM_StateTypeDef HAL_TIM_Base_GetState (TIM_HandleTypeDef * htim)
+{
+    return htim->State;
+}
+
+__weak void HAL_TIM_Base_MspInit (TIM_HandleTypeDef * htim)
+{
+    // empty
+}
+
+__weak void HAL_TIM_Base_MspDeInit (TIM_HandleTypeDef * htim)
+{
+    // empty
+}
+
+__weak void HAL_TIM_Encoder_MspInit (TIM_HandleTypeDef * htim)
+{
+    // empty
+}
+
+__weak void HAL_TIM_Encoder_MspDeInit (TIM_HandleTypeDef * htim)
+{
+    // empty
+}
+
+__weak void HAL_TIM_PeriodElapsedCallback (TIM_HandleTypeDef * htim)
+{
+    // empty
+}
+
+/************************************************************************
+ * HAL: RTC
+ ************************************************************************/
+
+HAL_StatusTypeDef HAL_RTC_Init (RTC_HandleTypeDef * hrtc)
+{
+    halCall();
+    if (hrtc == NULL)
+    {
+        return HAL_ERROR;
+    }
+    if (hrtc->State == HAL_RTC_STATE_RESET)
+    {
+        hrtc->Lock = HAL_UNLOCKED;
+        HAL_RTC_MspInit(hrtc);
+    }
+    if ((RCC->BDCR & RCC_BDCR_RTCEN) == 0 || getRtcClock() == 0)
+    {
+        hrtc->State = HAL_RTC_STATE_ERROR;
+        return HAL_ERROR;
+    }
+    hrtc->Instance->CR = (hrtc->Instance->CR & ~(RTC_CR_FMT | RTC_CR_OSEL | RTC_CR_POL))
+                         | hrtc->Init.HourFormat | hrtc->Init.OutPut | hrtc->Init.OutPutPolarity;
+    hrtc->Instance->PRER = hrtc->Init.SynchPrediv | (hrtc->Init.AsynchPrediv << 16U);
+    hrtc->Instance->ISR |= RTC_ISR_INITS | RTC_ISR_RSF;
+    hrtc->State = HAL_RTC_STATE_READY;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_RTC_DeInit (RTC_HandleTypeDef * hrtc)
+{
+    halCall();
+    hrtc->Instance->TR = hrtc->Instance->DR = 0;
+    hrtc->Instance->CR = 0;
+    hrtc->Instance->WUTR = 0xFFFF;
+    hrtc->Instance->PRER = 0x007F00FF;
+    hrtc->Instance->ISR = 0;
+    HAL_RTC_MspDeInit(hrtc);
+    hrtc->State = HAL_RTC_STATE_RESET;
+    __HAL_UNLOCK(hrtc);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_RTC_SetTime (RTC_HandleTypeDef * hrtc, RTC_TimeTypeDef * sTime, uint32_t Format)
+{
+    halCall();
+    uint32_t hours = sTime->Hours, minutes = sTime->Minutes, seconds = sTime->Seconds;
+    if (Format == RTC_FORMAT_BIN)
+    {
+        hours = RTC_ByteToBcd2(sTime->Hours);
+        minutes = RTC_ByteToBcd2(sTime->Minutes);
+        seconds = RTC_ByteToBcd2(sTime->Seconds);
+    }
+    hrtc->Instance->TR = ((hours << 16) | (minutes << 8) | seconds | ((uint32_t) sTime->TimeFormat << 16))
+                         & RTC_TR_RESERVED_MASK;
+    hrtc->State = HAL_RTC_STATE_READY;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_RTC_SetDate (RTC_HandleTypeDef * hrtc, RTC_DateTypeDef * sDate, uint32_t Format)
+{
+    halCall();
+    uint32_t year = sDate->Year, month = sDate->Month, date = sDate->Date;
+    if (Format == RTC_FORMAT_BIN)
+    {
+        year = RTC_ByteToBcd2(sDate->Year);
+        month = RTC_ByteToBcd2(sDate->Month);
+        date = RTC_ByteToBcd2(sDate->Date);
+    }
+    hrtc->Instance->DR = ((year << 16) | (month << 8) | date | ((uint32_t) sDate->WeekDay << 13))
+                         & RTC_DR_RESERVED_MASK;
+    hrtc->State = HAL_RTC_STATE_READY;
+    return HAL_OK;
+}
+
+uint8_t RTC_ByteToBcd2 (uint8_t Value)
+{
+    return (uint8_t) (((Value / 10U) << 4U) | (Value % 10U));
+}
+
+uint8_t RTC_Bcd2ToByte (uint8_t Value)
+{
+    return (uint8_t) (((Value & 0xF0U) >> 4U) * 10U + (Value & 0x0FU));
+}
+
+__weak void HAL_RTC_MspInit (RTC_HandleTypeDef * hrtc)
+{
+    // empty
+}
+
+__weak void HAL_RTC_MspDeInit (RTC_HandleTypeDef * hrtc)
+{
+    // empty
+}
+
+/************************************************************************
+ * HAL: RTCEx
+ ************************************************************************/
+
+HAL_StatusTypeDef HAL_RTCEx_SetWakeUpTimer_IT (RTC_HandleTypeDef * hrtc, uint32_t WakeUpCounter,
+                                               uint32_t WakeUpClock)
+{
+    halCall();
+    const uint32_t clock = getRtcClock();
+    if (clock == 0)
+    {
+        hrtc->State = HAL_RTC_STATE_TIMEOUT;
+        return HAL_TIMEOUT;
+    }
+    hrtc->State = HAL_RTC_STATE_BUSY;
+    HAL_RTCEx_DeactivateWakeUpTimer(hrtc);
+    hrtc->Instance->WUTR = WakeUpCounter;
+    hrtc->Instance->CR = (hrtc->Instance->CR & ~RTC_CR_WUCKSEL) | WakeUpClock | RTC_CR_WUTIE | RTC_CR_WUTE;
+    EXTI->IMR |= RTC_EXTI_LINE_WAKEUPTIMER_EVENT;
+    EXTI->RTSR |= RTC_EXTI_LINE_WAKEUPTIMER_EVENT;
+
+    // RTCCLK / 16, 8, 4 or 2, otherwise the 1 Hz ck_spre (17 bits: the counter plus 2^16)
+    uint64_t period;
+    if (WakeUpClock < RTC_WAKEUPCLOCK_CK_SPRE_16BITS)
+    {
+        period = (uint64_t) (WakeUpCounter + 1) * (16U >> WakeUpClock) * 1000000000ULL / clock;
+    }
+    else
+    {
+        const uint64_t prescaler = (uint64_t) ((hrtc->Instance->PRER >> 16) + 1) * ((hrtc->Instance->PRER & 0x7FFF) + 1);
+        const uint64_t counts = WakeUpCounter + 1 + (WakeUpClock == RTC_WAKEUPCLOCK_CK_SPRE_17BITS ? 0x10000 : 0);
+        period = counts * prescaler * 1000000000ULL / clock;
+    }
+    getWakeUpTimer().handle = hrtc;
+    scheduleWakeUp(period);
+    trace("RTC", "wakeup timer %llu us", (unsigned long long) (period / 1000));
+    hrtc->State = HAL_RTC_STATE_READY;
+    return HAL_OK;
+}
+
+uint32_t HAL_RTCEx_DeactivateWakeUpTimer (RTC_HandleTypeDef * hrtc)
+{
+    halCall();
+    cancel(&getWakeUpTimer());
+    hrtc->Instance->CR &= ~(RTC_CR_WUTE | RTC_CR_WUTIE);
+    hrtc->Instance->ISR &= ~RTC_ISR_WUTF;
+    return HAL_OK;
+}
+
+void HAL_RTCEx_WakeUpTimerIRQHandler (RTC_HandleTypeDef * hrtc)
+{
+    halCall();
+    if ((hrtc->Instance->CR & RTC_CR_WUTIE) && (hrtc->Instance->ISR & RTC_ISR_WUTF))
+    {
+        HAL_RTCEx_WakeUpTimerEventCallback(hrtc);
+        hrtc->Instance->ISR &= ~RTC_ISR_WUTF;
+    }
+    EXTI->PR &= ~RTC_EXTI_LINE_WAKEUPTIMER_EVENT;
+    hrtc->State = HAL_RTC_STATE_READY;
+}
+
+__weak void HAL_RTCEx_WakeUpTimerEventCallback (RTC_HandleTypeDef * hrtc)
+{
+    // empty
+}
+
+#endif
@@ -0,0 +1,229 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+#ifdef HAL_SIMULATION
+
+#include "hal_sim_internal.h"
+
+/*
+ * The vector table of startup/startup_stm32f405xx.s. The handlers are weak references:
+ * an entry is NULL if the firmware does not define the handler, where the startup code
+ * would branch to Default_Handler.
+ */
+extern "C"
+{
+    void Reset_Handler (void) __attribute__((weak));
+    void NMI_Handler (void) __attribute__((weak));
+    void HardFault_Handler (void) __attribute__((weak));
+    void MemManage_Handler (void) __attribute__((weak));
+    void BusFault_Handler (void) __attribute__((weak));
+    void UsageFault_Handler (void) __attribute__((weak));
+    void SVC_Handler (void) __attribute__((weak));
+    void DebugMon_Handler (void) __attribute__((weak));
+    void PendSV_Handler (void) __attribute__((weak));
+    void SysTick_Handler (void) __attribute__((weak));
+    void WWDG_IRQHandler (void) __attribute__((weak));
+    void PVD_IRQHandler (void) __attribute__((weak));
+    void TAMP_STAMP_IRQHandler (void) __attribute__((weak));
+    void RTC_WKUP_IRQHandler (void) __attribute__((weak));
+    void FLASH_IRQHandler (void) __attribute__((weak));
+    void RCC_IRQHandler (void) __attribute__((weak));
+    void EXTI0_IRQHandler (void) __attribute__((weak));
+    void EXTI1_IRQHandler (void) __attribute__((weak));
+    void EXTI2_IRQHandler (void) __attribute__((weak));
+    void EXTI3_IRQHandler (void) __attribute__((weak));
+    void EXTI4_IRQHandler (void) __attribute__((weak));
+    void DMA1_Stream0_IRQHandler (void) __attribute__((weak));
+    void DMA1_Stream1_IRQHandler (void) __attribute__((weak));
+    void DMA1_Stream2_IRQHandler (void) __attribute__((weak));
+    void DMA1_Stream3_IRQHandler (void) __attribute__((weak));
+    void DMA1_Stream4_IRQHandler (void) __attribute__((weak));
+    void DMA1_Stream5_IRQHandler (void) __attribute__((weak));
+    void DMA1_Stream6_IRQHandler (void) __attribute__((weak));
+    void ADC_IRQHandler (void) __attribute__((weak));
+    void CAN1_TX_IRQHandler (void) __attribute__((weak));
+    void CAN1_RX0_IRQHandler (void) __attribute__((weak));
+    void CAN1_RX1_IRQHandler (void) __attribute__((weak));
+    void CAN1_SCE_IRQHandler (void) __attribute__((weak));
+    void EXTI9_5_IRQHandler (void) __attribute__((weak));
+    void TIM1_BRK_TIM9_IRQHandler (void) __attribute__((weak));
+    void TIM1_UP_TIM10_IRQHandler (void) __attribute__((weak));
+    void TIM1_TRG_COM_TIM11_IRQHandler (void) __attribute__((weak));
+    void TIM1_CC_IRQHandler (void) __attribute__((weak));
+    void TIM2_IRQHandler (void) __attribute__((weak));
+    void TIM3_IRQHandler (void) __attribute__((weak));
+    void TIM4_IRQHandler (void) __attribute__((weak));
+    void I2C1_EV_IRQHandler (void) __attribute__((weak));
+    void I2C1_ER_IRQHandler (void) __attribute__((weak));
+    void I2C2_EV_IRQHandler (void) __attribute__((weak));
+    void I2C2_ER_IRQHandler (void) __attribute__((weak));
+    void SPI1_IRQHandler (void) __attribute__((weak));
+    void SPI2_IRQHandler (void) __attribute__((weak));
+    void USART1_IRQHandler (void) __attribute__((weak));
+    void USART2_IRQHandler (void) __attribute__((weak));
+    void USART3_IRQHandler (void) __attribute__((weak));
+    void EXTI15_10_IRQHandler (void) __attribute__((weak));
+    void RTC_Alarm_IRQHandler (void) __attribute__((weak));
+    void OTG_FS_WKUP_IRQHandler (void) __attribute__((weak));
+    void TIM8_BRK_TIM12_IRQHandler (void) __attribute__((weak));
+    void TIM8_UP_TIM13_IRQHandler (void) __attribute__((weak));
+    void TIM8_TRG_COM_TIM14_IRQHandler (void) __attribute__((weak));
+    void TIM8_CC_IRQHandler (void) __attribute__((weak));
+    void DMA1_Stream7_IRQHandler (void) __attribute__((weak));
+    void FSMC_IRQHandler (void) __attribute__((weak));
+    void SDIO_IRQHandler (void) __attribute__((weak));
+    void TIM5_IRQHandler (void) __attribute__((weak));
+    void SPI3_IRQHandler (void) __attribute__((weak));
+    void UART4_IRQHandler (void) __attribute__((weak));
+    void UART5_IRQHandler (void) __attribute__((weak));
+    void TIM6_DAC_IRQHandler (void) __attribute__((weak));
+    void TIM7_IRQHandler (void) __attribute__((weak));
+    void DMA2_Stream0_IRQHandler (void) __attribute__((weak));
+    void DMA2_Stream1_IRQHandler (void) __attribute__((weak));
+    void DMA2_Stream2_IRQHandler (void) __attribute__((weak));
+    void DMA2_Stream3_IRQHandler (void) __attribute__((weak));
+    void DMA2_Stream4_IRQHandler (void) __attribute__((weak));
+    void CAN2_TX_IRQHandler (void) __attribute__((weak));
+    void CAN2_RX0_IRQHandler (void) __attribute__((weak));
+    void CAN2_RX1_IRQHandler (void) __attribute__((weak));
+    void CAN2_SCE_IRQHandler (void) __attribute__((weak));
+    void OTG_FS_IRQHandler (void) __attribute__((weak));
+    void DMA2_Stream5_IRQHandler (void) __attribute__((weak));
+    void DMA2_Stream6_IRQHandler (void) __attribute__((weak));
+    void DMA2_Stream7_IRQHandler (void) __attribute__((weak));
+    void USART6_IRQHandler (void) __attribute__((weak));
+    void I2C3_EV_IRQHandler (void) __attribute__((weak));
+    void I2C3_ER_IRQHandler (void) __attribute__((weak));
+    void OTG_HS_EP1_OUT_IRQHandler (void) __attribute__((weak));
+    void OTG_HS_EP1_IN_IRQHandler (void) __attribute__((weak));
+    void OTG_HS_WKUP_IRQHandler (void) __attribute__((weak));
+    void OTG_HS_IRQHandler (void) __attribute__((weak));
+    void HASH_RNG_IRQHandler (void) __attribute__((weak));
+    void FPU_IRQHandler (void) __attribute__((weak));
+}
+
+namespace HalSim
+{
+
+const IrqHandler VECTOR_TABLE[VECTOR_COUNT] =
+{
+    NULL,
+    Reset_Handler,
+    NMI_Handler,
+    HardFault_Handler,
+    MemManage_Handler,
+    BusFault_Handler,
+    UsageFault_Handler,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    SVC_Handler,
+    DebugMon_Handler,
+    NULL,
+    PendSV_Handler,
+    SysTick_Handler,
+    WWDG_IRQHandler,
+    PVD_IRQHandler,
+    TAMP_STAMP_IRQHandler,
+    RTC_WKUP_IRQHandler,
+    FLASH_IRQHandler,
+    RCC_IRQHandler,
+    EXTI0_IRQHandler,
+    EXTI1_IRQHandler,
+    EXTI2_IRQHandler,
+    EXTI3_IRQHandler,
+    EXTI4_IRQHandler,
+    DMA1_Stream0_IRQHandler,
+    DMA1_Stream1_IRQHandler,
+    DMA1_Stream2_IRQHandler,
+    DMA1_Stream3_IRQHandler,
+    DMA1_Stream4_IRQHandler,
+    DMA1_Stream5_IRQHandler,
+    DMA1_Stream6_IRQHandler,
+    ADC_IRQHandler,
+    CAN1_TX_IRQHandler,
+    CAN1_RX0_IRQHandler,
+    CAN1_RX1_IRQHandler,
+    CAN1_SCE_IRQHandler,
+    EXTI9_5_IRQHandler,
+    TIM1_BRK_TIM9_IRQHandler,
+    TIM1_UP_TIM10_IRQHandler,
+    TIM1_TRG_COM_TIM11_IRQHandler,
+    TIM1_CC_IRQHandler,
+    TIM2_IRQHandler,
+    TIM3_IRQHandler,
+    TIM4_IRQHandler,
+    I2C1_EV_IRQHandler,
+    I2C1_ER_IRQHandler,
+    I2C2_EV_IRQHandler,
+    I2C2_ER_IRQHandler,
+    SPI1_IRQHandler,
+    SPI2_IRQHandler,
+    USART1_IRQHandler,
+    USART2_IRQHandler,
+    USART3_IRQHandler,
+    EXTI15_10_IRQHandler,
+    RTC_Alarm_IRQHandler,
+    OTG_FS_WKUP_IRQHandler,
+    TIM8_BRK_TIM12_IRQHandler,
+    TIM8_UP_TIM13_IRQHandler,
+    TIM8_TRG_COM_TIM14_IRQHandler,
+    TIM8_CC_IRQHandler,
+    DMA1_Stream7_IRQHandler,
+    FSMC_IRQHandler,
+    SDIO_IRQHandler,
+    TIM5_IRQHandler,
+    SPI3_IRQHandler,
+    UART4_IRQHandler,
+    UART5_IRQHandler,
+    TIM6_DAC_IRQHandler,
+    TIM7_IRQHandler,
+    DMA2_Stream0_IRQHandler,
+    DMA2_Stream1_IRQHandler,
+    DMA2_Stream2_IRQHandler,
+    DMA2_Stream3_IRQHandler,
+    DMA2_Stream4_IRQHandler,
+    NULL,
+    NULL,
+    CAN2_TX_IRQHandler,
+    CAN2_RX0_IRQHandler,
+    CAN2_RX1_IRQHandler,
+    CAN2_SCE_IRQHandler,
+    OTG_FS_IRQHandler,
+    DMA2_Stream5_IRQHandler,
+    DMA2_Stream6_IRQHandler,
+    DMA2_Stream7_IRQHandler,
+    USART6_IRQHandler,
+    I2C3_EV_IRQHandler,
+    I2C3_ER_IRQHandler,
+    OTG_HS_EP1_OUT_IRQHandler,
+    OTG_HS_EP1_IN_IRQHandler,
+    OTG_HS_WKUP_IRQHandler,
+    OTG_HS_IRQHandler,
+    NULL,
+    NULL,
+    HASH_RNG_IRQHandler,
+    FPU_IRQHandler
+};
+
+} // end of namespace HalSim
+
+#endif
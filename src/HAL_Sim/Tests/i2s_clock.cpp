@@ -0,0 +1,151 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+/*
+ * Test of the PLLI2S solver across the sample rates from 8 kHz to 96 kHz: the settings
+ * found by I2SClock::solve shall be within the ranges of RM0090, the reported rate shall
+ * match the datasheet formula, and no other PLLI2SN/PLLI2SR/I2SDIV combination shall
+ * come closer to the requested rate.
+ */
+
+#ifdef HAL_SIMULATION
+
+#include "stm32async/I2S.h"
+
+#include <cmath>
+#include <cstdio>
+
+using namespace Stm32async;
+
+namespace
+{
+
+uint32_t failures = 0;
+
+struct Clock
+{
+    uint32_t sourceFreq, pllM;
+};
+
+/**
+ * @brief Sample rate by RM0090 in double precision.
+ */
+double getDatasheetFreq (const Clock & clock, uint32_t n, uint32_t r, uint32_t div, uint32_t dataFormat, bool mclk)
+{
+    const double i2sClk = (double) clock.sourceFreq / clock.pllM * n / r;
+    const double channelBits = (dataFormat == I2S_DATAFORMAT_16B) ? 16.0 : 32.0;
+    return mclk ? i2sClk / (256.0 * div) : i2sClk / (channelBits * 2.0 * div);
+}
+
+/**
+ * @brief The smallest error of all valid settings, by an exhaustive search in double precision.
+ */
+double getBestError (const Clock & clock, uint32_t audioFreq, uint32_t dataFormat, bool mclk)
+{
+    double best = INFINITY;
+    for (uint32_t n = I2SClock::PLLI2SN_MIN; n <= I2SClock::PLLI2SN_MAX; ++n)
+    {
+        const double vco = (double) clock.sourceFreq / clock.pllM * n;
+        if (vco < I2SClock::VCO_OUTPUT_MIN || vco > I2SClock::VCO_OUTPUT_MAX)
+        {
+            continue;
+        }
+        for (uint32_t r = I2SClock::PLLI2SR_MIN; r <= I2SClock::PLLI2SR_MAX; ++r)
+        {
+            for (uint32_t div = 2 * I2SClock::I2SDIV_MIN; div <= 2 * I2SClock::I2SDIV_MAX + 1; ++div)
+            {
+                const double f = getDatasheetFreq(clock, n, r, div, dataFormat, mclk);
+                best = std::min(best, std::fabs(f - audioFreq) / audioFreq * 1.0e6);
+            }
+        }
+    }
+    return best;
+}
+
+void check (const Clock & clock, uint32_t audioFreq, uint32_t dataFormat, bool mclk)
+{
+    char name[64];
+    ::snprintf(name, sizeof(name), "%u/%u: %6u Hz %2d bit%s", (unsigned) clock.sourceFreq, (unsigned) clock.pllM,
+               (unsigned) audioFreq, dataFormat == I2S_DATAFORMAT_16B ? 16 : 32, mclk ? ", MCLK" : "");
+
+    I2SClock::Settings s;
+    const I2SClock solver(clock.sourceFreq, clock.pllM);
+    if (!solver.solve(audioFreq, dataFormat, mclk ? I2S_MCLKOUTPUT_ENABLE : I2S_MCLKOUTPUT_DISABLE, s))
+    {
+        printf("FAIL %s: no settings\n", name);
+        ++failures;
+        return;
+    }
+    const double vco = (double) clock.sourceFreq / clock.pllM * s.PLLI2SN;
+    if (s.PLLI2SN < I2SClock::PLLI2SN_MIN || s.PLLI2SN > I2SClock::PLLI2SN_MAX
+        || s.PLLI2SR < I2SClock::PLLI2SR_MIN || s.PLLI2SR > I2SClock::PLLI2SR_MAX
+        || s.I2SDIV < I2SClock::I2SDIV_MIN || s.I2SDIV > I2SClock::I2SDIV_MAX || s.ODD > 1
+        || vco < I2SClock::VCO_OUTPUT_MIN || vco > I2SClock::VCO_OUTPUT_MAX)
+    {
+        printf("FAIL %s: N=%u R=%u DIV=%u ODD=%u out of range\n", name, (unsigned) s.PLLI2SN,
+               (unsigned) s.PLLI2SR, (unsigned) s.I2SDIV, (unsigned) s.ODD);
+        ++failures;
+        return;
+    }
+
+    // The reported rate and error shall be the ones of the datasheet formula
+    const double expected = getDatasheetFreq(clock, s.PLLI2SN, s.PLLI2SR, 2 * s.I2SDIV + s.ODD, dataFormat, mclk);
+    const double expectedPpm = (expected - audioFreq) / audioFreq * 1.0e6;
+    if (std::fabs(s.achievedFreq - expected) > expected * 1.0e-6
+        || std::fabs(solver.getAudioFreq(s, dataFormat) - expected) > expected * 1.0e-6
+        || std::fabs(s.ppmError - expectedPpm) > 1.0)
+    {
+        printf("FAIL %s: achieved %.3f Hz (%.1f ppm), datasheet %.3f Hz (%.1f ppm)\n", name, s.achievedFreq,
+               s.ppmError, expected, expectedPpm);
+        ++failures;
+        return;
+    }
+
+    // No other settings shall be better
+    const double best = getBestError(clock, audioFreq, dataFormat, mclk);
+    if (std::fabs(expectedPpm) > best + 1.0)
+    {
+        printf("FAIL %s: %.1f ppm, but %.1f ppm is possible\n", name, std::fabs(expectedPpm), best);
+        ++failures;
+        return;
+    }
+    printf("OK   %s: N=%3u R=%u DIV=%3u ODD=%u, %.3f Hz, %+.1f ppm\n", name, (unsigned) s.PLLI2SN,
+           (unsigned) s.PLLI2SR, (unsigned) s.I2SDIV, (unsigned) s.ODD, expected, expectedPpm);
+}
+
+} // end of anonymous namespace
+
+int main ()
+{
+    // The board (16 MHz HSE, PLLM = 16) and the usual 8 MHz crystal with PLLM = 8 and 4
+    const Clock clocks[] = { { 16000000, 16 }, { 8000000, 8 }, { 8000000, 4 } };
+    const uint32_t rates[] = { 8000, 11025, 16000, 22050, 32000, 44100, 48000, 88200, 96000 };
+    for (const Clock & clock : clocks)
+    {
+        for (uint32_t rate : rates)
+        {
+            check(clock, rate, I2S_DATAFORMAT_16B, false);
+            check(clock, rate, I2S_DATAFORMAT_24B, false);
+            check(clock, rate, I2S_DATAFORMAT_16B, true);
+        }
+    }
+    return failures == 0 ? 0 : 1;
+}
+
+#endif
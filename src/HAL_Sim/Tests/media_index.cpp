@@ -0,0 +1,263 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+/*
+ * Persistent media index on a FAT image formatted by FatFS:
+ *
+ * - Full scan: every WAV file below the root directory (long names and nested directories
+ *   included) is indexed with its format and duration, other files are ignored.
+ * - Reload: a new index (like after a reset) loads the index file and validates it by the
+ *   directory signatures without opening any WAV file.
+ * - Incremental rescan: after a file is added to one directory, only this directory is
+ *   scanned again.
+ * - Volume serial change: the serial number in the boot sector of the image is changed, so
+ *   the card looks like a different one and the whole card is scanned again.
+ * - Corrupt index file: a flipped byte fails the checksum and the card is scanned again.
+ */
+
+#ifdef HAL_SIMULATION
+
+#include "streaming_setup.h"
+#include "stm32async/Drivers/MediaIndex.h"
+
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace Stm32async;
+using namespace Stm32async::Drivers;
+
+namespace
+{
+
+constexpr char IMAGE_NAME[] = "build/tests/media_index.img";
+constexpr char INDEX_FILE[] = "index.bin";
+constexpr uint32_t CLUSTER_SIZE = 2048;
+
+struct Track
+{
+    std::string path;
+    uint32_t sampleRate;
+    uint16_t channels, bitsPerSample;
+    uint32_t frames;
+};
+
+uint32_t failures = 0;
+
+void check (bool condition, const char * name)
+{
+    printf("%s %s\n", condition ? "OK  " : "FAIL", name);
+    if (!condition)
+    {
+        ++failures;
+    }
+}
+
+bool writeFile (const char * path, const void * data, UINT size)
+{
+    FIL file;
+    UINT written = 0;
+    if (f_open(&file, path, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK)
+    {
+        return false;
+    }
+    const bool ok = f_write(&file, data, size, &written) == FR_OK && written == size;
+    return f_close(&file) == FR_OK && ok;
+}
+
+/**
+ * @brief Writes a silent track; the sample data behind the header is not read by the index.
+ */
+bool writeTrack (const Track & t)
+{
+    const WavStreamer::WavHeader h = StreamingSetup::getWavHeader(t.sampleRate, t.channels, t.bitsPerSample, t.frames);
+    std::vector<uint8_t> data(sizeof(h.header) + t.frames * t.channels * t.bitsPerSample / 8);
+    ::memcpy(data.data(), h.header, sizeof(h.header));
+    return writeFile(t.path.c_str(), data.data(), (UINT) data.size());
+}
+
+/**
+ * @brief Checks that every track is indexed with its format and duration.
+ */
+bool isIndexed (const MediaIndex & index, const std::vector<Track> & tracks)
+{
+    for (const Track & t : tracks)
+    {
+        const MediaIndex::Entry * e = index.find(t.path.c_str());
+        if (e == NULL || e->sampleRate != t.sampleRate || e->numOfChan != t.channels
+            || e->bitsPerSample != t.bitsPerSample || e->duration != (uint32_t) ((uint64_t) t.frames * 1000 / t.sampleRate))
+        {
+            printf("     %s is not indexed correctly\n", t.path.c_str());
+            return false;
+        }
+    }
+    return index.getSize() == tracks.size();
+}
+
+/**
+ * @brief Runs update() on a new index, like after a reset, and counts the sectors read.
+ */
+std::unique_ptr<MediaIndex> updateNew (StreamingSetup & s, bool & updated, uint32_t & reads)
+{
+    std::unique_ptr<MediaIndex> index(new MediaIndex(s.sdCard, INDEX_FILE));
+    HalSim::clearTrace();
+    updated = index->update();
+    reads = 0;
+    for (const HalSim::TraceRecord & r : HalSim::getTrace())
+    {
+        unsigned long long sector = 0;
+        unsigned long blocks = 0;
+        if (r.bus == "SDIO" && ::sscanf(r.text.c_str(), "R %llu +%lu", &sector, &blocks) == 2)
+        {
+            reads += (uint32_t) blocks;
+        }
+    }
+    return index;
+}
+
+/**
+ * @brief Changes the volume serial number in the boot sector of the removed image.
+ */
+bool changeSerialNumber (uint32_t volumeBase, bool fat32)
+{
+    FILE * f = ::fopen(IMAGE_NAME, "r+b");
+    if (f == NULL)
+    {
+        return false;
+    }
+    // BS_VolID of FAT12/16, BS_VolID of FAT32
+    const long offset = (long) volumeBase * 512 + (fat32 ? 67 : 39);
+    uint8_t sn[4];
+    bool ok = ::fseek(f, offset, SEEK_SET) == 0 && ::fread(sn, 1, sizeof(sn), f) == sizeof(sn);
+    sn[0] ^= 0x5A;
+    ok = ok && ::fseek(f, offset, SEEK_SET) == 0 && ::fwrite(sn, 1, sizeof(sn), f) == sizeof(sn);
+    return ::fclose(f) == 0 && ok;
+}
+
+/**
+ * @brief Flips a byte of the first index entry in the index file.
+ */
+bool corruptIndexFile ()
+{
+    FIL file;
+    UINT n = 0;
+    uint8_t b = 0;
+    const DWORD offset = sizeof(MediaIndex::FileHeader) + sizeof(MediaIndex::Directory);
+    if (f_open(&file, INDEX_FILE, FA_READ | FA_WRITE) != FR_OK)
+    {
+        return false;
+    }
+    bool ok = f_lseek(&file, offset) == FR_OK && f_read(&file, &b, 1, &n) == FR_OK && n == 1;
+    b ^= 0x01;
+    ok = ok && f_lseek(&file, offset) == FR_OK && f_write(&file, &b, 1, &n) == FR_OK && n == 1;
+    return f_close(&file) == FR_OK && ok;
+}
+
+} // end of anonymous namespace
+
+int main ()
+{
+    HAL_Init();
+    HalSim::setConsole(::getenv("HAL_SIM_CONSOLE") != NULL);
+
+    StreamingSetup s;
+    s.start();
+    if (!s.format(IMAGE_NAME, 16, CLUSTER_SIZE))
+    {
+        printf("FAIL can not format %s\n", IMAGE_NAME);
+        return 1;
+    }
+
+    std::vector<Track> tracks = {
+        { "a.wav", 44100, 2, 16, 44100 },
+        { "B.WAV", 48000, 1, 16, 24000 },
+        { "music/Long File Name Track 01.wav", 96000, 2, 24, 192000 },
+        { "music/Long File Name Track 02.wav", 44100, 2, 16, 88200 },
+        { "music/short.wav", 22050, 1, 8, 11025 },
+        { "music/live/Concert Part 1.wav", 48000, 2, 32, 96000 },
+        { "music/live/Concert Part 2.wav", 48000, 2, 32, 48000 },
+        { "other/x1.wav", 32000, 2, 16, 64000 },
+        { "other/x2.wav", 16000, 1, 16, 8000 },
+    };
+    const char readme[] = "not a track";
+    bool written = f_mkdir("music") == FR_OK && f_mkdir("music/live") == FR_OK && f_mkdir("other") == FR_OK
+                   && writeFile("other/readme.txt", readme, sizeof(readme));
+    for (const Track & t : tracks)
+    {
+        written = written && writeTrack(t);
+    }
+    if (!written)
+    {
+        printf("FAIL can not write the tracks\n");
+        return 1;
+    }
+
+    // Full scan of a card without index file
+    bool updated = false;
+    uint32_t scanReads = 0, reloadReads = 0, reads = 0;
+    std::unique_ptr<MediaIndex> index = updateNew(s, updated, scanReads);
+    check(updated && isIndexed(*index, tracks) && index->find("other/readme.txt") == NULL
+          && index->find("/MUSIC/long file name track 01.WAV") == index->find("music/Long File Name Track 01.wav")
+          && index->getScannedFiles() == tracks.size() && index->getScannedDirectories() == 4,
+          "the full scan indexes all WAV files");
+
+    // Reload after a reset
+    index = updateNew(s, updated, reloadReads);
+    printf("BENCH full scan: %u sectors read, reload: %u sectors read\n", (unsigned) scanReads, (unsigned) reloadReads);
+    check(updated && isIndexed(*index, tracks) && index->getScannedFiles() == 0
+          && index->getScannedDirectories() == 0 && reloadReads < scanReads,
+          "the index is reloaded without opening the files");
+
+    // A file is added to one directory
+    tracks.push_back({ "other/x3.wav", 44100, 2, 16, 22050 });
+    writeTrack(tracks.back());
+    index = updateNew(s, updated, reads);
+    check(updated && isIndexed(*index, tracks) && index->getScannedDirectories() == 1 && index->getScannedFiles() == 3,
+          "only the changed directory is scanned again");
+
+    // The same index on a card with another serial number
+    const uint32_t volumeBase = s.sdCard.getFatFs().key.volbase;
+    const bool fat32 = s.sdCard.getFatFs().key.fs_type == FS_FAT32;
+    const uint32_t oldSN = s.sdCard.getFatFs().volumeSN;
+    s.remove();
+    while (s.sdCard.getMountState() != SdCardFat::MountState::NO_CARD)
+    {
+        s.sdCard.periodic();
+        HAL_Delay(1);
+    }
+    const bool changed = changeSerialNumber(volumeBase, fat32) && s.insert(IMAGE_NAME) && s.mount();
+    const bool sameIndex = index->update();
+    check(changed && s.sdCard.getFatFs().volumeSN != oldSN && sameIndex && isIndexed(*index, tracks)
+          && index->getScannedFiles() == tracks.size(), "a new volume serial number causes a full scan");
+
+    // A corrupt index file
+    const bool corrupted = corruptIndexFile();
+    index = updateNew(s, updated, reads);
+    check(corrupted && updated && isIndexed(*index, tracks) && index->getScannedFiles() == tracks.size(),
+          "a corrupt index file causes a full scan");
+    index = updateNew(s, updated, reads);
+    check(updated && index->getScannedFiles() == 0, "the rebuilt index file is valid");
+
+    s.remove();
+    ::remove(IMAGE_NAME);
+    return failures == 0 ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,253 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+/*
+ * Accuracy test of the parametric equalizer against its float reference:
+ *
+ * - Magnitude: for each band type, a sine is filtered by the fixed-point cascade after the
+ *   band transitions are finished, and its gain (fitted by least squares) is compared with
+ *   getResponse() at several frequencies. This includes two stacked +12 dB low shelves.
+ * - Headroom: the stacked shelves boost a -6 dBFS bass sine beyond the full scale. The
+ *   output shall be the float cascade saturated to 16 bits, i.e. clipped and not wrapped.
+ * - Limits: a band that would raise the summed boost (including the overshoot of a shelf
+ *   with high Q) beyond MAX_BOOST is rejected.
+ */
+
+#ifdef HAL_SIMULATION
+
+#include "stm32async/Drivers/ParametricEq.h"
+
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+using namespace Stm32async::Drivers;
+
+namespace
+{
+
+typedef ParametricEq::Band Band;
+typedef ParametricEq::BandType BandType;
+
+constexpr uint32_t SAMPLE_RATE = 48000;
+constexpr uint32_t BLOCK_FRAMES = 256;
+constexpr uint32_t SETTLE_FRAMES = 8192;
+constexpr uint32_t FIT_FRAMES = 16384;
+constexpr double MAX_DEVIATION = 0.1; // dB
+
+uint32_t failures = 0;
+
+void check (bool condition, const char * name)
+{
+    printf("%s %s\n", condition ? "OK  " : "FAIL", name);
+    if (!condition)
+    {
+        ++failures;
+    }
+}
+
+/**
+ * @brief Sets the bands and runs silence through the equalizer until the transitions are done.
+ */
+bool setBands (ParametricEq & eq, uint32_t dataFormat, const std::vector<Band> & bands)
+{
+    eq.configure(SAMPLE_RATE, dataFormat);
+    for (uint32_t b = 0; b < ParametricEq::MAX_BANDS; ++b)
+    {
+        Band band = eq.getBand(b);
+        band.enabled = false;
+        if (!eq.setBand(b, b < bands.size() ? bands[b] : band))
+        {
+            return false;
+        }
+    }
+    std::vector<uint16_t> block(4 * BLOCK_FRAMES);
+    for (uint32_t i = 0; i < 200; ++i)
+    {
+        std::fill(block.begin(), block.end(), 0);
+        eq.process(block.data(), BLOCK_FRAMES);
+    }
+    return true;
+}
+
+/**
+ * @brief Filters a sine of the given amplitude (relative to the full scale) and returns the
+ *        left channel of the output, in full scale units.
+ */
+std::vector<double> filterSine (ParametricEq & eq, bool wide, double freq, double amplitude, uint32_t frames)
+{
+    const uint32_t frameSize = wide ? 4 : 2;
+    std::vector<double> output;
+    std::vector<uint16_t> block(frameSize * BLOCK_FRAMES);
+    for (uint32_t done = 0; done < frames; done += BLOCK_FRAMES)
+    {
+        for (uint32_t i = 0; i < BLOCK_FRAMES; ++i)
+        {
+            const double v = amplitude * std::sin(2.0 * M_PI * freq * (done + i) / SAMPLE_RATE);
+            uint16_t * f = &block[frameSize * i];
+            if (wide)
+            {
+                const int32_t s = (int32_t) std::round(v * 8388607.0) << 8;
+                f[0] = f[2] = (uint16_t) ((uint32_t) s >> 16);
+                f[1] = f[3] = (uint16_t) s;
+            }
+            else
+            {
+                f[0] = f[1] = (uint16_t) (int16_t) std::round(v * 32767.0);
+            }
+        }
+        eq.process(block.data(), BLOCK_FRAMES);
+        for (uint32_t i = 0; i < BLOCK_FRAMES; ++i)
+        {
+            const uint16_t * f = &block[frameSize * i];
+            output.push_back(wide ? (int32_t) (((uint32_t) f[0] << 16) | f[1]) / 2147483648.0 :
+                                    (int16_t) f[0] / 32768.0);
+        }
+    }
+    return output;
+}
+
+/**
+ * @brief Returns the amplitude of a sine of the given frequency fitted to the samples.
+ */
+double fitAmplitude (const std::vector<double> & samples, uint32_t from, double freq)
+{
+    double ss = 0.0, cc = 0.0, sc = 0.0, sy = 0.0, cy = 0.0;
+    for (size_t i = from; i < samples.size(); ++i)
+    {
+        const double w = 2.0 * M_PI * freq * i / SAMPLE_RATE;
+        const double s = std::sin(w), c = std::cos(w);
+        ss += s * s;
+        cc += c * c;
+        sc += s * c;
+        sy += s * samples[i];
+        cy += c * samples[i];
+    }
+    const double det = ss * cc - sc * sc;
+    const double a = (sy * cc - cy * sc) / det, b = (cy * ss - sy * sc) / det;
+    return std::sqrt(a * a + b * b);
+}
+
+void checkResponse (const char * name, const std::vector<Band> & bands, bool wide, double amplitude,
+                    std::initializer_list<double> freqs)
+{
+    ParametricEq eq;
+    if (!setBands(eq, wide ? I2S_DATAFORMAT_24B : I2S_DATAFORMAT_16B, bands))
+    {
+        check(false, name);
+        return;
+    }
+    double worst = 0.0;
+    for (double freq : freqs)
+    {
+        const std::vector<double> out = filterSine(eq, wide, freq, amplitude, SETTLE_FRAMES + FIT_FRAMES);
+        const double measured = 20.0 * std::log10(fitAmplitude(out, SETTLE_FRAMES, freq) / amplitude);
+        const double reference = 20.0 * std::log10(eq.getResponse((float) freq));
+        printf("     %s: %.0f Hz: %.2f dB, reference %.2f dB\n", name, freq, measured, reference);
+        worst = std::max(worst, std::fabs(measured - reference));
+        // The next frequency starts from the silent state
+        setBands(eq, wide ? I2S_DATAFORMAT_24B : I2S_DATAFORMAT_16B, bands);
+    }
+    check(worst <= MAX_DEVIATION, name);
+}
+
+/**
+ * @brief Runs the float design of the bands as a double-precision cascade.
+ */
+std::vector<double> filterReference (const std::vector<Band> & bands, const std::vector<double> & input)
+{
+    std::vector<double> x = input;
+    for (const Band & band : bands)
+    {
+        float c[5];
+        ParametricEq::designBand(band, (float) SAMPLE_RATE, c);
+        double x1 = 0.0, x2 = 0.0, y1 = 0.0, y2 = 0.0;
+        for (double & v : x)
+        {
+            const double y = c[0] * v + c[1] * x1 + c[2] * x2 + c[3] * y1 + c[4] * y2;
+            x2 = x1;
+            x1 = v;
+            y2 = y1;
+            y1 = y;
+            v = y;
+        }
+    }
+    return x;
+}
+
+void checkHeadroom (const std::vector<Band> & bands)
+{
+    const double freq = 50.0, amplitude = 0.5;
+    ParametricEq eq;
+    setBands(eq, I2S_DATAFORMAT_16B, bands);
+    const std::vector<double> out = filterSine(eq, false, freq, amplitude, FIT_FRAMES);
+    std::vector<double> input(FIT_FRAMES);
+    for (uint32_t i = 0; i < FIT_FRAMES; ++i)
+    {
+        input[i] = std::round(amplitude * std::sin(2.0 * M_PI * freq * i / SAMPLE_RATE) * 32767.0) / 32768.0;
+    }
+    const std::vector<double> reference = filterReference(bands, input);
+    double worst = 0.0, peak = 0.0;
+    for (uint32_t i = 0; i < FIT_FRAMES; ++i)
+    {
+        const double expected = std::max(-1.0, std::min(32767.0 / 32768.0, reference[i]));
+        worst = std::max(worst, std::fabs(out[i] - expected));
+        peak = std::max(peak, std::fabs(reference[i]));
+    }
+    printf("     headroom: reference peak %.1f dBFS, largest error %.4f of the full scale\n",
+           20.0 * std::log10(peak), worst);
+    check(peak > 1.0 && worst < 0.02, "stacked boost beyond the full scale is clipped, not wrapped");
+}
+
+void checkLimits ()
+{
+    const Band shelf { BandType::LOW_SHELF, true, 100.0f, 12.0f, 0.707f };
+    const Band resonant { BandType::LOW_SHELF, true, 200.0f, -6.0f, 5.0f };
+    ParametricEq eq;
+    eq.configure(SAMPLE_RATE, I2S_DATAFORMAT_16B);
+    check(ParametricEq::getPeakGain(shelf) == 12.0f && ParametricEq::getPeakGain(resonant) > 0.0f
+          && ParametricEq::getPeakGain({ BandType::HIGH_SHELF, true, 5000.0f, 6.0f, 4.0f }) > 6.0f,
+          "the peak gain includes the overshoot of the shelves");
+    const bool accepted = eq.setBand(0, shelf) && eq.setBand(1, shelf);
+    check(accepted && !eq.setBand(2, shelf) && !eq.setBand(2, resonant)
+          && eq.setBand(2, { BandType::PEAKING, true, 1000.0f, -12.0f, 2.0f }),
+          "a band beyond the summed boost limit is rejected");
+}
+
+} // end of anonymous namespace
+
+int main ()
+{
+    const std::vector<Band> stacked = { { BandType::LOW_SHELF, true, 100.0f, 12.0f, 0.707f },
+                                        { BandType::LOW_SHELF, true, 100.0f, 12.0f, 0.707f } };
+    checkResponse("peaking", { { BandType::PEAKING, true, 1000.0f, 9.0f, 2.0f } }, true, 0.25,
+                  { 250.0, 700.0, 1000.0, 1500.0, 4000.0 });
+    checkResponse("peaking, 16 bit", { { BandType::PEAKING, true, 1000.0f, -9.0f, 2.0f } }, false, 0.5,
+                  { 250.0, 1000.0, 4000.0 });
+    checkResponse("low shelf", { { BandType::LOW_SHELF, true, 100.0f, -8.0f, 0.707f } }, true, 0.25,
+                  { 30.0, 100.0, 300.0, 1000.0 });
+    checkResponse("high shelf with overshoot", { { BandType::HIGH_SHELF, true, 6000.0f, 6.0f, 1.5f } }, true, 0.25,
+                  { 2000.0, 4500.0, 6000.0, 10000.0, 16000.0 });
+    checkResponse("stacked low shelves", stacked, true, 0.03, { 50.0, 100.0, 200.0, 1000.0 });
+    checkHeadroom(stacked);
+    checkLimits();
+    return failures == 0 ? 0 : 1;
+}
+
+#endif
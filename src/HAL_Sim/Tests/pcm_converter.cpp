@@ -0,0 +1,240 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+/*
+ * Golden-output test of the PCM conversion kernels: every kernel (format and channel
+ * number) converts a fixed input with unity and non-unity gain, including saturation,
+ * and the DMA buffer words and the meter snapshot are compared with the expected ones.
+ * The format check of the "fmt" chunk accepts only integer PCM, also in the extensible form.
+ */
+
+#ifdef HAL_SIMULATION
+
+#include "stm32async/Drivers/PcmConverter.h"
+
+#include <cstdio>
+#include <vector>
+
+using namespace Stm32async::Drivers;
+
+namespace
+{
+
+uint32_t failures = 0;
+
+struct Golden
+{
+    const char * name;
+    uint16_t bitsPerSample, channels;
+    float volume;
+    std::vector<uint8_t> input;
+    std::vector<uint16_t> output;
+};
+
+std::vector<uint8_t> words16 (std::initializer_list<int16_t> samples)
+{
+    std::vector<uint8_t> bytes;
+    for (int16_t s : samples)
+    {
+        bytes.push_back((uint8_t) s);
+        bytes.push_back((uint8_t) ((uint16_t) s >> 8));
+    }
+    return bytes;
+}
+
+std::vector<uint8_t> words32 (std::initializer_list<uint32_t> samples)
+{
+    std::vector<uint8_t> bytes;
+    for (uint32_t s : samples)
+    {
+        for (uint32_t i = 0; i < 4; ++i)
+        {
+            bytes.push_back((uint8_t) (s >> (8 * i)));
+        }
+    }
+    return bytes;
+}
+
+void check (const Golden & g)
+{
+    PcmConverter converter;
+    if (!converter.configure(g.bitsPerSample, g.channels))
+    {
+        printf("FAIL %s: not configured\n", g.name);
+        ++failures;
+        return;
+    }
+    converter.setVolume(g.volume);
+    const uint32_t frames = g.input.size() / converter.getInputFrameSize();
+    if (frames * converter.getOutputFrameSize() != g.output.size())
+    {
+        printf("FAIL %s: %d frames give %d half-words\n", g.name, (int) frames,
+               (int) (frames * converter.getOutputFrameSize()));
+        ++failures;
+        return;
+    }
+    // The guard word after the block shall not be written
+    std::vector<uint16_t> dst(g.output.size() + 1, 0xA5A5);
+    converter.convert(g.input.data(), dst.data(), frames);
+    for (size_t i = 0; i < g.output.size(); ++i)
+    {
+        if (dst[i] != g.output[i])
+        {
+            printf("FAIL %s: half-word %d is 0x%04X instead of 0x%04X\n", g.name, (int) i, dst[i], g.output[i]);
+            ++failures;
+            return;
+        }
+    }
+    if (dst.back() != 0xA5A5)
+    {
+        printf("FAIL %s: written beyond the block\n", g.name);
+        ++failures;
+        return;
+    }
+    printf("OK   %s\n", g.name);
+}
+
+void checkMeter ()
+{
+    PcmConverter converter;
+    converter.configure(16, 2);
+    const std::vector<uint8_t> input = words16({ 0x1234, -2, 0x7FFF, INT16_MIN, -100, 50 });
+    uint16_t dst[6];
+    converter.convert(input.data(), dst, 3);
+    LevelMeter::Snapshot s;
+    if (!converter.getLevelMeter().getSnapshot(s) || s.peak[0] != 0x7FFF || s.peak[1] != 0x7FFF
+        || s.clips[0] != 1 || s.clips[1] != 1 || s.blocks != 1)
+    {
+        printf("FAIL meter: peak %d/%d, clips %d/%d, blocks %d\n", s.peak[0], s.peak[1], (int) s.clips[0],
+               (int) s.clips[1], (int) s.blocks);
+        ++failures;
+        return;
+    }
+    printf("OK   meter\n");
+}
+
+void checkConfiguration ()
+{
+    PcmConverter converter;
+    uint32_t dataFormat = 0;
+    const bool ok = !converter.configure(12, 2) && !converter.configure(16, 3)
+        && converter.getFormat() == PcmConverter::Format::UNSUPPORTED
+        && PcmConverter::getI2sDataFormat(8, 1, dataFormat) && dataFormat == I2S_DATAFORMAT_16B
+        && PcmConverter::getI2sDataFormat(24, 2, dataFormat) && dataFormat == I2S_DATAFORMAT_24B
+        && PcmConverter::getI2sDataFormat(32, 1, dataFormat) && dataFormat == I2S_DATAFORMAT_32B
+        && !PcmConverter::getI2sDataFormat(20, 2, dataFormat);
+
+    // An unsupported stream is sent as silence
+    uint16_t dst[4] = { 1, 2, 3, 4 };
+    converter.convert(NULL, dst, 2);
+    if (!ok || dst[0] != 0 || dst[3] != 0)
+    {
+        printf("FAIL configuration\n");
+        ++failures;
+        return;
+    }
+    printf("OK   configuration\n");
+}
+
+/**
+ * @brief Returns the body of a "fmt" chunk for 16-bit stereo at 48 kHz.
+ *
+ * An extensible chunk has cbSize 22 and the SubFormat GUID whose first word is subType; the
+ * other 14 bytes are the same for all KSDATAFORMAT_SUBTYPE_* values.
+ */
+std::vector<uint8_t> fmtChunk (uint16_t tag, uint16_t subType = 0, uint16_t cbSize = 22)
+{
+    std::vector<uint8_t> fmt = { (uint8_t) tag, (uint8_t) (tag >> 8), 2, 0, 0x80, 0xBB, 0, 0,
+                                 0x00, 0xEE, 2, 0, 4, 0, 16, 0 };
+    if (tag == PcmConverter::WAVE_FORMAT_EXTENSIBLE)
+    {
+        const std::vector<uint8_t> extension = { (uint8_t) cbSize, (uint8_t) (cbSize >> 8), 16, 0, 3, 0, 0, 0,
+            (uint8_t) subType, (uint8_t) (subType >> 8), 0x00, 0x00, 0x00, 0x00, 0x10, 0x00,
+            0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71 };
+        fmt.insert(fmt.end(), extension.begin(), extension.end());
+    }
+    return fmt;
+}
+
+void checkFormat (const char * name, const std::vector<uint8_t> & fmt, bool expected)
+{
+    if (PcmConverter::isPcmFormat(fmt.data(), fmt.size()) != expected)
+    {
+        printf("FAIL format %s: %s\n", name, expected ? "rejected" : "accepted");
+        ++failures;
+        return;
+    }
+    printf("OK   format %s\n", name);
+}
+
+} // end of anonymous namespace
+
+int main ()
+{
+    const Golden tests[] = {
+        { "u8 stereo", 8, 2, 1.0f,
+          { 0x80, 0xFF, 0x00, 0x81 },
+          { 0x0000, 0x7F00, 0x8000, 0x0100 } },
+        { "u8 mono", 8, 1, 1.0f,
+          { 0x00, 0xC0 },
+          { 0x8000, 0x8000, 0x4000, 0x4000 } },
+        { "s16 stereo", 16, 2, 1.0f,
+          words16({ 0x1234, -2, 0x7FFF, INT16_MIN }),
+          { 0x1234, 0xFFFE, 0x7FFF, 0x8000 } },
+        { "s16 stereo, gain 2 with saturation", 16, 2, 2.0f,
+          words16({ 0x1234, -2, 0x7FFF, INT16_MIN }),
+          { 0x2468, 0xFFFC, 0x7FFF, 0x8000 } },
+        { "s16 mono, gain 0.5", 16, 1, 0.5f,
+          words16({ 1000, -3 }),
+          { 500, 500, 0xFFFE, 0xFFFE } },
+        { "s24 stereo", 24, 2, 1.0f,
+          { 0x56, 0x34, 0x12, 0xFF, 0xFF, 0xFF },
+          { 0x1234, 0x5600, 0xFFFF, 0xFF00 } },
+        { "s24 mono, gain 0.5", 24, 1, 0.5f,
+          { 0x00, 0x00, 0x80, 0x01, 0x00, 0x00 },
+          { 0xC000, 0x0000, 0xC000, 0x0000, 0x0000, 0x0080, 0x0000, 0x0080 } },
+        { "s32 stereo, gain 2 with saturation", 32, 2, 2.0f,
+          words32({ 0x40000000, 0x00010002 }),
+          { 0x7FFF, 0xFFFF, 0x0002, 0x0004 } },
+        { "s32 mono", 32, 1, 1.0f,
+          words32({ 0x89ABCDEF }),
+          { 0x89AB, 0xCDEF, 0x89AB, 0xCDEF } },
+    };
+    for (const Golden & g : tests)
+    {
+        check(g);
+    }
+    checkMeter();
+    checkConfiguration();
+
+    const uint16_t EXTENSIBLE = PcmConverter::WAVE_FORMAT_EXTENSIBLE;
+    checkFormat("PCM", fmtChunk(PcmConverter::WAVE_FORMAT_PCM), true);
+    checkFormat("extensible PCM", fmtChunk(EXTENSIBLE, 0x0001), true);
+    checkFormat("IEEE float", fmtChunk(0x0003), false);
+    checkFormat("extensible IEEE float", fmtChunk(EXTENSIBLE, 0x0003), false);
+    checkFormat("extensible A-law", fmtChunk(EXTENSIBLE, 0x0006), false);
+    checkFormat("extensible mu-law", fmtChunk(EXTENSIBLE, 0x0007), false);
+    checkFormat("extensible without extension", fmtChunk(EXTENSIBLE, 0x0001, 0), false);
+    std::vector<uint8_t> truncated = fmtChunk(EXTENSIBLE, 0x0001);
+    truncated.resize(30);
+    checkFormat("truncated extensible", truncated, false);
+    return failures == 0 ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,187 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+/*
+ * Accuracy test and benchmark of the resampler:
+ *
+ * - THD+N: a -6 dBFS sine at 44.1 kHz is up-sampled to 48 kHz in DAC blocks of 16-bit and
+ *   24-bit frames. A sine of the test frequency (with any amplitude and phase) and DC is
+ *   fitted to the output by least squares; the rest of the signal is distortion and noise,
+ *   and its level relative to the fitted sine shall not exceed MAX_THD_N.
+ * - Benchmark: the host time per output frame. The resampler runs outside of the virtual
+ *   clock, so the DWT does not count its cycles; the target cost is documented in Resampler.h.
+ */
+
+#ifdef HAL_SIMULATION
+
+#include "stm32async/Drivers/Resampler.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+using namespace Stm32async::Drivers;
+
+namespace
+{
+
+constexpr uint32_t INPUT_RATE = 44100;
+constexpr uint32_t OUTPUT_RATE = 48000;
+constexpr double AMPLITUDE = 0.5;   // -6 dBFS
+constexpr double MAX_THD_N = -80.0; // dB
+constexpr uint32_t BLOCKS = 40;
+
+// Global, since the filter bank is too large for the stack
+Resampler resampler { OUTPUT_RATE };
+
+uint32_t failures = 0;
+
+/**
+ * @brief Up-samples a sine and returns the left channel of the output, in full scale units.
+ */
+std::vector<double> resample (double freq, bool wide)
+{
+    const uint32_t frameSize = wide ? 4 : 2;
+    const uint32_t blockFrames = AudioDac_UDA1334::BLOCK_SIZE2 / frameSize;
+    resampler.configure(INPUT_RATE, wide ? I2S_DATAFORMAT_24B : I2S_DATAFORMAT_16B);
+    std::vector<double> output;
+    std::vector<uint16_t> block(blockFrames * frameSize);
+    uint64_t index = 0;
+    for (uint32_t b = 0; b < BLOCKS; ++b)
+    {
+        const uint32_t n = resampler.getRequiredFrames(blockFrames);
+        uint16_t * input = resampler.getInputPtr();
+        for (uint32_t i = 0; i < n; ++i, ++index, input += frameSize)
+        {
+            const double v = AMPLITUDE * std::sin(2.0 * M_PI * freq * (double) index / INPUT_RATE);
+            if (wide)
+            {
+                // 24-bit samples, left-aligned in the 32-bit I2S frame
+                const int32_t s = (int32_t) std::round(v * 8388607.0) << 8;
+                input[0] = input[2] = (uint16_t) ((uint32_t) s >> 16);
+                input[1] = input[3] = (uint16_t) s;
+            }
+            else
+            {
+                input[0] = input[1] = (uint16_t) (int16_t) std::round(v * 32767.0);
+            }
+        }
+        resampler.process(block.data(), blockFrames);
+        for (uint32_t i = 0; i < blockFrames; ++i)
+        {
+            const uint16_t * frame = &block[i * frameSize];
+            output.push_back(wide ? (int32_t) (((uint32_t) frame[0] << 16) | frame[1]) / 2147483648.0 :
+                                    (int16_t) frame[0] / 32768.0);
+        }
+    }
+    return output;
+}
+
+/**
+ * @brief Fits a * sin + b * cos + c at the given frequency and returns the residual level in dB.
+ */
+double getThdN (const std::vector<double> & samples, double freq)
+{
+    // Normal equations of the least-squares fit
+    double m[3][4] = { };
+    for (size_t i = 0; i < samples.size(); ++i)
+    {
+        const double w = 2.0 * M_PI * freq * (double) i / OUTPUT_RATE;
+        const double f[3] = { std::sin(w), std::cos(w), 1.0 };
+        for (uint32_t r = 0; r < 3; ++r)
+        {
+            for (uint32_t c = 0; c < 3; ++c)
+            {
+                m[r][c] += f[r] * f[c];
+            }
+            m[r][3] += f[r] * samples[i];
+        }
+    }
+    for (uint32_t p = 0; p < 3; ++p)
+    {
+        for (uint32_t r = 0; r < 3; ++r)
+        {
+            if (r != p)
+            {
+                const double k = m[r][p] / m[p][p];
+                for (uint32_t c = p; c < 4; ++c)
+                {
+                    m[r][c] -= k * m[p][c];
+                }
+            }
+        }
+    }
+    const double a = m[0][3] / m[0][0], b = m[1][3] / m[1][1], dc = m[2][3] / m[2][2];
+    double residual = 0.0;
+    for (size_t i = 0; i < samples.size(); ++i)
+    {
+        const double w = 2.0 * M_PI * freq * (double) i / OUTPUT_RATE;
+        const double e = samples[i] - a * std::sin(w) - b * std::cos(w) - dc;
+        residual += e * e;
+    }
+    const double signal = (a * a + b * b) / 2.0 * samples.size();
+    return 10.0 * std::log10(residual / signal);
+}
+
+void checkThdN (double freq, bool wide)
+{
+    std::vector<double> samples = resample(freq, wide);
+    // The first block contains the start of the filter history
+    samples.erase(samples.begin(), samples.begin() + samples.size() / BLOCKS);
+    const double thdN = getThdN(samples, freq);
+    printf("%s THD+N %.0f Hz, %s: %.1f dB\n", thdN <= MAX_THD_N ? "OK  " : "FAIL", freq,
+           wide ? "24 bit" : "16 bit", thdN);
+    if (thdN > MAX_THD_N)
+    {
+        ++failures;
+    }
+}
+
+void benchmark (bool wide)
+{
+    const uint32_t frameSize = wide ? 4 : 2;
+    const uint32_t blockFrames = AudioDac_UDA1334::BLOCK_SIZE2 / frameSize;
+    const uint32_t blocks = 2000;
+    resampler.configure(INPUT_RATE, wide ? I2S_DATAFORMAT_24B : I2S_DATAFORMAT_16B);
+    std::vector<uint16_t> block(blockFrames * frameSize);
+    const auto start = std::chrono::steady_clock::now();
+    for (uint32_t b = 0; b < blocks; ++b)
+    {
+        resampler.getRequiredFrames(blockFrames);
+        resampler.process(block.data(), blockFrames);
+    }
+    const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    printf("BENCH %s: host %.1f ns per output frame\n", wide ? "24 bit" : "16 bit", ns / blocks / blockFrames);
+}
+
+} // end of anonymous namespace
+
+int main ()
+{
+    checkThdN(1000.0, false);
+    checkThdN(10000.0, false);
+    checkThdN(1000.0, true);
+    checkThdN(10000.0, true);
+    benchmark(false);
+    benchmark(true);
+    return failures == 0 ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,192 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+/*
+ * Fallback of the SDIO clock and the clock cache in the SPI EEPROM:
+ *
+ * - The inserted card is tuned by SdCardFat::periodic(): the fastest divider is measured and
+ *   stored by SdClockCache in the EEPROM page of the card.
+ * - The card inserted again is mounted with the cached divider, the tuning does not read.
+ * - A CRC error at the tuned divider: the read is repeated at the default divider, which is
+ *   kept and stored in the EEPROM instead of the tuned one.
+ * - The card inserted again is mounted with the stored default divider, without measuring.
+ */
+
+#ifdef HAL_SIMULATION
+
+#include "streaming_setup.h"
+#include "stm32async/HardwareLayout/Spi1.h"
+#include "stm32async/Drivers/SdClockCache.h"
+
+#include <cstdlib>
+
+using namespace Stm32async;
+using namespace Stm32async::Drivers;
+
+namespace
+{
+
+constexpr char IMAGE_NAME[] = "build/tests/sd_clock_cache.img";
+constexpr uint32_t CLUSTER_SIZE = 4096;
+constexpr uint32_t CLOCK_DIV = 8;
+constexpr uint32_t TUNING_BLOCKS = 8;
+constexpr uint32_t EEPROM_SIZE = 512;
+constexpr uint8_t CACHE_ADDRESS = 0x40;
+
+uint32_t tuningBuffer[TUNING_BLOCKS * Sdio::BLOCK_SIZE / sizeof(uint32_t)];
+uint32_t readBuffer[Sdio::BLOCK_SIZE / sizeof(uint32_t)];
+uint32_t failures = 0;
+
+void check (bool condition, const char * name)
+{
+    printf("%s %s\n", condition ? "OK  " : "FAIL", name);
+    if (!condition)
+    {
+        ++failures;
+    }
+}
+
+/**
+ * @brief Counts the SDIO reads in the trace since the last clearTrace().
+ */
+uint32_t countReads ()
+{
+    uint32_t reads = 0;
+    for (const HalSim::TraceRecord & r : HalSim::getTrace())
+    {
+        reads += (r.bus == "SDIO" && r.text.compare(0, 2, "R ") == 0) ? 1 : 0;
+    }
+    return reads;
+}
+
+/**
+ * @brief Inserts the card and mounts it by SdCardFat::periodic(); returns the number of
+ *        SDIO reads of the clock tuning.
+ */
+uint32_t mount (StreamingSetup & s)
+{
+    uint32_t tuningReads = 0;
+    s.insert(IMAGE_NAME);
+    while (!s.sdCard.isMounted() && s.sdCard.getMountState() != SdCardFat::MountState::FAILED)
+    {
+        const bool tuning = s.sdCard.getMountState() == SdCardFat::MountState::TUNE_CLOCK;
+        HalSim::clearTrace();
+        s.sdCard.periodic();
+        tuningReads += tuning ? countReads() : 0;
+        HAL_Delay(1);
+    }
+    return tuningReads;
+}
+
+void unmount (StreamingSetup & s)
+{
+    s.remove();
+    while (s.sdCard.getMountState() != SdCardFat::MountState::NO_CARD)
+    {
+        s.sdCard.periodic();
+        HAL_Delay(1);
+    }
+}
+
+/**
+ * @brief Finds the record of the given card in the EEPROM memory, bypassing the driver.
+ */
+bool findRecord (HalSim::SpiEepRom & rom, uint32_t cardSerial, SdClockCache::Record & r)
+{
+    for (uint32_t slot = 0; slot < SdClockCache::MAX_CARDS; ++slot)
+    {
+        ::memcpy(&r, &rom.getMemory()[CACHE_ADDRESS + slot * SdClockCache::PAGE_SIZE], sizeof(r));
+        if (r.magic == SdClockCache::RECORD_MAGIC && r.cardSerial == cardSerial)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+} // end of anonymous namespace
+
+int main ()
+{
+    HAL_Init();
+    HalSim::setConsole(::getenv("HAL_SIM_CONSOLE") != NULL);
+
+    StreamingSetup s { CLOCK_DIV };
+    s.start();
+    if (!s.format(IMAGE_NAME, 32, CLUSTER_SIZE))
+    {
+        printf("FAIL can not prepare %s\n", IMAGE_NAME);
+        return 1;
+    }
+    unmount(s);
+
+    // The EEPROM at SPI1 with the chip select at PC4, wired as in the firmware
+    HardwareLayout::Spi1 spi1 { s.portA, GPIO_PIN_5, s.portA, GPIO_PIN_7, s.portA, GPIO_PIN_6, true, NULL,
+                                HardwareLayout::Interrupt { SPI1_IRQn, 1, 0 },
+                                HardwareLayout::DmaStream { &s.dma2, DMA2_Stream5, DMA_CHANNEL_3,
+                                                            HardwareLayout::Interrupt { DMA2_Stream5_IRQn, 2, 0 } },
+                                HardwareLayout::DmaStream { &s.dma2, DMA2_Stream0, DMA_CHANNEL_3,
+                                                            HardwareLayout::Interrupt { DMA2_Stream0_IRQn, 2, 0 } } };
+    BaseSpi spi { spi1, GPIO_NOPULL };
+    EepRom_25AA040A eepRom { spi, s.portC, GPIO_PIN_4 };
+    HalSim::SpiEepRom rom { EEPROM_SIZE };
+    HalSim::attachSpiDevice(SPI1, GPIOC, GPIO_PIN_4, &rom);
+    spi.start(SPI_DIRECTION_2LINES, SPI_BAUDRATEPRESCALER_256, SPI_DATASIZE_8BIT, SPI_POLARITY_LOW, SPI_PHASE_1EDGE);
+    eepRom.start();
+    SdClockCache cache { eepRom, CACHE_ADDRESS };
+    s.sdCard.getSdio().enableClockTuning(tuningBuffer, TUNING_BLOCKS, &cache);
+
+    // The first mount measures the dividers and stores the fastest one
+    uint32_t reads = mount(s);
+    const uint32_t cardSerial = s.sdCard.getSdio().getClockTuning().cardSerial;
+    const uint32_t tunedDiv = s.sdCard.getSdio().getClockDiv();
+    SdClockCache::Record r;
+    printf("first mount: %u tuning reads, clock divider %u\n", (unsigned) reads, (unsigned) tunedDiv);
+    check(s.sdCard.isMounted() && reads > 0 && tunedDiv < CLOCK_DIV, "the first mount measures the clock");
+    check(findRecord(rom, cardSerial, r) && r.clockDiv == tunedDiv && r.throughput > 0,
+          "the tuned divider is stored in the EEPROM");
+
+    // The next mount takes the cached divider
+    unmount(s);
+    reads = mount(s);
+    check(s.sdCard.isMounted() && reads == 0 && s.sdCard.getSdio().getClockDiv() == tunedDiv,
+          "the next mount loads the cached divider without measuring");
+
+    // A CRC error at the tuned divider is repeated at the default one
+    HalSim::injectSdErrors(1);
+    HalSim::clearTrace();
+    const HAL_SD_ErrorTypedef status = s.sdCard.getSdio().readBlocks(readBuffer, 0, Sdio::BLOCK_SIZE, 1);
+    reads = countReads();
+    check(status == SD_OK && reads == 2 && s.sdCard.getSdio().getClockDiv() == CLOCK_DIV,
+          "a CRC error falls back to the default divider");
+    check(findRecord(rom, cardSerial, r) && r.clockDiv == CLOCK_DIV && r.throughput == 0,
+          "the default divider is stored in the EEPROM");
+
+    // The next mount takes the stored default divider
+    unmount(s);
+    reads = mount(s);
+    check(s.sdCard.isMounted() && reads == 0 && s.sdCard.getSdio().getClockDiv() == CLOCK_DIV,
+          "the mount after the fallback loads the default divider without measuring");
+
+    HalSim::removeSdCard();
+    ::remove(IMAGE_NAME);
+    return failures == 0 ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,265 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+/*
+ * Hot plug of the SD card while a WAV file is streamed:
+ *
+ * - The card is mounted by SdCardFat::periodic() like in the main loop. The clock tuning
+ *   measures one divider per call, so a call reads at most TUNING_ROUNDS times.
+ * - The card is pulled while a read-ahead load is pending. The stream stops, the pending
+ *   read ends with an error instead of blocking, and the card is unmounted after the
+ *   debounce time without touching the bus again.
+ * - The card is inserted again: the handler resumes the playback at the position that was
+ *   saved periodically before the card was pulled.
+ */
+
+#ifdef HAL_SIMULATION
+
+#include "streaming_setup.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+using namespace Stm32async;
+using namespace Stm32async::Drivers;
+
+namespace
+{
+
+constexpr char IMAGE_NAME[] = "build/tests/sd_hotplug.img";
+constexpr uint32_t CLUSTER_SIZE = 4096;
+constexpr uint32_t CLOCK_DIV = 8;
+constexpr uint32_t TUNING_BLOCKS = 8;
+constexpr uint32_t SAMPLE_RATE = 16000;
+constexpr uint32_t FRAME_SIZE = 4;
+
+uint32_t tuningBuffer[TUNING_BLOCKS * Sdio::BLOCK_SIZE / sizeof(uint32_t)];
+uint32_t failures = 0;
+
+void check (bool condition, const char * name)
+{
+    printf("%s %s\n", condition ? "OK  " : "FAIL", name);
+    if (!condition)
+    {
+        ++failures;
+    }
+}
+
+/**
+ * @brief Writes a 16-bit stereo track whose frame n is (n & 0xFFFF, n >> 16).
+ */
+bool writeTrack (const char * fileName, uint32_t frames)
+{
+    FIL file;
+    if (f_open(&file, fileName, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK)
+    {
+        return false;
+    }
+    const WavStreamer::WavHeader h = StreamingSetup::getWavHeader(SAMPLE_RATE, 2, 16, frames);
+    std::vector<uint8_t> data(sizeof(h.header) + frames * FRAME_SIZE);
+    ::memcpy(data.data(), h.header, sizeof(h.header));
+    for (uint32_t n = 0; n < frames; ++n)
+    {
+        const uint16_t frame[2] = { (uint16_t) n, (uint16_t) (n >> 16) };
+        ::memcpy(&data[sizeof(h.header) + n * FRAME_SIZE], frame, FRAME_SIZE);
+    }
+    UINT written = 0;
+    const bool ok = f_write(&file, data.data(), (UINT) data.size(), &written) == FR_OK && written == data.size();
+    return f_close(&file) == FR_OK && ok;
+}
+
+/**
+ * @brief The application part: resumes or starts the track when the card is mounted.
+ */
+class Player : public SdCardFat::EventHandler
+{
+public:
+
+    uint32_t attached = 0, detached = 0;
+
+    Player (StreamingSetup & _setup) : setup { _setup }
+    {
+        // empty
+    }
+
+    virtual void onSdCardAttach () override
+    {
+        ++attached;
+        if (!setup.streamer.resume())
+        {
+            setup.streamer.start(AudioDac_UDA1334::SourceType::STREAM, "track.wav");
+        }
+    }
+
+    virtual void onSdCardDeAttach () override
+    {
+        ++detached;
+        setup.streamer.stop();
+    }
+
+private:
+
+    StreamingSetup & setup;
+};
+
+/**
+ * @brief Counts the SDIO reads in the trace since the last clearTrace().
+ */
+uint32_t countReads ()
+{
+    uint32_t reads = 0;
+    for (const HalSim::TraceRecord & r : HalSim::getTrace())
+    {
+        reads += (r.bus == "SDIO" && r.text.compare(0, 2, "R ") == 0) ? 1 : 0;
+    }
+    return reads;
+}
+
+/**
+ * @brief Mounts the card by SdCardFat::periodic() and checks the steps of the clock tuning.
+ */
+void checkMount (StreamingSetup & s, const char * name)
+{
+    uint32_t tuningCalls = 0, maxReads = 0;
+    const uint32_t startTime = HAL_GetTick();
+    while (!s.sdCard.isMounted() && s.sdCard.getMountState() != SdCardFat::MountState::FAILED
+           && HAL_GetTick() - startTime < 1000)
+    {
+        const bool tuning = s.sdCard.getMountState() == SdCardFat::MountState::TUNE_CLOCK;
+        HalSim::clearTrace();
+        s.sdCard.periodic();
+        if (tuning)
+        {
+            ++tuningCalls;
+            maxReads = std::max(maxReads, countReads());
+        }
+        HAL_Delay(1);
+    }
+    printf("%s: %u tuning calls, at most %u reads per call, clock divider %u\n", name, (unsigned) tuningCalls,
+           (unsigned) maxReads, (unsigned) s.sdCard.getSdio().getClockDiv());
+    check(s.sdCard.isMounted(), name);
+
+    // The cache lookup, then the default divider and every faster one: 8, 4, 2, 1, 0
+    check(tuningCalls == 6 && maxReads <= Sdio::TUNING_ROUNDS && s.sdCard.getSdio().getClockDiv() == 0,
+          "the clock tuning measures a divider per call");
+}
+
+bool readResumePoint (WavStreamer::ResumePoint & point)
+{
+    FIL file;
+    UINT bytesRead = 0;
+    if (f_open(&file, "resume.bin", FA_READ) != FR_OK)
+    {
+        return false;
+    }
+    const FRESULT code = f_read(&file, &point, sizeof(point), &bytesRead);
+    f_close(&file);
+    return code == FR_OK && bytesRead == sizeof(point) && point.magic == WavStreamer::RESUME_MAGIC;
+}
+
+} // end of anonymous namespace
+
+int main ()
+{
+    HAL_Init();
+    HalSim::setConsole(::getenv("HAL_SIM_CONSOLE") != NULL);
+
+    StreamingSetup s { CLOCK_DIV };
+    s.sdCard.getSdio().enableClockTuning(tuningBuffer, TUNING_BLOCKS);
+    s.start();
+    if (!s.format(IMAGE_NAME, 32, CLUSTER_SIZE) || !writeTrack("track.wav", 20 * SAMPLE_RATE))
+    {
+        printf("FAIL can not prepare %s\n", IMAGE_NAME);
+        return 1;
+    }
+
+    // The card of the preparation is pulled without a handler
+    s.remove();
+    while (s.sdCard.getMountState() != SdCardFat::MountState::NO_CARD)
+    {
+        s.sdCard.periodic();
+        HAL_Delay(1);
+    }
+
+    Player player { s };
+    s.sdCard.setHandler(&player);
+    s.streamer.setResumeFile("resume.bin");
+    s.insert(IMAGE_NAME);
+    checkMount(s, "the inserted card is mounted");
+    check(player.attached == 1 && s.streamer.isActive(), "the playback is started by the handler");
+
+    // The card is pulled during a pending read, after the first periodic save of the position
+    const uint32_t startTime = HAL_GetTick();
+    s.stream([&s, startTime] ()
+    {
+        return HAL_GetTick() - startTime >= WavStreamer::RESUME_INTERVAL + 1000
+               && s.sdCard.getSdio().getCurrState() == SharedDevice::State::RX;
+    });
+    s.remove();
+    HalSim::clearTrace();
+    const uint32_t removeTime = HAL_GetTick();
+    s.stream([] ()
+    {
+        return false;
+    });
+    check(!s.streamer.isActive() && !s.audioDac.isActive() && HAL_GetTick() - removeTime < SdCardFat::DEBOUNCE_TIME,
+          "the playback stops when the card is pulled");
+    while (s.sdCard.getMountState() != SdCardFat::MountState::NO_CARD && HAL_GetTick() - removeTime < 1000)
+    {
+        s.sdCard.periodic();
+        HAL_Delay(1);
+    }
+    check(s.sdCard.getMountState() == SdCardFat::MountState::NO_CARD && player.detached == 1
+          && !s.sdCard.getSdio().isOccupied() && countReads() == 0,
+          "the card is unmounted after the debounce time");
+
+    // Inserted again, the playback is resumed at the periodically saved position
+    std::vector<uint32_t> frames;
+    HalSim::captureI2s(SPI2, [&frames] (const uint16_t * items, uint32_t n)
+    {
+        for (uint32_t i = 0; i + 1 < n; i += 2)
+        {
+            frames.push_back(items[i] | ((uint32_t) items[i + 1] << 16));
+        }
+    });
+    s.insert(IMAGE_NAME);
+    checkMount(s, "the card inserted again is mounted");
+    WavStreamer::ResumePoint point;
+    const bool saved = readResumePoint(point);
+    const uint32_t resumeTime = HAL_GetTick();
+    s.stream([resumeTime] ()
+    {
+        return HAL_GetTick() - resumeTime >= 500;
+    });
+    s.streamer.stop();
+    HalSim::captureI2s(SPI2, nullptr);
+
+    // The first frames of the DAC are the silence of the start
+    auto first = std::find_if(frames.begin(), frames.end(), [] (uint32_t f) { return f != 0; });
+    check(player.attached == 2 && saved && first != frames.end() && *first == point.position / FRAME_SIZE
+          && first + 1 != frames.end() && *(first + 1) == *first + 1,
+          "the playback is resumed when the card is inserted again");
+
+    HalSim::removeSdCard();
+    ::remove(IMAGE_NAME);
+    return failures == 0 ? 0 : 1;
+}
+
+#endif
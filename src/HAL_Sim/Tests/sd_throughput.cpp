@@ -0,0 +1,200 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+/*
+ * SDIO throughput benchmark on the simulated card backed by a disk image.
+ *
+ * A contiguous 1 MB file is read by FatFS in 2 KB pieces, as the streamer did before the
+ * read-ahead, and by the ReadAhead ring with multi-block reads of the contiguous runs.
+ * The throughput is given in virtual time, i.e. by the timing of the card model (the command
+ * and response, the read access time, and every block with its CRC at the configured clock
+ * and bus width), and compared with the data rate of a 96 kHz, 24-bit stereo stream.
+ *
+ * A write that is issued while a load of the ring is pending shall wait for it, and it is
+ * counted in the statistics of the device like the reads.
+ */
+
+#ifdef HAL_SIMULATION
+
+#include "streaming_setup.h"
+#include "stm32async/Drivers/ReadAhead.h"
+
+#include <cstdlib>
+#include <vector>
+
+using namespace Stm32async;
+using namespace Stm32async::Drivers;
+
+namespace
+{
+
+constexpr char IMAGE_NAME[] = "build/tests/sd_throughput.img";
+constexpr uint32_t FILE_SIZE = 1024 * 1024;
+constexpr uint32_t PIECE_SIZE = WavStreamer::BLOCK_SIZE;
+constexpr uint32_t STREAM_RATE = 96000 * 3 * 2;
+
+uint32_t failures = 0;
+
+uint32_t countCommands (const char * prefix)
+{
+    uint32_t n = 0;
+    for (const HalSim::TraceRecord & r : HalSim::getTrace())
+    {
+        n += (r.bus == "SDIO" && r.text.compare(0, 2, prefix) == 0) ? 1 : 0;
+    }
+    return n;
+}
+
+/**
+ * @brief Reads the whole file and returns the throughput in KB/s of virtual time.
+ */
+double measure (const char * name, FIL & file, const std::function<uint32_t (uint8_t *, uint32_t)> & read)
+{
+    std::vector<uint8_t> data(PIECE_SIZE);
+    uint32_t total = 0, errors = 0;
+    HalSim::clearTrace();
+    const uint64_t start = HalSim::getTime();
+    while (total < FILE_SIZE)
+    {
+        const uint32_t n = read(data.data(), PIECE_SIZE);
+        if (n == 0)
+        {
+            break;
+        }
+        // Every 32-bit word of the file holds its own offset
+        for (uint32_t i = 0; i + 4 <= n; i += 4)
+        {
+            uint32_t word;
+            ::memcpy(&word, &data[i], sizeof(word));
+            errors += (word != total + i) ? 1 : 0;
+        }
+        total += n;
+    }
+    const double seconds = (HalSim::getTime() - start) / 1e9;
+    const double throughput = seconds > 0.0 ? total / 1024.0 / seconds : 0.0;
+    const uint32_t commands = countCommands("R ");
+    printf("BENCH %s: %.0f KB/s, %u read commands, %u bytes per command (%.1f times the 96 kHz/24-bit stream)\n",
+           name, throughput, (unsigned) commands, (unsigned) (commands == 0 ? 0 : total / commands),
+           throughput * 1024.0 / STREAM_RATE);
+    if (total != FILE_SIZE || errors != 0)
+    {
+        printf("FAIL %s: %u bytes read, %u wrong words\n", name, (unsigned) total, (unsigned) errors);
+        ++failures;
+    }
+    return throughput;
+}
+
+} // end of anonymous namespace
+
+int main ()
+{
+    HAL_Init();
+    HalSim::setConsole(::getenv("HAL_SIM_CONSOLE") != NULL);
+
+    StreamingSetup s;
+    s.start();
+    if (!s.format(IMAGE_NAME, 32, 4096))
+    {
+        printf("FAIL can not format %s\n", IMAGE_NAME);
+        return 1;
+    }
+    FIL file;
+    std::vector<uint32_t> words(FILE_SIZE / sizeof(uint32_t));
+    for (size_t i = 0; i < words.size(); ++i)
+    {
+        words[i] = (uint32_t) (i * sizeof(uint32_t));
+    }
+    UINT written = 0;
+    if (f_open(&file, "data.bin", FA_CREATE_ALWAYS | FA_WRITE) != FR_OK
+        || f_write(&file, words.data(), FILE_SIZE, &written) != FR_OK || written != FILE_SIZE
+        || f_close(&file) != FR_OK)
+    {
+        printf("FAIL can not write the file\n");
+        return 1;
+    }
+
+    // FatFS alone
+    f_open(&file, "data.bin", FA_READ);
+    const double single = measure("f_read of 2 KB", file, [&file] (uint8_t * dst, uint32_t n)
+    {
+        UINT bytesRead = 0;
+        return f_read(&file, dst, n, &bytesRead) == FR_OK ? (uint32_t) bytesRead : 0;
+    });
+    f_close(&file);
+
+    // The read-ahead with the cluster link map of the file
+    static ReadAhead readAhead(s.sdCard.getSdio());
+    DWORD clmt[WavStreamer::CLMT_SIZE];
+    clmt[0] = WavStreamer::CLMT_SIZE;
+    f_open(&file, "data.bin", FA_READ);
+    file.cltbl = clmt;
+    if (f_lseek(&file, CREATE_LINKMAP) != FR_OK)
+    {
+        printf("FAIL can not create the cluster link map\n");
+        return 1;
+    }
+    readAhead.start(file, 0);
+    const double ring = measure("read-ahead", file, [] (uint8_t * dst, uint32_t n)
+    {
+        // Like the streamer: the ring is topped up and the CPU sleeps until the load is finished
+        readAhead.fill();
+        while (readAhead.getUsed() < n && readAhead.isPending())
+        {
+            __WFI();
+            readAhead.fill();
+        }
+        return readAhead.read(dst, n);
+    });
+
+    // A write while a load of the ring is pending waits for it and is a transaction of the
+    // device like the reads
+    readAhead.start(file, 0);
+    readAhead.fill();
+    const bool pending = readAhead.isPending();
+    HalSim::clearTrace();
+    const uint32_t transactions = s.sdCard.getSdio().getStatistics().transactions;
+    FIL other;
+    UINT n = 0;
+    const bool otherWritten = f_open(&other, "other.bin", FA_CREATE_ALWAYS | FA_WRITE) == FR_OK
+                         && f_write(&other, words.data(), 4096, &n) == FR_OK && n == 4096
+                         && f_close(&other) == FR_OK;
+    const uint32_t commands = countCommands("R ") + countCommands("W ");
+    std::vector<uint8_t> data(PIECE_SIZE);
+    const bool intact = readAhead.read(data.data(), PIECE_SIZE) == PIECE_SIZE
+                        && ::memcmp(data.data(), words.data(), PIECE_SIZE) == 0;
+    if (!pending || !otherWritten || !intact || countCommands("W ") == 0
+        || s.sdCard.getSdio().getStatistics().transactions - transactions != commands)
+    {
+        printf("FAIL write during a pending read\n");
+        ++failures;
+    }
+    readAhead.stop();
+    f_close(&file);
+
+    if (ring < 1.5 * single || ring * 1024.0 < 4.0 * STREAM_RATE)
+    {
+        printf("FAIL the read-ahead does not reach the expected throughput\n");
+        ++failures;
+    }
+    HalSim::removeSdCard();
+    ::remove(IMAGE_NAME);
+    return failures == 0 ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,258 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+/*
+ * Benchmark of the sector cache below the FatFS disk driver with an open/seek-heavy
+ * workload on a FatFS-formatted image:
+ *
+ * - A directory of fragmented files (written in pairs, cluster by cluster) is listed,
+ *   and every file is opened, read at a few offsets behind the first cluster (f_lseek
+ *   walks the FAT chain) and closed, for several rounds.
+ * - The workload runs without a cache and with caches of different sizes. The virtual time,
+ *   the read commands of the card and the hit/miss counters are reported; the cache shall
+ *   save at least the half of the card reads.
+ * - Write-through: a sector written by FatFS is the same in the cache and on the card.
+ */
+
+#ifdef HAL_SIMULATION
+
+#include "streaming_setup.h"
+#include "stm32async/Drivers/SectorCache.h"
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+using namespace Stm32async;
+using namespace Stm32async::Drivers;
+
+namespace
+{
+
+constexpr char IMAGE_NAME[] = "build/tests/sector_cache.img";
+constexpr uint32_t CLUSTER_SIZE = 1024;
+constexpr uint32_t FILES = 16;
+constexpr uint32_t FILE_SIZE = 16 * CLUSTER_SIZE;
+constexpr uint32_t ROUNDS = 2;
+constexpr uint32_t MAX_CACHE = 16;
+
+uint32_t failures = 0;
+
+std::string getName (uint32_t file)
+{
+    return "music/track" + std::to_string(file) + ".wav";
+}
+
+/**
+ * @brief Every 32-bit word holds the file number and its offset.
+ */
+uint32_t getWord (uint32_t file, uint32_t offset)
+{
+    return (file << 24) | offset;
+}
+
+bool writeFiles ()
+{
+    if (f_mkdir("music") != FR_OK)
+    {
+        return false;
+    }
+    // Two files are written cluster by cluster in turn, so both are fragmented
+    std::vector<uint32_t> words(CLUSTER_SIZE / sizeof(uint32_t));
+    for (uint32_t i = 0; i < FILES; i += 2)
+    {
+        FIL files[2];
+        bool ok = f_open(&files[0], getName(i).c_str(), FA_CREATE_ALWAYS | FA_WRITE) == FR_OK
+                  && f_open(&files[1], getName(i + 1).c_str(), FA_CREATE_ALWAYS | FA_WRITE) == FR_OK;
+        for (uint32_t pos = 0; ok && pos < FILE_SIZE; pos += CLUSTER_SIZE)
+        {
+            for (uint32_t k = 0; ok && k < 2; ++k)
+            {
+                for (uint32_t w = 0; w < words.size(); ++w)
+                {
+                    words[w] = getWord(i + k, pos + w * sizeof(uint32_t));
+                }
+                UINT written = 0;
+                ok = f_write(&files[k], words.data(), CLUSTER_SIZE, &written) == FR_OK && written == CLUSTER_SIZE;
+            }
+        }
+        if (f_close(&files[0]) != FR_OK || f_close(&files[1]) != FR_OK || !ok)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint32_t countReads ()
+{
+    uint32_t n = 0;
+    for (const HalSim::TraceRecord & r : HalSim::getTrace())
+    {
+        n += (r.bus == "SDIO" && r.text.compare(0, 2, "R ") == 0) ? 1 : 0;
+    }
+    return n;
+}
+
+/**
+ * @brief Lists the directory, then opens, seeks, reads and closes every file.
+ *
+ * @return false if a file can not be read or its content is wrong.
+ */
+bool runWorkload ()
+{
+    DIR dir;
+    FILINFO info;
+    char lfn[_MAX_LFN + 1];
+    info.lfname = lfn;
+    info.lfsize = sizeof(lfn);
+    uint32_t entries = 0;
+    if (f_opendir(&dir, "music") != FR_OK)
+    {
+        return false;
+    }
+    while (f_readdir(&dir, &info) == FR_OK && info.fname[0] != 0)
+    {
+        // The entries "." and ".." of the sub-directory are not counted
+        entries += (info.fname[0] != '.') ? 1 : 0;
+    }
+    f_closedir(&dir);
+
+    bool ok = entries == FILES;
+    for (uint32_t i = 0; i < FILES; ++i)
+    {
+        FIL file;
+        if (f_open(&file, getName(i).c_str(), FA_READ) != FR_OK)
+        {
+            return false;
+        }
+        for (uint32_t k = 1; k <= 3; ++k)
+        {
+            const uint32_t offset = k * FILE_SIZE / 4 + 64;
+            uint32_t word = 0;
+            UINT bytesRead = 0;
+            ok = ok && f_lseek(&file, offset) == FR_OK && f_read(&file, &word, sizeof(word), &bytesRead) == FR_OK
+                 && bytesRead == sizeof(word) && word == getWord(i, offset);
+        }
+        f_close(&file);
+    }
+    return ok;
+}
+
+void benchmark (StreamingSetup & s, uint32_t cacheSize, uint32_t & referenceReads)
+{
+    static SectorCache::Entry entries[MAX_CACHE];
+    static uint32_t data[MAX_CACHE * SectorCache::SECTOR_WORDS];
+    SectorCache cache(s.sdCard.getSdio(), data, entries, cacheSize);
+    s.sdCard.setCache(cacheSize > 0 ? &cache : NULL);
+
+    // The volume is mounted again, so that FatFS does not hold a sector in its window
+    f_mount(NULL, s.sdCard.getFatFs().path, 0);
+    f_mount((FATFS *) &s.sdCard.getFatFs().key, s.sdCard.getFatFs().path, 1);
+    HalSim::clearTrace();
+    const uint64_t start = HalSim::getTime();
+    bool ok = true;
+    for (uint32_t r = 0; r < ROUNDS; ++r)
+    {
+        ok = runWorkload() && ok;
+    }
+    const double ms = (HalSim::getTime() - start) / 1e6 / ROUNDS;
+    const uint32_t reads = countReads();
+    printf("BENCH cache of %2u sectors: %.2f ms per round, %u card reads, %u hits, %u misses (%.0f%% hit rate)\n",
+           (unsigned) cacheSize, ms, (unsigned) reads, (unsigned) cache.getHits(), (unsigned) cache.getMisses(),
+           cache.getHits() + cache.getMisses() == 0 ? 0.0
+                   : 100.0 * cache.getHits() / (cache.getHits() + cache.getMisses()));
+    if (cacheSize == 0)
+    {
+        referenceReads = reads;
+    }
+    if (!ok)
+    {
+        printf("FAIL cache of %u sectors: wrong data\n", (unsigned) cacheSize);
+        ++failures;
+    }
+    else if (cacheSize >= 16 && 2 * reads > referenceReads)
+    {
+        printf("FAIL cache of %u sectors: %u card reads, %u without cache\n", (unsigned) cacheSize,
+               (unsigned) reads, (unsigned) referenceReads);
+        ++failures;
+    }
+    s.sdCard.setCache(NULL);
+}
+
+void checkWriteThrough (StreamingSetup & s)
+{
+    static SectorCache::Entry entries[8];
+    static uint32_t data[8 * SectorCache::SECTOR_WORDS];
+    SectorCache cache(s.sdCard.getSdio(), data, entries, 8);
+    s.sdCard.setCache(&cache);
+
+    // The sector is cached by the first read and updated by the write
+    FIL file;
+    const uint32_t offset = FILE_SIZE / 2;
+    const uint32_t word = 0x5A5A5A5A;
+    uint32_t cached = 0, stored = 0;
+    UINT n = 0;
+    bool ok = f_open(&file, getName(0).c_str(), FA_READ | FA_WRITE) == FR_OK
+              && f_lseek(&file, offset) == FR_OK && f_read(&file, &cached, sizeof(cached), &n) == FR_OK
+              && f_lseek(&file, offset) == FR_OK && f_write(&file, &word, sizeof(word), &n) == FR_OK
+              && f_close(&file) == FR_OK;
+    const uint32_t hits = cache.getHits();
+    ok = ok && f_open(&file, getName(0).c_str(), FA_READ) == FR_OK && f_lseek(&file, offset) == FR_OK
+         && f_read(&file, &cached, sizeof(cached), &n) == FR_OK && f_close(&file) == FR_OK;
+    const bool hit = cache.getHits() > hits;
+
+    cache.invalidate();
+    ok = ok && f_open(&file, getName(0).c_str(), FA_READ) == FR_OK && f_lseek(&file, offset) == FR_OK
+         && f_read(&file, &stored, sizeof(stored), &n) == FR_OK && f_close(&file) == FR_OK;
+    s.sdCard.setCache(NULL);
+    printf("%s write-through: cached 0x%08x, card 0x%08x\n", ok && hit && cached == word && stored == word
+           ? "OK  " : "FAIL", (unsigned) cached, (unsigned) stored);
+    if (!ok || !hit || cached != word || stored != word)
+    {
+        ++failures;
+    }
+}
+
+} // end of anonymous namespace
+
+int main ()
+{
+    HAL_Init();
+    HalSim::setConsole(::getenv("HAL_SIM_CONSOLE") != NULL);
+
+    StreamingSetup s;
+    s.start();
+    if (!s.format(IMAGE_NAME, 16, CLUSTER_SIZE) || !writeFiles())
+    {
+        printf("FAIL can not create the files on %s\n", IMAGE_NAME);
+        return 1;
+    }
+    uint32_t referenceReads = 0;
+    for (uint32_t size : { 0, 4, 16 })
+    {
+        benchmark(s, size, referenceReads);
+    }
+    checkWriteThrough(s);
+    HalSim::removeSdCard();
+    ::remove(IMAGE_NAME);
+    return failures == 0 ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,290 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+/*
+ * Test and benchmark of the spectrum analyzer:
+ *
+ * - Correctness: test signals are fed as 16-bit and 24-bit DAC blocks, and the band levels
+ *   are compared with a reference computed in double precision from the same decimated
+ *   samples (Hann window, DFT, power per band). On the host, arm_rfft_q15 is provided by
+ *   hal_sim_dsp.cpp, so the test covers the decimation, windowing, scaling and band
+ *   mapping of the analyzer rather than the fixed-point FFT of the target library.
+ * - Load: blocks that arrive while a window waits for periodic() are skipped, so the
+ *   number of analyses per second is bounded by MIN_INTERVAL.
+ * - Benchmark: the DWT cycles per analyzed frame and their share of the target clock at
+ *   the maximum analysis rate. Only the FFT is charged to the virtual clock (with the
+ *   estimated cycles of the target library); the windowing and the band sums run outside
+ *   of it, so the host time per frame and per fed block is reported as well.
+ */
+
+#ifdef HAL_SIMULATION
+
+#include "hal_sim.h"
+#include "stm32async/Drivers/SpectrumAnalyzer.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+using namespace Stm32async::Drivers;
+
+extern "C" void SysTick_Handler (void)
+{
+    HAL_IncTick();
+}
+
+namespace
+{
+
+constexpr uint32_t BLOCK_FRAMES = AudioDac_UDA1334::BLOCK_SIZE2 / 2;
+constexpr uint32_t TARGET_CLOCK = 168000000;
+
+uint32_t failures = 0;
+
+struct Tone
+{
+    double freq, amplitude; // amplitude relative to the full scale
+};
+
+/**
+ * @brief Test signal with a fixed phase per tone, as a sample of a mono source.
+ */
+double getSignal (const std::vector<Tone> & tones, uint32_t sampleRate, uint64_t index)
+{
+    double v = 0.0;
+    for (size_t t = 0; t < tones.size(); ++t)
+    {
+        v += tones[t].amplitude * std::sin(2.0 * M_PI * tones[t].freq * (double) index / sampleRate + 0.3 * t);
+    }
+    return v;
+}
+
+/**
+ * @brief Feeds DAC blocks until a window is complete and analyzes it.
+ *
+ * @return the decimated samples of the analyzed window, as the analyzer computes them.
+ */
+std::vector<int32_t> analyze (SpectrumAnalyzer & analyzer, const std::vector<Tone> & tones, uint32_t sampleRate,
+                              bool wide)
+{
+    // The window collection starts MIN_INTERVAL after the last analysis
+    HalSim::advance(1000000ULL * (SpectrumAnalyzer::MIN_INTERVAL + 1));
+
+    const uint32_t decimation = sampleRate / analyzer.getAnalysisRate();
+    std::vector<int32_t> decimated;
+    int32_t sum = 0;
+    uint64_t index = 0;
+    std::vector<uint16_t> block(BLOCK_FRAMES * (wide ? 4 : 2));
+    while (!analyzer.periodic())
+    {
+        for (uint32_t i = 0; i < BLOCK_FRAMES; ++i, ++index)
+        {
+            const double v = getSignal(tones, sampleRate, index);
+            const int32_t s32 = (int32_t) std::max(-2147483648.0, std::min(2147483647.0, std::round(v * 2147483647.0)));
+            if (wide)
+            {
+                block[4 * i] = block[4 * i + 2] = (uint16_t) ((uint32_t) s32 >> 16);
+                block[4 * i + 1] = block[4 * i + 3] = (uint16_t) s32;
+            }
+            else
+            {
+                block[2 * i] = block[2 * i + 1] = (uint16_t) (s32 >> 16);
+            }
+            // Reference decimation: the mono mix of the upper 16 bits of both channels
+            if (decimated.size() < SpectrumAnalyzer::FFT_SIZE)
+            {
+                sum += 2 * (int32_t) (int16_t) (s32 >> 16);
+                if ((index + 1) % decimation == 0)
+                {
+                    decimated.push_back(sum / (int32_t) (2 * decimation));
+                    sum = 0;
+                }
+            }
+        }
+        analyzer.feed(block.data(), BLOCK_FRAMES);
+    }
+    return decimated;
+}
+
+/**
+ * @brief Band levels in dBFS by a double-precision DFT of the same samples.
+ */
+std::vector<double> getReference (const SpectrumAnalyzer & analyzer, const std::vector<int32_t> & samples)
+{
+    const uint32_t n = SpectrumAnalyzer::FFT_SIZE;
+    std::vector<double> windowed(n);
+    for (uint32_t i = 0; i < n; ++i)
+    {
+        windowed[i] = samples[i] * (0.5 - 0.5 * std::cos(2.0 * M_PI * i / n));
+    }
+    std::vector<double> db(SpectrumAnalyzer::BANDS);
+    for (uint32_t b = 0; b < SpectrumAnalyzer::BANDS; ++b)
+    {
+        double power = 0.0;
+        for (uint32_t k = analyzer.getBandEdge(b); k < analyzer.getBandEdge(b + 1); ++k)
+        {
+            double re = 0.0, im = 0.0;
+            for (uint32_t i = 0; i < n; ++i)
+            {
+                re += windowed[i] * std::cos(2.0 * M_PI * k * i / n);
+                im -= windowed[i] * std::sin(2.0 * M_PI * k * i / n);
+            }
+            // The analyzer works with the FFT output scaled down by n
+            power += (re * re + im * im) / ((double) n * n);
+        }
+        db[b] = 10.0 * std::log10(power + 1.0) - 10.0 * std::log10((double) (1UL << 26));
+    }
+    return db;
+}
+
+void checkBands (const char * name, const std::vector<Tone> & tones, uint32_t sampleRate, bool wide)
+{
+    SpectrumAnalyzer analyzer;
+    analyzer.configure(sampleRate, wide ? I2S_DATAFORMAT_24B : I2S_DATAFORMAT_16B);
+    const std::vector<int32_t> samples = analyze(analyzer, tones, sampleRate, wide);
+    const std::vector<double> reference = getReference(analyzer, samples);
+
+    // Bands far below the display range are dominated by the fixed-point rounding
+    double maxError = 0.0;
+    for (uint32_t b = 0; b < SpectrumAnalyzer::BANDS; ++b)
+    {
+        if (reference[b] < -SpectrumAnalyzer::RANGE_DB)
+        {
+            continue;
+        }
+        const double error = std::fabs(analyzer.getBandDb(b) - reference[b]);
+        maxError = std::max(maxError, error);
+        const double level = (reference[b] + SpectrumAnalyzer::RANGE_DB) / SpectrumAnalyzer::RANGE_DB
+                             * SpectrumAnalyzer::LEVELS;
+        if (error > 0.5 || std::fabs(analyzer.getLevel(b) - std::max(0.0, std::min((double) SpectrumAnalyzer::LEVELS, level))) > 1.0)
+        {
+            printf("FAIL %s: band %u (bins %u..%u) is %.2f dBFS, level %u, reference %.2f dBFS\n", name, (unsigned) b,
+                   (unsigned) analyzer.getBandEdge(b), (unsigned) analyzer.getBandEdge(b + 1) - 1,
+                   analyzer.getBandDb(b), (unsigned) analyzer.getLevel(b), reference[b]);
+            ++failures;
+            return;
+        }
+    }
+
+    // The band of every tone shall show it
+    const double binWidth = (double) analyzer.getAnalysisRate() / SpectrumAnalyzer::FFT_SIZE;
+    for (const Tone & t : tones)
+    {
+        const uint32_t bin = (uint32_t) std::round(t.freq / binWidth);
+        uint32_t b = 0;
+        while (b + 1 < SpectrumAnalyzer::BANDS && analyzer.getBandEdge(b + 1) <= bin)
+        {
+            ++b;
+        }
+        const double expected = 20.0 * std::log10(t.amplitude);
+        if (std::fabs(analyzer.getBandDb(b) - expected) > 3.0)
+        {
+            printf("FAIL %s: %.0f Hz tone of %.1f dBFS gives %.2f dBFS in band %u\n", name, t.freq, expected,
+                   analyzer.getBandDb(b), (unsigned) b);
+            ++failures;
+            return;
+        }
+    }
+    printf("OK   %s: %u Hz, analysis at %u Hz, max. error %.3f dB\n", name, (unsigned) sampleRate,
+           (unsigned) analyzer.getAnalysisRate(), maxError);
+}
+
+void checkLoad ()
+{
+    // One second of 48 kHz audio while the main loop analyzes only every 100 ms
+    SpectrumAnalyzer analyzer;
+    analyzer.configure(48000, I2S_DATAFORMAT_16B);
+    std::vector<uint16_t> block(2 * BLOCK_FRAMES, 0x1000);
+    const uint64_t blockTime = 1000000000ULL * BLOCK_FRAMES / 48000;
+    uint32_t analyses = 0;
+    for (uint64_t t = 0; t < 1000000000ULL; t += blockTime)
+    {
+        analyzer.feed(block.data(), BLOCK_FRAMES);
+        if (t % 100000000ULL < blockTime && analyzer.periodic())
+        {
+            ++analyses;
+        }
+        HalSim::advance(blockTime);
+    }
+    if (analyses > 1000 / 100 + 1 || analyzer.getSkipped() == 0)
+    {
+        printf("FAIL load: %u analyses, %u blocks skipped\n", (unsigned) analyses, (unsigned) analyzer.getSkipped());
+        ++failures;
+        return;
+    }
+    printf("OK   load: %u analyses per second, %u blocks skipped\n", (unsigned) analyses,
+           (unsigned) analyzer.getSkipped());
+}
+
+void benchmark ()
+{
+    SpectrumAnalyzer analyzer;
+    analyzer.configure(48000, I2S_DATAFORMAT_16B);
+    const std::vector<Tone> tones = { { 1000.0, 0.5 } };
+    const uint32_t runs = 20;
+    uint64_t cycles = 0;
+    double hostNs = 0.0;
+    for (uint32_t r = 0; r < runs; ++r)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        analyze(analyzer, tones, 48000, false);
+        hostNs += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        cycles += analyzer.getCycles();
+    }
+
+    // Feeding alone, with the window collection in progress
+    std::vector<uint16_t> block(2 * BLOCK_FRAMES, 0x1000);
+    const uint32_t blocks = 1000;
+    const auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < blocks; ++i)
+    {
+        analyzer.configure(48000, I2S_DATAFORMAT_16B);
+        analyzer.feed(block.data(), BLOCK_FRAMES);
+    }
+    const double feedNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    const double perAnalysis = (double) cycles / runs;
+    const double share = perAnalysis * (1000.0 / SpectrumAnalyzer::MIN_INTERVAL) / TARGET_CLOCK * 100.0;
+    printf("BENCH analysis: %.0f cycles per frame of %u samples (%.2f%% of %u MHz at the maximum rate), "
+           "host %.1f us per frame, %.2f us per fed block\n", perAnalysis, (unsigned) SpectrumAnalyzer::FFT_SIZE,
+           share, (unsigned) (TARGET_CLOCK / 1000000), hostNs / runs / 1000.0, feedNs / blocks / 1000.0);
+    if (perAnalysis == 0 || share > 5.0)
+    {
+        printf("FAIL benchmark: the analysis exceeds its CPU budget\n");
+        ++failures;
+    }
+}
+
+} // end of anonymous namespace
+
+int main ()
+{
+    HAL_Init();
+    checkBands("single tone", { { 1000.0, 0.5 } }, 48000, false);
+    checkBands("full scale", { { 440.0, 0.99 } }, 44100, false);
+    checkBands("three tones", { { 100.0, 0.3 }, { 2000.0, 0.1 }, { 8000.0, 0.05 } }, 48000, false);
+    checkBands("three tones, 24 bit", { { 150.0, 0.2 }, { 3000.0, 0.2 }, { 9000.0, 0.02 } }, 96000, true);
+    checkBands("low rate", { { 300.0, 0.25 }, { 3500.0, 0.25 } }, 8000, false);
+    checkLoad();
+    benchmark();
+    return failures == 0 ? 0 : 1;
+}
+
+#endif
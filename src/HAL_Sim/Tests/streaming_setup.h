@@ -0,0 +1,328 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+/*
+ * Board setup of the streaming tests: the SD card at SDIO, the UDA1334 DAC at I2S2 and the
+ * logger at USART1, wired as in Tools/wav_render.cpp. A test creates its FAT image by FatFS
+ * itself (format() and writeFile()), so it does not depend on the host tools.
+ *
+ * The header is included by a single test source: it defines the interrupt handlers.
+ */
+
+#ifndef HAL_SIM_TESTS_STREAMING_SETUP_H_
+#define HAL_SIM_TESTS_STREAMING_SETUP_H_
+
+#ifdef HAL_SIMULATION
+
+#include "hal_sim.h"
+
+#include "stm32async/HardwareLayout/Dma1.h"
+#include "stm32async/HardwareLayout/Dma2.h"
+#include "stm32async/HardwareLayout/PortA.h"
+#include "stm32async/HardwareLayout/PortB.h"
+#include "stm32async/HardwareLayout/PortC.h"
+#include "stm32async/HardwareLayout/PortD.h"
+#include "stm32async/HardwareLayout/PortH.h"
+#include "stm32async/HardwareLayout/Sdio1.h"
+#include "stm32async/HardwareLayout/I2S2.h"
+#include "stm32async/HardwareLayout/Usart1.h"
+#include "stm32async/SystemClock.h"
+#include "stm32async/UsartLogger.h"
+#include "stm32async/Drivers/WavStreamer.h"
+
+#include <cstdio>
+#include <cstring>
+#include <functional>
+
+class StreamingSetup
+{
+public:
+
+    // Ports and clock
+    Stm32async::HardwareLayout::PortA portA;
+    Stm32async::HardwareLayout::PortB portB;
+    Stm32async::HardwareLayout::PortC portC;
+    Stm32async::HardwareLayout::PortD portD;
+    Stm32async::HardwareLayout::PortH portH;
+    Stm32async::HardwareLayout::Dma1 dma1;
+    Stm32async::HardwareLayout::Dma2 dma2;
+    Stm32async::SystemClock sysClock;
+
+    // Logger
+    Stm32async::HardwareLayout::Usart1 usart1;
+    Stm32async::UsartLogger usartLogger;
+
+    // SD card: D0..D3 and CK at PC8..PC12, CMD at PD2, card detect at PC13
+    Stm32async::HardwareLayout::Sdio1 sdio1;
+    Stm32async::IOPort sdDetect;
+    Stm32async::Drivers::SdCardFat sdCard;
+
+    // Audio: I2S2 at PB12 (WS), PB13 (CK) and PB15 (SD)
+    Stm32async::HardwareLayout::I2S2 i2s2;
+    Stm32async::AsyncI2S i2s;
+    Stm32async::Drivers::AudioDac_UDA1334 audioDac;
+    Stm32async::Drivers::WavStreamer streamer;
+
+    static StreamingSetup * instance;
+
+    /**
+     * @brief The SDIO clock divider is the default one of the card, 0 is the fastest clock.
+     */
+    StreamingSetup (uint32_t clockDiv = 0) :
+        sysClock { Stm32async::HardwareLayout::Interrupt { SysTick_IRQn, 0 } },
+        usart1 { portB, GPIO_PIN_6, portB, Stm32async::UNUSED_PIN, /*remapped=*/ true, NULL,
+                 Stm32async::HardwareLayout::Interrupt { USART1_IRQn, 13, 0 },
+                 Stm32async::HardwareLayout::DmaStream { &dma2, DMA2_Stream7, DMA_CHANNEL_4,
+                                                         Stm32async::HardwareLayout::Interrupt { DMA2_Stream7_IRQn, 14 } },
+                 Stm32async::HardwareLayout::DmaStream { &dma2, DMA2_Stream5, DMA_CHANNEL_4,
+                                                         Stm32async::HardwareLayout::Interrupt { DMA2_Stream5_IRQn, 14 } } },
+        usartLogger { usart1, 115200 },
+        sdio1 { portC, GPIO_PIN_8 | GPIO_PIN_9 | GPIO_PIN_10 | GPIO_PIN_11 | GPIO_PIN_12, portD, GPIO_PIN_2,
+                Stm32async::HardwareLayout::Interrupt { SDIO_IRQn, 3, 0 },
+                Stm32async::HardwareLayout::DmaStream { &dma2, DMA2_Stream6, DMA_CHANNEL_4,
+                                                        Stm32async::HardwareLayout::Interrupt { DMA2_Stream6_IRQn, 4, 0 } },
+                Stm32async::HardwareLayout::DmaStream { &dma2, DMA2_Stream3, DMA_CHANNEL_4,
+                                                        Stm32async::HardwareLayout::Interrupt { DMA2_Stream3_IRQn, 4, 1 } } },
+        sdDetect { portC, GPIO_PIN_13, GPIO_MODE_INPUT, GPIO_PULLUP },
+        sdCard { sdio1, sdDetect, clockDiv },
+        i2s2 { portB, GPIO_PIN_12 | GPIO_PIN_13 | GPIO_PIN_15, /*remapped=*/ true, NULL,
+               Stm32async::HardwareLayout::DmaStream { &dma1, DMA1_Stream4, DMA_CHANNEL_0,
+                                                       Stm32async::HardwareLayout::Interrupt { DMA1_Stream4_IRQn, 2, 0 } },
+               Stm32async::HardwareLayout::DmaStream { &dma1, DMA1_Stream3, DMA_CHANNEL_0,
+                                                       Stm32async::HardwareLayout::Interrupt { DMA1_Stream3_IRQn, 2, 0 } } },
+        i2s { i2s2 },
+        audioDac { i2s, portC, GPIO_PIN_0, portC, GPIO_PIN_1, portC, GPIO_PIN_2 },
+        streamer { sdCard, audioDac }
+    {
+        // External oscillators use system pins
+        sysClock.setHSE(&portH, GPIO_PIN_0 | GPIO_PIN_1);
+        instance = this;
+    }
+
+    /**
+     * @brief Starts the 168 MHz system clock (48 MHz for the SDIO), the logger and the DAC.
+     */
+    void start ()
+    {
+        sysClock.setSysClockSource(RCC_SYSCLKSOURCE_PLLCLK);
+        sysClock.getOscParameters().PLL.PLLState = RCC_PLL_ON;
+        sysClock.getOscParameters().PLL.PLLSource = RCC_PLLSOURCE_HSE;
+        sysClock.getOscParameters().PLL.PLLM = HSE_VALUE / 1000000;
+        sysClock.getOscParameters().PLL.PLLN = 336;
+        sysClock.getOscParameters().PLL.PLLP = RCC_PLLP_DIV2;
+        sysClock.getOscParameters().PLL.PLLQ = 7;
+        sysClock.setAHB(RCC_SYSCLK_DIV1, RCC_HCLK_DIV4, RCC_HCLK_DIV2);
+        sysClock.setLatency(FLASH_LATENCY_5);
+        sysClock.start();
+        usartLogger.initInstance();
+        sdDetect.start();
+        audioDac.powerOn();
+    }
+
+    /**
+     * @brief Creates an empty image of the given size, inserts it and formats it by FatFS.
+     *
+     * The card is mounted by the blocking SdCardFat::mountFatFs(); it fails once before
+     * the volume is created.
+     */
+    bool format (const char * imageName, uint32_t megabytes, uint32_t clusterSize)
+    {
+        FILE * f = ::fopen(imageName, "wb");
+        if (f == NULL || ::fseek(f, (long) megabytes * 1024 * 1024 - 1, SEEK_SET) != 0 || ::fputc(0, f) == EOF)
+        {
+            return false;
+        }
+        ::fclose(f);
+        if (!insert(imageName) || sdCard.start() != Stm32async::DeviceStart::OK)
+        {
+            return false;
+        }
+        sdCard.mountFatFs();
+        return f_mkfs(sdCard.getFatFs().path, 0, clusterSize) == FR_OK
+               && sdCard.mountFatFs() == Stm32async::DeviceStart::OK;
+    }
+
+    /**
+     * @brief Inserts an image and pulls the card-detect pin.
+     */
+    bool insert (const char * imageName)
+    {
+        if (!HalSim::insertSdCard(imageName))
+        {
+            return false;
+        }
+        HalSim::setPin(GPIOC, GPIO_PIN_13, false);
+        return true;
+    }
+
+    /**
+     * @brief Releases the card-detect pin and removes the image.
+     */
+    void remove ()
+    {
+        HalSim::setPin(GPIOC, GPIO_PIN_13, true);
+        HalSim::removeSdCard();
+    }
+
+    /**
+     * @brief Mounts the inserted card by SdCardFat::periodic(), like the main loop does.
+     */
+    bool mount ()
+    {
+        while (sdCard.getMountState() != Stm32async::Drivers::SdCardFat::MountState::MOUNTED
+               && sdCard.getMountState() != Stm32async::Drivers::SdCardFat::MountState::FAILED)
+        {
+            sdCard.periodic();
+            HAL_Delay(1);
+        }
+        return sdCard.isMounted();
+    }
+
+    /**
+     * @brief Header of a PCM WAV file with the given number of frames.
+     */
+    static Stm32async::Drivers::WavStreamer::WavHeader getWavHeader (uint32_t sampleRate, uint16_t channels,
+                                                                      uint16_t bitsPerSample, uint32_t frames)
+    {
+        Stm32async::Drivers::WavStreamer::WavHeader h;
+        ::memset(&h, 0, sizeof(h));
+        const uint32_t blockAlign = channels * bitsPerSample / 8;
+        ::memcpy(h.fields.RIFF, "RIFF", 4);
+        h.fields.chunkSize = 36 + frames * blockAlign;
+        ::memcpy(h.fields.WAVE, "WAVE", 4);
+        ::memcpy(h.fields.fmt, "fmt ", 4);
+        h.fields.subchunk1Size = 16;
+        h.fields.audioFormat = Stm32async::Drivers::WavStreamer::WAVE_FORMAT_PCM;
+        h.fields.numOfChan = channels;
+        h.fields.samplesPerSec = sampleRate;
+        h.fields.bytesPerSec = sampleRate * blockAlign;
+        h.fields.blockAlign = (uint16_t) blockAlign;
+        h.fields.bitsPerSample = bitsPerSample;
+        ::memcpy(h.fields.subchunk2ID, "data", 4);
+        h.fields.subchunk2Size = frames * blockAlign;
+        return h;
+    }
+
+    /**
+     * @brief Streams until the condition is met or the stream ends, like the main loop.
+     *
+     * The CPU does not wait for the virtual I2S clock: __WFI() lets the virtual time jump
+     * to the next interrupt.
+     */
+    void stream (const std::function<bool ()> & done)
+    {
+        while (streamer.isActive() && !done())
+        {
+            sdCard.periodic();
+            streamer.periodic();
+            if (streamer.isActive() && !audioDac.isBlockRequested())
+            {
+                __WFI();
+            }
+        }
+    }
+};
+
+StreamingSetup * StreamingSetup::instance = NULL;
+
+/************************************************************************
+ * Interrupts
+ ************************************************************************/
+
+extern "C"
+{
+    void SysTick_Handler (void)
+    {
+        HAL_IncTick();
+    }
+
+    void SDIO_IRQHandler (void)
+    {
+        StreamingSetup::instance->sdCard.getSdio().processSdIOInterrupt();
+    }
+
+    void DMA2_Stream3_IRQHandler (void)
+    {
+        StreamingSetup::instance->sdCard.getSdio().processDmaRxInterrupt();
+    }
+
+    void DMA2_Stream6_IRQHandler (void)
+    {
+        StreamingSetup::instance->sdCard.getSdio().processDmaTxInterrupt();
+    }
+
+    void HAL_SD_XferCpltCallback (SD_HandleTypeDef * /*hsd*/)
+    {
+        StreamingSetup::instance->sdCard.getSdio().processXferCpltCallback();
+    }
+
+    void HAL_SD_DMA_RxCpltCallback (DMA_HandleTypeDef * /*hdma*/)
+    {
+        StreamingSetup::instance->sdCard.getSdio().processRxCpltCallback();
+    }
+
+    void HAL_SD_XferErrorCallback (SD_HandleTypeDef * /*hsd*/)
+    {
+        StreamingSetup::instance->sdCard.getSdio().processErrorCallback();
+    }
+
+    void DMA1_Stream4_IRQHandler (void)
+    {
+        StreamingSetup::instance->i2s.processDmaTxInterrupt();
+    }
+
+    void HAL_I2S_TxCpltCallback (I2S_HandleTypeDef * /*hi2s*/)
+    {
+        StreamingSetup::instance->i2s.processCallback(Stm32async::SharedDevice::State::TX_CMPL);
+    }
+
+    void HAL_I2S_ErrorCallback (I2S_HandleTypeDef * /*hi2s*/)
+    {
+        StreamingSetup::instance->i2s.processCallback(Stm32async::SharedDevice::State::ERROR);
+    }
+
+    void DMA2_Stream7_IRQHandler (void)
+    {
+        StreamingSetup::instance->usartLogger.getUsart().processDmaTxInterrupt();
+    }
+
+    void USART1_IRQHandler (void)
+    {
+        StreamingSetup::instance->usartLogger.getUsart().processInterrupt();
+    }
+
+    void HAL_UART_TxCpltCallback (UART_HandleTypeDef * channel)
+    {
+        if (channel->Instance == USART1)
+        {
+            StreamingSetup::instance->usartLogger.getUsart().processCallback(Stm32async::SharedDevice::State::TX_CMPL);
+        }
+    }
+
+    void HAL_UART_ErrorCallback (UART_HandleTypeDef * channel)
+    {
+        if (channel->Instance == USART1)
+        {
+            StreamingSetup::instance->usartLogger.getUsart().processCallback(Stm32async::SharedDevice::State::ERROR);
+        }
+    }
+}
+
+#endif
+#endif
@@ -0,0 +1,266 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+/*
+ * Timeout supervision of the SharedDevice transactions by TimeoutSupervisor:
+ *
+ * - Two SPI buses with different timeouts are supervised by a 1 kHz TIM7 interrupt, the
+ *   main loop never calls SharedDevice::periodic().
+ * - A finished transaction removes its deadline from the supervisor.
+ * - The completion interrupts of both buses are dropped: the transactions are finished with
+ *   State::TIMEOUT from the timer interrupt in the order of their deadlines, and a transaction
+ *   waiting in the queue is started and finished normally after the expired one.
+ * - The aborted buses transmit again.
+ */
+
+#ifdef HAL_SIMULATION
+
+#include "stm32async/Spi.h"
+#include "stm32async/Timer.h"
+#include "stm32async/TimeoutSupervisor.h"
+#include "stm32async/HardwareLayout/PortA.h"
+#include "stm32async/HardwareLayout/PortB.h"
+#include "stm32async/HardwareLayout/Dma1.h"
+#include "stm32async/HardwareLayout/Dma2.h"
+#include "stm32async/HardwareLayout/Spi1.h"
+#include "stm32async/HardwareLayout/Spi2.h"
+#include "stm32async/HardwareLayout/Timer7.h"
+#include "hal_sim.h"
+
+#include <cstdio>
+
+using namespace Stm32async;
+
+namespace
+{
+
+typedef HardwareLayout::DmaAllocation DA;
+
+constexpr uint32_t TIMEOUT1 = 50;
+constexpr uint32_t TIMEOUT2 = 20;
+
+HardwareLayout::PortA portA;
+HardwareLayout::PortB portB;
+HardwareLayout::Dma1 dma1;
+HardwareLayout::Dma2 dma2;
+HardwareLayout::Spi1 spi1 { portA, GPIO_PIN_5, portA, GPIO_PIN_7, portA, GPIO_PIN_6, true, NULL,
+    HardwareLayout::Interrupt { SPI1_IRQn, 1, 0 },
+    HardwareLayout::DmaStream { &dma2, DA { "SPI1 TX", DMA2_Stream5_BASE, DMA_CHANNEL_3, DMA2_Stream5_IRQn, 1, 1 } },
+    HardwareLayout::DmaStream { &dma2, DA { "SPI1 RX", DMA2_Stream0_BASE, DMA_CHANNEL_3, DMA2_Stream0_IRQn, 1, 2 } } };
+HardwareLayout::Spi2 spi2 { portB, GPIO_PIN_13, portB, GPIO_PIN_15, portB, GPIO_PIN_14, true, NULL,
+    HardwareLayout::Interrupt { SPI2_IRQn, 2, 0 },
+    HardwareLayout::DmaStream { &dma1, DA { "SPI2 TX", DMA1_Stream4_BASE, DMA_CHANNEL_0, DMA1_Stream4_IRQn, 2, 1 } },
+    HardwareLayout::DmaStream { &dma1, DA { "SPI2 RX", DMA1_Stream3_BASE, DMA_CHANNEL_0, DMA1_Stream3_IRQn, 2, 2 } } };
+HardwareLayout::Timer7 timer7 { HardwareLayout::Interrupt { TIM7_IRQn, 15, 1 } };
+
+AsyncSpi bus1 { spi1, GPIO_NOPULL };
+AsyncSpi bus2 { spi2, GPIO_NOPULL };
+InterruptTimer timeoutTimer { timer7 };
+
+uint32_t failures = 0;
+
+void check (bool condition, const char * name)
+{
+    printf("%s %s\n", condition ? "OK  " : "FAIL", name);
+    if (!condition)
+    {
+        ++failures;
+    }
+}
+
+/**
+ * @brief Client that records how and when its transactions are finished.
+ */
+class Client : public SharedDevice::DeviceClient
+{
+public:
+
+    uint8_t data[8];
+    uint32_t finished;
+    SharedDevice::State state;
+    uint32_t ipsr;
+    uint32_t tick;
+
+    Client () : finished { 0 }, state { SharedDevice::State::NONE }, ipsr { 0 }, tick { 0 }
+    {
+        for (uint32_t i = 0; i < sizeof(data); ++i)
+        {
+            data[i] = i;
+        }
+    }
+
+    virtual bool onTransmissionFinished (SharedDevice::State s) override
+    {
+        ++finished;
+        state = s;
+        ipsr = __get_IPSR();
+        tick = HAL_GetTick();
+        return true;
+    }
+};
+
+Client clientA, clientB, clientC;
+
+AsyncSpi & getBus (SPI_HandleTypeDef * hspi)
+{
+    return hspi->Instance == SPI1 ? bus1 : bus2;
+}
+
+/**
+ * @brief Lets the virtual time run, the main loop does not call periodic() or waitForRelease().
+ */
+void idle (uint32_t ms)
+{
+    const uint32_t start = HAL_GetTick();
+    while (HAL_GetTick() - start < ms)
+    {
+        __WFI();
+    }
+}
+
+} // end namespace
+
+extern "C"
+{
+    void SysTick_Handler (void)
+    {
+        HAL_IncTick();
+    }
+
+    void DMA2_Stream5_IRQHandler (void)
+    {
+        bus1.processDmaTxInterrupt();
+    }
+
+    void DMA2_Stream0_IRQHandler (void)
+    {
+        bus1.processDmaRxInterrupt();
+    }
+
+    void SPI1_IRQHandler (void)
+    {
+        bus1.processInterrupt();
+    }
+
+    void DMA1_Stream4_IRQHandler (void)
+    {
+        bus2.processDmaTxInterrupt();
+    }
+
+    void DMA1_Stream3_IRQHandler (void)
+    {
+        bus2.processDmaRxInterrupt();
+    }
+
+    void SPI2_IRQHandler (void)
+    {
+        bus2.processInterrupt();
+    }
+
+    void TIM7_IRQHandler (void)
+    {
+        timeoutTimer.processInterrupt();
+    }
+
+    void HAL_TIM_PeriodElapsedCallback (TIM_HandleTypeDef * htim)
+    {
+        if (htim->Instance == TIM7)
+        {
+            TimeoutSupervisor::processTick();
+        }
+    }
+
+    void HAL_SPI_TxCpltCallback (SPI_HandleTypeDef * hspi)
+    {
+        getBus(hspi).processCallback(SharedDevice::State::TX_CMPL);
+    }
+
+    void HAL_SPI_RxCpltCallback (SPI_HandleTypeDef * hspi)
+    {
+        getBus(hspi).processCallback(SharedDevice::State::RX_CMPL);
+    }
+
+    void HAL_SPI_ErrorCallback (SPI_HandleTypeDef * hspi)
+    {
+        getBus(hspi).processCallback(SharedDevice::State::ERROR);
+    }
+}
+
+int main ()
+{
+    HAL_Init();
+    portA.enableClock();
+    portB.enableClock();
+    for (AsyncSpi * bus : { &bus1, &bus2 })
+    {
+        bus->start(SPI_DIRECTION_2LINES, SPI_BAUDRATEPRESCALER_256, SPI_DATASIZE_8BIT,
+                   SPI_POLARITY_LOW, SPI_PHASE_1EDGE);
+    }
+    bus1.setTimeout(TIMEOUT1);
+    bus2.setTimeout(TIMEOUT2);
+    const DeviceStart::Status timerStatus = timeoutTimer.start(TIM_COUNTERMODE_UP,
+        SystemCoreClock / 1000000 - 1, 999, TIM_CLOCKDIVISION_DIV1, 0);
+    check(timerStatus == DeviceStart::OK, "the supervisor timer is started");
+
+    // Normal transfers
+    bus1.transmit(NULL, clientA.data, 4);
+    bus2.transmit(NULL, clientB.data, 4);
+    idle(5);
+    check(TimeoutSupervisor::getSize() == 0 && TimeoutSupervisor::getExpired() == 0
+          && bus1.getStatistics().timeouts == 0 && bus2.getStatistics().timeouts == 0,
+          "the deadlines of the finished transactions are removed");
+
+    // The half and the full transfer interrupts of A and B are lost: B (bus 2) expires
+    // before A (bus 1), C waits behind A
+    HalSim::dropIrqs(DMA2_Stream5_IRQn, 2);
+    HalSim::dropIrqs(DMA1_Stream4_IRQn, 2);
+    const uint32_t start = HAL_GetTick();
+    bus1.enqueueTransmit(&clientA, clientA.data, sizeof(clientA.data));
+    bus1.enqueueTransmit(&clientC, clientC.data, sizeof(clientC.data));
+    bus2.enqueueTransmit(&clientB, clientB.data, sizeof(clientB.data));
+    check(TimeoutSupervisor::getSize() == 2, "the deadlines of the running transactions are registered");
+    idle(3 * TIMEOUT1);
+    check(clientA.finished == 1 && clientA.state == SharedDevice::State::TIMEOUT
+          && clientB.finished == 1 && clientB.state == SharedDevice::State::TIMEOUT,
+          "the transactions without completion interrupt are finished by a timeout");
+    check(clientA.ipsr == TIM7_IRQn + 16 && clientB.ipsr == TIM7_IRQn + 16,
+          "the timeouts are signalled from the timer interrupt");
+    check(clientB.tick - start >= TIMEOUT2 && clientB.tick - start <= TIMEOUT2 + 2
+          && clientA.tick - start >= TIMEOUT1 && clientA.tick - start <= TIMEOUT1 + 2,
+          "the transactions are expired in the order of their deadlines");
+    check(clientC.finished == 1 && clientC.state == SharedDevice::State::TX_CMPL
+          && clientC.tick - clientA.tick <= 2,
+          "the queued transaction is started after the expired one");
+    check(TimeoutSupervisor::getSize() == 0 && TimeoutSupervisor::getExpired() == 2
+          && bus1.getStatistics().timeouts == 1 && bus2.getStatistics().timeouts == 1,
+          "the timeouts are counted");
+
+    // The aborted buses work again
+    const bool restarted = bus1.enqueueTransmit(&clientA, clientA.data, 2) == HAL_OK
+                           && bus2.enqueueTransmit(&clientB, clientB.data, 2) == HAL_OK;
+    idle(5);
+    check(restarted && clientA.finished == 2 && clientA.state == SharedDevice::State::TX_CMPL
+          && clientB.finished == 2 && clientB.state == SharedDevice::State::TX_CMPL
+          && TimeoutSupervisor::getSize() == 0,
+          "the aborted buses transmit again");
+
+    return failures == 0 ? 0 : 1;
+}
+
+#endif
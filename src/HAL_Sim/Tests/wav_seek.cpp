@@ -0,0 +1,318 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+/*
+ * Seek and resume of the WavStreamer on a fragmented FAT image:
+ *
+ * - The image is formatted by FatFS with 1 KB clusters, and the tracks are written
+ *   interleaved with a filler file, so that every track consists of many fragments. One
+ *   track fits into the cluster link map table, the other one has more than
+ *   (CLMT_SIZE - 2) / 2 fragments and falls back to the normal seek.
+ * - Seek latency: the virtual time from seek() to the delivery of the first block at the
+ *   new position, and the sectors read meanwhile. With the link map, the FAT is not read.
+ *   The streamed frames carry their own index, so the captured I2S output shows where the
+ *   playback continues.
+ * - Resume: the position is saved periodically while streaming and when stopped, resume()
+ *   continues at the saved position, and a name that does not fit into the resume point
+ *   is rejected instead of being truncated.
+ * - Resume in the playlist mode: the position is also saved while the next track of the
+ *   playlist is prefetched, i.e. while two tracks are open.
+ */
+
+#ifdef HAL_SIMULATION
+
+#include "streaming_setup.h"
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+using namespace Stm32async;
+using namespace Stm32async::Drivers;
+
+namespace
+{
+
+constexpr char IMAGE_NAME[] = "build/tests/wav_seek.img";
+constexpr uint32_t CLUSTER_SIZE = 1024;
+constexpr uint32_t SAMPLE_RATE = 16000;
+constexpr uint32_t FRAME_SIZE = 4;
+
+uint32_t failures = 0;
+
+void check (bool condition, const char * name)
+{
+    printf("%s %s\n", condition ? "OK  " : "FAIL", name);
+    if (!condition)
+    {
+        ++failures;
+    }
+}
+
+/**
+ * @brief Writes a 16-bit stereo track whose frame n is (n & 0xFFFF, n >> 16).
+ *
+ * After every chunk of the track, a cluster of the filler file is written, so the track
+ * has a fragment per chunk.
+ */
+bool writeTrack (const char * fileName, uint32_t frames, uint32_t chunkSize, FIL & filler)
+{
+    FIL file;
+    if (f_open(&file, fileName, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK)
+    {
+        return false;
+    }
+    const WavStreamer::WavHeader h = StreamingSetup::getWavHeader(SAMPLE_RATE, 2, 16, frames);
+    std::vector<uint8_t> data(sizeof(h.header) + frames * FRAME_SIZE);
+    ::memcpy(data.data(), h.header, sizeof(h.header));
+    for (uint32_t n = 0; n < frames; ++n)
+    {
+        const uint16_t frame[2] = { (uint16_t) n, (uint16_t) (n >> 16) };
+        ::memcpy(&data[sizeof(h.header) + n * FRAME_SIZE], frame, FRAME_SIZE);
+    }
+    std::vector<uint8_t> fill(CLUSTER_SIZE, 0xA5);
+    bool ok = true;
+    for (uint32_t pos = 0; ok && pos < data.size(); pos += chunkSize)
+    {
+        UINT written = 0;
+        const UINT n = (UINT) std::min((size_t) chunkSize, data.size() - pos);
+        ok = f_write(&file, &data[pos], n, &written) == FR_OK && written == n
+             && f_write(&filler, fill.data(), CLUSTER_SIZE, &written) == FR_OK && written == CLUSTER_SIZE;
+    }
+    return f_close(&file) == FR_OK && ok;
+}
+
+/**
+ * @brief Decodes the captured I2S frames into the frame indices of the track.
+ */
+class FrameCapture
+{
+public:
+
+    void start ()
+    {
+        frames.clear();
+        HalSim::captureI2s(SPI2, [this] (const uint16_t * items, uint32_t n)
+        {
+            for (uint32_t i = 0; i + 1 < n; i += 2)
+            {
+                frames.push_back(items[i] | ((uint32_t) items[i + 1] << 16));
+            }
+        });
+    }
+
+    void stop ()
+    {
+        HalSim::captureI2s(SPI2, nullptr);
+    }
+
+    /**
+     * @brief Checks that the playback jumps to the given frame and continues from there.
+     */
+    bool continuesAt (uint32_t frame) const
+    {
+        for (size_t i = 0; i < frames.size(); ++i)
+        {
+            if (frames[i] == frame && (i == 0 || frames[i - 1] + 1 != frame))
+            {
+                return i + 1 < frames.size() && frames[i + 1] == frame + 1;
+            }
+        }
+        return false;
+    }
+
+private:
+
+    std::vector<uint32_t> frames;
+};
+
+/**
+ * @brief Seeks while a block is requested and reads the block at the new position.
+ */
+void checkSeek (StreamingSetup & s, FrameCapture & capture, const char * fileName, bool linkMap)
+{
+    const std::string name = std::string("seek in ") + fileName;
+    if (!s.streamer.start(AudioDac_UDA1334::SourceType::STREAM, fileName))
+    {
+        check(false, name.c_str());
+        return;
+    }
+    const uint32_t startTime = HAL_GetTick();
+    s.stream([&s, startTime] ()
+    {
+        return HAL_GetTick() - startTime >= 500 && s.audioDac.isBlockRequested();
+    });
+
+    const uint32_t milliseconds = 3000;
+    const uint32_t dataStart = s.sdCard.getFatFs().key.database;
+    capture.start();
+    HalSim::clearTrace();
+    const uint64_t t0 = HalSim::getTime();
+    const bool sought = s.streamer.seek(milliseconds);
+    s.streamer.periodic();
+    const uint64_t latency = HalSim::getTime() - t0;
+
+    uint32_t reads = 0, fatReads = 0;
+    for (const HalSim::TraceRecord & r : HalSim::getTrace())
+    {
+        unsigned long long sector = 0;
+        unsigned long blocks = 0;
+        if (r.bus == "SDIO" && ::sscanf(r.text.c_str(), "R %llu +%lu", &sector, &blocks) == 2)
+        {
+            reads += (uint32_t) blocks;
+            fatReads += sector < dataStart ? 1 : 0;
+        }
+    }
+
+    s.stream([&s] ()
+    {
+        return s.streamer.getPosition() >= 3500;
+    });
+    s.streamer.stop();
+    capture.stop();
+    printf("BENCH %s: seek latency %.3f ms, %u sectors read, %u FAT reads\n", fileName, latency / 1e6,
+           (unsigned) reads, (unsigned) fatReads);
+    check(sought && capture.continuesAt(milliseconds * SAMPLE_RATE / 1000), name.c_str());
+    if (linkMap)
+    {
+        check(fatReads == 0, "seek by the cluster link map does not read the FAT");
+    }
+}
+
+bool readResumePoint (WavStreamer::ResumePoint & point)
+{
+    FIL file;
+    UINT bytesRead = 0;
+    if (f_open(&file, "resume.bin", FA_READ) != FR_OK)
+    {
+        return false;
+    }
+    const FRESULT code = f_read(&file, &point, sizeof(point), &bytesRead);
+    f_close(&file);
+    return code == FR_OK && bytesRead == sizeof(point) && point.magic == WavStreamer::RESUME_MAGIC;
+}
+
+void checkResume (StreamingSetup & s, FrameCapture & capture)
+{
+    s.streamer.setResumeFile("resume.bin");
+    if (!s.streamer.start(AudioDac_UDA1334::SourceType::STREAM, "long.wav"))
+    {
+        check(false, "start with a resume file");
+        return;
+    }
+
+    // The stream is interrupted like by a reset: the periodic save is the last one
+    const uint32_t startTime = HAL_GetTick();
+    s.stream([&s, startTime] ()
+    {
+        return HAL_GetTick() - startTime >= WavStreamer::RESUME_INTERVAL + 1000;
+    });
+    WavStreamer::ResumePoint periodic;
+    const uint32_t bytesPerSecond = SAMPLE_RATE * FRAME_SIZE;
+    check(readResumePoint(periodic) && ::strcmp(periodic.fileName, "long.wav") == 0
+          && periodic.position >= (WavStreamer::RESUME_INTERVAL - 500) / 1000.0 * bytesPerSecond
+          && periodic.position <= (WavStreamer::RESUME_INTERVAL + 500) / 1000.0 * bytesPerSecond,
+          "the position is saved periodically");
+
+    s.streamer.stop();
+    WavStreamer::ResumePoint stopped;
+    check(readResumePoint(stopped) && stopped.position > periodic.position, "the position is saved by stop()");
+
+    capture.start();
+    const bool resumed = s.streamer.resume();
+    s.stream([&s] ()
+    {
+        return s.streamer.getPosition() >= WavStreamer::RESUME_INTERVAL + 2000;
+    });
+    s.streamer.stop();
+    capture.stop();
+    check(resumed && capture.continuesAt(stopped.position / FRAME_SIZE), "resume() continues at the saved position");
+
+    const std::string longName = std::string(Playlist::MAX_NAME_LENGTH, 'x') + ".wav";
+    check(!s.streamer.start(AudioDac_UDA1334::SourceType::STREAM, longName.c_str()), "a too long name is rejected");
+    s.streamer.setResumeFile(NULL);
+}
+
+void checkPlaylistResume (StreamingSetup & s)
+{
+    f_unlink("resume.bin");
+    s.streamer.setResumeFile("resume.bin");
+    Playlist playlist;
+    playlist.add("long.wav");
+    playlist.add("linked.wav");
+    if (!s.streamer.start(playlist))
+    {
+        check(false, "start a playlist with a resume file");
+        return;
+    }
+    const uint32_t startTime = HAL_GetTick();
+    s.stream([&s, startTime] ()
+    {
+        return HAL_GetTick() - startTime >= WavStreamer::RESUME_INTERVAL + 1000;
+    });
+    WavStreamer::ResumePoint periodic;
+    check(readResumePoint(periodic) && ::strcmp(periodic.fileName, "long.wav") == 0 && periodic.position > 0,
+          "the position is saved periodically while the next track is prefetched");
+
+    s.streamer.stop();
+    WavStreamer::ResumePoint stopped;
+    check(readResumePoint(stopped) && ::strcmp(stopped.fileName, "long.wav") == 0
+          && stopped.position > periodic.position, "the position in a playlist is saved by stop()");
+    s.streamer.setResumeFile(NULL);
+}
+
+} // end of anonymous namespace
+
+int main ()
+{
+    HAL_Init();
+    HalSim::setConsole(::getenv("HAL_SIM_CONSOLE") != NULL);
+
+    StreamingSetup s;
+    s.start();
+    if (!s.format(IMAGE_NAME, 16, CLUSTER_SIZE))
+    {
+        printf("FAIL can not format %s\n", IMAGE_NAME);
+        return 1;
+    }
+
+    // 24 fragments fit into the link map, 250 fragments do not
+    FIL filler;
+    const bool written = f_open(&filler, "filler.bin", FA_CREATE_ALWAYS | FA_WRITE) == FR_OK
+                         && writeTrack("linked.wav", 6 * SAMPLE_RATE, 16 * CLUSTER_SIZE, filler)
+                         && writeTrack("scatter.wav", 4 * SAMPLE_RATE, CLUSTER_SIZE, filler)
+                         && writeTrack("long.wav", 15 * SAMPLE_RATE, 40 * CLUSTER_SIZE, filler)
+                         && f_close(&filler) == FR_OK;
+    if (!written)
+    {
+        printf("FAIL can not write the tracks\n");
+        return 1;
+    }
+
+    FrameCapture capture;
+    checkSeek(s, capture, "linked.wav", true);
+    checkSeek(s, capture, "scatter.wav", false);
+    checkResume(s, capture);
+    checkPlaylistResume(s);
+    HalSim::removeSdCard();
+    ::remove(IMAGE_NAME);
+    return failures == 0 ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,129 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+/*
+ * Writes the interrupt and DMA stream allocation of the class Hardware (namespace
+ * Allocation in Hardware.h) as a header file:
+ *
+ *     alloc_table > src/AllocationTable.h
+ *
+ * make allocation in HAL_Sim does this, and make test fails if the committed header
+ * differs from the output, so the header can not get out of date with Hardware.h.
+ *
+ * The conflicts are rejected by the static_assert in Hardware.h already when this tool
+ * or the firmware is compiled; the generated header documents the result and provides
+ * the owner of every used DMA stream as a macro.
+ *
+ * Build: make build/alloc_table in HAL_Sim; the tool is compiled with the flags of the
+ * firmware, only reads constants and is linked without further objects.
+ */
+
+#ifdef HAL_SIMULATION
+
+#include "Hardware.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+std::string getStreamName (uint32_t streamBase)
+{
+    const uint32_t dmaBase = (streamBase >= DMA2_BASE) ? DMA2_BASE : DMA1_BASE;
+    return std::string((dmaBase == DMA2_BASE) ? "DMA2" : "DMA1") + "_Stream"
+           + std::to_string((streamBase - dmaBase - 0x10) / 0x18);
+}
+
+std::string toMacro (std::string s)
+{
+    std::transform(s.begin(), s.end(), s.begin(), ::toupper);
+    return s;
+}
+
+} // end of anonymous namespace
+
+int main ()
+{
+    using namespace Stm32async::HardwareLayout;
+
+    std::vector<const DmaAllocation *> dmas;
+    for (const DmaAllocation & d : Allocation::DMAS)
+    {
+        dmas.push_back(&d);
+    }
+    std::sort(dmas.begin(), dmas.end(), [] (const DmaAllocation * a, const DmaAllocation * b)
+    {
+        return a->streamBase < b->streamBase;
+    });
+
+    std::vector<const IrqAllocation *> irqs;
+    for (const IrqAllocation & i : Allocation::IRQS)
+    {
+        irqs.push_back(&i);
+    }
+    for (const DmaAllocation * d : dmas)
+    {
+        irqs.push_back(&d->irq);
+    }
+    std::sort(irqs.begin(), irqs.end(), [] (const IrqAllocation * a, const IrqAllocation * b)
+    {
+        return a->irq.irqn < b->irq.irqn;
+    });
+
+    ::printf("/*\n"
+             " * Interrupt and DMA stream allocation of the class Hardware.\n"
+             " *\n"
+             " * Generated by HAL_Sim/Tools/alloc_table from the namespace Allocation in Hardware.h,\n"
+             " * do not edit.\n"
+             " *\n"
+             " * DMA streams:\n"
+             " *\n"
+             " *     stream          channel   IRQn   priority   owner\n");
+    for (const DmaAllocation * d : dmas)
+    {
+        ::printf(" *     %-15s %7lu   %4d   %5lu.%-4lu %s\n", getStreamName(d->streamBase).c_str(),
+                 (unsigned long) (d->channel >> DMA_SxCR_CHSEL_Pos), (int) d->irq.irq.irqn,
+                 (unsigned long) d->irq.irq.prio, (unsigned long) d->irq.irq.subPrio, d->irq.owner);
+    }
+    ::printf(" *\n"
+             " * Interrupts:\n"
+             " *\n"
+             " *     IRQn   priority   owner\n");
+    for (const IrqAllocation * i : irqs)
+    {
+        ::printf(" *     %4d   %5lu.%-4lu %s\n", (int) i->irq.irqn, (unsigned long) i->irq.prio,
+                 (unsigned long) i->irq.subPrio, i->owner);
+    }
+    ::printf(" */\n\n"
+             "#ifndef ALLOCATION_TABLE_H_\n"
+             "#define ALLOCATION_TABLE_H_\n\n");
+    for (const DmaAllocation * d : dmas)
+    {
+        ::printf("#define ALLOCATION_%s \"%s\"\n", toMacro(getStreamName(d->streamBase)).c_str(), d->irq.owner);
+    }
+    ::printf("\n#define ALLOCATION_DMA_STREAMS %lu\n"
+             "#define ALLOCATION_IRQS %lu\n\n"
+             "#endif\n", (unsigned long) dmas.size(), (unsigned long) irqs.size());
+    return 0;
+}
+
+#endif
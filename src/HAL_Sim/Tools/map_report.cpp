@@ -0,0 +1,363 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+/*
+ * Reports the placement of the firmware into the memories of STM32F405 from the map file
+ * of the GNU linker (-Wl,-Map=firmware.map, with LinkerScript.ld):
+ *
+ *     map_report firmware.map [--dma NAME]...
+ *
+ * The report lists the usage of the memory regions, the functions that run from RAM
+ * (RAM_FUNC, section .ramfunc) and the variables in the core-coupled memory (CCM_RAM,
+ * section .ccmram). It then checks that the RAM functions are in RAM, the CCM variables in
+ * CCMRAM and the main stack in CCMRAM. Every --dma option names a DMA buffer that must not
+ * be placed into the CCM, since the CCM is not accessible by DMA; a symbol matches if its
+ * (demangled) name contains NAME. The exit code is 1 if a check fails.
+ *
+ * Build: make build/map_report in HAL_Sim, or g++ -std=c++14 -o map_report map_report.cpp
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+struct Region
+{
+    std::string name;
+    uint64_t origin, length, used;
+};
+
+struct Symbol
+{
+    uint64_t address;
+    std::string name;
+};
+
+/**
+ * @brief An input section: the code or data of a single object file.
+ */
+struct InputSection
+{
+    std::string name, file;
+    uint64_t address, size;
+    std::vector<Symbol> symbols;
+};
+
+std::vector<Region> regions;
+std::vector<InputSection> inputs;
+std::map<std::string, uint64_t> assignments;
+
+std::vector<std::string> split (const char * line)
+{
+    std::vector<std::string> words;
+    const char * s = line;
+    while (*s != 0)
+    {
+        s += ::strspn(s, " \t\r\n");
+        const size_t n = ::strcspn(s, " \t\r\n");
+        if (n > 0)
+        {
+            words.emplace_back(s, n);
+        }
+        s += n;
+    }
+    return words;
+}
+
+bool isNumber (const std::string & word)
+{
+    return word.compare(0, 2, "0x") == 0;
+}
+
+uint64_t toNumber (const std::string & word)
+{
+    return ::strtoull(word.c_str(), NULL, 16);
+}
+
+Region * findRegion (uint64_t address)
+{
+    for (auto & r : regions)
+    {
+        if (address >= r.origin && address < r.origin + r.length)
+        {
+            return &r;
+        }
+    }
+    return NULL;
+}
+
+std::string getRegionName (uint64_t address)
+{
+    const Region * r = findRegion(address);
+    return r == NULL ? "no region" : r->name;
+}
+
+/**
+ * @brief Parses the memory configuration and the memory map. A section name that is too
+ *        long for its column is printed on an own line, the address follows on the next one.
+ */
+bool parse (FILE * in)
+{
+    enum class Part { HEADER, MEMORY, MAP } part = Part::HEADER;
+    std::string pendingOutput, pendingInput;
+    InputSection * current = NULL;
+    char line[4096];
+    while (::fgets(line, sizeof(line), in) != NULL)
+    {
+        const std::vector<std::string> w = split(line);
+        if (::strncmp(line, "Memory Configuration", 20) == 0)
+        {
+            part = Part::MEMORY;
+            continue;
+        }
+        if (::strncmp(line, "Linker script and memory map", 28) == 0)
+        {
+            part = Part::MAP;
+            continue;
+        }
+        if (part == Part::MEMORY)
+        {
+            if (w.size() >= 3 && isNumber(w[1]) && w[0] != "*default*")
+            {
+                regions.push_back(Region { w[0], toNumber(w[1]), toNumber(w[2]), 0 });
+            }
+            continue;
+        }
+        if (part != Part::MAP || w.empty())
+        {
+            continue;
+        }
+
+        // Output section
+        if (line[0] == '.' || !pendingOutput.empty())
+        {
+            const size_t i = pendingOutput.empty() ? 1 : 0;
+            const std::string name = pendingOutput.empty() ? w[0] : pendingOutput;
+            pendingOutput.clear();
+            current = NULL;
+            if (w.size() < i + 2)
+            {
+                pendingOutput = (w.size() == 1 && line[0] == '.') ? name : "";
+                continue;
+            }
+            const uint64_t address = toNumber(w[i]), size = toNumber(w[i + 1]);
+            Region * r = findRegion(address);
+            if (r != NULL && size > 0)
+            {
+                r->used += size;
+                // The initial values of a section in RAM are stored in ROM; the uninitialized
+                // sections follow the load address of .data, but they take no space there
+                Region * load = (w.size() >= i + 5 && w[i + 2] == "load") ? findRegion(toNumber(w[i + 4])) : NULL;
+                if (load != NULL && load != r && name.compare(0, 4, ".bss") != 0 && name.compare(0, 6, "._user") != 0)
+                {
+                    load->used += size;
+                }
+            }
+            continue;
+        }
+
+        // Input section
+        if ((line[0] == ' ' && line[1] == '.') || !pendingInput.empty())
+        {
+            const size_t i = pendingInput.empty() ? 1 : 0;
+            const std::string name = pendingInput.empty() ? w[0] : pendingInput;
+            pendingInput.clear();
+            current = NULL;
+            if (w.size() < i + 3)
+            {
+                pendingInput = (w.size() == 1 && line[1] == '.') ? name : "";
+                continue;
+            }
+            inputs.push_back(InputSection { name, w[i + 2], toNumber(w[i]), toNumber(w[i + 1]), {} });
+            current = &inputs.back();
+            continue;
+        }
+
+        // Symbol or assignment: the address is followed by the name or the expression
+        if (isNumber(w[0]) && w.size() >= 2)
+        {
+            const char * s = ::strstr(line, w[0].c_str()) + w[0].size();
+            s += ::strspn(s, " \t");
+            std::string text = s;
+            text.erase(text.find_last_not_of(" \t\r\n") + 1);
+            const size_t eq = text.find(" = ");
+            if (eq != std::string::npos)
+            {
+                assignments[text.substr(0, eq)] = toNumber(w[0]);
+            }
+            else if (current != NULL)
+            {
+                current->symbols.push_back(Symbol { toNumber(w[0]), text });
+            }
+            continue;
+        }
+        current = NULL;
+    }
+    return !regions.empty();
+}
+
+std::string getFileName (const std::string & path)
+{
+    const size_t slash = path.find_last_of("/\\");
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+/**
+ * @brief Prints the symbols of all input sections whose name starts with the given prefix.
+ *
+ * @return the total size of the sections
+ */
+uint64_t printSections (const char * prefix)
+{
+    uint64_t total = 0;
+    for (const auto & in : inputs)
+    {
+        if (in.name.compare(0, ::strlen(prefix), prefix) != 0 || in.size == 0)
+        {
+            continue;
+        }
+        total += in.size;
+        if (in.symbols.empty())
+        {
+            ::printf("  0x%08llx %7llu  (local symbols) [%s]\n", (unsigned long long) in.address,
+                     (unsigned long long) in.size, getFileName(in.file).c_str());
+        }
+        for (size_t k = 0; k < in.symbols.size(); ++k)
+        {
+            const uint64_t end = (k + 1 < in.symbols.size()) ? in.symbols[k + 1].address : in.address + in.size;
+            ::printf("  0x%08llx %7llu  %s [%s]\n", (unsigned long long) in.symbols[k].address,
+                     (unsigned long long) (end - in.symbols[k].address), in.symbols[k].name.c_str(),
+                     getFileName(in.file).c_str());
+        }
+    }
+    ::printf("  %19llu bytes in total\n", (unsigned long long) total);
+    return total;
+}
+
+/**
+ * @brief Checks that all input sections whose name starts with the given prefix are in a region.
+ */
+bool checkSections (const char * prefix, const char * region)
+{
+    for (const auto & in : inputs)
+    {
+        if (in.name.compare(0, ::strlen(prefix), prefix) == 0 && in.size > 0 && getRegionName(in.address) != region)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint32_t failures = 0;
+
+void report (bool ok, const std::string & text)
+{
+    ::printf("  %-5s %s\n", ok ? "ok" : "FAIL", text.c_str());
+    failures += ok ? 0 : 1;
+}
+
+} // end of anonymous namespace
+
+int main (int argc, char ** argv)
+{
+    const char * fileName = NULL;
+    std::vector<std::string> dmaBuffers;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (::strcmp(argv[i], "--dma") == 0 && i + 1 < argc)
+        {
+            dmaBuffers.push_back(argv[++i]);
+        }
+        else if (fileName == NULL && argv[i][0] != '-')
+        {
+            fileName = argv[i];
+        }
+        else
+        {
+            fileName = NULL;
+            break;
+        }
+    }
+    if (fileName == NULL)
+    {
+        ::fprintf(stderr, "usage: map_report firmware.map [--dma NAME]...\n");
+        return 1;
+    }
+    FILE * in = ::fopen(fileName, "r");
+    if (in == NULL)
+    {
+        ::fprintf(stderr, "map_report: can not open %s\n", fileName);
+        return 1;
+    }
+    const bool valid = parse(in);
+    ::fclose(in);
+    if (!valid)
+    {
+        ::fprintf(stderr, "map_report: %s has no memory configuration\n", fileName);
+        return 1;
+    }
+
+    ::printf("Memory regions:\n");
+    for (const auto & r : regions)
+    {
+        ::printf("  %-8s 0x%08llx %7llu of %7llu bytes used (%.1f%%)\n", r.name.c_str(), (unsigned long long) r.origin,
+                 (unsigned long long) r.used, (unsigned long long) r.length, 100.0 * r.used / r.length);
+    }
+    ::printf("\nFunctions in RAM (.ramfunc):\n");
+    printSections(".ramfunc");
+    ::printf("\nVariables in CCM (.ccmram):\n");
+    printSections(".ccmram");
+
+    ::printf("\nChecks:\n");
+    report(checkSections(".ramfunc", "RAM"), "the RAM functions are in RAM");
+    report(checkSections(".ccmram", "CCMRAM"), "the CCM variables are in CCMRAM");
+    const auto stack = assignments.find("_estack");
+    report(stack != assignments.end() && getRegionName(stack->second - 1) == "CCMRAM",
+           "the main stack is in CCMRAM");
+    for (const auto & name : dmaBuffers)
+    {
+        bool found = false;
+        for (const auto & s : inputs)
+        {
+            for (const auto & sym : s.symbols)
+            {
+                if (sym.name.find(name) == std::string::npos)
+                {
+                    continue;
+                }
+                found = true;
+                report(getRegionName(sym.address) != "CCMRAM",
+                       "the DMA buffer " + sym.name + " is in " + getRegionName(sym.address));
+            }
+        }
+        if (!found)
+        {
+            report(false, "the DMA buffer " + name + " is not found");
+        }
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,207 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+/*
+ * Converts the event trace of the firmware into the Chrome trace_event format.
+ *
+ * The tool reads a log of the USART1 logger (a serial terminal capture or the console
+ * output of the host simulation), picks the lines written by Tracer::dump() and writes a
+ * JSON file that chrome://tracing or Perfetto can open:
+ *
+ *     trace_json [log.txt] > trace.json
+ *
+ * The spans of the main loop and of every interrupt handler are shown as threads of the
+ * process "MCU"; the transactions of a device are shown on an own thread named by its DMA
+ * stream or peripheral. The 32-bit cycle counter is unwrapped under the assumption that
+ * consecutive events are less than 2^32 cycles apart, several dumps in a log continue
+ * the same time line.
+ *
+ * Build: make build/trace_json in HAL_Sim, or g++ -std=c++14 -o trace_json trace_json.cpp
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+
+namespace
+{
+
+/**
+ * @brief Names of the exceptions of STM32F405, given by the exception number.
+ */
+std::string getContextName (uint32_t context)
+{
+    static const std::map<uint32_t, const char *> names = {
+        { 0, "main" }, { 2, "NMI" }, { 3, "HardFault" }, { 11, "SVCall" }, { 14, "PendSV" }, { 15, "SysTick" },
+        { 16 + 3, "RTC_WKUP" }, { 16 + 6, "EXTI0" }, { 16 + 7, "EXTI1" }, { 16 + 8, "EXTI2" }, { 16 + 9, "EXTI3" },
+        { 16 + 10, "EXTI4" }, { 16 + 11, "DMA1_Stream0" }, { 16 + 12, "DMA1_Stream1" }, { 16 + 13, "DMA1_Stream2" },
+        { 16 + 14, "DMA1_Stream3" }, { 16 + 15, "DMA1_Stream4" }, { 16 + 16, "DMA1_Stream5" },
+        { 16 + 17, "DMA1_Stream6" }, { 16 + 18, "ADC" }, { 16 + 23, "EXTI9_5" }, { 16 + 27, "TIM1_CC" },
+        { 16 + 28, "TIM2" }, { 16 + 29, "TIM3" }, { 16 + 31, "I2C1_EV" }, { 16 + 32, "I2C1_ER" },
+        { 16 + 33, "I2C2_EV" }, { 16 + 34, "I2C2_ER" }, { 16 + 35, "SPI1" }, { 16 + 36, "SPI2" },
+        { 16 + 37, "USART1" }, { 16 + 38, "USART2" }, { 16 + 40, "EXTI15_10" }, { 16 + 47, "DMA1_Stream7" },
+        { 16 + 49, "SDIO" }, { 16 + 51, "SPI3" }, { 16 + 56, "DMA2_Stream0" }, { 16 + 57, "DMA2_Stream1" },
+        { 16 + 58, "DMA2_Stream2" }, { 16 + 59, "DMA2_Stream3" }, { 16 + 60, "DMA2_Stream4" },
+        { 16 + 68, "DMA2_Stream5" }, { 16 + 69, "DMA2_Stream6" }, { 16 + 70, "DMA2_Stream7" },
+        { 16 + 71, "USART6" }
+    };
+    auto it = names.find(context);
+    if (it != names.end())
+    {
+        return it->second;
+    }
+    return "IRQ " + std::to_string((int) context - 16);
+}
+
+/**
+ * @brief Names of a device track: the DMA streams and I2C peripherals are recognized by
+ *        their register address.
+ */
+std::string getDeviceName (uint32_t id)
+{
+    static const uint32_t DMA1_BASE = 0x40026000, DMA2_BASE = 0x40026400;
+    for (uint32_t dma = 1; dma <= 2; ++dma)
+    {
+        const uint32_t base = (dma == 1) ? DMA1_BASE : DMA2_BASE;
+        if (id >= base + 0x10 && id < base + 0x10 + 8 * 0x18 && (id - base - 0x10) % 0x18 == 0)
+        {
+            return "DMA" + std::to_string(dma) + "_Stream" + std::to_string((id - base - 0x10) / 0x18);
+        }
+    }
+    static const std::map<uint32_t, const char *> names = {
+        { 0x40005400, "I2C1" }, { 0x40005800, "I2C2" }, { 0x40005C00, "I2C3" }
+    };
+    auto it = names.find(id);
+    if (it != names.end())
+    {
+        return it->second;
+    }
+    char buffer[32];
+    ::snprintf(buffer, sizeof(buffer), "device 0x%08X", id);
+    return buffer;
+}
+
+std::string escape (const std::string & s)
+{
+    std::string result;
+    for (char c : s)
+    {
+        if (c == '"' || c == '\\')
+        {
+            result += '\\';
+        }
+        if ((unsigned char) c >= 0x20)
+        {
+            result += c;
+        }
+    }
+    return result;
+}
+
+} // end of anonymous namespace
+
+int main (int argc, char ** argv)
+{
+    FILE * in = stdin;
+    if (argc == 2)
+    {
+        in = ::fopen(argv[1], "r");
+        if (in == NULL)
+        {
+            ::fprintf(stderr, "trace_json: can not open %s\n", argv[1]);
+            return 1;
+        }
+    }
+    else if (argc > 2)
+    {
+        ::fprintf(stderr, "usage: trace_json [log.txt] > trace.json\n");
+        return 1;
+    }
+
+    static const char * PREFIX = "TRC: ";
+    std::map<uint32_t, std::string> threads;
+    double mhz = 0;
+    bool first = true, started = false;
+    uint32_t lastCycles = 0;
+    uint64_t cycles = 0;
+    uint32_t events = 0, lost = 0;
+    char line[1024];
+
+    ::printf("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    while (::fgets(line, sizeof(line), in) != NULL)
+    {
+        const char * s = ::strstr(line, PREFIX);
+        if (s == NULL)
+        {
+            continue;
+        }
+        s += ::strlen(PREFIX);
+
+        int n1 = 0, n2 = 0, n3 = 0;
+        if (::sscanf(s, "trace %d events, %d lost, cycles at %d MHz", &n1, &n2, &n3) == 3)
+        {
+            mhz = n3;
+            lost += (uint32_t) n2;
+            continue;
+        }
+
+        long long time = 0, id = 0;
+        char type = 0;
+        int context = 0, offset = 0;
+        if (mhz <= 0 || ::sscanf(s, "%lld %c %d %lld %n", &time, &type, &context, &id, &offset) < 4
+            || (type != 'B' && type != 'E' && type != 'i'))
+        {
+            continue;
+        }
+        std::string name = s + offset;
+        name.erase(name.find_last_not_of(" \t\r\n") + 1);
+
+        // Unwrap the 32-bit cycle counter
+        const uint32_t raw = (uint32_t) time;
+        cycles = started ? cycles + (uint32_t) (raw - lastCycles) : 0;
+        lastCycles = raw;
+        started = true;
+
+        const uint32_t tid = (id != 0) ? (uint32_t) id : (uint32_t) context;
+        if (threads.find(tid) == threads.end())
+        {
+            threads[tid] = (id != 0) ? getDeviceName((uint32_t) id) : getContextName((uint32_t) context);
+        }
+        ::printf("%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%u%s}", first ? "" : ",",
+                 escape(name).c_str(), type, (double) cycles / mhz, tid, (type == 'i') ? ",\"s\":\"t\"" : "");
+        first = false;
+        ++events;
+    }
+    ::printf("%s\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"MCU\"}}", first ? "" : ",");
+    for (const auto & t : threads)
+    {
+        ::printf(",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                 t.first, escape(t.second).c_str());
+    }
+    ::printf("\n]}\n");
+    if (in != stdin)
+    {
+        ::fclose(in);
+    }
+    ::fprintf(stderr, "trace_json: %u events on %u threads, %u lost in the firmware\n", events, (uint32_t) threads.size(), lost);
+    return 0;
+}
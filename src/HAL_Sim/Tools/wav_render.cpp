@@ -0,0 +1,680 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+/*
+ * Offline render of the WavStreamer pipeline.
+ *
+ * The tool plays WAV files from a FAT image through the unmodified streaming chain (FatFS,
+ * read-ahead, PCM converter, resampler, equalizer and analyzer) on the simulated HAL, and
+ * writes the samples that the I2S DMA shifts out into a WAV file. The card is the file
+ * backed SD card of the simulation, so the FatFS driver of SdCardFat and the multi-block
+ * reads of the read-ahead work on the image like on a real card. The CPU does not wait
+ * for the virtual I2S clock: whenever the requested block is filled, __WFI() lets the
+ * virtual time jump to the next interrupt, so the chain runs at the speed of the host.
+ *
+ *     wav_render [options] card.img out.wav track.wav [track.wav ...]
+ *
+ *     -r RATE               up-sample the streams to RATE Hz by the resampler
+ *     -e TYPE:FREQ:GAIN:Q   add an equalizer band, TYPE is peak, low or high
+ *     -a                    feed the spectrum analyzer
+ *     -v VOLUME             volume of the PCM converter, 1.0 is the unity gain
+ *     -s FILE               save the position into FILE on the card, and resume the
+ *                           track saved there instead of starting the playlist
+ *     -q                    do not echo the log of the streamer
+ *
+ * Several tracks are played as a playlist, i.e. gapless if their parameters are equal. At
+ * the end, the tool reports the rendered frames, the throughput of the host and the cost
+ * of every processing stage. The stage cost is measured with the host clock and given as
+ * cycles-equivalent: the host time multiplied by SystemCoreClock. It shows the proportions
+ * of the stages and their share of the real-time budget, but not the Cortex-M4 cycles.
+ * A read that waits for the card includes the host time of the simulated SD transfer, and
+ * "other" includes the simulation itself; the compute stages are not affected.
+ *
+ * Build: make build/wav_render in HAL_Sim; like the firmware, with this file instead of
+ * main.cpp, Hardware.cpp and MyApplication.cpp.
+ */
+
+#ifdef HAL_SIMULATION
+
+#include "hal_sim.h"
+
+#include "stm32async/HardwareLayout/Dma1.h"
+#include "stm32async/HardwareLayout/Dma2.h"
+#include "stm32async/HardwareLayout/PortA.h"
+#include "stm32async/HardwareLayout/PortB.h"
+#include "stm32async/HardwareLayout/PortC.h"
+#include "stm32async/HardwareLayout/PortD.h"
+#include "stm32async/HardwareLayout/PortH.h"
+#include "stm32async/HardwareLayout/Sdio1.h"
+#include "stm32async/HardwareLayout/I2S2.h"
+#include "stm32async/HardwareLayout/Usart1.h"
+#include "stm32async/SystemClock.h"
+#include "stm32async/UsartLogger.h"
+#include "stm32async/Profiler.h"
+#include "stm32async/Tracer.h"
+#include "stm32async/Drivers/WavStreamer.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+using namespace Stm32async;
+using namespace Stm32async::Drivers;
+
+namespace
+{
+
+typedef std::chrono::steady_clock HostClock;
+
+uint64_t getNanoseconds (HostClock::duration d)
+{
+    return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+}
+
+uint64_t toCycles (uint64_t ns)
+{
+    return ns * SystemCoreClock / 1000000000ULL;
+}
+
+/**
+ * @brief Measures the processing stages of the streamer with the host clock.
+ */
+class StageProfiler : public WavStreamer::StageHandler
+{
+public:
+
+    typedef struct
+    {
+        uint32_t calls;
+        uint64_t total, max;
+    } Statistics;
+
+    StageProfiler () :
+        startTime {  },
+        statistics {  }
+    {
+        // empty
+    }
+
+    virtual void onStageStarted (WavStreamer::Stage s) override
+    {
+        startTime[(size_t) s] = HostClock::now();
+    }
+
+    virtual void onStageFinished (WavStreamer::Stage s) override
+    {
+        const uint64_t ns = getNanoseconds(HostClock::now() - startTime[(size_t) s]);
+        Statistics & st = statistics[(size_t) s];
+        ++st.calls;
+        st.total += ns;
+        st.max = std::max(st.max, ns);
+    }
+
+    inline const Statistics & getStatistics (WavStreamer::Stage s) const
+    {
+        return statistics[(size_t) s];
+    }
+
+private:
+
+    HostClock::time_point startTime[WavStreamer::STAGES];
+    Statistics statistics[WavStreamer::STAGES];
+};
+
+/**
+ * @brief Writes the I2S DMA items into a PCM WAV file.
+ *
+ * A 16-bit stream is written as 16-bit samples. The 24- and 32-bit data formats carry
+ * every sample in two items, the most significant one first; they are written as 24-bit
+ * and 32-bit samples.
+ */
+class WavWriter final
+{
+public:
+
+    WavWriter () :
+        file { NULL },
+        sampleRate { 0 },
+        dataFormat { 0 },
+        frames { 0 },
+        mismatch { false }
+    {
+        // empty
+    }
+
+    ~WavWriter ()
+    {
+        close();
+    }
+
+    bool open (const char * fileName)
+    {
+        file = ::fopen(fileName, "wb");
+        return file != NULL;
+    }
+
+    void write (const I2S_HandleTypeDef & i2s, const uint16_t * items, uint32_t n)
+    {
+        if (file == NULL || mismatch)
+        {
+            return;
+        }
+        if (sampleRate == 0)
+        {
+            // The header is completed by close()
+            sampleRate = i2s.Init.AudioFreq;
+            dataFormat = i2s.Init.DataFormat;
+            writeHeader();
+        }
+        if (i2s.Init.AudioFreq != sampleRate || i2s.Init.DataFormat != dataFormat)
+        {
+            // A WAV file has a single format: the rest of the stream is not written
+            mismatch = true;
+            return;
+        }
+        if (dataFormat == I2S_DATAFORMAT_16B)
+        {
+            ::fwrite(items, sizeof(uint16_t), n, file);
+            frames += n / 2;
+            return;
+        }
+        const uint32_t bytes = getBytesPerSample();
+        for (uint32_t i = 0; i + 1 < n; i += 2)
+        {
+            const uint32_t sample = ((uint32_t) items[i] << 16) | items[i + 1];
+            const uint8_t data[4] = { (uint8_t) sample, (uint8_t) (sample >> 8), (uint8_t) (sample >> 16),
+                                      (uint8_t) (sample >> 24) };
+            ::fwrite(data + (4 - bytes), 1, bytes, file);
+        }
+        frames += n / 4;
+    }
+
+    void close ()
+    {
+        if (file == NULL)
+        {
+            return;
+        }
+        if (sampleRate != 0)
+        {
+            ::fseek(file, 0, SEEK_SET);
+            writeHeader();
+        }
+        ::fclose(file);
+        file = NULL;
+    }
+
+    inline uint32_t getFrames () const
+    {
+        return frames;
+    }
+
+    inline uint32_t getSampleRate () const
+    {
+        return sampleRate;
+    }
+
+    inline bool isMismatch () const
+    {
+        return mismatch;
+    }
+
+private:
+
+    FILE * file;
+    uint32_t sampleRate, dataFormat, frames;
+    bool mismatch;
+
+    uint32_t getBytesPerSample () const
+    {
+        return dataFormat == I2S_DATAFORMAT_16B ? 2 : (dataFormat == I2S_DATAFORMAT_24B ? 3 : 4);
+    }
+
+    void writeHeader ()
+    {
+        WavStreamer::WavHeader h;
+        ::memset(&h, 0, sizeof(h));
+        const uint32_t blockAlign = 2 * getBytesPerSample();
+        ::memcpy(h.fields.RIFF, "RIFF", 4);
+        h.fields.chunkSize = 36 + frames * blockAlign;
+        ::memcpy(h.fields.WAVE, "WAVE", 4);
+        ::memcpy(h.fields.fmt, "fmt ", 4);
+        h.fields.subchunk1Size = 16;
+        h.fields.audioFormat = WavStreamer::WAVE_FORMAT_PCM;
+        h.fields.numOfChan = 2;
+        h.fields.samplesPerSec = sampleRate;
+        h.fields.bytesPerSec = sampleRate * blockAlign;
+        h.fields.blockAlign = (uint16_t) blockAlign;
+        h.fields.bitsPerSample = (uint16_t) (8 * getBytesPerSample());
+        ::memcpy(h.fields.subchunk2ID, "data", 4);
+        h.fields.subchunk2Size = frames * blockAlign;
+        ::fwrite(h.header, 1, sizeof(h.header), file);
+    }
+};
+
+bool parseBand (const char * text, ParametricEq::Band & band)
+{
+    char type[8] = { 0 };
+    if (::sscanf(text, "%7[a-z]:%f:%f:%f", type, &band.freq, &band.gain, &band.q) != 4)
+    {
+        return false;
+    }
+    band.enabled = true;
+    if (::strcmp(type, "peak") == 0)
+    {
+        band.type = ParametricEq::BandType::PEAKING;
+    }
+    else if (::strcmp(type, "low") == 0)
+    {
+        band.type = ParametricEq::BandType::LOW_SHELF;
+    }
+    else if (::strcmp(type, "high") == 0)
+    {
+        band.type = ParametricEq::BandType::HIGH_SHELF;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+int usage ()
+{
+    ::fprintf(stderr, "usage: wav_render [-r rate] [-e type:freq:gain:q]... [-a] [-v volume] [-s resume] [-q]"
+              " card.img out.wav track.wav [track.wav ...]\n");
+    return 1;
+}
+
+} // end of anonymous namespace
+
+/************************************************************************
+ * Render setup
+ ************************************************************************/
+
+class WavRender
+{
+public:
+
+    // Ports and clock
+    HardwareLayout::PortA portA;
+    HardwareLayout::PortB portB;
+    HardwareLayout::PortC portC;
+    HardwareLayout::PortD portD;
+    HardwareLayout::PortH portH;
+    HardwareLayout::Dma1 dma1;
+    HardwareLayout::Dma2 dma2;
+    SystemClock sysClock;
+
+    // Logger
+    HardwareLayout::Usart1 usart1;
+    UsartLogger usartLogger;
+
+    // SD card: D0..D3 and CK at PC8..PC12, CMD at PD2, card detect at PC13
+    HardwareLayout::Sdio1 sdio1;
+    IOPort sdDetect;
+    SdCardFat sdCard;
+
+    // Audio: I2S2 at PB12 (WS), PB13 (CK) and PB15 (SD)
+    HardwareLayout::I2S2 i2s2;
+    AsyncI2S i2s;
+    AudioDac_UDA1334 audioDac;
+
+    // Streaming chain
+    WavStreamer streamer;
+    Playlist playlist;
+    Resampler * resampler;
+    ParametricEq equalizer;
+    SpectrumAnalyzer analyzer;
+    StageProfiler profiler;
+    WavWriter writer;
+
+    WavRender () :
+        sysClock { HardwareLayout::Interrupt { SysTick_IRQn, 0 } },
+        usart1 { portB, GPIO_PIN_6, portB, UNUSED_PIN, /*remapped=*/ true, NULL,
+                 HardwareLayout::Interrupt { USART1_IRQn, 13, 0 },
+                 HardwareLayout::DmaStream { &dma2, DMA2_Stream7, DMA_CHANNEL_4,
+                                             HardwareLayout::Interrupt { DMA2_Stream7_IRQn, 14 } },
+                 HardwareLayout::DmaStream { &dma2, DMA2_Stream5, DMA_CHANNEL_4,
+                                             HardwareLayout::Interrupt { DMA2_Stream5_IRQn, 14 } } },
+        usartLogger { usart1, 115200 },
+        sdio1 { portC, GPIO_PIN_8 | GPIO_PIN_9 | GPIO_PIN_10 | GPIO_PIN_11 | GPIO_PIN_12, portD, GPIO_PIN_2,
+                HardwareLayout::Interrupt { SDIO_IRQn, 3, 0 },
+                HardwareLayout::DmaStream { &dma2, DMA2_Stream6, DMA_CHANNEL_4,
+                                            HardwareLayout::Interrupt { DMA2_Stream6_IRQn, 4, 0 } },
+                HardwareLayout::DmaStream { &dma2, DMA2_Stream3, DMA_CHANNEL_4,
+                                            HardwareLayout::Interrupt { DMA2_Stream3_IRQn, 4, 1 } } },
+        sdDetect { portC, GPIO_PIN_13, GPIO_MODE_INPUT, GPIO_PULLUP },
+        sdCard { sdio1, sdDetect, 0 },
+        i2s2 { portB, GPIO_PIN_12 | GPIO_PIN_13 | GPIO_PIN_15, /*remapped=*/ true, NULL,
+               HardwareLayout::DmaStream { &dma1, DMA1_Stream4, DMA_CHANNEL_0,
+                                           HardwareLayout::Interrupt { DMA1_Stream4_IRQn, 2, 0 } },
+               HardwareLayout::DmaStream { &dma1, DMA1_Stream3, DMA_CHANNEL_0,
+                                           HardwareLayout::Interrupt { DMA1_Stream3_IRQn, 2, 0 } } },
+        i2s { i2s2 },
+        audioDac { i2s, portC, GPIO_PIN_0, portC, GPIO_PIN_1, portC, GPIO_PIN_2 },
+        streamer { sdCard, audioDac },
+        resampler { NULL }
+    {
+        // External oscillators use system pins
+        sysClock.setHSE(&portH, GPIO_PIN_0 | GPIO_PIN_1);
+    }
+
+    ~WavRender ()
+    {
+        delete resampler;
+    }
+
+    void initClock ()
+    {
+        // 168 MHz system clock and 48 MHz for the SDIO
+        sysClock.setSysClockSource(RCC_SYSCLKSOURCE_PLLCLK);
+        sysClock.getOscParameters().PLL.PLLState = RCC_PLL_ON;
+        sysClock.getOscParameters().PLL.PLLSource = RCC_PLLSOURCE_HSE;
+        sysClock.getOscParameters().PLL.PLLM = HSE_VALUE / 1000000;
+        sysClock.getOscParameters().PLL.PLLN = 336;
+        sysClock.getOscParameters().PLL.PLLP = RCC_PLLP_DIV2;
+        sysClock.getOscParameters().PLL.PLLQ = 7;
+        sysClock.setAHB(RCC_SYSCLK_DIV1, RCC_HCLK_DIV4, RCC_HCLK_DIV2);
+        sysClock.setLatency(FLASH_LATENCY_5);
+        sysClock.start();
+    }
+
+    bool mount (const char * imageName)
+    {
+        if (!HalSim::insertSdCard(imageName))
+        {
+            ::fprintf(stderr, "wav_render: can not open %s\n", imageName);
+            return false;
+        }
+        HalSim::setPin(GPIOC, GPIO_PIN_13, false);
+        sdDetect.start();
+        while (sdCard.getMountState() != SdCardFat::MountState::MOUNTED
+               && sdCard.getMountState() != SdCardFat::MountState::FAILED)
+        {
+            sdCard.periodic();
+            HAL_Delay(1);
+        }
+        if (!sdCard.isMounted())
+        {
+            ::fprintf(stderr, "wav_render: can not mount %s\n", imageName);
+            return false;
+        }
+        return true;
+    }
+
+    void render ()
+    {
+        while (streamer.isActive())
+        {
+            streamer.periodic();
+            if (writer.isMismatch())
+            {
+                streamer.stop();
+            }
+            else if (streamer.isActive() && !audioDac.isBlockRequested())
+            {
+                // The next block is only requested by the DMA interrupt
+                __WFI();
+            }
+        }
+    }
+
+    void report (uint64_t hostNs) const
+    {
+        const uint32_t rate = writer.getSampleRate();
+        const uint64_t frames = writer.getFrames();
+        const double seconds = rate == 0 ? 0.0 : (double) frames / rate;
+        const double hostSeconds = (double) hostNs / 1e9;
+        ::printf("Rendered %llu frames at %lu Hz (%.3f s), %lu gapless transitions\n",
+                 (unsigned long long) frames, (unsigned long) rate, seconds,
+                 (unsigned long) streamer.getGaplessTransitions());
+        if (writer.isMismatch())
+        {
+            ::printf("The stream parameters changed: the following tracks are not rendered\n");
+        }
+        ::printf("Host time %.3f s: %.0f frames/s, %.1f times real time\n", hostSeconds,
+                 hostSeconds > 0.0 ? frames / hostSeconds : 0.0, hostSeconds > 0.0 ? seconds / hostSeconds : 0.0);
+
+        // The budget is the CPU time of the rendered audio at the core clock
+        const double budget = seconds * SystemCoreClock;
+        static const char * const names[WavStreamer::STAGES] = { "read", "convert", "resample", "equalize", "analyze" };
+        ::printf("Stage cost in cycles-equivalent at %lu MHz:\n", (unsigned long) (SystemCoreClock / 1000000));
+        ::printf("    %-10s %8s %12s %12s %9s\n", "stage", "calls", "per call", "max", "budget");
+        uint64_t stagesNs = 0;
+        for (uint32_t i = 0; i < WavStreamer::STAGES; ++i)
+        {
+            const StageProfiler::Statistics & st = profiler.getStatistics((WavStreamer::Stage) i);
+            if (st.calls == 0)
+            {
+                continue;
+            }
+            stagesNs += st.total;
+            ::printf("    %-10s %8lu %12llu %12llu %8.2f%%\n", names[i], (unsigned long) st.calls,
+                     (unsigned long long) toCycles(st.total / st.calls), (unsigned long long) toCycles(st.max),
+                     budget > 0.0 ? 100.0 * toCycles(st.total) / budget : 0.0);
+        }
+        // The rest is spent in the streamer control, FatFS and the simulated HAL
+        const uint64_t otherNs = hostNs > stagesNs ? hostNs - stagesNs : 0;
+        ::printf("    %-10s %8s %12s %12s %8.2f%%\n", "other", "", "", "",
+                 budget > 0.0 ? 100.0 * toCycles(otherNs) / budget : 0.0);
+    }
+};
+
+WavRender * renderPtr = NULL;
+
+int main (int argc, char ** argv)
+{
+    HAL_Init();
+
+    WavRender r;
+    renderPtr = &r;
+    bool console = true, analyze = false;
+    const char * resumeFile = NULL;
+    float volume = 1.0f;
+    uint32_t bands = 0;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; ++i)
+    {
+        const char * option = argv[i];
+        const bool hasValue = ::strchr("revs", option[1]) != NULL;
+        if (option[1] == 0 || option[2] != 0 || (hasValue && i + 1 >= argc))
+        {
+            return usage();
+        }
+        const char * value = hasValue ? argv[++i] : NULL;
+        ParametricEq::Band band;
+        switch (option[1])
+        {
+        case 'r':
+            delete r.resampler;
+            r.resampler = new Resampler((uint32_t) ::atoi(value));
+            break;
+        case 'e':
+            if (!parseBand(value, band) || !r.equalizer.setBand(bands++, band))
+            {
+                ::fprintf(stderr, "wav_render: invalid equalizer band %s, or the bands boost more than %.0f dB\n", value,
+                          ParametricEq::MAX_BOOST);
+                return 1;
+            }
+            break;
+        case 'a':
+            analyze = true;
+            break;
+        case 'v':
+            volume = (float) ::atof(value);
+            break;
+        case 's':
+            resumeFile = value;
+            break;
+        case 'q':
+            console = false;
+            break;
+        default:
+            return usage();
+        }
+    }
+    if (argc - i < 3)
+    {
+        return usage();
+    }
+    const char * imageName = argv[i];
+    const char * outputName = argv[i + 1];
+    for (int k = i + 2; k < argc; ++k)
+    {
+        if (!r.playlist.add(argv[k]))
+        {
+            ::fprintf(stderr, "wav_render: can not add %s to the playlist\n", argv[k]);
+            return 1;
+        }
+    }
+
+    HalSim::setConsole(console);
+    r.initClock();
+    r.usartLogger.initInstance();
+    if (!r.mount(imageName))
+    {
+        return 1;
+    }
+    if (!r.writer.open(outputName))
+    {
+        ::fprintf(stderr, "wav_render: can not create %s\n", outputName);
+        return 1;
+    }
+    HalSim::captureI2s(SPI2, [&r] (const uint16_t * items, uint32_t n)
+    {
+        r.writer.write(r.i2s.getParameters(), items, n);
+    });
+
+    r.streamer.setResampler(r.resampler);
+    r.streamer.setEqualizer(bands > 0 ? &r.equalizer : NULL);
+    r.streamer.setAnalyzer(analyze ? &r.analyzer : NULL);
+    r.streamer.setVolume(volume);
+    r.streamer.setStageHandler(&r.profiler);
+    r.streamer.setResumeFile(resumeFile);
+    r.audioDac.powerOn();
+
+    const HostClock::time_point start = HostClock::now();
+    if ((resumeFile == NULL || !r.streamer.resume()) && !r.streamer.start(r.playlist))
+    {
+        ::fprintf(stderr, "wav_render: can not start the stream\n");
+        return 1;
+    }
+    r.render();
+    const uint64_t hostNs = getNanoseconds(HostClock::now() - start);
+    r.writer.close();
+    HalSim::captureI2s(SPI2, nullptr);
+
+    ::fflush(stdout);
+    HalSim::setConsole(false);
+    r.report(hostNs);
+#if defined(STM32ASYNC_PROFILING) || defined(STM32ASYNC_TRACING)
+    // The regions and the last events of the firmware, see Profiler.h and Tracer.h
+    HalSim::setConsole(true);
+    PROFILE_DUMP();
+    TRACE_DUMP();
+    r.usartLogger.getUsart().waitForRelease();
+#endif
+    return 0;
+}
+
+/************************************************************************
+ * Interrupts
+ ************************************************************************/
+
+extern "C"
+{
+    void SysTick_Handler (void)
+    {
+        HAL_IncTick();
+    }
+
+    void SDIO_IRQHandler (void)
+    {
+        renderPtr->sdCard.getSdio().processSdIOInterrupt();
+    }
+
+    void DMA2_Stream3_IRQHandler (void)
+    {
+        renderPtr->sdCard.getSdio().processDmaRxInterrupt();
+    }
+
+    void DMA2_Stream6_IRQHandler (void)
+    {
+        renderPtr->sdCard.getSdio().processDmaTxInterrupt();
+    }
+
+    void HAL_SD_XferCpltCallback (SD_HandleTypeDef * /*hsd*/)
+    {
+        renderPtr->sdCard.getSdio().processXferCpltCallback();
+    }
+
+    void HAL_SD_DMA_RxCpltCallback (DMA_HandleTypeDef * /*hdma*/)
+    {
+        renderPtr->sdCard.getSdio().processRxCpltCallback();
+    }
+
+    void HAL_SD_XferErrorCallback (SD_HandleTypeDef * /*hsd*/)
+    {
+        renderPtr->sdCard.getSdio().processErrorCallback();
+    }
+
+    void DMA1_Stream4_IRQHandler (void)
+    {
+        renderPtr->i2s.processDmaTxInterrupt();
+    }
+
+    void HAL_I2S_TxCpltCallback (I2S_HandleTypeDef * /*hi2s*/)
+    {
+        renderPtr->i2s.processCallback(SharedDevice::State::TX_CMPL);
+    }
+
+    void HAL_I2S_ErrorCallback (I2S_HandleTypeDef * /*hi2s*/)
+    {
+        renderPtr->i2s.processCallback(SharedDevice::State::ERROR);
+    }
+
+    void DMA2_Stream7_IRQHandler (void)
+    {
+        renderPtr->usartLogger.getUsart().processDmaTxInterrupt();
+    }
+
+    void USART1_IRQHandler (void)
+    {
+        renderPtr->usartLogger.getUsart().processInterrupt();
+    }
+
+    void HAL_UART_TxCpltCallback (UART_HandleTypeDef * channel)
+    {
+        if (channel->Instance == USART1)
+        {
+            renderPtr->usartLogger.getUsart().processCallback(SharedDevice::State::TX_CMPL);
+        }
+    }
+
+    void HAL_UART_ErrorCallback (UART_HandleTypeDef * channel)
+    {
+        if (channel->Instance == USART1)
+        {
+            renderPtr->usartLogger.getUsart().processCallback(SharedDevice::State::ERROR);
+        }
+    }
+}
+
+#endif
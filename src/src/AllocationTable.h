@@ -0,0 +1,43 @@
+/*
+ * Interrupt and DMA stream allocation of the class Hardware.
+ *
+ * Generated by HAL_Sim/Tools/alloc_table from the namespace Allocation in Hardware.h,
+ * do not edit.
+ *
+ * DMA streams:
+ *
+ *     stream          channel   IRQn   priority   owner
+ *     DMA2_Stream0          3     56       1.2    SPI1 RX
+ *     DMA2_Stream2          4     58      14.0    USART1 RX
+ *     DMA2_Stream5          3     68       1.1    SPI1 TX
+ *     DMA2_Stream7          4     70      14.0    USART1 TX
+ *
+ * Interrupts:
+ *
+ *     IRQn   priority   owner
+ *       -1       0.0    SysTick
+ *        3      15.0    RTC
+ *       25       8.0    TIM1 (volume)
+ *       28       8.0    TIM2 (bass)
+ *       29       8.0    TIM3 (treble)
+ *       35       1.0    SPI1
+ *       37      13.0    USART1
+ *       55      15.1    TIM7 (timeouts)
+ *       56       1.2    SPI1 RX
+ *       58      14.0    USART1 RX
+ *       68       1.1    SPI1 TX
+ *       70      14.0    USART1 TX
+ */
+
+#ifndef ALLOCATION_TABLE_H_
+#define ALLOCATION_TABLE_H_
+
+#define ALLOCATION_DMA2_STREAM0 "SPI1 RX"
+#define ALLOCATION_DMA2_STREAM2 "USART1 RX"
+#define ALLOCATION_DMA2_STREAM5 "SPI1 TX"
+#define ALLOCATION_DMA2_STREAM7 "USART1 TX"
+
+#define ALLOCATION_DMA_STREAMS 4
+#define ALLOCATION_IRQS 12
+
+#endif
@@ -0,0 +1,66 @@
+/*------------------------------------------------------------------------*/
+/* Unicode - OEM code bidirectional converter for FatFs                   */
+/* Single byte code page 1252 (Latin 1, Windows)                          */
+/*------------------------------------------------------------------------*/
+/* This file is included by option/unicode.c when the LFN feature is
+/  enabled. Only the code page used by this project is provided: the
+/  lower half is ASCII, 0xA0-0xFF is identical to ISO-8859-1 and only
+/  0x80-0x9F has to be mapped through a table.
+*/
+
+#if _CODE_PAGE != 1252
+#error This file provides the code page 1252 only.
+#endif
+
+static
+const WCHAR Tbl[] = {	/*  CP1252(0x80-0x9F) to Unicode conversion table */
+	0x20AC, 0x0000, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021,
+	0x02C6, 0x2030, 0x0160, 0x2039, 0x0152, 0x0000, 0x017D, 0x0000,
+	0x0000, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+	0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, 0x0000, 0x017E, 0x0178
+};
+
+
+
+WCHAR ff_convert (	/* Converted character, Returns zero on error */
+	WCHAR	chr,	/* Character code to be converted */
+	UINT	dir		/* 0: Unicode to OEM code, 1: OEM code to Unicode */
+)
+{
+	WCHAR c;
+
+
+	if (chr < 0x80 || (chr >= 0xA0 && chr < 0x100)) {	/* ASCII and Latin-1 */
+		c = chr;
+
+	} else {
+		if (dir) {		/* OEM code to Unicode */
+			c = (chr >= 0x100) ? 0 : Tbl[chr - 0x80];
+
+		} else {		/* Unicode to OEM code */
+			for (c = 0; c < 0x20; c++) {
+				if (Tbl[c] && chr == Tbl[c]) break;
+			}
+			c = (c < 0x20) ? c + 0x80 : 0;
+		}
+	}
+
+	return c;
+}
+
+
+
+WCHAR ff_wtoupper (	/* Returns upper converted character */
+	WCHAR chr		/* Unicode character to be upper converted */
+)
+{
+	if (chr >= 'a' && chr <= 'z') return chr - 0x20;				/* ASCII */
+	if (chr >= 0xE0 && chr <= 0xFE && chr != 0xF7) return chr - 0x20;	/* Latin-1 */
+	switch (chr) {													/* CP1252 extensions */
+	case 0xFF:	 return 0x0178;
+	case 0x0161: return 0x0160;
+	case 0x0153: return 0x0152;
+	case 0x017E: return 0x017D;
+	default:	 return chr;
+	}
+}
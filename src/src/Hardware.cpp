@@ -124,11 +124,11 @@ void ClockParameters::searchBestParameters (uint32_t targetFreq)
  ************************************************************************/
 Hardware::Hardware ():
     // System, RTC and MCO
-    sysClock { HardwareLayout::Interrupt { SysTick_IRQn, 0 } },
-    rtc { HardwareLayout::Interrupt { RTC_WKUP_IRQn, 15 } },
+    sysClock { HardwareLayout::Interrupt { Allocation::IRQ_SYSTICK.irq } },
+    rtc { HardwareLayout::Interrupt { Allocation::IRQ_RTC.irq } },
 
     // LEDs
-    ledBlue { portC, GPIO_PIN_1, Drivers::Led::ConnectionType::CATHODE },
+    ledBlue { portC, LedBluePin::PIN, Drivers::Led::ConnectionType::CATHODE },
 
     // I2C (TDA7439)
     i2c2 { portB, GPIO_PIN_10 | GPIO_PIN_11, /*remapped=*/ true, NULL },
@@ -140,10 +140,10 @@ Hardware::Hardware ():
     btn2 { portB, GPIO_PIN_14, GPIO_PULLUP },
     btn3 { portB, GPIO_PIN_13, GPIO_PULLUP },
     btn4 { portB, GPIO_PIN_12, GPIO_PULLUP },
-    led1 { portA, GPIO_PIN_12, Drivers::Led::ConnectionType::ANODE },
-    led2 { portA, GPIO_PIN_11, Drivers::Led::ConnectionType::ANODE },
-    led3 { portA, GPIO_PIN_10, Drivers::Led::ConnectionType::ANODE },
-    led4 { portC, GPIO_PIN_9, Drivers::Led::ConnectionType::ANODE },
+    led1 { portA, Led1Pin::PIN, Drivers::Led::ConnectionType::ANODE },
+    led2 { portA, Led2Pin::PIN, Drivers::Led::ConnectionType::ANODE },
+    led3 { portA, Led3Pin::PIN, Drivers::Led::ConnectionType::ANODE },
+    led4 { portC, Led4Pin::PIN, Drivers::Led::ConnectionType::ANODE },
 
     // Amp switches
     pinAmpMute { portC, GPIO_PIN_10, GPIO_MODE_OUTPUT_PP, GPIO_NOPULL },
@@ -152,31 +152,31 @@ Hardware::Hardware ():
     pinAmpGain1 { portD, GPIO_PIN_2, GPIO_MODE_OUTPUT_PP, GPIO_NOPULL },
 
     // Encoders
-    timer1 { HardwareLayout::Interrupt { TIM1_UP_TIM10_IRQn, 8, 0 } },
+    timer1 { HardwareLayout::Interrupt { Allocation::IRQ_TIMER1.irq } },
     volumeEncoder { timer1, portA, GPIO_PIN_8, portA, GPIO_PIN_9, TIM_ENCODERMODE_TI12, /*filter=*/ 0xA, /*step=*/ 4 },
-    timer2 { HardwareLayout::Interrupt { TIM2_IRQn, 8, 0 } },
+    timer2 { HardwareLayout::Interrupt { Allocation::IRQ_TIMER2.irq } },
     bassEncoder { timer2, portA, GPIO_PIN_15, portB, GPIO_PIN_3, TIM_ENCODERMODE_TI12, /*filter=*/ 0xA, /*step=*/ 4 },
-    timer3 { HardwareLayout::Interrupt { TIM3_IRQn, 8, 0 } },
+    timer3 { HardwareLayout::Interrupt { Allocation::IRQ_TIMER3.irq } },
     trebleEncoder { timer3, portC, GPIO_PIN_6, portC, GPIO_PIN_7, TIM_ENCODERMODE_TI12, /*filter=*/ 0xA, /*step=*/ 4 },
 
+    // Timeout supervisor
+    timer7 { HardwareLayout::Interrupt { Allocation::IRQ_TIMER7.irq } },
+    timeoutTimer { timer7 },
+
     // SPI
     spi1 { portA, GPIO_PIN_5, portA, GPIO_PIN_7, portA, GPIO_PIN_6, /*remapped=*/ true, NULL,
-             HardwareLayout::Interrupt { SPI1_IRQn, 1, 0 },
-             HardwareLayout::DmaStream { &dma2, DMA2_Stream5, DMA_CHANNEL_3,
-                                         HardwareLayout::Interrupt { DMA2_Stream5_IRQn, 1, 1 } },
-             HardwareLayout::DmaStream { &dma2, DMA2_Stream2, DMA_CHANNEL_3,
-                                         HardwareLayout::Interrupt { DMA2_Stream2_IRQn, 1, 2 } }
+             HardwareLayout::Interrupt { Allocation::IRQ_SPI1.irq },
+             HardwareLayout::DmaStream { &dma2, Allocation::DMA_SPI1_TX },
+             HardwareLayout::DmaStream { &dma2, Allocation::DMA_SPI1_RX }
     },
     spi { spi1, GPIO_NOPULL },
     eepRom { spi, portC, GPIO_PIN_4 },
 
     // USART logger
     usart1 { portB, GPIO_PIN_6, portB, UNUSED_PIN, /*remapped=*/ true, NULL,
-             HardwareLayout::Interrupt { USART1_IRQn, 13, 0 },
-             HardwareLayout::DmaStream { &dma2, DMA2_Stream7, DMA_CHANNEL_4,
-                                         HardwareLayout::Interrupt { DMA2_Stream7_IRQn, 14 } },
-             HardwareLayout::DmaStream { &dma2, DMA2_Stream2, DMA_CHANNEL_4,
-                                         HardwareLayout::Interrupt { DMA2_Stream2_IRQn, 14 } }
+             HardwareLayout::Interrupt { Allocation::IRQ_USART1.irq },
+             HardwareLayout::DmaStream { &dma2, Allocation::DMA_USART1_TX },
+             HardwareLayout::DmaStream { &dma2, Allocation::DMA_USART1_RX }
     },
     usartLogger { usart1, 115200 }
 {
@@ -222,11 +222,18 @@ bool Hardware::start()
     ledBlue.start();
     ledBlue.turnOff();
 
+    // Timeout supervisor: 1 MHz counter clock and 1 ms period; the timer clock is twice
+    // PCLK1 if APB1 is divided. Started first, so that the logger is supervised
+    const uint32_t pclk1 = HAL_RCC_GetPCLK1Freq();
+    const uint32_t timerClock = (pclk1 == HAL_RCC_GetHCLKFreq()) ? pclk1 : 2 * pclk1;
+    status = timeoutTimer.start(TIM_COUNTERMODE_UP, timerClock / 1000000 - 1, 999);
+
     // Logger
     usartLogger.initInstance();
     USART_DEBUG("--------------------------------------------------------" << UsartLogger::ENDL);
     USART_DEBUG("MCU frequency: " << SystemClock::getInstance()->getMcuFreq() << UsartLogger::ENDL);
     clockParameters.print();
+    USART_DEBUG("TIM(timeouts) status: " << DeviceStart::asString(status) << " (" << timeoutTimer.getHalStatus() << ")" << UsartLogger::ENDL);
 
     // For RTC, it is necessary to reset the state since it will not be
     // automatically reset after MCU programming.
@@ -297,6 +304,7 @@ void Hardware::stop ()
     volumeEncoder.stop();
     bassEncoder.stop();
     trebleEncoder.stop();
+    timeoutTimer.stop();
     i2cDsp.stop();
     btn1.stop();
     btn2.stop();
@@ -362,8 +370,8 @@ extern "C"
         appPtr->abort();
     }
 
-    // System
-    void SysTick_Handler (void)
+    // System; the frequent handlers run from RAM
+    RAM_FUNC void SysTick_Handler (void)
     {
         HAL_IncTick();
         if (Rtc::getInstance() != NULL)
@@ -389,9 +397,24 @@ extern "C"
         }
     }
 
+    // Timeout supervisor
+    void TIM7_IRQHandler (void)
+    {
+        appPtr->timeoutTimer.processInterrupt();
+    }
+
+    void HAL_TIM_PeriodElapsedCallback (TIM_HandleTypeDef * htim)
+    {
+        if (htim->Instance == TIM7)
+        {
+            TimeoutSupervisor::processTick();
+        }
+    }
+
     // UARTs: uses both USART and DMA interrupts
-    void DMA2_Stream7_IRQHandler (void)
+    RAM_FUNC void DMA2_Stream7_IRQHandler (void)
     {
+        PROFILE_SCOPE("DMA2_Stream7_IRQHandler");
         appPtr->getLoggerUsart().processDmaTxInterrupt();
     }
 
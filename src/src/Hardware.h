@@ -33,12 +33,17 @@
 #include "stm32async/HardwareLayout/Timer1.h"
 #include "stm32async/HardwareLayout/Timer2.h"
 #include "stm32async/HardwareLayout/Timer3.h"
+#include "stm32async/HardwareLayout/Timer7.h"
 
 #include "stm32async/SystemClock.h"
 #include "stm32async/Rtc.h"
 #include "stm32async/IOPort.h"
 #include "stm32async/UsartLogger.h"
+#include "stm32async/Profiler.h"
+#include "stm32async/Tracer.h"
 #include "stm32async/Timer.h"
+#include "stm32async/TimeoutSupervisor.h"
+#include "stm32async/FastPin.h"
 #include "stm32async/Spi.h"
 
 #include "stm32async/Drivers/Button.h"
@@ -71,6 +76,42 @@ public:
     void searchBestParameters (uint32_t targetFreq);
 };
 
+/**
+ * @brief Interrupts and DMA streams used by the class Hardware.
+ *
+ * The allocation is checked for conflicts at compile time. HAL_Sim/Tools/alloc_table
+ * reports it into AllocationTable.h (make allocation in HAL_Sim, checked by make test).
+ */
+namespace Allocation
+{
+
+constexpr HardwareLayout::IrqAllocation IRQ_SYSTICK { "SysTick", SysTick_IRQn, 0 };
+constexpr HardwareLayout::IrqAllocation IRQ_RTC { "RTC", RTC_WKUP_IRQn, 15 };
+constexpr HardwareLayout::IrqAllocation IRQ_TIMER1 { "TIM1 (volume)", TIM1_UP_TIM10_IRQn, 8, 0 };
+constexpr HardwareLayout::IrqAllocation IRQ_TIMER2 { "TIM2 (bass)", TIM2_IRQn, 8, 0 };
+constexpr HardwareLayout::IrqAllocation IRQ_TIMER3 { "TIM3 (treble)", TIM3_IRQn, 8, 0 };
+constexpr HardwareLayout::IrqAllocation IRQ_TIMER7 { "TIM7 (timeouts)", TIM7_IRQn, 15, 1 };
+constexpr HardwareLayout::IrqAllocation IRQ_SPI1 { "SPI1", SPI1_IRQn, 1, 0 };
+constexpr HardwareLayout::IrqAllocation IRQ_USART1 { "USART1", USART1_IRQn, 13, 0 };
+
+constexpr HardwareLayout::DmaAllocation DMA_SPI1_TX { "SPI1 TX", DMA2_Stream5_BASE, DMA_CHANNEL_3, DMA2_Stream5_IRQn, 1, 1 };
+constexpr HardwareLayout::DmaAllocation DMA_SPI1_RX { "SPI1 RX", DMA2_Stream0_BASE, DMA_CHANNEL_3, DMA2_Stream0_IRQn, 1, 2 };
+constexpr HardwareLayout::DmaAllocation DMA_USART1_TX { "USART1 TX", DMA2_Stream7_BASE, DMA_CHANNEL_4, DMA2_Stream7_IRQn, 14 };
+constexpr HardwareLayout::DmaAllocation DMA_USART1_RX { "USART1 RX", DMA2_Stream2_BASE, DMA_CHANNEL_4, DMA2_Stream2_IRQn, 14 };
+
+constexpr HardwareLayout::IrqAllocation IRQS[] = {
+    IRQ_SYSTICK, IRQ_RTC, IRQ_TIMER1, IRQ_TIMER2, IRQ_TIMER3, IRQ_TIMER7, IRQ_SPI1, IRQ_USART1
+};
+
+constexpr HardwareLayout::DmaAllocation DMAS[] = {
+    DMA_SPI1_TX, DMA_SPI1_RX, DMA_USART1_TX, DMA_USART1_RX
+};
+
+static_assert(HardwareLayout::hasUniqueStreams(DMAS), "A DMA stream is used by two devices");
+static_assert(HardwareLayout::hasStreamIrqs(DMAS), "The interrupt of a DMA allocation does not belong to its stream");
+static_assert(HardwareLayout::hasUniqueIrqs(IRQS, DMAS), "An interrupt is used by two devices");
+
+} // end of namespace Allocation
 
 /**
  * @brief A class providing the map of used hardware
@@ -83,6 +124,15 @@ public:
     static const uint16_t I2C_MASTER_ADDRESS = 0x01;
     static const uint16_t I2C_DSP_ADDRESS = 0x88;
 
+    // Direct access to the LED pins; the pins are configured by the Led objects below
+    typedef FastPin<HardwareLayout::PortC, GPIO_PIN_1, GPIO_PIN_RESET> LedBluePin;
+    typedef FastPin<HardwareLayout::PortA, GPIO_PIN_12> Led1Pin;
+    typedef FastPin<HardwareLayout::PortA, GPIO_PIN_11> Led2Pin;
+    typedef FastPin<HardwareLayout::PortA, GPIO_PIN_10> Led3Pin;
+    typedef FastPin<HardwareLayout::PortC, GPIO_PIN_9> Led4Pin;
+    typedef PinGroup<Led1Pin, Led2Pin, Led3Pin> InputLedsA;
+    typedef PinGroup<Led4Pin> InputLedsC;
+
     // Used ports
     HardwareLayout::PortA portA;
     HardwareLayout::PortB portB;
@@ -118,6 +168,10 @@ public:
     HardwareLayout::Timer3 timer3;
     EncoderTimer trebleEncoder;
 
+    // Timeout supervisor: the lowest priority, below all supervised devices
+    HardwareLayout::Timer7 timer7;
+    InterruptTimer timeoutTimer;
+
     // SPI
     HardwareLayout::Spi1 spi1;
     BaseSpi spi;
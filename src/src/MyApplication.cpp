@@ -55,7 +55,7 @@ MyApplication::MyApplication () :
 
 void MyApplication::init ()
 {
-    ledBlue.turnOn();
+    LedBluePin::turnOn();
     eepRom.getMode(true);
     uint8_t inp = readWithDef(inputChannel, 1);
     tda7439.setInput(inp);
@@ -67,32 +67,28 @@ void MyApplication::init ()
     tda7439.setTone(Drivers::Dsp_TDA7439::ToneRange::TREBBLE, readWithDef(trebble, 7));
     tda7439.setInputGain(readWithDef(inputGain, 0));
     setOutputGain(readWithDef(outputGain, 0));
-    ledBlue.turnOff();
+    LedBluePin::turnOff();
 }
 
 
 void MyApplication::setInput(uint8_t input)
 {
-    ledBlue.turnOn();
+    LedBluePin::turnOn();
     USART_DEBUG("input channel = " << input << UsartLogger::ENDL);
     tda7439.setInput(input);
     inputChannel.write(input);
     updateLeds(input);
-    ledBlue.turnOff();
+    LedBluePin::turnOff();
 }
 
 
 void MyApplication::updateLeds(uint8_t input)
 {
-    for (auto l : inputLeds)
-    {
-        l->turnOff();
-    }
+    // One BSRR store per port instead of a HAL call per LED
     size_t idx = input - 1;
-    if (idx < BTN_COUNT)
-    {
-        inputLeds[idx]->turnOn();
-    }
+    uint32_t states = (idx < BTN_COUNT) ? (1u << idx) : 0;
+    InputLedsA::write(states);
+    InputLedsC::write(states >> InputLedsA::SIZE);
 }
 
 
@@ -113,7 +109,7 @@ void MyApplication::updateActiveLed(int mode)
 
 void MyApplication::setUp (Mode _mode)
 {
-    ledBlue.turnOn();
+    LedBluePin::turnOn();
     switch (_mode)
     {
         case Mode::INPUT: tda7439.inputUp(); break;
@@ -136,13 +132,13 @@ void MyApplication::setUp (Mode _mode)
         case Mode::MIDDLE: tda7439.middleUp(); break;
         case Mode::TREBLE: tda7439.trebbleUp(); break;
     }
-    ledBlue.turnOff();
+    LedBluePin::turnOff();
 }
 
 
 void MyApplication::setDown (Mode _mode)
 {
-    ledBlue.turnOn();
+    LedBluePin::turnOn();
     switch (_mode)
     {
         case Mode::INPUT: tda7439.inputDown(); break;
@@ -165,7 +161,7 @@ void MyApplication::setDown (Mode _mode)
         case Mode::MIDDLE: tda7439.middleDown(); break;
         case Mode::TREBLE: tda7439.trebbleDown(); break;
     }
-    ledBlue.turnOff();
+    LedBluePin::turnOff();
 }
 
 
@@ -271,6 +267,20 @@ void MyApplication::processButton(uint8_t num, int numOccured)
         updateLeds(3);
         led4.setHigh();
     }
+    else if (btn1.isPressed() && btn4.isPressed())
+    {
+        // Only compiled with STM32ASYNC_PROFILING
+        PROFILE_DUMP();
+    }
+    else if (btn2.isPressed() && btn3.isPressed())
+    {
+        // Only compiled with STM32ASYNC_TRACING
+        TRACE_DUMP();
+    }
+    else if (btn1.isPressed() && btn3.isPressed())
+    {
+        getLoggerUsart().dumpStatistics("USART1");
+    }
 }
 
 
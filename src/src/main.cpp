@@ -35,7 +35,9 @@ int main (void)
         __HAL_FLASH_PREFETCH_BUFFER_ENABLE();
     }
 
-    MyApplication app;
+    // Note: the stack is in the CCM, which is not accessible by DMA, so the application
+    // and its driver buffers are placed into the SRAM (.bss) and constructed here
+    static MyApplication app;
     appPtr = &app;
 
     // Note: currently used EEPROM only works with core frequency 72MHz or below
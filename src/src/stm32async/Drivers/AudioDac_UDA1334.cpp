@@ -20,9 +20,8 @@
 
 #include "AudioDac_UDA1334.h"
 #include "../UsartLogger.h"
-
-#include <cmath>
-#define M_PI 3.14159265358979323846
+#include "../SystemClock.h"
+#include "../Profiler.h"
 
 using namespace Stm32async::Drivers;
 
@@ -37,6 +36,8 @@ AudioDac_UDA1334::AudioDac_UDA1334 (AsyncI2S & _i2s,
     mute { _mutePort, _mutePin, GPIO_MODE_OUTPUT_PP, GPIO_NOPULL, GPIO_SPEED_LOW },
     smplFreq { _smplFreqPort, _smplFreqPin, GPIO_MODE_OUTPUT_PP, GPIO_NOPULL, GPIO_SPEED_LOW },
     sourceType { SourceType::STREAM },
+    dataFormat { I2S_DATAFORMAT_16B },
+    generator {  },
     dataPtr1 { NULL },
     dataPtr2 { NULL },
     currDataBuffer { NULL },
@@ -61,28 +62,51 @@ void AudioDac_UDA1334::powerOn ()
 }
 
 bool AudioDac_UDA1334::start (AudioDac_UDA1334::SourceType s, uint32_t standard, uint32_t audioFreq,
-                              uint32_t dataFormat)
+                              uint32_t _dataFormat)
 {
     sourceType = s;
+    dataFormat = _dataFormat;
     currDataBuffer = NULL;
     blockRequested = false;
     
     switch (sourceType)
     {
     case SourceType::STREAM:
-        ::memset(dataBuffer1, MSB_OFFSET, BLOCK_SIZE2);
-        ::memset(dataBuffer2, MSB_OFFSET, BLOCK_SIZE2);
-        // nothing to do
+        ::memset(dataBuffer1, 0, sizeof(dataBuffer1));
+        ::memset(dataBuffer2, 0, sizeof(dataBuffer2));
         break;
     case SourceType::TEST_LIN:
-        makeTestSignalLin();
+        generator.setRamp(TEST_FREQ, TEST_AMPLITUDE);
         break;
     case SourceType::TEST_SIN:
-        makeTestSignalSin();
+        generator.setSine(TEST_FREQ, TEST_AMPLITUDE);
+        break;
+    case SourceType::TEST_GEN:
         break;
     }
+    if (sourceType != SourceType::STREAM)
+    {
+        // Both buffers are filled in the order of their playback
+        generator.configure(audioFreq, dataFormat);
+        generator.generate(dataPtr1, getBlockFrames());
+        generator.generate(dataPtr2, getBlockFrames());
+        USART_DEBUG("Test signal started: waveform=" << (int) generator.getWaveform() << UsartLogger::ENDL);
+    }
+
+    // The PLLI2S is re-tuned for every stream in order to hit the sample rate as exact as possible
+    I2SClock::Settings clock;
+    const SystemClock * sysClock = SystemClock::getInstance();
+    if (sysClock == NULL || !I2SClock(sysClock->getPllSourceFreq(), sysClock->getPllM()).solve(
+            audioFreq, dataFormat, I2S_MCLKOUTPUT_DISABLE, clock))
+    {
+        USART_DEBUG("Can not find I2S clock settings for " << audioFreq << " Hz" << UsartLogger::ENDL);
+        return false;
+    }
+    USART_DEBUG("I2S clock: PLLI2SN=" << clock.PLLI2SN << ", PLLI2SR=" << clock.PLLI2SR
+                << ", I2SDIV=" << clock.I2SDIV << ", ODD=" << clock.ODD
+                << ", achieved=" << (int) clock.achievedFreq << " Hz, error=" << (int) clock.ppmError << " ppm" << UsartLogger::ENDL);
 
-    DeviceStart::Status status = i2s.start(standard, audioFreq, dataFormat);
+    DeviceStart::Status status = i2s.start(standard, clock, dataFormat);
     USART_DEBUG("I2S status: " << DeviceStart::asString(status) << " (" << i2s.getHalStatus() << ")" << UsartLogger::ENDL);
     if (status != DeviceStart::Status::OK)
     {
@@ -113,22 +137,25 @@ void AudioDac_UDA1334::stop ()
     smplFreq.stop();
 }
 
-bool AudioDac_UDA1334::onTransmissionFinished (SharedDevice::State /*state*/)
+RAM_FUNC bool AudioDac_UDA1334::onTransmissionFinished (SharedDevice::State /*state*/)
 {
+    PROFILE_SCOPE("AudioDac_UDA1334::onTransmissionFinished");
     if (currDataBuffer == NULL)
     {
         return true;
     }
+    // For 24/32-bit data format, HAL expects the number of 32-bit samples
+    const uint16_t samples = (getFrameSize() == 2) ? BLOCK_SIZE2 : BLOCK_SIZE2 / 2;
     HAL_StatusTypeDef status = HAL_ERROR;
     if (currDataBuffer == dataPtr1)
     {
         currDataBuffer = dataPtr2;
-        status = i2s.transmit(this, dataPtr2, BLOCK_SIZE2);
+        status = i2s.transmit(this, dataPtr2, samples);
     }
     else
     {
         currDataBuffer = dataPtr1;
-        status = i2s.transmit(this, dataPtr1, BLOCK_SIZE2);
+        status = i2s.transmit(this, dataPtr1, samples);
     }
     if (status != HAL_OK)
     {
@@ -140,38 +167,3 @@ bool AudioDac_UDA1334::onTransmissionFinished (SharedDevice::State /*state*/)
     }
     return false;
 }
-
-void AudioDac_UDA1334::makeTestSignalLin ()
-{
-    uint16_t l, r;
-    double maxValue = (double) 0xFFFF;
-    double f = (double) (BLOCK_SIZE2);
-    for (size_t i = 0; i < BLOCK_SIZE2; i += 2)
-    {
-        l = r = (uint16_t) (((double) i / f) * maxValue) + MSB_OFFSET;
-        dataPtr1[i + 0] = l;
-        dataPtr1[i + 1] = r;
-        l = r = (uint16_t) ((1.0 - (double) i / f) * maxValue) + MSB_OFFSET;
-        dataPtr2[i + 0] = l;
-        dataPtr2[i + 1] = r;
-    }
-    USART_DEBUG("WAV streaming (LIN test signal) started..." << UsartLogger::ENDL);
-}
-
-void AudioDac_UDA1334::makeTestSignalSin ()
-{
-    uint16_t l, r;
-    double maxValue = (double) 0xFFFF;
-    double f = (double) (BLOCK_SIZE2);
-    for (size_t i = 0; i < BLOCK_SIZE2; i += 2)
-    {
-        l = (sin(2.0 * M_PI * (double) i / f) + 1.0) * maxValue / 2.0 + MSB_OFFSET;
-        r = (cos(4.0 * M_PI * (double) i / f) + 1.0) * maxValue / 2.0 + MSB_OFFSET;
-        dataPtr1[i + 0] = l;
-        dataPtr1[i + 1] = r;
-        dataPtr2[i + 0] = l;
-        dataPtr2[i + 1] = r;
-    }
-    USART_DEBUG("WAV streaming (SIN test signal) started..." << UsartLogger::ENDL);
-}
-
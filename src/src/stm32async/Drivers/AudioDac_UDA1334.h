@@ -22,6 +22,7 @@
 #define DRIVERS_AUDIO_DAC_UDA1334_H_
 
 #include "../I2S.h"
+#include "SignalGenerator.h"
 
 namespace Stm32async
 {
@@ -36,10 +37,12 @@ public:
     static constexpr uint32_t BLOCK_SIZE2 = BLOCK_SIZE / 2;
     static constexpr uint32_t MSB_OFFSET = 0xFFFF / 2 + 1;
     static constexpr uint32_t START_DELAY = 50;
+    static constexpr float TEST_FREQ = 1000.0f;
+    static constexpr float TEST_AMPLITUDE = 0.5f;
 
     enum class SourceType
     {
-        STREAM = 0, TEST_LIN = 1, TEST_SIN = 2
+        STREAM = 0, TEST_LIN = 1, TEST_SIN = 2, TEST_GEN = 3
     };
 
     AudioDac_UDA1334 (AsyncI2S & _i2s,
@@ -78,10 +81,50 @@ public:
         return (currDataBuffer == dataPtr1) ? dataPtr2 : dataPtr1;
     }
     
+    /**
+     * @brief Refills the requested block from the test-signal generator.
+     */
+    inline void generateBlock ()
+    {
+        generator.generate(getBlockPtr(), getBlockFrames());
+    }
+
+    /**
+     * @brief Test-signal generator used for TEST_LIN, TEST_SIN and TEST_GEN sources.
+     *
+     * TEST_LIN and TEST_SIN set up a ramp and a sine respectively, TEST_GEN keeps
+     * the signal that is configured by the caller.
+     */
+    inline SignalGenerator & getGenerator ()
+    {
+        return generator;
+    }
+
     inline uint32_t getBlockSize () const
     {
         return BLOCK_SIZE2;
     }
+
+    inline uint32_t getDataFormat () const
+    {
+        return dataFormat;
+    }
+
+    /**
+     * @brief Size of a stereo frame in half-words: 2 for 16-bit and 4 for 24/32-bit data format.
+     */
+    inline uint32_t getFrameSize () const
+    {
+        return (dataFormat == I2S_DATAFORMAT_24B || dataFormat == I2S_DATAFORMAT_32B) ? 4 : 2;
+    }
+
+    /**
+     * @brief Number of stereo frames that fit into a single block.
+     */
+    inline uint32_t getBlockFrames () const
+    {
+        return BLOCK_SIZE2 / getFrameSize();
+    }
     
 private:
     
@@ -90,6 +133,10 @@ private:
 
     // Source
     SourceType sourceType;
+    uint32_t dataFormat;
+
+    // Test signals
+    SignalGenerator generator;
 
     // Data containers
     uint16_t dataBuffer1[BLOCK_SIZE2];
@@ -100,11 +147,6 @@ private:
     // These variables are modified from interrupt service routine, therefore declare them as volatile
     volatile uint16_t * currDataBuffer;
     volatile bool blockRequested;
-
-protected:
-    
-    void makeTestSignalLin ();
-    void makeTestSignalSin ();
 };
 
 } // end of namespace Drivers
@@ -60,6 +60,7 @@ void Lcd_DOGM162::stop ()
 
 void Lcd_DOGM162::init (uint8_t n)
 {
+    spi.waitForQueue();
     linesNumber = n;
     rsPin.setLow();
 
@@ -95,16 +96,33 @@ void Lcd_DOGM162::init (uint8_t n)
 }
 
 
-void Lcd_DOGM162::putString (const char * pData, uint16_t pSize)
+HAL_StatusTypeDef Lcd_DOGM162::putString (const char * pData, uint16_t pSize)
 {
+    // The chip select is driven by the transaction queue of the SPI, other devices at the
+    // bus ignore the RS line
     rsPin.setHigh();
-    csPin.setLow();
-    spi.transmit(this, (uint8_t *)pData, pSize);
+    return spi.enqueueTransmit(this, (uint8_t *)pData, pSize, &csPin);
+}
+
+
+void Lcd_DOGM162::defineChar (uint8_t index, const uint8_t * pattern)
+{
+    // CGRAM address can only be set within the instruction table 0
+    uint8_t lineMask = linesNumber == 1? 0b00000100 : 0b00001000;
+    writeData(false, 0b00100000 | lineMask); // Function Set ; 8 Bit; Istr.Tab 0
+    writeData(false, 0x40 | ((index & 0x07) << 3));
+    for (uint8_t i = 0; i < 8; ++i)
+    {
+        writeData(true, pattern[i] & 0x1F);
+    }
+    writeData(false, 0x80); // back to DDRAM
 }
 
 
 void Lcd_DOGM162::writeData (bool isData, uint8_t data)
 {
+    // The commands are sent in blocking mode, after the queued transactions
+    spi.waitForQueue();
     rsPin.putBit(isData);
     csPin.setLow();
     HAL_Delay(1);
@@ -116,7 +134,5 @@ void Lcd_DOGM162::writeData (bool isData, uint8_t data)
 
 bool Lcd_DOGM162::onTransmissionFinished (SharedDevice::State /*state*/)
 {
-    while (spi.isBusy());
-    csPin.setHigh();
     return true;
 }
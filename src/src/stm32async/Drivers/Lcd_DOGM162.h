@@ -87,23 +87,44 @@ public:
     
     /**
      * @brief Write string that starts at current position
+     *
+     * The string is sent asynchronously by the transaction queue of the SPI and shall be kept
+     * until isBusy() is false.
+     *
+     * @return HAL_BUSY if the queue is full; the string is not written then.
      */
-    void putString (const char * pData, uint16_t pSize);
+    HAL_StatusTypeDef putString (const char * pData, uint16_t pSize);
 
     /**
      * @brief Write string that starts at given position
      */
-    inline void putString (uint8_t x, uint8_t y, const char * pData, uint16_t pSize)
+    inline HAL_StatusTypeDef putString (uint8_t x, uint8_t y, const char * pData, uint16_t pSize)
     {
         gotoXY(x,y);
-        putString(pData, pSize);
+        return putString(pData, pSize);
     }
 
+    /**
+     * @brief Define one of eight user characters in CGRAM
+     *
+     * @param index character code 0..7
+     * @param pattern eight rows from top to bottom, five lower bits per row
+     */
+    void defineChar (uint8_t index, const uint8_t * pattern);
+
     inline uint8_t getLinesNumber () const
     {
         return linesNumber;
     }
 
+    /**
+     * @brief Check whether an asynchronous string transmission is still ongoing
+     */
+    inline bool isBusy () const
+    {
+        return getQueueStatistics().depth > 0;
+    }
+
 private:
 
     AsyncSpi & spi;
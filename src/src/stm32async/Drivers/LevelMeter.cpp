@@ -0,0 +1,101 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#include "LevelMeter.h"
+
+#include <cmath>
+
+#ifdef HAL_I2S_MODULE_ENABLED
+
+using namespace Stm32async::Drivers;
+
+/************************************************************************
+ * Class LevelMeter
+ ************************************************************************/
+
+constexpr uint32_t LevelMeter::CHANNELS;
+constexpr uint16_t LevelMeter::FULL_SCALE;
+constexpr uint32_t LevelMeter::READ_ATTEMPTS;
+
+LevelMeter::LevelMeter () :
+    peak { 0 },
+    clipCount { 0 },
+    sum {  },
+    sequence { 0 },
+    snapshot {  }
+{
+    // empty
+}
+
+void LevelMeter::publish (uint32_t frames)
+{
+    if (frames == 0)
+    {
+        return;
+    }
+
+    // An odd sequence number marks the snapshot as being written
+    sequence = sequence + 1;
+    __DMB();
+    for (uint32_t c = 0; c < CHANNELS; ++c)
+    {
+        snapshot.peak[c] = (uint16_t) (peak >> (16 * c));
+        snapshot.rms[c] = (uint16_t) ::sqrtf((float) sum[c] / (float) frames);
+        snapshot.clips[c] += (clipCount >> (16 * c)) & 0xFFFF;
+    }
+    ++snapshot.blocks;
+    __DMB();
+    sequence = sequence + 1;
+}
+
+bool LevelMeter::getSnapshot (Snapshot & s) const
+{
+    for (uint32_t i = 0; i < READ_ATTEMPTS; ++i)
+    {
+        const uint32_t before = sequence;
+        if (before & 1)
+        {
+            continue;
+        }
+        __DMB();
+        s = snapshot;
+        __DMB();
+        if (sequence == before)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void LevelMeter::reset ()
+{
+    sequence = sequence + 1;
+    __DMB();
+    snapshot = Snapshot();
+    __DMB();
+    sequence = sequence + 1;
+}
+
+float LevelMeter::toDecibel (uint16_t level)
+{
+    return (level == 0) ? -96.0f : 20.0f * ::log10f((float) level / (float) FULL_SCALE);
+}
+
+#endif
@@ -0,0 +1,135 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#ifndef DRIVERS_LEVELMETER_H_
+#define DRIVERS_LEVELMETER_H_
+
+#include "../I2S.h"
+
+#ifdef HAL_I2S_MODULE_ENABLED
+
+namespace Stm32async
+{
+namespace Drivers
+{
+
+/**
+ * @brief Per-channel peak, RMS and clip metering of a stereo stream.
+ *
+ * The meter is fed frame by frame from the conversion kernels, so it does not need an
+ * own pass over the block. A frame is given as a packed word with the left sample in the
+ * lower and the right sample in the upper half-word (16-bit resolution), and both channels
+ * are processed by the Cortex-M4 SIMD instructions at once: QSUB16/SEL for the absolute
+ * value and the peak, SMLALD for the sums of squares and UADD16 for the clip counters.
+ *
+ * At the end of a block, publish() stores the levels of this block into a snapshot. The
+ * snapshot is protected by a sequence counter: a reader (UI, logger, or an interrupt)
+ * never blocks the writer and just retries if the snapshot was changed during the copy.
+ */
+class LevelMeter final
+{
+public:
+
+    static constexpr uint32_t CHANNELS = 2;
+    static constexpr uint16_t FULL_SCALE = 0x7FFF;
+
+    typedef struct
+    {
+        uint16_t peak[CHANNELS];    // peak level of the last block, FULL_SCALE = 0 dBFS
+        uint16_t rms[CHANNELS];     // RMS level of the last block, FULL_SCALE = 0 dBFS
+        uint32_t clips[CHANNELS];   // number of clipped samples since the last reset
+        uint32_t blocks;            // number of published blocks since the last reset
+    } Snapshot;
+
+    LevelMeter ();
+
+    /**
+     * @brief Clears the accumulators before a new block.
+     */
+    inline void begin ()
+    {
+        peak = 0;
+        clipCount = 0;
+        sum[0] = sum[1] = 0;
+    }
+
+    /**
+     * @brief Accumulates one frame given as packed left/right 16-bit samples.
+     */
+    inline void accumulate (uint32_t frame)
+    {
+        // Lane-wise absolute value with saturation: GE flags are set for non-negative lanes
+        const uint32_t neg = __QSUB16(0, frame);
+        __SSUB16(frame, neg);
+        const uint32_t abs = __SEL(frame, neg);
+
+        // Lane-wise maximum
+        __SSUB16(abs, peak);
+        peak = __SEL(abs, peak);
+
+        // Lanes at full scale are counted as clipped
+        __SSUB16(abs, FULL_SCALE | (FULL_SCALE << 16));
+        clipCount = __UADD16(clipCount, __SEL(0x00010001, 0));
+
+        // Dual 16x16 multiply-accumulate with the other lane masked out
+        sum[0] = __SMLALD(frame, frame & 0x0000FFFF, sum[0]);
+        sum[1] = __SMLALD(frame, frame & 0xFFFF0000, sum[1]);
+    }
+
+    /**
+     * @brief Publishes the levels of the accumulated block.
+     */
+    void publish (uint32_t frames);
+
+    /**
+     * @brief Copies the last published levels.
+     *
+     * @return false if no consistent copy could be made, i.e. the reader has interrupted
+     *         the writer.
+     */
+    bool getSnapshot (Snapshot & s) const;
+
+    /**
+     * @brief Resets the clip and block counters.
+     */
+    void reset ();
+
+    /**
+     * @brief Converts a level into dBFS.
+     */
+    static float toDecibel (uint16_t level);
+
+private:
+
+    static constexpr uint32_t READ_ATTEMPTS = 4;
+
+    // Accumulators of the current block
+    uint32_t peak, clipCount;
+    uint64_t sum[CHANNELS];
+
+    // Published levels
+    volatile uint32_t sequence;
+    Snapshot snapshot;
+};
+
+} // end of namespace Drivers
+} // end of namespace Stm32async
+
+#endif
+#endif
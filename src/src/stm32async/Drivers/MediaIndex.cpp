@@ -0,0 +1,537 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+#include "MediaIndex.h"
+#include "../UsartLogger.h"
+
+#include <algorithm>
+
+#ifdef HAL_SD_MODULE_ENABLED
+
+using namespace Stm32async::Drivers;
+
+#define USART_DEBUG_MODULE "IDX: "
+
+/************************************************************************
+ * Class MediaIndex
+ ************************************************************************/
+
+constexpr uint32_t MediaIndex::MAX_ENTRIES;
+constexpr uint32_t MediaIndex::MAX_DIRECTORIES;
+constexpr uint32_t MediaIndex::MAX_DEPTH;
+constexpr uint32_t MediaIndex::MAX_PATH_LENGTH;
+constexpr uint32_t MediaIndex::INDEX_MAGIC;
+constexpr uint32_t MediaIndex::INDEX_VERSION;
+
+static constexpr uint32_t FNV_OFFSET_BASIS = 2166136261UL;
+static constexpr uint32_t FNV_PRIME = 16777619UL;
+
+MediaIndex::MediaIndex (SdCardFat & _sdCard, const char * _indexFile) :
+    sdCard { _sdCard },
+    indexFile { _indexFile },
+    loaded { false },
+    changed { false },
+    volumeSN { 0 },
+    entries {  },
+    size { 0 },
+    directories {  },
+    visited {  },
+    directoryCount { 0 },
+    scannedDirectories { 0 },
+    scannedFiles { 0 },
+    path {  },
+    lfn {  },
+    fno {  }
+{
+    fno.lfname = lfn;
+    fno.lfsize = sizeof(lfn);
+}
+
+bool MediaIndex::update ()
+{
+    scannedDirectories = scannedFiles = 0;
+
+    // A different card is detected by the volume serial number
+    const uint32_t sn = sdCard.getFatFs().volumeSN;
+    if (!loaded || volumeSN != sn)
+    {
+        if (!load() || volumeSN != sn)
+        {
+            USART_DEBUG("Index " << indexFile << " is not valid for this card, scanning the card" << UsartLogger::ENDL);
+            clear();
+        }
+    }
+
+    // Scan the directories whose signature has changed
+    ::memset(visited, 0, sizeof(visited));
+    ::strcpy(path, "/");
+    if (!walkDirectory(0))
+    {
+        USART_DEBUG("Can not scan directory " << path << UsartLogger::ENDL);
+        return false;
+    }
+    removeUnvisited();
+
+    if (changed)
+    {
+        std::sort(entries, entries + size, [](const Entry & a, const Entry & b)
+        {
+            return a.pathHash < b.pathHash;
+        });
+        if (!save())
+        {
+            USART_DEBUG("Can not write index " << indexFile << UsartLogger::ENDL);
+            return false;
+        }
+        changed = false;
+    }
+
+    USART_DEBUG("Index contains " << size << " files in " << directoryCount << " directories, scanned "
+                << scannedFiles << " files in " << scannedDirectories << " directories" << UsartLogger::ENDL);
+    return true;
+}
+
+void MediaIndex::clear ()
+{
+    size = directoryCount = 0;
+    volumeSN = sdCard.getFatFs().volumeSN;
+    loaded = true;
+    changed = true;
+}
+
+const MediaIndex::Entry * MediaIndex::find (const char * path) const
+{
+    const uint32_t h = hashPath(path);
+    const Entry * e = std::lower_bound(entries, entries + size, h, [](const Entry & a, uint32_t b)
+    {
+        return a.pathHash < b;
+    });
+    return (e != entries + size && e->pathHash == h)? e : NULL;
+}
+
+bool MediaIndex::setGain (const char * path, int16_t gain)
+{
+    Entry * e = const_cast<Entry *>(find(path));
+    if (e == NULL)
+    {
+        return false;
+    }
+    if (e->gain != gain)
+    {
+        e->gain = gain;
+        changed = true;
+    }
+    return true;
+}
+
+uint32_t MediaIndex::hashPath (const char * path)
+{
+    // Skip the drive and the leading slash
+    const char * colon = ::strchr(path, ':');
+    if (colon != NULL)
+    {
+        path = colon + 1;
+    }
+    while (*path == '/' || *path == '\\')
+    {
+        ++path;
+    }
+
+    uint32_t h = FNV_OFFSET_BASIS;
+    for (; *path != 0; ++path)
+    {
+        char c = *path;
+        if (c == '\\')
+        {
+            c = '/';
+        }
+        else if (c >= 'a' && c <= 'z')
+        {
+            c = (char) (c - 'a' + 'A');
+        }
+        h = hash(h, &c, 1);
+    }
+    return h;
+}
+
+bool MediaIndex::load ()
+{
+    FIL file;
+    if (f_open(&file, indexFile, FA_READ) != FR_OK)
+    {
+        return false;
+    }
+
+    FileHeader h;
+    UINT bytesRead = 0;
+    bool result = f_read(&file, &h, sizeof(h), &bytesRead) == FR_OK && bytesRead == sizeof(h)
+                  && h.magic == INDEX_MAGIC && h.version == INDEX_VERSION
+                  && h.directories <= MAX_DIRECTORIES && h.entries <= MAX_ENTRIES;
+    if (result)
+    {
+        const UINT directoriesSize = h.directories * sizeof(Directory);
+        const UINT entriesSize = h.entries * sizeof(Entry);
+        result = f_read(&file, directories, directoriesSize, &bytesRead) == FR_OK && bytesRead == directoriesSize
+                 && f_read(&file, entries, entriesSize, &bytesRead) == FR_OK && bytesRead == entriesSize;
+    }
+    f_close(&file);
+
+    if (result)
+    {
+        volumeSN = h.volumeSN;
+        directoryCount = h.directories;
+        size = h.entries;
+        result = calculateChecksum() == h.checksum;
+    }
+    if (!result)
+    {
+        size = directoryCount = 0;
+        return false;
+    }
+    loaded = true;
+    changed = false;
+    USART_DEBUG("Index " << indexFile << " loaded: " << size << " files" << UsartLogger::ENDL);
+    return true;
+}
+
+bool MediaIndex::save ()
+{
+    FIL file;
+    if (f_open(&file, indexFile, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK)
+    {
+        return false;
+    }
+
+    FileHeader h;
+    h.magic = INDEX_MAGIC;
+    h.version = INDEX_VERSION;
+    h.volumeSN = volumeSN;
+    h.directories = directoryCount;
+    h.entries = size;
+    h.checksum = calculateChecksum();
+
+    const UINT directoriesSize = directoryCount * sizeof(Directory);
+    const UINT entriesSize = size * sizeof(Entry);
+    UINT bytesWritten = 0;
+    bool result = f_write(&file, &h, sizeof(h), &bytesWritten) == FR_OK && bytesWritten == sizeof(h)
+                  && f_write(&file, directories, directoriesSize, &bytesWritten) == FR_OK && bytesWritten == directoriesSize
+                  && f_write(&file, entries, entriesSize, &bytesWritten) == FR_OK && bytesWritten == entriesSize;
+    return f_close(&file) == FR_OK && result;
+}
+
+bool MediaIndex::walkDirectory (uint32_t depth)
+{
+    const uint32_t length = ::strlen(path);
+    const uint32_t directoryHash = hashPath(path);
+    uint32_t signature = 0, subdirectories = 0;
+    if (!readDirectory(__UINT32_MAX__, signature, subdirectories))
+    {
+        return false;
+    }
+
+    Directory * d = findDirectory(directoryHash);
+    if (d == NULL)
+    {
+        if (directoryCount >= MAX_DIRECTORIES)
+        {
+            USART_DEBUG("Too many directories, " << path << " is not indexed" << UsartLogger::ENDL);
+            return true;
+        }
+        d = &directories[directoryCount++];
+        d->pathHash = directoryHash;
+        d->signature = ~signature;
+    }
+    visited[d - directories] = true;
+    if (d->signature != signature)
+    {
+        removeEntries(directoryHash);
+        if (!scanDirectory(directoryHash))
+        {
+            return false;
+        }
+        d->signature = signature;
+        changed = true;
+        ++scannedDirectories;
+    }
+
+    // The file lock (_FS_LOCK) limits the number of open objects, so the parent directory is not
+    // kept open while a sub-directory is walked: every sub-directory is searched again by its number.
+    // The directory sectors are still in the FatFS window or in the sector cache.
+    for (uint32_t i = 0; i < subdirectories && depth + 1 < MAX_DEPTH; ++i)
+    {
+        uint32_t unused1, unused2;
+        if (!readDirectory(i, unused1, unused2))
+        {
+            return false;
+        }
+        if (appendName(length, getName()))
+        {
+            const bool result = walkDirectory(depth + 1);
+            path[length] = 0;
+            if (!result)
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool MediaIndex::readDirectory (uint32_t subdirectory, uint32_t & signature, uint32_t & subdirectories)
+{
+    DIR dir;
+    if (f_opendir(&dir, path) != FR_OK)
+    {
+        return false;
+    }
+
+    // The signature covers the WAV files and the sub-directories, so that writing other files
+    // (including the index itself) does not invalidate the directory
+    signature = FNV_OFFSET_BASIS;
+    subdirectories = 0;
+    bool result = true;
+    for (;;)
+    {
+        if (f_readdir(&dir, &fno) != FR_OK)
+        {
+            result = false;
+            break;
+        }
+        if (fno.fname[0] == 0)
+        {
+            break;
+        }
+        const bool isDirectory = (fno.fattrib & AM_DIR) != 0;
+        if (fno.fname[0] == '.' || (fno.fattrib & (AM_HID | AM_SYS)) != 0 || (!isDirectory && !isWavFile(getName())))
+        {
+            continue;
+        }
+        if (isDirectory && subdirectories++ == subdirectory)
+        {
+            break;
+        }
+        signature = hash(signature, getName(), ::strlen(getName()));
+        signature = hash(signature, &fno.fsize, sizeof(fno.fsize));
+        signature = hash(signature, &fno.fdate, sizeof(fno.fdate));
+        signature = hash(signature, &fno.ftime, sizeof(fno.ftime));
+        signature = hash(signature, &fno.fattrib, sizeof(fno.fattrib));
+    }
+    f_closedir(&dir);
+    return result;
+}
+
+bool MediaIndex::scanDirectory (uint32_t directoryHash)
+{
+    DIR dir;
+    if (f_opendir(&dir, path) != FR_OK)
+    {
+        return false;
+    }
+    const uint32_t length = ::strlen(path);
+    bool result = true;
+    for (;;)
+    {
+        if (f_readdir(&dir, &fno) != FR_OK)
+        {
+            result = false;
+            break;
+        }
+        if (fno.fname[0] == 0)
+        {
+            break;
+        }
+        if (fno.fname[0] == '.' || (fno.fattrib & (AM_DIR | AM_HID | AM_SYS)) != 0 || !isWavFile(getName()))
+        {
+            continue;
+        }
+        if (size >= MAX_ENTRIES)
+        {
+            USART_DEBUG("Index is full, " << getName() << " is not indexed" << UsartLogger::ENDL);
+            break;
+        }
+        if (appendName(length, getName()))
+        {
+            Entry & e = entries[size];
+            e.pathHash = hashPath(path);
+            e.directoryHash = directoryHash;
+            e.gain = 0;
+            if (scanFile(e))
+            {
+                ++size;
+            }
+            path[length] = 0;
+        }
+    }
+    f_closedir(&dir);
+    return result;
+}
+
+bool MediaIndex::scanFile (Entry & e)
+{
+    FIL file;
+    if (f_open(&file, path, FA_READ) != FR_OK)
+    {
+        return false;
+    }
+    ++scannedFiles;
+    e.firstCluster = file.sclust;
+
+    // Walk the chunks up to the data chunk; the reads are served from the sector buffer of the file
+    uint8_t chunk[16];
+    UINT bytesRead = 0;
+    bool result = f_read(&file, chunk, 12, &bytesRead) == FR_OK && bytesRead == 12
+                  && ::memcmp(chunk, "RIFF", 4) == 0 && ::memcmp(chunk + 8, "WAVE", 4) == 0;
+    bool fmtFound = false;
+    uint32_t bytesPerSec = 0;
+    DWORD pos = 12;
+    while (result)
+    {
+        result = pos + 8 <= file.fsize && f_lseek(&file, pos) == FR_OK
+                 && f_read(&file, chunk, 8, &bytesRead) == FR_OK && bytesRead == 8;
+        if (!result)
+        {
+            break;
+        }
+        uint32_t chunkSize;
+        ::memcpy(&chunkSize, chunk + 4, sizeof(chunkSize));
+        if (::memcmp(chunk, "fmt ", 4) == 0)
+        {
+            result = chunkSize >= 16 && f_read(&file, chunk, 16, &bytesRead) == FR_OK && bytesRead == 16;
+            if (result)
+            {
+                uint16_t audioFormat, numOfChan, bitsPerSample;
+                ::memcpy(&audioFormat, chunk, sizeof(audioFormat));
+                ::memcpy(&numOfChan, chunk + 2, sizeof(numOfChan));
+                ::memcpy(&e.sampleRate, chunk + 4, sizeof(e.sampleRate));
+                ::memcpy(&bytesPerSec, chunk + 8, sizeof(bytesPerSec));
+                ::memcpy(&bitsPerSample, chunk + 14, sizeof(bitsPerSample));
+                e.numOfChan = (uint8_t) numOfChan;
+                e.bitsPerSample = (uint8_t) bitsPerSample;
+                result = (audioFormat == 0x0001 || audioFormat == 0xFFFE) && bytesPerSec != 0;
+                fmtFound = true;
+            }
+        }
+        else if (::memcmp(chunk, "data", 4) == 0)
+        {
+            const uint32_t dataSize = std::min(chunkSize, (uint32_t) (file.fsize - pos - 8));
+            e.duration = (uint32_t) ((uint64_t) dataSize * 1000 / bytesPerSec);
+            result = fmtFound;
+            break;
+        }
+        // A chunk running past the end of the file would wrap the position around
+        result = chunkSize < file.fsize - pos - 8;
+        pos += 8 + chunkSize + (chunkSize & 1);
+    }
+    f_close(&file);
+    if (!result)
+    {
+        USART_DEBUG("File " << path << " is not a supported WAV file" << UsartLogger::ENDL);
+    }
+    return result;
+}
+
+void MediaIndex::removeEntries (uint32_t directoryHash)
+{
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < size; ++i)
+    {
+        if (entries[i].directoryHash != directoryHash)
+        {
+            entries[n++] = entries[i];
+        }
+    }
+    if (n != size)
+    {
+        size = n;
+        changed = true;
+    }
+}
+
+void MediaIndex::removeUnvisited ()
+{
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < directoryCount; ++i)
+    {
+        if (visited[i])
+        {
+            directories[n++] = directories[i];
+        }
+        else
+        {
+            removeEntries(directories[i].pathHash);
+            changed = true;
+        }
+    }
+    directoryCount = n;
+}
+
+MediaIndex::Directory * MediaIndex::findDirectory (uint32_t pathHash)
+{
+    for (uint32_t i = 0; i < directoryCount; ++i)
+    {
+        if (directories[i].pathHash == pathHash)
+        {
+            return &directories[i];
+        }
+    }
+    return NULL;
+}
+
+uint32_t MediaIndex::calculateChecksum () const
+{
+    uint32_t h = hash(FNV_OFFSET_BASIS, &volumeSN, sizeof(volumeSN));
+    h = hash(h, directories, directoryCount * sizeof(Directory));
+    return hash(h, entries, size * sizeof(Entry));
+}
+
+bool MediaIndex::appendName (uint32_t length, const char * name)
+{
+    const bool separator = path[length - 1] != '/';
+    if (length + separator + ::strlen(name) >= MAX_PATH_LENGTH)
+    {
+        USART_DEBUG("Path is too long: " << name << UsartLogger::ENDL);
+        return false;
+    }
+    if (separator)
+    {
+        path[length] = '/';
+    }
+    ::strcpy(path + length + separator, name);
+    return true;
+}
+
+bool MediaIndex::isWavFile (const char * name)
+{
+    const char * ext = ::strrchr(name, '.');
+    return ext != NULL && ::strlen(ext) == 4 && (ext[1] | 0x20) == 'w' && (ext[2] | 0x20) == 'a' && (ext[3] | 0x20) == 'v';
+}
+
+uint32_t MediaIndex::hash (uint32_t h, const void * data, uint32_t length)
+{
+    // FNV-1a
+    const uint8_t * p = (const uint8_t *) data;
+    for (uint32_t i = 0; i < length; ++i)
+    {
+        h = (h ^ p[i]) * FNV_PRIME;
+    }
+    return h;
+}
+
+#endif
@@ -0,0 +1,191 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+#ifndef DRIVERS_MEDIAINDEX_H_
+#define DRIVERS_MEDIAINDEX_H_
+
+#include "SdCardFat.h"
+
+#ifdef HAL_SD_MODULE_ENABLED
+
+namespace Stm32async
+{
+namespace Drivers
+{
+
+/**
+ * @brief Persistent index of the WAV files on the SD card.
+ *
+ * Every WAV file found below the root directory (up to MAX_DEPTH levels, long file names
+ * included) is described by a compact Entry: the hash of its path, its first cluster, the
+ * sample format, the duration and a gain. The entries are sorted by the path hash, so a file
+ * is looked up by a binary search without touching the card. The table is stored in the
+ * index file and loaded when the card is mounted instead of opening and parsing every file.
+ *
+ * The index is validated against the volume serial number and a signature of every directory.
+ * FAT does not update the time stamp of a directory when its content changes, so the signature
+ * is calculated from the directory items (names, sizes and modification time stamps of the WAV
+ * files and sub-directories). The validation only reads the directories; the files of a
+ * directory are opened and parsed again only if its signature has changed.
+ */
+class MediaIndex final
+{
+public:
+
+    static constexpr uint32_t MAX_ENTRIES = 256;
+    static constexpr uint32_t MAX_DIRECTORIES = 32;
+    static constexpr uint32_t MAX_DEPTH = 4;
+    static constexpr uint32_t MAX_PATH_LENGTH = 256;
+    static constexpr uint32_t INDEX_MAGIC = 0x5844494D;
+    static constexpr uint32_t INDEX_VERSION = 1;
+
+    typedef struct
+    {
+        uint32_t pathHash;
+        uint32_t directoryHash;
+        uint32_t firstCluster;
+        uint32_t sampleRate;
+        uint32_t duration;       // milliseconds
+        uint8_t bitsPerSample;
+        uint8_t numOfChan;
+        int16_t gain;            // 0.01 dB, 0 until set by setGain()
+    } Entry;
+
+    typedef struct
+    {
+        uint32_t pathHash;
+        uint32_t signature;
+    } Directory;
+
+    typedef struct
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t volumeSN;
+        uint32_t directories;
+        uint32_t entries;
+        uint32_t checksum;
+    } FileHeader;
+
+    MediaIndex (SdCardFat & _sdCard, const char * _indexFile);
+
+    /**
+     * @brief Loads the index and brings it up to date with the card.
+     *
+     * Should be called after the card is mounted. At most one directory and one file are
+     * open at a time. The index file is written if anything has changed.
+     *
+     * @return false if the card can not be read or the index file can not be written.
+     */
+    bool update ();
+
+    /**
+     * @brief Drops the index, so that the next update() scans the whole card.
+     */
+    void clear ();
+
+    /**
+     * @brief Looks up a file by its path, relative to the root directory.
+     *
+     * The comparison ignores the case of ASCII letters, the leading slash and the drive.
+     *
+     * @return NULL if the file is not indexed.
+     */
+    const Entry * find (const char * path) const;
+
+    /**
+     * @brief Sets the gain of an indexed file; it is saved by the next update().
+     */
+    bool setGain (const char * path, int16_t gain);
+
+    static uint32_t hashPath (const char * path);
+
+    inline uint32_t getSize () const
+    {
+        return size;
+    }
+
+    inline const Entry & getEntry (uint32_t i) const
+    {
+        return entries[i];
+    }
+
+    /**
+     * @brief Returns the number of directories that were scanned again by the last update().
+     */
+    inline uint32_t getScannedDirectories () const
+    {
+        return scannedDirectories;
+    }
+
+    /**
+     * @brief Returns the number of files that were opened by the last update().
+     */
+    inline uint32_t getScannedFiles () const
+    {
+        return scannedFiles;
+    }
+
+private:
+
+    SdCardFat & sdCard;
+    const char * indexFile;
+
+    // The index
+    bool loaded, changed;
+    uint32_t volumeSN;
+    Entry entries[MAX_ENTRIES];
+    uint32_t size;
+    Directory directories[MAX_DIRECTORIES];
+    bool visited[MAX_DIRECTORIES];
+    uint32_t directoryCount;
+    uint32_t scannedDirectories, scannedFiles;
+
+    // Static work buffers of the scanner
+    char path[MAX_PATH_LENGTH];
+    char lfn[_MAX_LFN + 1];
+    FILINFO fno;
+
+    bool load ();
+    bool save ();
+    bool walkDirectory (uint32_t depth);
+    bool readDirectory (uint32_t subdirectory, uint32_t & signature, uint32_t & subdirectories);
+    bool scanDirectory (uint32_t directoryHash);
+    bool scanFile (Entry & e);
+    void removeEntries (uint32_t directoryHash);
+    void removeUnvisited ();
+    Directory * findDirectory (uint32_t pathHash);
+    uint32_t calculateChecksum () const;
+    bool appendName (uint32_t length, const char * name);
+
+    inline const char * getName () const
+    {
+        return (lfn[0] != 0)? lfn : fno.fname;
+    }
+
+    static bool isWavFile (const char * name);
+    static uint32_t hash (uint32_t h, const void * data, uint32_t length);
+};
+
+} // end of namespace Drivers
+} // end of namespace Stm32async
+
+#endif
+#endif
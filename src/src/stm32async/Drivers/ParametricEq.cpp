@@ -0,0 +1,456 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#include "ParametricEq.h"
+
+#include <cmath>
+
+#ifdef HAL_I2S_MODULE_ENABLED
+
+using namespace Stm32async::Drivers;
+
+/************************************************************************
+ * Helper functions
+ ************************************************************************/
+
+namespace
+{
+
+inline float approach (float value, float goal, float step)
+{
+    return (value < goal) ? std::min(value + step, goal) : std::max(value - step, goal);
+}
+
+inline float approachLog (float value, float goal, float factor)
+{
+    return (value < goal) ? std::min(value * factor, goal) : std::max(value / factor, goal);
+}
+
+/**
+ * @brief Opens a new slot of WIDTH elements at given stage position.
+ */
+template<uint32_t WIDTH> inline void insertSlot (q31_t * array, uint32_t stage, uint32_t stages)
+{
+    ::memmove(array + (stage + 1) * WIDTH, array + stage * WIDTH, (stages - stage) * WIDTH * sizeof(q31_t));
+}
+
+/**
+ * @brief Closes the slot of WIDTH elements at given stage position.
+ */
+template<uint32_t WIDTH> inline void removeSlot (q31_t * array, uint32_t stage, uint32_t stages)
+{
+    ::memmove(array + stage * WIDTH, array + (stage + 1) * WIDTH, (stages - stage - 1) * WIDTH * sizeof(q31_t));
+}
+
+/**
+ * @brief Initializes the history of a new unity stage.
+ *
+ * The state of a stage is {x[n-1], x[n-2], y[n-1], y[n-2]}. A unity stage that is inserted
+ * in front of stage "stage + 1" sees the same input as that stage had, and its output equals
+ * its input. A stage appended to the end of the cascade sees the output of the last stage.
+ */
+inline void initSlot (q31_t * state, uint32_t stage, uint32_t stages)
+{
+    q31_t * s = state + stage * 4;
+    if (stage + 1 < stages)
+    {
+        s[0] = s[2] = s[4];
+        s[1] = s[3] = s[5];
+    }
+    else if (stage > 0)
+    {
+        s[0] = s[2] = s[-2];
+        s[1] = s[3] = s[-1];
+    }
+    else
+    {
+        s[0] = s[1] = s[2] = s[3] = 0;
+    }
+}
+
+} // end of anonymous namespace
+
+/************************************************************************
+ * Class ParametricEq
+ ************************************************************************/
+
+constexpr uint32_t ParametricEq::MAX_BANDS;
+constexpr int8_t ParametricEq::POST_SHIFT;
+constexpr float ParametricEq::MAX_GAIN;
+constexpr float ParametricEq::MAX_BOOST;
+constexpr float ParametricEq::GAIN_STEP;
+constexpr float ParametricEq::FREQ_STEP;
+constexpr uint32_t ParametricEq::CHUNK_FRAMES;
+
+ParametricEq::ParametricEq () :
+    sampleRate { 48000.0f },
+    wide { false },
+    target {  },
+    current {  },
+    inUse {  },
+    changed { false },
+    stages { 0 },
+    cycles { 0 },
+    instance {  },
+    coeffs {  },
+    state {  },
+    channels {  }
+{
+    for (uint32_t b = 0; b < MAX_BANDS; ++b)
+    {
+        target[b] = { BandType::PEAKING, false, 1000.0f, 0.0f, 0.707f };
+        current[b] = target[b];
+    }
+}
+
+bool ParametricEq::configure (uint32_t _sampleRate, uint32_t dataFormat)
+{
+    if (_sampleRate == 0)
+    {
+        return false;
+    }
+    sampleRate = (float) _sampleRate;
+    wide = (dataFormat == I2S_DATAFORMAT_24B || dataFormat == I2S_DATAFORMAT_32B);
+
+    // Enable the cycle counter used for the cost measurement
+    enableCycleCounter();
+
+    // Rebuild the cascade from the target parameters: there is no history to keep yet.
+    // The bands were limited for the previous sample rate, so they are limited again.
+    stages = 0;
+    for (uint32_t b = 0; b < MAX_BANDS; ++b)
+    {
+        limit(target[b]);
+        current[b] = target[b];
+        inUse[b] = target[b].enabled;
+        if (inUse[b])
+        {
+            setCoefficients(stages++, current[b]);
+        }
+    }
+    for (uint32_t c = 0; c < 2; ++c)
+    {
+        arm_biquad_cascade_df1_init_q31(&instance[c], MAX_BANDS, coeffs, state[c], POST_SHIFT);
+        instance[c].numStages = stages;
+    }
+    changed = false;
+    cycles = 0;
+    return true;
+}
+
+bool ParametricEq::setBand (uint32_t index, const Band & band)
+{
+    if (index >= MAX_BANDS)
+    {
+        return false;
+    }
+    Band limited = band;
+    limit(limited);
+    float boost = limited.enabled ? getPeakGain(limited) : 0.0f;
+    for (uint32_t b = 0; b < MAX_BANDS; ++b)
+    {
+        if (b != index && target[b].enabled)
+        {
+            boost += getPeakGain(target[b]);
+        }
+    }
+    if (boost > MAX_BOOST)
+    {
+        return false;
+    }
+    target[index] = limited;
+    changed = true;
+    return true;
+}
+
+void ParametricEq::limit (Band & band) const
+{
+    band.gain = std::max(-MAX_GAIN, std::min(MAX_GAIN, band.gain));
+    band.freq = std::max(20.0f, std::min(0.45f * sampleRate, band.freq));
+    band.q = std::max(0.1f, std::min(10.0f, band.q));
+}
+
+void ParametricEq::process (uint16_t * block, uint32_t frames)
+{
+    const uint32_t start = DWT->CYCCNT;
+    if (changed)
+    {
+        update();
+    }
+    if (stages > 0)
+    {
+        const uint32_t frameSize = wide ? 4 : 2;
+        for (uint32_t done = 0; done < frames; done += CHUNK_FRAMES)
+        {
+            const uint32_t n = std::min(frames - done, CHUNK_FRAMES);
+            if (wide)
+            {
+                filter<true>(block + done * frameSize, n);
+            }
+            else
+            {
+                filter<false>(block + done * frameSize, n);
+            }
+        }
+    }
+    cycles = DWT->CYCCNT - start;
+}
+
+template<bool WIDE> void ParametricEq::filter (uint16_t * block, uint32_t frames)
+{
+    // The Q31 filter neither guards nor saturates its accumulator, so the samples are
+    // scaled down by HEADROOM_BITS (above MAX_BOOST) and saturated afterwards.
+    // A wide sample occupies two half-words, the most significant one first.
+    static const uint32_t shift = WIDE ? HEADROOM_BITS : 16 - HEADROOM_BITS;
+    for (uint32_t i = 0; i < frames; ++i)
+    {
+        const uint16_t * f = block + (WIDE ? 4 : 2) * i;
+        if (WIDE)
+        {
+            channels[0][i] = (q31_t) (((uint32_t) f[0] << 16) | f[1]) >> shift;
+            channels[1][i] = (q31_t) (((uint32_t) f[2] << 16) | f[3]) >> shift;
+        }
+        else
+        {
+            channels[0][i] = (q31_t) (int16_t) f[0] * (1 << shift);
+            channels[1][i] = (q31_t) (int16_t) f[1] * (1 << shift);
+        }
+    }
+    arm_biquad_cascade_df1_fast_q31(&instance[0], channels[0], channels[0], frames);
+    arm_biquad_cascade_df1_fast_q31(&instance[1], channels[1], channels[1], frames);
+    for (uint32_t i = 0; i < frames; ++i)
+    {
+        uint16_t * f = block + (WIDE ? 4 : 2) * i;
+        if (WIDE)
+        {
+            const int32_t l = (int32_t) std::max((int64_t) INT32_MIN, std::min((int64_t) INT32_MAX, (int64_t) channels[0][i] << shift));
+            const int32_t r = (int32_t) std::max((int64_t) INT32_MIN, std::min((int64_t) INT32_MAX, (int64_t) channels[1][i] << shift));
+            f[0] = (uint16_t) ((uint32_t) l >> 16);
+            f[1] = (uint16_t) ((uint32_t) l & 0xFFFF);
+            f[2] = (uint16_t) ((uint32_t) r >> 16);
+            f[3] = (uint16_t) ((uint32_t) r & 0xFFFF);
+        }
+        else
+        {
+            f[0] = (uint16_t) (int16_t) std::max((int32_t) INT16_MIN, std::min((int32_t) INT16_MAX, channels[0][i] >> shift));
+            f[1] = (uint16_t) (int16_t) std::max((int32_t) INT16_MIN, std::min((int32_t) INT16_MAX, channels[1][i] >> shift));
+        }
+    }
+}
+
+void ParametricEq::update ()
+{
+    changed = false;
+    float boost = 0.0f;
+    for (uint32_t b = 0; b < MAX_BANDS; ++b)
+    {
+        if (inUse[b])
+        {
+            boost += getPeakGain(current[b]);
+        }
+    }
+    uint32_t stage = 0;
+    for (uint32_t b = 0; b < MAX_BANDS; ++b)
+    {
+        const Band & t = target[b];
+        Band & c = current[b];
+        if (!inUse[b])
+        {
+            if (!t.enabled)
+            {
+                continue;
+            }
+            // A new band starts as a unity stage with the target shape
+            c = t;
+            c.gain = 0.0f;
+            inUse[b] = true;
+            insertStage(stage);
+        }
+
+        // The band type can only be changed while the band is flat
+        Band next = c;
+        if (next.type != t.type && next.gain == 0.0f)
+        {
+            next.type = t.type;
+        }
+        const float goal = (t.enabled && next.type == t.type) ? t.gain : 0.0f;
+        next.gain = approach(next.gain, goal, GAIN_STEP);
+        next.freq = approachLog(next.freq, t.freq, FREQ_STEP);
+        next.q = approachLog(next.q, t.q, FREQ_STEP);
+
+        // A step that raises the summed boost beyond MAX_BOOST waits until the other
+        // bands have released enough of it
+        const float peak = getPeakGain(c), nextPeak = getPeakGain(next);
+        if (nextPeak <= peak || boost + nextPeak - peak <= MAX_BOOST)
+        {
+            boost += nextPeak - peak;
+            c = next;
+        }
+        else
+        {
+            changed = true;
+        }
+
+        if (!t.enabled && c.gain == 0.0f)
+        {
+            // A flat stage can be removed without any discontinuity
+            inUse[b] = false;
+            removeStage(stage);
+            continue;
+        }
+        if (c.gain != t.gain || c.freq != t.freq || c.q != t.q || c.type != t.type)
+        {
+            changed = true;
+        }
+        setCoefficients(stage++, c);
+    }
+}
+
+void ParametricEq::insertStage (uint32_t stage)
+{
+    insertSlot<5>(coeffs, stage, stages);
+    ++stages;
+    for (uint32_t c = 0; c < 2; ++c)
+    {
+        insertSlot<4>(state[c], stage, stages - 1);
+        initSlot(state[c], stage, stages);
+        instance[c].numStages = stages;
+    }
+}
+
+void ParametricEq::removeStage (uint32_t stage)
+{
+    removeSlot<5>(coeffs, stage, stages);
+    --stages;
+    for (uint32_t c = 0; c < 2; ++c)
+    {
+        removeSlot<4>(state[c], stage, stages + 1);
+        instance[c].numStages = stages;
+    }
+}
+
+void ParametricEq::setCoefficients (uint32_t stage, const Band & band)
+{
+    float c[5];
+    designBand(band, sampleRate, c);
+    q31_t * dst = &coeffs[5 * stage];
+    for (uint32_t k = 0; k < 5; ++k)
+    {
+        dst[k] = (q31_t) std::max(-2147483648.0f, std::min(2147483520.0f, ::roundf(c[k] * (float) (1UL << (31 - POST_SHIFT)))));
+    }
+}
+
+void ParametricEq::designBand (const Band & band, float sampleRate, float coeffs[5])
+{
+    const float A = ::powf(10.0f, band.gain / 40.0f);
+    const float w0 = 2.0f * PI * band.freq / sampleRate;
+    const float cosW = ::cosf(w0);
+    const float alpha = ::sinf(w0) / (2.0f * band.q);
+    const float sqrtA2 = 2.0f * ::sqrtf(A) * alpha;
+
+    float b0, b1, b2, a0, a1, a2;
+    switch (band.type)
+    {
+    case BandType::LOW_SHELF:
+        b0 = A * ((A + 1.0f) - (A - 1.0f) * cosW + sqrtA2);
+        b1 = 2.0f * A * ((A - 1.0f) - (A + 1.0f) * cosW);
+        b2 = A * ((A + 1.0f) - (A - 1.0f) * cosW - sqrtA2);
+        a0 = (A + 1.0f) + (A - 1.0f) * cosW + sqrtA2;
+        a1 = -2.0f * ((A - 1.0f) + (A + 1.0f) * cosW);
+        a2 = (A + 1.0f) + (A - 1.0f) * cosW - sqrtA2;
+        break;
+    case BandType::HIGH_SHELF:
+        b0 = A * ((A + 1.0f) + (A - 1.0f) * cosW + sqrtA2);
+        b1 = -2.0f * A * ((A - 1.0f) + (A + 1.0f) * cosW);
+        b2 = A * ((A + 1.0f) + (A - 1.0f) * cosW - sqrtA2);
+        a0 = (A + 1.0f) - (A - 1.0f) * cosW + sqrtA2;
+        a1 = 2.0f * ((A - 1.0f) - (A + 1.0f) * cosW);
+        a2 = (A + 1.0f) - (A - 1.0f) * cosW - sqrtA2;
+        break;
+    default:
+        b0 = 1.0f + alpha * A;
+        b1 = -2.0f * cosW;
+        b2 = 1.0f - alpha * A;
+        a0 = 1.0f + alpha / A;
+        a1 = -2.0f * cosW;
+        a2 = 1.0f - alpha / A;
+        break;
+    }
+
+    // CMSIS-DSP adds the feedback terms: y[n] = b0 x[n] + ... + a1 y[n-1] + a2 y[n-2]
+    coeffs[0] = b0 / a0;
+    coeffs[1] = b1 / a0;
+    coeffs[2] = b2 / a0;
+    coeffs[3] = -a1 / a0;
+    coeffs[4] = -a2 / a0;
+}
+
+float ParametricEq::getPeakGain (const Band & band)
+{
+    const float peak = std::max(0.0f, band.gain);
+    if (band.type == BandType::PEAKING || band.gain == 0.0f)
+    {
+        return peak;
+    }
+
+    // The shelves are bilinear transforms of the analog prototype
+    //     |H(jw)|^2 = A^2 ((A - x)^2 + k x) / ((1 - A x)^2 + k x), x = w^2, k = A / Q^2
+    // (the high shelf at 1/w). Besides DC and infinity, it has extremes at the roots of
+    // m x^2 + 2 (1 + A^2) x + m with m = k - 2A; they exist for Q > 1/sqrt(2), where the
+    // shelf overshoots. The roots are x1 and 1/x1.
+    const float A = ::powf(10.0f, band.gain / 40.0f);
+    const float k = A / (band.q * band.q), m = k - 2.0f * A;
+    if (m >= 0.0f)
+    {
+        return peak;
+    }
+    const float p = 1.0f + A * A;
+    const float x1 = (::sqrtf(p * p - m * m) - p) / m;
+    float result = peak;
+    for (const float x : { x1, 1.0f / x1 })
+    {
+        const float n = (A - x) * (A - x) + k * x, d = (1.0f - A * x) * (1.0f - A * x) + k * x;
+        result = std::max(result, 10.0f * ::log10f(A * A * n / d));
+    }
+    return result;
+}
+
+float ParametricEq::getResponse (float freq) const
+{
+    const float w = 2.0f * PI * freq / sampleRate;
+    const float c1 = ::cosf(w), s1 = ::sinf(w);
+    const float c2 = ::cosf(2.0f * w), s2 = ::sinf(2.0f * w);
+    float magnitude = 1.0f;
+    for (uint32_t b = 0; b < MAX_BANDS; ++b)
+    {
+        if (!target[b].enabled)
+        {
+            continue;
+        }
+        float c[5];
+        designBand(target[b], sampleRate, c);
+        // H(z) = (b0 + b1 z^-1 + b2 z^-2) / (1 - a1 z^-1 - a2 z^-2) at z = e^jw
+        const float nRe = c[0] + c[1] * c1 + c[2] * c2, nIm = -c[1] * s1 - c[2] * s2;
+        const float dRe = 1.0f - c[3] * c1 - c[4] * c2, dIm = c[3] * s1 + c[4] * s2;
+        magnitude *= ::sqrtf((nRe * nRe + nIm * nIm) / (dRe * dRe + dIm * dIm));
+    }
+    return magnitude;
+}
+
+#endif
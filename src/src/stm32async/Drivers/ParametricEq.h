@@ -0,0 +1,195 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#ifndef DRIVERS_PARAMETRICEQ_H_
+#define DRIVERS_PARAMETRICEQ_H_
+
+#include "AudioDac_UDA1334.h"
+
+#ifdef HAL_I2S_MODULE_ENABLED
+
+#ifndef ARM_MATH_CM4
+#define ARM_MATH_CM4
+#endif
+#include "arm_math.h"
+
+namespace Stm32async
+{
+namespace Drivers
+{
+
+/**
+ * @brief Software parametric equalizer for stereo frames in the I2S DMA layout.
+ *
+ * Every enabled band is a second-order section (RBJ audio cookbook design) of a CMSIS-DSP
+ * direct form I biquad cascade, filtered by arm_biquad_cascade_df1_fast_q31. The Q31 variant is
+ * used for all sample formats, 16-bit samples are extended to Q31 for the filter: with Q15
+ * coefficients, the bass bands (low shelf at 100 Hz and below) deviate from the design by
+ * several dB at 48 kHz. The coefficients are stored with postShift = POST_SHIFT, i.e. in the
+ * range [-8, 8), that covers all band types within the +/- MAX_GAIN range.
+ *
+ * Bands are changed without clicks: the target parameters are set immediately, but the
+ * working parameters approach them in small steps (GAIN_STEP, FREQ_STEP) once per block,
+ * and the coefficients are recalculated from the working parameters. Every intermediate
+ * filter is therefore a valid, stable biquad. A disabled band is first faded to 0 dB and
+ * only then removed from the cascade, so the cost of a block is proportional to the number
+ * of bands in use. The cost of the last processed block is available by getCycles().
+ *
+ * The Q31 filter does not saturate between the stages of the cascade, so the input is
+ * scaled down by HEADROOM_BITS (30 dB) and the summed boost of the bands is limited to
+ * MAX_BOOST. The boost of a band is its largest gain over all frequencies, see
+ * getPeakGain(): shelves with a high Q overshoot their nominal gain. setBand() rejects a
+ * band that would exceed the limit, and a band in transition waits while its next step
+ * would exceed it. The remaining 6 dB cover the overshoot of transient signals.
+ *
+ * designBand() and getResponse() are plain float implementations of the same design and
+ * serve as the reference when checking the fixed-point filter on a host.
+ *
+ * The filter state and the work buffers are only accessed by the CPU, so the object can be
+ * placed into the CCM: "ParametricEq equalizer CCM_RAM;".
+ */
+class ParametricEq final
+{
+public:
+
+    static constexpr uint32_t MAX_BANDS = 8;
+    static constexpr int8_t POST_SHIFT = 3;
+    static constexpr float MAX_GAIN = 12.0f;
+    static constexpr float MAX_BOOST = 24.0f;
+    static constexpr float GAIN_STEP = 0.5f;
+    static constexpr float FREQ_STEP = 1.06f;
+
+    enum class BandType
+    {
+        PEAKING = 0, LOW_SHELF = 1, HIGH_SHELF = 2
+    };
+
+    typedef struct
+    {
+        BandType type;
+        bool enabled;
+        float freq;  // center or corner frequency in Hz
+        float gain;  // gain in dB
+        float q;     // quality factor, or the shelf slope parameter
+    } Band;
+
+    ParametricEq ();
+
+    /**
+     * @brief Prepares the cascade for the given stream and resets the filter history.
+     *
+     * The band frequencies set before are limited to 0.45 of the new sample rate.
+     *
+     * @return false if the sample rate is not valid.
+     */
+    bool configure (uint32_t sampleRate, uint32_t dataFormat);
+
+    /**
+     * @brief Sets the target parameters of the given band.
+     *
+     * The change is applied within the next blocks without clicks.
+     *
+     * @return false if the band index is out of range or if the summed boost of the
+     *         enabled bands would exceed MAX_BOOST.
+     */
+    bool setBand (uint32_t index, const Band & band);
+
+    inline const Band & getBand (uint32_t index) const
+    {
+        return target[index];
+    }
+
+    /**
+     * @brief Filters given number of interleaved stereo frames in place.
+     */
+    void process (uint16_t * block, uint32_t frames);
+
+    /**
+     * @brief Returns the number of biquad sections that are currently processed.
+     */
+    inline uint32_t getStages () const
+    {
+        return stages;
+    }
+
+    /**
+     * @brief Returns the number of CPU cycles spent in the last process() call.
+     */
+    inline uint32_t getCycles () const
+    {
+        return cycles;
+    }
+
+    /**
+     * @brief Float reference design of a single band.
+     *
+     * @param coeffs receives {b0, b1, b2, a1, a2} normalized to a0 = 1, with the feedback
+     *        coefficients negated as expected by CMSIS-DSP.
+     */
+    static void designBand (const Band & band, float sampleRate, float coeffs[5]);
+
+    /**
+     * @brief Returns the largest gain of a single band over all frequencies, in dB.
+     *
+     * A band that only attenuates has 0 dB.
+     */
+    static float getPeakGain (const Band & band);
+
+    /**
+     * @brief Float reference magnitude response of all enabled target bands at given frequency.
+     */
+    float getResponse (float freq) const;
+
+private:
+
+    // Number of frames filtered at once: a DAC block is processed in chunks of this size
+    static constexpr uint32_t CHUNK_FRAMES = AudioDac_UDA1334::BLOCK_SIZE2 / 4;
+    static constexpr uint32_t HEADROOM_BITS = 5;
+
+    float sampleRate;
+    bool wide;
+    Band target[MAX_BANDS];
+    Band current[MAX_BANDS];
+    bool inUse[MAX_BANDS];
+    bool changed;
+    uint32_t stages, cycles;
+
+    // CMSIS-DSP instances for left and right channels, sharing the coefficients
+    arm_biquad_casd_df1_inst_q31 instance[2];
+    q31_t coeffs[5 * MAX_BANDS];
+    q31_t state[2][4 * MAX_BANDS];
+    q31_t channels[2][CHUNK_FRAMES];
+
+    /**
+     * @brief Limits the band parameters to the valid ranges at the current sample rate.
+     */
+    void limit (Band & band) const;
+
+    template<bool WIDE> void filter (uint16_t * block, uint32_t frames);
+    void update ();
+    void insertStage (uint32_t stage);
+    void removeStage (uint32_t stage);
+    void setCoefficients (uint32_t stage, const Band & band);
+};
+
+} // end of namespace Drivers
+} // end of namespace Stm32async
+
+#endif
+#endif
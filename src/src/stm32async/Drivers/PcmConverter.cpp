@@ -0,0 +1,244 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#include "PcmConverter.h"
+
+#ifdef HAL_I2S_MODULE_ENABLED
+
+using namespace Stm32async::Drivers;
+
+/************************************************************************
+ * Conversion kernels
+ ************************************************************************/
+
+namespace
+{
+
+inline int16_t applyGain16 (int32_t s, int32_t gain)
+{
+    int32_t v = (int32_t) (((int64_t) s * gain) >> 16);
+    return (int16_t) std::max((int32_t) INT16_MIN, std::min((int32_t) INT16_MAX, v));
+}
+
+inline int32_t applyGain32 (int32_t s, int32_t gain)
+{
+    int64_t v = ((int64_t) s * gain) >> 16;
+    return (int32_t) std::max((int64_t) INT32_MIN, std::min((int64_t) INT32_MAX, v));
+}
+
+inline void put32 (uint16_t * dst, int32_t v)
+{
+    // The I2S peripheral expects the most significant half-word first
+    dst[0] = (uint16_t) ((uint32_t) v >> 16);
+    dst[1] = (uint16_t) ((uint32_t) v & 0xFFFF);
+}
+
+inline uint32_t pack16 (int16_t l, int16_t r)
+{
+    return (uint32_t) (uint16_t) l | ((uint32_t) (uint16_t) r << 16);
+}
+
+inline uint32_t pack32 (int32_t l, int32_t r)
+{
+    // Metering uses the upper 16 bits of wide samples
+    return ((uint32_t) l >> 16) | ((uint32_t) r & 0xFFFF0000);
+}
+
+template<uint32_t CHANNELS> void convertU8 (const uint8_t * src, uint16_t * dst, uint32_t frames, int32_t gain, LevelMeter & meter)
+{
+    for (uint32_t i = 0; i < frames; ++i, src += CHANNELS, dst += 2)
+    {
+        const int16_t l = applyGain16(((int32_t) src[0] - 128) << 8, gain);
+        const int16_t r = (CHANNELS == 1) ? l : applyGain16(((int32_t) src[1] - 128) << 8, gain);
+        dst[0] = (uint16_t) l;
+        dst[1] = (uint16_t) r;
+        meter.accumulate(pack16(l, r));
+    }
+}
+
+template<uint32_t CHANNELS> void convertS16 (const uint8_t * src, uint16_t * dst, uint32_t frames, int32_t gain, LevelMeter & meter)
+{
+    const int16_t * s = (const int16_t *) src;
+    if (gain == PcmConverter::UNITY_GAIN && CHANNELS == 2)
+    {
+        // Stereo frames are copied as packed words, so that the meter sees them as they are
+        for (uint32_t i = 0; i < frames; ++i, s += 2, dst += 2)
+        {
+            uint32_t frame;
+            ::memcpy(&frame, s, sizeof(frame));
+            ::memcpy(dst, &frame, sizeof(frame));
+            meter.accumulate(frame);
+        }
+        return;
+    }
+    for (uint32_t i = 0; i < frames; ++i, s += CHANNELS, dst += 2)
+    {
+        const int16_t l = applyGain16(s[0], gain);
+        const int16_t r = (CHANNELS == 1) ? l : applyGain16(s[1], gain);
+        dst[0] = (uint16_t) l;
+        dst[1] = (uint16_t) r;
+        meter.accumulate(pack16(l, r));
+    }
+}
+
+template<uint32_t CHANNELS> void convertS24 (const uint8_t * src, uint16_t * dst, uint32_t frames, int32_t gain, LevelMeter & meter)
+{
+    for (uint32_t i = 0; i < frames; ++i, src += 3 * CHANNELS, dst += 4)
+    {
+        // Packed little-endian 24-bit sample is left-aligned into 32 bits
+        const int32_t l = applyGain32((int32_t) (((uint32_t) src[0] << 8) | ((uint32_t) src[1] << 16)
+                                                 | ((uint32_t) src[2] << 24)), gain);
+        const int32_t r = (CHANNELS == 1) ? l :
+                applyGain32((int32_t) (((uint32_t) src[3] << 8) | ((uint32_t) src[4] << 16)
+                                       | ((uint32_t) src[5] << 24)), gain);
+        put32(dst, l);
+        put32(dst + 2, r);
+        meter.accumulate(pack32(l, r));
+    }
+}
+
+template<uint32_t CHANNELS> void convertS32 (const uint8_t * src, uint16_t * dst, uint32_t frames, int32_t gain, LevelMeter & meter)
+{
+    const int32_t * s = (const int32_t *) src;
+    for (uint32_t i = 0; i < frames; ++i, s += CHANNELS, dst += 4)
+    {
+        const int32_t l = applyGain32(s[0], gain);
+        const int32_t r = (CHANNELS == 1) ? l : applyGain32(s[1], gain);
+        put32(dst, l);
+        put32(dst + 2, r);
+        meter.accumulate(pack32(l, r));
+    }
+}
+
+} // end of anonymous namespace
+
+/************************************************************************
+ * Class PcmConverter
+ ************************************************************************/
+
+constexpr int32_t PcmConverter::UNITY_GAIN;
+constexpr float PcmConverter::MAX_VOLUME;
+
+PcmConverter::PcmConverter () :
+    format { Format::UNSUPPORTED },
+    kernel { convertNone },
+    inputFrameSize { 0 },
+    gain { UNITY_GAIN },
+    meter {  }
+{
+    // empty
+}
+
+bool PcmConverter::configure (uint16_t bitsPerSample, uint16_t channels)
+{
+    format = Format::UNSUPPORTED;
+    kernel = convertNone;
+    inputFrameSize = 0;
+    if (channels != 1 && channels != 2)
+    {
+        return false;
+    }
+
+    const bool mono = (channels == 1);
+    switch (bitsPerSample)
+    {
+    case 8:
+        format = Format::PCM_U8;
+        kernel = mono ? convertU8<1> : convertU8<2>;
+        break;
+    case 16:
+        format = Format::PCM_S16;
+        kernel = mono ? convertS16<1> : convertS16<2>;
+        break;
+    case 24:
+        format = Format::PCM_S24;
+        kernel = mono ? convertS24<1> : convertS24<2>;
+        break;
+    case 32:
+        format = Format::PCM_S32;
+        kernel = mono ? convertS32<1> : convertS32<2>;
+        break;
+    default:
+        return false;
+    }
+    inputFrameSize = channels * bitsPerSample / 8;
+    return true;
+}
+
+bool PcmConverter::getI2sDataFormat (uint16_t bitsPerSample, uint16_t channels, uint32_t & dataFormat)
+{
+    if (channels != 1 && channels != 2)
+    {
+        return false;
+    }
+    switch (bitsPerSample)
+    {
+    case 8:
+    case 16:
+        dataFormat = I2S_DATAFORMAT_16B;
+        return true;
+    case 24:
+        dataFormat = I2S_DATAFORMAT_24B;
+        return true;
+    case 32:
+        dataFormat = I2S_DATAFORMAT_32B;
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool PcmConverter::isPcmFormat (const uint8_t * fmt, uint32_t size)
+{
+    // KSDATAFORMAT_SUBTYPE_PCM, 00000001-0000-0010-8000-00AA00389B71
+    static const uint8_t SUBTYPE_PCM[16] = {
+        0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71
+    };
+    // The offsets of cbSize and SubFormat in the chunk body. cbSize counts the extension
+    // behind it: wValidBitsPerSample, dwChannelMask and SubFormat
+    static constexpr uint32_t CB_SIZE = 16, SUB_FORMAT = 24, EXTENSION_SIZE = 22;
+
+    if (size < CB_SIZE)
+    {
+        return false;
+    }
+    const uint16_t tag = fmt[0] | (fmt[1] << 8);
+    if (tag == WAVE_FORMAT_PCM)
+    {
+        return true;
+    }
+    if (tag != WAVE_FORMAT_EXTENSIBLE || size < SUB_FORMAT + sizeof(SUBTYPE_PCM))
+    {
+        return false;
+    }
+    const uint16_t cbSize = fmt[CB_SIZE] | (fmt[CB_SIZE + 1] << 8);
+    return cbSize >= EXTENSION_SIZE && ::memcmp(fmt + SUB_FORMAT, SUBTYPE_PCM, sizeof(SUBTYPE_PCM)) == 0;
+}
+
+void PcmConverter::setVolume (float v)
+{
+    gain = (int32_t) (std::max(0.0f, std::min(v, MAX_VOLUME)) * (float) UNITY_GAIN);
+}
+
+void PcmConverter::convertNone (const uint8_t * /*src*/, uint16_t * dst, uint32_t frames, int32_t /*gain*/, LevelMeter & /*meter*/)
+{
+    ::memset(dst, 0, frames * 2 * sizeof(uint16_t));
+}
+
+#endif
@@ -0,0 +1,149 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#ifndef DRIVERS_PCMCONVERTER_H_
+#define DRIVERS_PCMCONVERTER_H_
+
+#include "LevelMeter.h"
+
+#ifdef HAL_I2S_MODULE_ENABLED
+
+namespace Stm32async
+{
+namespace Drivers
+{
+
+/**
+ * @brief Conversion of PCM frames read from a WAV file into the I2S DMA buffer layout.
+ *
+ * The conversion kernel is selected once per stream by configure(), so the per-block
+ * loop does not contain any format or channel decisions. The output is always stereo:
+ * - 8-bit unsigned and 16-bit signed input are sent as 16-bit I2S words;
+ * - 24-bit packed and 32-bit input are sent left-aligned in 32-bit I2S words. For these formats,
+ *   every sample occupies two half-words in the DMA buffer, the most significant one first.
+ * Mono input is duplicated into both channels. The volume is applied as a Q16 fixed-point gain
+ * with saturation. The same pass feeds the level meter with the converted frames, so peak,
+ * RMS and clip counts refer to the signal after the volume.
+ */
+class PcmConverter final
+{
+public:
+
+    static constexpr int32_t UNITY_GAIN = 0x10000;
+    static constexpr float MAX_VOLUME = 256.0f;
+    static constexpr uint16_t WAVE_FORMAT_PCM = 0x0001;
+    static constexpr uint16_t WAVE_FORMAT_EXTENSIBLE = 0xFFFE;
+
+    enum class Format
+    {
+        UNSUPPORTED = 0, PCM_U8 = 1, PCM_S16 = 2, PCM_S24 = 3, PCM_S32 = 4
+    };
+
+    typedef void (*Kernel) (const uint8_t * src, uint16_t * dst, uint32_t frames, int32_t gain, LevelMeter & meter);
+
+    PcmConverter ();
+
+    /**
+     * @brief Selects the conversion kernel for the given WAV parameters.
+     *
+     * @return false if the sample format or the channel number is not supported.
+     */
+    bool configure (uint16_t bitsPerSample, uint16_t channels);
+
+    /**
+     * @brief Converts given number of frames from src into dst and publishes their levels.
+     */
+    inline void convert (const uint8_t * src, uint16_t * dst, uint32_t frames)
+    {
+        meter.begin();
+        kernel(src, dst, frames, gain, meter);
+        meter.publish(frames);
+    }
+
+    void setVolume (float v);
+
+    inline Format getFormat () const
+    {
+        return format;
+    }
+
+    /**
+     * @brief Returns the I2S data format that shall be used for the converted stream.
+     */
+    inline uint32_t getI2sDataFormat () const
+    {
+        return (format == Format::PCM_S24) ? I2S_DATAFORMAT_24B :
+               (format == Format::PCM_S32) ? I2S_DATAFORMAT_32B : I2S_DATAFORMAT_16B;
+    }
+
+    /**
+     * @brief Returns the I2S data format for the given WAV parameters without selecting a kernel.
+     *
+     * @return false if the sample format or the channel number is not supported.
+     */
+    static bool getI2sDataFormat (uint16_t bitsPerSample, uint16_t channels, uint32_t & dataFormat);
+
+    /**
+     * @brief Checks that the body of a "fmt" chunk describes integer PCM samples.
+     *
+     * WAVE_FORMAT_EXTENSIBLE is accepted only with the PCM SubFormat GUID, so that IEEE
+     * float, A-law or mu-law extensible files are not played as noise.
+     *
+     * @param fmt the chunk body, starting with the format tag.
+     * @param size the available size of the chunk body, in bytes.
+     */
+    static bool isPcmFormat (const uint8_t * fmt, uint32_t size);
+
+    /**
+     * @brief Size of an input frame (all channels), in bytes.
+     */
+    inline uint32_t getInputFrameSize () const
+    {
+        return inputFrameSize;
+    }
+
+    /**
+     * @brief Size of an output stereo frame, in half-words of the DMA buffer.
+     */
+    inline uint32_t getOutputFrameSize () const
+    {
+        return (getI2sDataFormat() == I2S_DATAFORMAT_16B) ? 2 : 4;
+    }
+
+    inline LevelMeter & getLevelMeter ()
+    {
+        return meter;
+    }
+
+private:
+
+    Format format;
+    Kernel kernel;
+    uint32_t inputFrameSize;
+    int32_t gain;
+    LevelMeter meter;
+
+    static void convertNone (const uint8_t * src, uint16_t * dst, uint32_t frames, int32_t gain, LevelMeter & meter);
+};
+
+} // end of namespace Drivers
+} // end of namespace Stm32async
+
+#endif
+#endif
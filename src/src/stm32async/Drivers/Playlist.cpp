@@ -0,0 +1,70 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#include "Playlist.h"
+
+#ifdef HAL_SD_MODULE_ENABLED
+
+using namespace Stm32async::Drivers;
+
+/************************************************************************
+ * Class Playlist
+ ************************************************************************/
+
+constexpr uint32_t Playlist::MAX_TRACKS;
+constexpr uint32_t Playlist::MAX_NAME_LENGTH;
+
+Playlist::Playlist () :
+    names {  },
+    size { 0 },
+    position { 0 },
+    repeat { false }
+{
+    // empty
+}
+
+void Playlist::clear ()
+{
+    size = position = 0;
+}
+
+bool Playlist::add (const char * fileName)
+{
+    if (size >= MAX_TRACKS || ::strlen(fileName) >= MAX_NAME_LENGTH)
+    {
+        return false;
+    }
+    ::strcpy(names[size++], fileName);
+    return true;
+}
+
+const char * Playlist::next ()
+{
+    if (position >= size)
+    {
+        if (!repeat || size == 0)
+        {
+            return NULL;
+        }
+        position = 0;
+    }
+    return names[position++];
+}
+
+#endif
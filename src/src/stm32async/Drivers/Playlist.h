@@ -0,0 +1,99 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#ifndef DRIVERS_PLAYLIST_H_
+#define DRIVERS_PLAYLIST_H_
+
+#include "SdCardFat.h"
+
+#ifdef HAL_SD_MODULE_ENABLED
+
+namespace Stm32async
+{
+namespace Drivers
+{
+
+/**
+ * @brief Ordered list of WAV files played back by the WavStreamer.
+ *
+ * The file names are copied into a fixed table, so the caller does not need to keep them.
+ */
+class Playlist final
+{
+public:
+
+    static constexpr uint32_t MAX_TRACKS = 16;
+    static constexpr uint32_t MAX_NAME_LENGTH = 64;
+
+    Playlist ();
+
+    void clear ();
+
+    /**
+     * @brief Appends a file to the list.
+     *
+     * @return false if the list is full or the name is too long.
+     */
+    bool add (const char * fileName);
+
+    /**
+     * @brief Returns the file of the next track and moves to it.
+     *
+     * @return NULL at the end of the list, unless repeating is enabled.
+     */
+    const char * next ();
+
+    /**
+     * @brief Moves back to the first track.
+     */
+    inline void rewind ()
+    {
+        position = 0;
+    }
+
+    inline void setRepeat (bool _repeat)
+    {
+        repeat = _repeat;
+    }
+
+    inline uint32_t getSize () const
+    {
+        return size;
+    }
+
+    /**
+     * @brief Returns the number of tracks taken by next().
+     */
+    inline uint32_t getPosition () const
+    {
+        return position;
+    }
+
+private:
+
+    char names[MAX_TRACKS][MAX_NAME_LENGTH];
+    uint32_t size, position;
+    bool repeat;
+};
+
+} // end of namespace Drivers
+} // end of namespace Stm32async
+
+#endif
+#endif
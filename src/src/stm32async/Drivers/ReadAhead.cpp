@@ -0,0 +1,245 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#include "ReadAhead.h"
+#include "../UsartLogger.h"
+
+#ifdef HAL_SD_MODULE_ENABLED
+
+using namespace Stm32async::Drivers;
+
+#define USART_DEBUG_MODULE "RAH: "
+
+/************************************************************************
+ * Class ReadAhead
+ ************************************************************************/
+
+constexpr uint32_t ReadAhead::RING_SIZE;
+constexpr uint32_t ReadAhead::SECTOR_SIZE;
+constexpr uint32_t ReadAhead::MAX_READ_BLOCKS;
+
+ReadAhead::ReadAhead (Sdio & _sdio) :
+    sdio { _sdio },
+    file { NULL },
+    error { false },
+    ring {  },
+    head { 0 },
+    tail { 0 },
+    used { 0 },
+    skip { 0 },
+    fillOffset { 0 },
+    pending { false },
+    pendingSectors { 0 },
+    loadState { SharedDevice::State::NONE },
+    reads { 0 },
+    bytesLoaded { 0 }
+{
+    // empty
+}
+
+bool ReadAhead::onTransmissionFinished (SharedDevice::State state)
+{
+    // Called from the interrupt context: the data is added to the ring by the main loop
+    loadState = state;
+    return true;
+}
+
+void ReadAhead::start (FIL & _file, uint32_t offset)
+{
+    // The DMA of a pending load still writes into the ring
+    finishLoad(true);
+    file = &_file;
+    error = false;
+    head = tail = used = 0;
+    reads = bytesLoaded = 0;
+
+    // Loading starts at the sector boundary; the bytes before the offset are dropped
+    fillOffset = offset - offset % SECTOR_SIZE;
+    skip = offset - fillOffset;
+}
+
+void ReadAhead::stop ()
+{
+    finishLoad(true);
+    file = NULL;
+    used = skip = 0;
+}
+
+uint32_t ReadAhead::read (uint8_t * dst, uint32_t bytes)
+{
+    finishLoad(false);
+    const uint8_t * data = (const uint8_t *) ring;
+    uint32_t done = 0;
+    while (done < bytes)
+    {
+        if (used == 0)
+        {
+            // The ring is empty: wait for the pending load or for a new one
+            if ((!pending && !startLoad()) || !finishLoad(true) || used == 0)
+            {
+                break;
+            }
+        }
+        const uint32_t n = std::min(std::min(bytes - done, used), RING_SIZE - tail);
+        ::memcpy(dst + done, data + tail, n);
+        tail = (tail + n) % RING_SIZE;
+        used -= n;
+        done += n;
+    }
+
+    // The next load runs while the caller processes the data
+    fill();
+    return done;
+}
+
+void ReadAhead::fill ()
+{
+    finishLoad(false);
+    if (!pending && used <= RING_SIZE / 2)
+    {
+        startLoad();
+    }
+}
+
+bool ReadAhead::startLoad ()
+{
+    if (pending || file == NULL || error || fillOffset >= file->fsize)
+    {
+        return false;
+    }
+
+    // The read goes into the free space up to the end of the ring
+    uint32_t sectors = std::min(RING_SIZE - head, RING_SIZE - used) / SECTOR_SIZE;
+    sectors = std::min(sectors, MAX_READ_BLOCKS);
+    if (sectors == 0)
+    {
+        return false;
+    }
+
+    uint8_t * dst = (uint8_t *) ring + head;
+    if (file->cltbl == NULL)
+    {
+        UINT bytesRead = 0;
+        FRESULT code = f_lseek(file, fillOffset);
+        if (code == FR_OK)
+        {
+            code = f_read(file, dst, sectors * SECTOR_SIZE, &bytesRead);
+        }
+        if (code != FR_OK)
+        {
+            USART_DEBUG("Can not read file: " << code << UsartLogger::ENDL);
+            error = true;
+            return false;
+        }
+        commit(sectors);
+        return true;
+    }
+
+    uint32_t runSectors = 0;
+    const uint32_t sector = mapSector(fillOffset, runSectors);
+    sectors = std::min(sectors, runSectors);
+    if (sector == 0 || sectors == 0)
+    {
+        USART_DEBUG("Can not map file offset " << fillOffset << UsartLogger::ENDL);
+        error = true;
+        return false;
+    }
+    loadState = SharedDevice::State::RX;
+    HAL_SD_ErrorTypedef status = sdio.readBlocksAsync(this, (uint32_t *) dst, (uint64_t) sector * SECTOR_SIZE,
+                                                      SECTOR_SIZE, sectors);
+    if (status != SD_OK)
+    {
+        // An occupied device is not an error, the load is repeated later
+        error = (status != SD_REQUEST_PENDING);
+        return false;
+    }
+    pending = true;
+    pendingSectors = sectors;
+    return true;
+}
+
+bool ReadAhead::finishLoad (bool wait)
+{
+    if (!pending)
+    {
+        return true;
+    }
+    while (wait && loadState == SharedDevice::State::RX)
+    {
+        // the SDIO reports either the completion or an error, including the data timeout
+        __NOP();
+    }
+    if (loadState == SharedDevice::State::RX)
+    {
+        return false;
+    }
+    pending = false;
+    if (loadState != SharedDevice::State::RX_CMPL)
+    {
+        USART_DEBUG("Can not read blocks: " << sdio.getLastError() << UsartLogger::ENDL);
+        error = true;
+        return false;
+    }
+    commit(pendingSectors);
+    return true;
+}
+
+void ReadAhead::commit (uint32_t sectors)
+{
+    ++reads;
+
+    // The last sector can be behind the end of file
+    const uint32_t bytes = sectors * SECTOR_SIZE;
+    const uint32_t valid = std::min(bytes, (uint32_t) (file->fsize - fillOffset));
+    bytesLoaded += bytes;
+    fillOffset += bytes;
+    head = (head + bytes) % RING_SIZE;
+    used += valid;
+
+    if (skip > 0)
+    {
+        const uint32_t n = std::min(skip, used);
+        tail = (tail + n) % RING_SIZE;
+        used -= n;
+        skip -= n;
+    }
+}
+
+uint32_t ReadAhead::mapSector (uint32_t offset, uint32_t & runSectors) const
+{
+    // The table consists of the pairs (length, first cluster) of the fragments and ends with 0
+    const FATFS * fs = file->fs;
+    const uint32_t clusterSize = fs->csize * SECTOR_SIZE;
+    uint32_t cluster = offset / clusterSize;
+    const DWORD * tbl = file->cltbl + 1;
+    while (tbl[0] != 0 && cluster >= tbl[0])
+    {
+        cluster -= tbl[0];
+        tbl += 2;
+    }
+    if (tbl[0] == 0)
+    {
+        return 0;
+    }
+    const uint32_t sectorInCluster = (offset % clusterSize) / SECTOR_SIZE;
+    runSectors = (tbl[0] - cluster) * fs->csize - sectorInCluster;
+    return fs->database + (tbl[1] + cluster - 2) * fs->csize + sectorInCluster;
+}
+
+#endif
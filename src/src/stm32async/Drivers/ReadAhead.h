@@ -0,0 +1,137 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#ifndef DRIVERS_READAHEAD_H_
+#define DRIVERS_READAHEAD_H_
+
+#include "SdCardFat.h"
+
+#ifdef HAL_SD_MODULE_ENABLED
+
+namespace Stm32async
+{
+namespace Drivers
+{
+
+/**
+ * @brief Read-ahead ring buffer for a file that is read sequentially.
+ *
+ * FatFS splits a large f_read() at every cluster boundary. The read-ahead bypasses f_read()
+ * for files opened in fast-seek mode: it maps the file offset to a sector using the cluster
+ * link map table and issues a single multi-block Sdio::readBlocks() for the whole contiguous
+ * run, limited by the free contiguous space of the ring and MAX_READ_BLOCKS. For files without
+ * a link map, the ring is filled by f_read().
+ *
+ * The card is read asynchronously: fill() queues the next read if at least a half of the ring
+ * is free and returns immediately; the completion is signalled by the SDIO interrupts and
+ * the read data is added to the ring by the next call of fill() or read(). read() copies data
+ * out of the ring, queues the next read and only waits for the card if the ring is empty.
+ * So the audio processing of a block overlaps with the transfer of the following data.
+ */
+class ReadAhead final : public SharedDevice::DeviceClient
+{
+public:
+
+    static constexpr uint32_t RING_SIZE = 32768;
+    static constexpr uint32_t SECTOR_SIZE = SdCardFat::SDHC_BLOCK_SIZE;
+    static constexpr uint32_t MAX_READ_BLOCKS = RING_SIZE / SECTOR_SIZE;
+
+    ReadAhead (Sdio & _sdio);
+
+    virtual bool onTransmissionFinished (SharedDevice::State state) override;
+
+    /**
+     * @brief Attaches the ring to a file and discards the buffered data.
+     *
+     * The data is read starting from given file offset.
+     */
+    void start (FIL & _file, uint32_t offset);
+
+    void stop ();
+
+    /**
+     * @brief Copies up to given number of bytes from the ring.
+     *
+     * @return the number of bytes; it is less than requested at the end of file or on error.
+     */
+    uint32_t read (uint8_t * dst, uint32_t bytes);
+
+    /**
+     * @brief Queues the read of the next contiguous run if at least a half of the ring is free.
+     */
+    void fill ();
+
+    inline bool isPending () const
+    {
+        return pending;
+    }
+
+    inline uint32_t getUsed () const
+    {
+        return used;
+    }
+
+    /**
+     * @brief Returns the number of read commands issued since start.
+     */
+    inline uint32_t getReads () const
+    {
+        return reads;
+    }
+
+    /**
+     * @brief Returns the number of bytes read from the card since start.
+     */
+    inline uint32_t getBytesLoaded () const
+    {
+        return bytesLoaded;
+    }
+
+private:
+
+    Sdio & sdio;
+    FIL * file;
+    bool error;
+
+    // Ring state; the head is always sector-aligned
+    uint32_t ring[RING_SIZE / sizeof(uint32_t)];
+    uint32_t head, tail, used, skip;
+
+    // File offset of the next sector to be loaded
+    uint32_t fillOffset;
+
+    // Asynchronous load in progress
+    bool pending;
+    uint32_t pendingSectors;
+    volatile SharedDevice::State loadState;
+
+    // Statistics
+    uint32_t reads, bytesLoaded;
+
+    bool startLoad ();
+    bool finishLoad (bool wait);
+    void commit (uint32_t sectors);
+    uint32_t mapSector (uint32_t offset, uint32_t & runSectors) const;
+};
+
+} // end of namespace Drivers
+} // end of namespace Stm32async
+
+#endif
+#endif
@@ -0,0 +1,186 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#include "Resampler.h"
+
+#include <cmath>
+
+#ifdef HAL_I2S_MODULE_ENABLED
+
+using namespace Stm32async::Drivers;
+
+/************************************************************************
+ * Helper functions
+ ************************************************************************/
+
+namespace
+{
+
+template<bool WIDE> inline int32_t getSample (const uint16_t * frame, uint32_t channel)
+{
+    return WIDE ? (int32_t) (((uint32_t) frame[2 * channel] << 16) | frame[2 * channel + 1]) :
+                  (int32_t) (int16_t) frame[channel];
+}
+
+template<bool WIDE> inline void putSample (uint16_t * frame, uint32_t channel, int64_t v)
+{
+    if (WIDE)
+    {
+        const int32_t s = (int32_t) std::max((int64_t) INT32_MIN, std::min((int64_t) INT32_MAX, v));
+        frame[2 * channel] = (uint16_t) ((uint32_t) s >> 16);
+        frame[2 * channel + 1] = (uint16_t) ((uint32_t) s & 0xFFFF);
+    }
+    else
+    {
+        frame[channel] = (uint16_t) (int16_t) std::max((int64_t) INT16_MIN, std::min((int64_t) INT16_MAX, v));
+    }
+}
+
+} // end of anonymous namespace
+
+/************************************************************************
+ * Class Resampler
+ ************************************************************************/
+
+constexpr uint32_t Resampler::TAPS;
+constexpr uint32_t Resampler::PHASES;
+constexpr float Resampler::CUTOFF;
+
+Resampler::Resampler (uint32_t _outputRate) :
+    outputRate { _outputRate },
+    inputRate { 0 },
+    frameSize { 2 },
+    step { 0 },
+    frac { 0 },
+    available { 0 },
+    coeffs {  },
+    buffer {  }
+{
+    // empty
+}
+
+bool Resampler::configure (uint32_t _inputRate, uint32_t dataFormat)
+{
+    if (_inputRate == 0 || _inputRate >= outputRate)
+    {
+        return false;
+    }
+    frameSize = (dataFormat == I2S_DATAFORMAT_24B || dataFormat == I2S_DATAFORMAT_32B) ? 4 : 2;
+    step = (uint32_t) (((uint64_t) _inputRate << 32) / outputRate);
+    if (inputRate != _inputRate)
+    {
+        inputRate = _inputRate;
+        makeFilter(CUTOFF);
+    }
+    reset();
+    return true;
+}
+
+void Resampler::reset ()
+{
+    // The first output sample is centered at the first input frame
+    frac = 0;
+    available = TAPS / 2 - 1;
+    ::memset(buffer, 0, available * frameSize * sizeof(uint16_t));
+}
+
+uint32_t Resampler::getRequiredFrames (uint32_t outFrames) const
+{
+    if (outFrames == 0)
+    {
+        return 0;
+    }
+    const uint32_t lastPos = (uint32_t) (((uint64_t) frac + (uint64_t) (outFrames - 1) * step) >> 32);
+    const uint32_t length = lastPos + TAPS;
+    return (length > available) ? length - available : 0;
+}
+
+// Inlined into process(), so that the kernel runs from RAM as well
+template<bool WIDE> __attribute__((always_inline)) inline void Resampler::filter (uint16_t * out, uint32_t outFrames)
+{
+    const uint32_t length = available + getRequiredFrames(outFrames);
+    uint32_t pos = 0;
+    for (uint32_t i = 0; i < outFrames; ++i, out += frameSize)
+    {
+        // The upper bits of the fractional position select the sub-filter, the next
+        // 15 bits are used to interpolate between two neighbouring sub-filters
+        const int16_t * c0 = coeffs[frac >> (32 - PHASE_BITS)];
+        const int16_t * c1 = c0 + TAPS;
+        const int32_t t = (int32_t) ((frac >> (32 - PHASE_BITS - 15)) & 0x7FFF);
+        const uint16_t * x = &buffer[pos * frameSize];
+        int64_t accL = 0, accR = 0;
+        for (uint32_t k = 0; k < TAPS; ++k, x += frameSize)
+        {
+            const int32_t c = c0[k] + (((c1[k] - c0[k]) * t) >> 15);
+            accL += (int64_t) c * getSample<WIDE>(x, 0);
+            accR += (int64_t) c * getSample<WIDE>(x, 1);
+        }
+        putSample<WIDE>(out, 0, accL >> 15);
+        putSample<WIDE>(out, 1, accR >> 15);
+
+        const uint64_t next = (uint64_t) frac + step;
+        pos += (uint32_t) (next >> 32);
+        frac = (uint32_t) next;
+    }
+
+    // Keep the frames that are still needed as filter history
+    available = length - pos;
+    ::memmove(buffer, &buffer[pos * frameSize], available * frameSize * sizeof(uint16_t));
+}
+
+RAM_FUNC void Resampler::process (uint16_t * out, uint32_t outFrames)
+{
+    if (frameSize == 4)
+    {
+        filter<true>(out, outFrames);
+    }
+    else
+    {
+        filter<false>(out, outFrames);
+    }
+}
+
+void Resampler::makeFilter (float cutoff)
+{
+    static const float PI = 3.14159265358979f;
+    const float halfWidth = (float) (TAPS / 2);
+    for (uint32_t p = 0; p <= PHASES; ++p)
+    {
+        float h[TAPS];
+        float sum = 0.0f;
+        for (uint32_t k = 0; k < TAPS; ++k)
+        {
+            const float x = (float) p / (float) PHASES + halfWidth - 1.0f - (float) k;
+            const float s = (x == 0.0f) ? cutoff : ::sinf(PI * cutoff * x) / (PI * x);
+            const float w = (::fabsf(x) >= halfWidth) ? 0.0f :
+                    0.35875f + 0.48829f * ::cosf(PI * x / halfWidth) + 0.14128f * ::cosf(2.0f * PI * x / halfWidth)
+                    + 0.01168f * ::cosf(3.0f * PI * x / halfWidth);
+            h[k] = s * w;
+            sum += h[k];
+        }
+        // Each sub-filter is normalized to unity DC gain
+        for (uint32_t k = 0; k < TAPS; ++k)
+        {
+            const float c = ::roundf(h[k] / sum * 32768.0f);
+            coeffs[p][k] = (int16_t) std::max(-32768.0f, std::min(32767.0f, c));
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,145 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#ifndef DRIVERS_RESAMPLER_H_
+#define DRIVERS_RESAMPLER_H_
+
+#include "AudioDac_UDA1334.h"
+
+#ifdef HAL_I2S_MODULE_ENABLED
+
+namespace Stm32async
+{
+namespace Drivers
+{
+
+/**
+ * @brief Fixed-point polyphase sample-rate converter for stereo frames in the I2S DMA layout.
+ *
+ * The converter allows to keep the I2S clock at a fixed, exactly achievable rate (for example 48 kHz)
+ * and up-sample streams with lower rates (44.1 kHz, 32 kHz, 22.05 kHz, ...) to it. The filter is a
+ * Blackman-Harris windowed sinc that is stored as a bank of PHASES + 1 sub-filters with TAPS Q15
+ * coefficients each. The fractional position of an output sample selects two neighbouring
+ * sub-filters, whose coefficients are linearly interpolated, so arbitrary ratios are supported.
+ *
+ * The cost per block is bounded and depends on the number of output frames only: every output
+ * frame takes TAPS coefficient interpolations and 2 * TAPS multiply-accumulate operations. On the
+ * Cortex-M4 this is about 210 CPU cycles per output frame for 16-bit frames and 280 cycles for
+ * 24/32-bit frames (counted from the inner loop: per tap 4 or 6 loads, the interpolation of the
+ * coefficient and 2 SMLAL), i.e. 6% or 8% of 168 MHz at 48 kHz. HAL_Sim/Tests/resampler.cpp
+ * checks the THD+N of a -6 dBFS sine converted from 44.1 kHz to 48 kHz (below -80 dB) and
+ * reports the host time per output frame.
+ *
+ * Usage within a streaming loop:
+ *
+ *     uint32_t n = resampler.getRequiredFrames(outFrames);
+ *     // write n input frames into resampler.getInputPtr()
+ *     resampler.process(out, outFrames);
+ *
+ * The input buffer is written by the CPU, not by DMA, so the object can be placed into the
+ * CCM: "Resampler resampler CCM_RAM;".
+ */
+class Resampler final
+{
+public:
+
+    static constexpr uint32_t TAPS = 16;
+    static constexpr uint32_t PHASE_BITS = 8;
+    static constexpr uint32_t PHASES = 1 << PHASE_BITS;
+    static constexpr float CUTOFF = 0.9f;
+
+    /**
+     * @brief Default constructor.
+     *
+     * @param _outputRate a fixed output sample rate the I2S clock shall run with.
+     */
+    Resampler (uint32_t _outputRate);
+
+    /**
+     * @brief Prepares the filter bank for the given input rate.
+     *
+     * @return false if the ratio is not supported: only up-sampling is implemented, since
+     *         the SD block does not have room for more input frames than output frames.
+     */
+    bool configure (uint32_t inputRate, uint32_t dataFormat);
+
+    /**
+     * @brief Resets the history of the converter.
+     */
+    void reset ();
+
+    /**
+     * @brief Returns the number of new input frames that shall be provided in order
+     *        to produce given number of output frames.
+     */
+    uint32_t getRequiredFrames (uint32_t outFrames) const;
+
+    /**
+     * @brief Returns the upper bound of getRequiredFrames for given number of output frames.
+     */
+    inline uint32_t getMaxRequiredFrames (uint32_t outFrames) const
+    {
+        return (uint32_t) (((uint64_t) outFrames * step) >> 32) + TAPS;
+    }
+
+    /**
+     * @brief Returns the pointer where new input frames shall be written to.
+     */
+    inline uint16_t * getInputPtr ()
+    {
+        return &buffer[available * frameSize];
+    }
+
+    /**
+     * @brief Produces given number of output frames and consumes the required input frames.
+     */
+    void process (uint16_t * out, uint32_t outFrames);
+
+    inline uint32_t getOutputRate () const
+    {
+        return outputRate;
+    }
+
+    inline uint32_t getInputRate () const
+    {
+        return inputRate;
+    }
+
+private:
+
+    // Input frames that fit into a single DAC block plus filter history
+    static constexpr uint32_t BUFFER_SIZE = AudioDac_UDA1334::BLOCK_SIZE2 + 8 * TAPS;
+
+    uint32_t outputRate, inputRate;
+    uint32_t frameSize;
+    uint32_t step, frac;
+    uint32_t available;
+    int16_t coeffs[PHASES + 1][TAPS];
+    uint16_t buffer[BUFFER_SIZE];
+
+    void makeFilter (float cutoff);
+
+    template<bool WIDE> void filter (uint16_t * out, uint32_t outFrames);
+};
+
+} // end of namespace Drivers
+} // end of namespace Stm32async
+
+#endif
+#endif
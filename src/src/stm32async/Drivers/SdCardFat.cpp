@@ -62,8 +62,13 @@ DSTATUS SD_status(BYTE /*lun*/)
   */
 DRESULT SD_read(BYTE /*lun*/, BYTE *buff, DWORD sector, UINT count)
 {
+    SectorCache * cache = SdCardFat::getInstance()->getCache();
+    if (cache != NULL)
+    {
+        return cache->read(buff, sector, count);
+    }
     HAL_SD_ErrorTypedef status = SdCardFat::getInstance()->getSdio().readBlocks(
-            (uint32_t*)buff, (uint64_t) (sector * SdCardFat::SDHC_BLOCK_SIZE), SdCardFat::SDHC_BLOCK_SIZE, count);
+            (uint32_t*)buff, (uint64_t) sector * SdCardFat::SDHC_BLOCK_SIZE, SdCardFat::SDHC_BLOCK_SIZE, count);
     return (status != SD_OK)? RES_ERROR : RES_OK;
 }
 
@@ -77,8 +82,13 @@ DRESULT SD_read(BYTE /*lun*/, BYTE *buff, DWORD sector, UINT count)
   */
 DRESULT SD_write(BYTE /*lun*/, const BYTE *buff, DWORD sector, UINT count)
 {
+    SectorCache * cache = SdCardFat::getInstance()->getCache();
+    if (cache != NULL)
+    {
+        return cache->write(buff, sector, count);
+    }
     HAL_SD_ErrorTypedef status = SdCardFat::getInstance()->getSdio().writeBlocks(
-            (uint32_t*)buff, (uint64_t)(sector * SdCardFat::SDHC_BLOCK_SIZE), SdCardFat::SDHC_BLOCK_SIZE, count);
+            (uint32_t*)buff, (uint64_t) sector * SdCardFat::SDHC_BLOCK_SIZE, SdCardFat::SDHC_BLOCK_SIZE, count);
     return (status != SD_OK)? RES_ERROR : RES_OK;
 }
 
@@ -138,11 +148,18 @@ Diskio_drvTypeDef SdCardFat::fatFsDriver =
  * Class SdCardFat
  ************************************************************************/
 
+constexpr uint32_t SdCardFat::DEBOUNCE_TIME;
+
 SdCardFat::SdCardFat (const HardwareLayout::Sdio & _device, IOPort & _sdDetect, uint32_t _clockDiv):
     sdio { _device, _clockDiv },
     sdDetect { _sdDetect },
     sdCardInserted { false },
-    handler { NULL }
+    detectTime { 0 },
+    mountState { MountState::NO_CARD },
+    sdioStarted { false },
+    driverLinked { false },
+    handler { NULL },
+    cache { NULL }
 {
     instance = this;
 }
@@ -150,53 +167,192 @@ SdCardFat::SdCardFat (const HardwareLayout::Sdio & _device, IOPort & _sdDetect,
 
 void SdCardFat::periodic ()
 {
+    // The card-detect pin shall be stable for DEBOUNCE_TIME before anything is done
     bool s = isCardInserted();
     if (sdCardInserted != s)
     {
         sdCardInserted = s;
-        USART_DEBUG("SD card " << (s? "inserted" : "de-attached") << UsartLogger::ENDL);
+        detectTime = HAL_GetTick();
+        return;
+    }
+    if (HAL_GetTick() - detectTime < DEBOUNCE_TIME)
+    {
+        return;
+    }
+
+    if (!sdCardInserted)
+    {
+        if (mountState != MountState::NO_CARD)
+        {
+            unmount();
+        }
+        return;
+    }
+
+    switch (mountState)
+    {
+    case MountState::MOUNTED:
+    case MountState::FAILED:
+        return;
+
+    case MountState::NO_CARD:
+        USART_DEBUG("SD card inserted" << UsartLogger::ENDL);
+        mountState = MountState::INIT_CARD;
+        return;
+
+    default:
+        break;
+    }
+
+    // One step per call
+    DeviceStart::Status status = performStep();
+    if (status != DeviceStart::OK)
+    {
+        USART_DEBUG("SD card mount failed at step " << (int) mountState << ": "
+                    << DeviceStart::asString(status) << UsartLogger::ENDL);
+        mountState = MountState::FAILED;
+        return;
+    }
+    if (mountState == MountState::TUNE_CLOCK && sdio.isClockTuning())
+    {
+        return;
+    }
+    mountState = (MountState) ((int) mountState + 1);
+    if (mountState == MountState::MOUNTED)
+    {
+        USART_DEBUG("SD card mounted: " << fatFs.volumeLabel << ", " << fatFs.currentDirectory << UsartLogger::ENDL);
         if (handler != NULL)
         {
-            if (sdCardInserted)
-            {
-                handler->onSdCardAttach();
-            }
-            else
-            {
-                handler->onSdCardDeAttach();
-            }
+            handler->onSdCardAttach();
         }
     }
 }
 
 
-Stm32async::DeviceStart::Status SdCardFat::mountFatFs ()
+Stm32async::DeviceStart::Status SdCardFat::performStep ()
 {
-    uint8_t code1 = FATFS_LinkDriver(&fatFsDriver, fatFs.path);
-    if (code1 != 0)
+    switch (mountState)
     {
-        return DeviceStart::FAT_DRIVER_NOT_LINKED;
+    case MountState::INIT_CARD:
+        sdioStarted = true;
+        return sdio.initCard();
+    case MountState::CONFIGURE_BUS:
+        return sdio.configureBus();
+    case MountState::START_TRANSFERS:
+        return sdio.startTransfers();
+    case MountState::TUNE_CLOCK:
+        // The first call looks up the cached divider, every further one measures a divider
+        if (sdio.isClockTuning())
+        {
+            sdio.tuneClockStep();
+        }
+        else
+        {
+            sdio.startClockTuning();
+        }
+        return DeviceStart::OK;
+    case MountState::LINK_DRIVER:
+        return linkDriver();
+    case MountState::MOUNT_VOLUME:
+        return mountVolume();
+    case MountState::READ_LABEL:
+        return readLabel();
+    case MountState::READ_DIRECTORY:
+        return readDirectory();
+    default:
+        return DeviceStart::UNDEFINED_ERROR;
     }
+}
 
-    FRESULT code2 = f_mount(&fatFs.key, fatFs.path, 1);
-    if (code2 != FR_OK)
+
+Stm32async::DeviceStart::Status SdCardFat::mountFatFs ()
+{
+    DeviceStart::Status status = linkDriver();
+    if (status == DeviceStart::OK)
+    {
+        status = mountVolume();
+    }
+    if (status == DeviceStart::OK)
     {
-        return DeviceStart::FAT_VOLUME_NOT_MOUNTED;
+        status = readLabel();
     }
+    if (status == DeviceStart::OK)
+    {
+        status = readDirectory();
+    }
+    mountState = (status == DeviceStart::OK)? MountState::MOUNTED : MountState::FAILED;
+    return status;
+}
 
-    code2 = f_getlabel(fatFs.path, fatFs.volumeLabel, &fatFs.volumeSN);
-    if (code2 != FR_OK)
+
+Stm32async::DeviceStart::Status SdCardFat::linkDriver ()
+{
+    if (!driverLinked)
     {
-        return DeviceStart::FAT_VOLUME_STATUS_ERROR;
+        if (FATFS_LinkDriver(&fatFsDriver, fatFs.path) != 0)
+        {
+            return DeviceStart::FAT_DRIVER_NOT_LINKED;
+        }
+        driverLinked = true;
     }
+    return DeviceStart::OK;
+}
+
 
-    code2 = f_getcwd(fatFs.currentDirectory, sizeof(fatFs.currentDirectory));
-    if (code2 != FR_OK)
+Stm32async::DeviceStart::Status SdCardFat::mountVolume ()
+{
+    // The card could be changed since the last mount
+    if (cache != NULL)
     {
-        return DeviceStart::FAT_DIR_STATUS_ERROR;
+        cache->invalidate();
     }
 
-    return DeviceStart::OK;
+    FRESULT code = f_mount(&fatFs.key, fatFs.path, 1);
+    return (code != FR_OK)? DeviceStart::FAT_VOLUME_NOT_MOUNTED : DeviceStart::OK;
+}
+
+
+Stm32async::DeviceStart::Status SdCardFat::readLabel ()
+{
+    FRESULT code = f_getlabel(fatFs.path, fatFs.volumeLabel, &fatFs.volumeSN);
+    return (code != FR_OK)? DeviceStart::FAT_VOLUME_STATUS_ERROR : DeviceStart::OK;
+}
+
+
+Stm32async::DeviceStart::Status SdCardFat::readDirectory ()
+{
+    FRESULT code = f_getcwd(fatFs.currentDirectory, sizeof(fatFs.currentDirectory));
+    return (code != FR_OK)? DeviceStart::FAT_DIR_STATUS_ERROR : DeviceStart::OK;
+}
+
+
+void SdCardFat::unmount ()
+{
+    USART_DEBUG("SD card de-attached" << UsartLogger::ENDL);
+
+    // The handler stops the clients (e.g. a running stream) while the volume is still mounted
+    if (mountState == MountState::MOUNTED && handler != NULL)
+    {
+        handler->onSdCardDeAttach();
+    }
+    if (driverLinked)
+    {
+        f_mount(NULL, fatFs.path, 0);
+        FATFS_UnLinkDriver(fatFs.path);
+        driverLinked = false;
+    }
+    if (sdioStarted)
+    {
+        // An asynchronous read in progress is finished by an error interrupt
+        sdio.waitForRelease();
+        sdio.stop();
+        sdioStarted = false;
+    }
+    if (cache != NULL)
+    {
+        cache->invalidate();
+    }
+    mountState = MountState::NO_CARD;
 }
 
 
@@ -205,6 +361,9 @@ void SdCardFat::listFiles()
     FRESULT res;
     DIR dir;
     FILINFO fno;
+    char lfn[_MAX_LFN + 1];
+    fno.lfname = lfn;
+    fno.lfsize = sizeof(lfn);
 
     res = f_opendir(&dir, fatFs.currentDirectory); /* Open the directory */
     if (res == FR_OK)
@@ -216,13 +375,14 @@ void SdCardFat::listFiles()
             {
                 break; /* Break on error or end of dir */
             }
+            const char * name = (lfn[0] != 0)? lfn : fno.fname;
             if (fno.fattrib & AM_DIR)
             {
-                USART_DEBUG("  " << fno.fname << " <DIR>" << UsartLogger::ENDL);
+                USART_DEBUG("  " << name << " <DIR>" << UsartLogger::ENDL);
             }
             else
             {
-                USART_DEBUG("  " << fno.fname << " (" << fno.fsize << ")" << UsartLogger::ENDL);
+                USART_DEBUG("  " << name << " (" << fno.fsize << ")" << UsartLogger::ENDL);
             }
         }
         f_closedir(&dir);
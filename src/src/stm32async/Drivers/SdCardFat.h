@@ -21,6 +21,7 @@
 #define DRIVERS_SDCARDFAT_H_
 
 #include "../Sdio.h"
+#include "SectorCache.h"
 
 #ifdef HAL_SD_MODULE_ENABLED
 
@@ -33,6 +34,13 @@ namespace Drivers
 
 /**
  * @brief Class that implements SD card handling using FAT FS.
+ *
+ * periodic() debounces the card-detect pin and mounts an inserted card as a state machine
+ * that performs one step per call: card initialization, wide bus and status, DMA start, clock
+ * tuning (one divider per call), driver link, volume mount, label and current directory. The control loop is
+ * therefore never blocked for the whole sequence. The handler is notified by onSdCardAttach()
+ * when the volume is mounted, and by onSdCardDeAttach() when the card is removed, before the
+ * volume is unmounted and the SDIO is stopped.
  */
 class SdCardFat
 {
@@ -49,6 +57,22 @@ public:
 
     static constexpr uint32_t SDHC_BLOCK_SIZE = 512;
     static constexpr size_t FAT_FS_OBJECT_LENGHT = 64;
+    static constexpr uint32_t DEBOUNCE_TIME = 50;
+
+    enum class MountState
+    {
+        NO_CARD = 0,
+        INIT_CARD = 1,
+        CONFIGURE_BUS = 2,
+        START_TRANSFERS = 3,
+        TUNE_CLOCK = 4,
+        LINK_DRIVER = 5,
+        MOUNT_VOLUME = 6,
+        READ_LABEL = 7,
+        READ_DIRECTORY = 8,
+        MOUNTED = 9,
+        FAILED = 10
+    };
 
     typedef struct
     {
@@ -64,10 +88,27 @@ public:
      */
     SdCardFat (const HardwareLayout::Sdio & _device, IOPort & _sdDetect, uint32_t _clockDiv);
 
+    /**
+     * @brief Performs the next step of the card mount or removal.
+     */
     void periodic ();
+
+    /**
+     * @brief Blocking mount of a card started by start(), as an alternative to periodic().
+     */
     DeviceStart::Status mountFatFs ();
     void listFiles ();
 
+    inline MountState getMountState () const
+    {
+        return mountState;
+    }
+
+    inline bool isMounted () const
+    {
+        return mountState == MountState::MOUNTED;
+    }
+
     inline void setHandler (EventHandler * handler)
     {
         this->handler = handler;
@@ -83,6 +124,19 @@ public:
         return sdio;
     }
 
+    /**
+     * @brief Sets an optional sector cache used by the FatFS driver.
+     */
+    inline void setCache (SectorCache * _cache)
+    {
+        cache = _cache;
+    }
+
+    inline SectorCache * getCache ()
+    {
+        return cache;
+    }
+
     inline bool isCardInserted () const
     {
         return !sdDetect.getBit();
@@ -99,12 +153,14 @@ public:
         {
             return DeviceStart::SD_NOT_INSERTED;
         }
+        sdioStarted = true;
         return sdio.start();
     }
 
     inline void stop ()
     {
         sdio.stop();
+        sdioStarted = false;
     }
 
 private:
@@ -112,9 +168,20 @@ private:
     Sdio sdio;
     IOPort & sdDetect;
     bool sdCardInserted;
+    uint32_t detectTime;
+    MountState mountState;
+    bool sdioStarted, driverLinked;
     EventHandler * handler;
+    SectorCache * cache;
     static Diskio_drvTypeDef fatFsDriver;
     FatFs fatFs;
+
+    DeviceStart::Status performStep ();
+    DeviceStart::Status linkDriver ();
+    DeviceStart::Status mountVolume ();
+    DeviceStart::Status readLabel ();
+    DeviceStart::Status readDirectory ();
+    void unmount ();
 };
 
 } // end of namespace Drivers
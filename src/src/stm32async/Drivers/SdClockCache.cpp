@@ -0,0 +1,133 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+#include "SdClockCache.h"
+#include "../UsartLogger.h"
+
+#ifdef HAL_SD_MODULE_ENABLED
+
+using namespace Stm32async::Drivers;
+
+#define USART_DEBUG_MODULE "ROM: "
+
+/************************************************************************
+ * Class SdClockCache
+ ************************************************************************/
+
+constexpr uint32_t SdClockCache::MAX_CARDS;
+constexpr uint32_t SdClockCache::PAGE_SIZE;
+constexpr uint16_t SdClockCache::RECORD_MAGIC;
+constexpr uint32_t SdClockCache::WRITE_TIMEOUT;
+
+SdClockCache::SdClockCache (EepRom_25AA040A & _eepRom, uint8_t _address) :
+    eepRom { _eepRom },
+    address { _address }
+{
+    // empty
+}
+
+bool SdClockCache::loadClockTuning (uint32_t cardSerial, Sdio::ClockTuning & tuning)
+{
+    Record r;
+    for (uint32_t slot = 0; slot < MAX_CARDS; ++slot)
+    {
+        if (readRecord(slot, r) && r.cardSerial == cardSerial)
+        {
+            tuning.cardSerial = cardSerial;
+            tuning.clockDiv = r.clockDiv;
+            tuning.throughput = r.throughput;
+            return true;
+        }
+    }
+    return false;
+}
+
+void SdClockCache::storeClockTuning (const Sdio::ClockTuning & tuning)
+{
+    // The record of the same card, or else a free one, or else the oldest one is replaced
+    Record r;
+    uint32_t slot = 0, sequence = 0, oldest = __UINT32_MAX__;
+    bool found = false;
+    for (uint32_t i = 0; i < MAX_CARDS; ++i)
+    {
+        if (!readRecord(i, r))
+        {
+            if (!found)
+            {
+                slot = i;
+                oldest = 0;
+                found = true;
+            }
+            continue;
+        }
+        sequence = std::max(sequence, r.sequence);
+        if (r.cardSerial == tuning.cardSerial)
+        {
+            slot = i;
+            oldest = 0;
+            found = true;
+        }
+        else if (!found && r.sequence < oldest)
+        {
+            slot = i;
+            oldest = r.sequence;
+        }
+    }
+
+    r.magic = RECORD_MAGIC;
+    r.clockDiv = (uint8_t) tuning.clockDiv;
+    r.cardSerial = tuning.cardSerial;
+    r.throughput = tuning.throughput;
+    r.sequence = sequence + 1;
+    r.checksum = getChecksum(r);
+    eepRom.enableWrite();
+    eepRom.writePage((uint8_t) (address + slot * PAGE_SIZE), (uint8_t *) &r, sizeof(Record));
+    eepRom.disableWrite();
+
+    // Wait for the end of the internal write cycle (WIP bit of the status register)
+    const uint32_t start = HAL_GetTick();
+    while ((eepRom.getMode() & 0x01) != 0 && HAL_GetTick() - start < WRITE_TIMEOUT)
+    {
+        // empty
+    }
+    USART_DEBUG("SD clock tuning of card " << tuning.cardSerial << " stored in slot " << slot << UsartLogger::ENDL);
+}
+
+bool SdClockCache::readRecord (uint32_t slot, Record & r)
+{
+    eepRom.readPage((uint8_t) (address + slot * PAGE_SIZE), (uint8_t *) &r, sizeof(Record));
+    return r.magic == RECORD_MAGIC && r.checksum == getChecksum(r);
+}
+
+uint8_t SdClockCache::getChecksum (const Record & r)
+{
+    const uint8_t * p = (const uint8_t *) &r;
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < sizeof(Record); ++i)
+    {
+        if (p + i != &r.checksum)
+        {
+            sum = (uint8_t) (sum + p[i]);
+        }
+    }
+    return (uint8_t) ~sum;
+}
+
+#endif
@@ -0,0 +1,77 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+#ifndef DRIVERS_SDCLOCKCACHE_H_
+#define DRIVERS_SDCLOCKCACHE_H_
+
+#include "../Sdio.h"
+#include "EepRom_25AA040A.h"
+
+#ifdef HAL_SD_MODULE_ENABLED
+
+namespace Stm32async
+{
+namespace Drivers
+{
+
+/**
+ * @brief Stores the SDIO clock tuning of the last MAX_CARDS cards in the EEPROM.
+ *
+ * Every card takes one EEPROM page of PAGE_SIZE bytes, starting from the given page-aligned
+ * address. If all records are used, the least recently stored one is replaced.
+ */
+class SdClockCache final : public Sdio::ClockCache
+{
+public:
+
+    static constexpr uint32_t MAX_CARDS = 4;
+    static constexpr uint32_t PAGE_SIZE = 16;
+    static constexpr uint16_t RECORD_MAGIC = 0x5343;
+    static constexpr uint32_t WRITE_TIMEOUT = 10;
+
+    typedef struct
+    {
+        uint16_t magic;
+        uint8_t clockDiv;
+        uint8_t checksum;
+        uint32_t cardSerial;
+        uint32_t throughput;
+        uint32_t sequence;
+    } Record;
+
+    SdClockCache (EepRom_25AA040A & _eepRom, uint8_t _address);
+
+    virtual bool loadClockTuning (uint32_t cardSerial, Sdio::ClockTuning & tuning) override;
+    virtual void storeClockTuning (const Sdio::ClockTuning & tuning) override;
+
+private:
+
+    EepRom_25AA040A & eepRom;
+    uint8_t address;
+
+    bool readRecord (uint32_t slot, Record & r);
+    static uint8_t getChecksum (const Record & r);
+};
+
+} // end of namespace Drivers
+} // end of namespace Stm32async
+
+#endif
+#endif
@@ -0,0 +1,148 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#include "SectorCache.h"
+
+#ifdef HAL_SD_MODULE_ENABLED
+
+using namespace Stm32async::Drivers;
+
+/************************************************************************
+ * Class SectorCache
+ ************************************************************************/
+
+constexpr uint32_t SectorCache::SECTOR_SIZE;
+constexpr uint32_t SectorCache::SECTOR_WORDS;
+
+SectorCache::SectorCache (Sdio & _sdio, uint32_t * _data, Entry * _entries, uint32_t _size) :
+    sdio { _sdio },
+    data { _data },
+    entries { _entries },
+    size { _size },
+    useCounter { 0 },
+    hits { 0 },
+    misses { 0 },
+    bypassed { 0 }
+{
+    invalidate();
+}
+
+DRESULT SectorCache::read (BYTE * buff, DWORD sector, UINT count)
+{
+    if (count == 1)
+    {
+        Entry * e = find(sector);
+        if (e != NULL)
+        {
+            ++hits;
+            e->lastUse = ++useCounter;
+            ::memcpy(buff, getData(e), SECTOR_SIZE);
+            return RES_OK;
+        }
+        ++misses;
+    }
+    else
+    {
+        ++bypassed;
+    }
+
+    // The card is always read into the FatFS buffer, since the cache may be not accessible by DMA
+    if (sdio.readBlocks((uint32_t *) buff, (uint64_t) sector * SECTOR_SIZE, SECTOR_SIZE, count) != SD_OK)
+    {
+        return RES_ERROR;
+    }
+    if (count == 1 && size > 0)
+    {
+        Entry * e = findVictim();
+        e->sector = sector;
+        e->valid = true;
+        e->lastUse = ++useCounter;
+        ::memcpy(getData(e), buff, SECTOR_SIZE);
+    }
+    return RES_OK;
+}
+
+DRESULT SectorCache::write (const BYTE * buff, DWORD sector, UINT count)
+{
+    const DRESULT res = (sdio.writeBlocks((uint32_t *) buff, (uint64_t) sector * SECTOR_SIZE, SECTOR_SIZE, count)
+                         == SD_OK) ? RES_OK : RES_ERROR;
+    for (uint32_t i = 0; i < size; ++i)
+    {
+        Entry & e = entries[i];
+        if (e.valid && e.sector >= sector && e.sector < sector + count)
+        {
+            // After a failed write, the content of the card is unknown
+            if (res == RES_OK)
+            {
+                ::memcpy(getData(&e), buff + (e.sector - sector) * SECTOR_SIZE, SECTOR_SIZE);
+            }
+            else
+            {
+                e.valid = false;
+            }
+        }
+    }
+    return res;
+}
+
+void SectorCache::invalidate ()
+{
+    for (uint32_t i = 0; i < size; ++i)
+    {
+        entries[i].valid = false;
+        entries[i].lastUse = 0;
+    }
+}
+
+void SectorCache::resetStatistics ()
+{
+    hits = misses = bypassed = 0;
+}
+
+SectorCache::Entry * SectorCache::find (DWORD sector)
+{
+    for (uint32_t i = 0; i < size; ++i)
+    {
+        if (entries[i].valid && entries[i].sector == sector)
+        {
+            return &entries[i];
+        }
+    }
+    return NULL;
+}
+
+SectorCache::Entry * SectorCache::findVictim ()
+{
+    // A free entry is taken first, otherwise the least recently used one
+    Entry * victim = &entries[0];
+    for (uint32_t i = 0; i < size; ++i)
+    {
+        if (!entries[i].valid)
+        {
+            return &entries[i];
+        }
+        if (entries[i].lastUse < victim->lastUse)
+        {
+            victim = &entries[i];
+        }
+    }
+    return victim;
+}
+
+#endif
@@ -0,0 +1,121 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#ifndef DRIVERS_SECTORCACHE_H_
+#define DRIVERS_SECTORCACHE_H_
+
+#include "../Sdio.h"
+
+#ifdef HAL_SD_MODULE_ENABLED
+
+#include "FatFS/diskio.h"
+
+namespace Stm32async
+{
+namespace Drivers
+{
+
+/**
+ * @brief Write-through LRU cache of single SD card sectors below the FatFS disk driver.
+ *
+ * FatFS accesses the FAT and the directory sectors one by one through its sector window,
+ * and the same sectors are read again and again by f_open, f_lseek and f_readdir. Only these
+ * single-sector reads are cached; multi-sector reads of file data bypass the cache, so that a
+ * streamed file does not evict the file system structures. Writes go to the card first and
+ * then update the cached copies.
+ *
+ * The storage is provided by the caller and sized in sectors. The data is only copied by the
+ * CPU (the card is read into the FatFS buffer), so it can be placed into the CCM:
+ *
+ *     SectorCache::Entry cacheEntries[16];
+ *     uint32_t cacheData[16 * SectorCache::SECTOR_WORDS] CCM_RAM;
+ *     SectorCache cache(sdio, cacheData, cacheEntries, 16);
+ */
+class SectorCache final
+{
+public:
+
+    static constexpr uint32_t SECTOR_SIZE = 512;
+    static constexpr uint32_t SECTOR_WORDS = SECTOR_SIZE / sizeof(uint32_t);
+
+    typedef struct
+    {
+        DWORD sector;
+        uint32_t lastUse;
+        bool valid;
+    } Entry;
+
+    SectorCache (Sdio & _sdio, uint32_t * _data, Entry * _entries, uint32_t _size);
+
+    DRESULT read (BYTE * buff, DWORD sector, UINT count);
+    DRESULT write (const BYTE * buff, DWORD sector, UINT count);
+
+    /**
+     * @brief Drops all cached sectors, for example if the card was changed.
+     */
+    void invalidate ();
+
+    void resetStatistics ();
+
+    inline uint32_t getSize () const
+    {
+        return size;
+    }
+
+    inline uint32_t getHits () const
+    {
+        return hits;
+    }
+
+    inline uint32_t getMisses () const
+    {
+        return misses;
+    }
+
+    /**
+     * @brief Returns the number of multi-sector reads that were passed to the card.
+     */
+    inline uint32_t getBypassed () const
+    {
+        return bypassed;
+    }
+
+private:
+
+    Sdio & sdio;
+    uint32_t * data;
+    Entry * entries;
+    uint32_t size;
+    uint32_t useCounter;
+    uint32_t hits, misses, bypassed;
+
+    inline uint8_t * getData (const Entry * e) const
+    {
+        return (uint8_t *) (data + (e - entries) * SECTOR_WORDS);
+    }
+
+    Entry * find (DWORD sector);
+    Entry * findVictim ();
+};
+
+} // end of namespace Drivers
+} // end of namespace Stm32async
+
+#endif
+#endif
@@ -0,0 +1,267 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#include "SignalGenerator.h"
+
+#include <cmath>
+
+using namespace Stm32async::Drivers;
+
+/************************************************************************
+ * Compile-time sine table
+ ************************************************************************/
+
+namespace
+{
+
+constexpr double TABLE_PI = 3.14159265358979323846;
+
+/**
+ * @brief Taylor series of sin(x) for x in [-PI/2, PI/2]
+ */
+constexpr double taylorSin (double x)
+{
+    double term = x, sum = x;
+    for (int n = 1; n < 12; ++n)
+    {
+        term *= -x * x / ((2 * n) * (2 * n + 1));
+        sum += term;
+    }
+    return sum;
+}
+
+constexpr double tableSin (double x)
+{
+    // Reduce x in [0, 2*PI) to [-PI/2, PI/2] using the symmetries of the sine
+    return (x < TABLE_PI / 2) ? taylorSin(x) :
+           (x < 3 * TABLE_PI / 2) ? taylorSin(TABLE_PI - x) : taylorSin(x - 2 * TABLE_PI);
+}
+
+struct SineTable
+{
+    // One guard entry for the interpolation at the end of the period
+    int16_t values[SignalGenerator::TABLE_SIZE + 1];
+
+    constexpr SineTable () :
+        values {  }
+    {
+        for (uint32_t i = 0; i <= SignalGenerator::TABLE_SIZE; ++i)
+        {
+            const double v = 32767.0 * tableSin(2 * TABLE_PI * (double) (i % SignalGenerator::TABLE_SIZE)
+                                                / SignalGenerator::TABLE_SIZE);
+            values[i] = (int16_t) (v < 0 ? v - 0.5 : v + 0.5);
+        }
+    }
+};
+
+constexpr SineTable SINE_TABLE;
+
+inline void putSample (uint16_t * frame, bool wide, int32_t v)
+{
+    if (wide)
+    {
+        // The I2S peripheral expects the most significant half-word first
+        frame[0] = frame[2] = (uint16_t) ((uint32_t) v >> 16);
+        frame[1] = frame[3] = (uint16_t) ((uint32_t) v & 0xFFFF);
+    }
+    else
+    {
+        frame[0] = frame[1] = (uint16_t) v;
+    }
+}
+
+} // end of anonymous namespace
+
+/************************************************************************
+ * Class SignalGenerator
+ ************************************************************************/
+
+constexpr uint32_t SignalGenerator::TABLE_BITS;
+constexpr uint32_t SignalGenerator::TABLE_SIZE;
+constexpr uint32_t SignalGenerator::MAX_TONES;
+
+SignalGenerator::SignalGenerator () :
+    waveform { Waveform::SILENCE },
+    sampleRate { 48000.0f },
+    wide { false },
+    gain { 0 },
+    phase {  },
+    increment {  },
+    tones { 0 },
+    sweepIncrement { 0.0f },
+    sweepStart { 0.0f },
+    sweepStop { 0.0f },
+    sweepFactor { 1.0f },
+    seed { 0x12345678 },
+    pink {  }
+{
+    // empty
+}
+
+void SignalGenerator::configure (uint32_t _sampleRate, uint32_t dataFormat)
+{
+    // Frequencies are kept as phase increments, so they are recalculated for the new rate
+    const float scale = sampleRate / (float) _sampleRate;
+    for (uint32_t i = 0; i < MAX_TONES; ++i)
+    {
+        increment[i] = (uint32_t) ((float) increment[i] * scale);
+    }
+    sweepIncrement *= scale;
+    sweepStart *= scale;
+    sweepStop *= scale;
+    sweepFactor = ::powf(sweepFactor, scale);
+    sampleRate = (float) _sampleRate;
+    wide = (dataFormat == I2S_DATAFORMAT_24B || dataFormat == I2S_DATAFORMAT_32B);
+}
+
+void SignalGenerator::setSilence ()
+{
+    waveform = Waveform::SILENCE;
+    gain = 0;
+}
+
+void SignalGenerator::setSine (float freq, float amplitude)
+{
+    setMultitone(&freq, 1, amplitude);
+    waveform = Waveform::SINE;
+}
+
+void SignalGenerator::setRamp (float freq, float amplitude)
+{
+    setMultitone(&freq, 1, amplitude);
+    waveform = Waveform::RAMP;
+}
+
+void SignalGenerator::setMultitone (const float * freqs, uint32_t n, float amplitude)
+{
+    tones = std::min(n, MAX_TONES);
+    for (uint32_t i = 0; i < tones; ++i)
+    {
+        increment[i] = toIncrement(freqs[i]);
+    }
+    gain = toGain(amplitude) / (int32_t) std::max(tones, (uint32_t) 1);
+    waveform = Waveform::MULTITONE;
+}
+
+void SignalGenerator::setSweep (float freq1, float freq2, float seconds, float amplitude)
+{
+    // The phase increment is multiplied by a constant factor every sample
+    sweepStart = (float) toIncrement(freq1);
+    sweepStop = (float) toIncrement(freq2);
+    sweepIncrement = sweepStart;
+    sweepFactor = ::powf(freq2 / freq1, 1.0f / std::max(1.0f, seconds * sampleRate));
+    gain = toGain(amplitude);
+    waveform = Waveform::SWEEP;
+}
+
+void SignalGenerator::setPinkNoise (float amplitude)
+{
+    pink[0] = pink[1] = pink[2] = 0.0f;
+    gain = toGain(amplitude);
+    waveform = Waveform::PINK_NOISE;
+}
+
+void SignalGenerator::generate (uint16_t * block, uint32_t frames)
+{
+    const uint32_t frameSize = wide ? 4 : 2;
+    if (waveform == Waveform::SILENCE)
+    {
+        ::memset(block, 0, frames * frameSize * sizeof(uint16_t));
+        return;
+    }
+    for (uint32_t i = 0; i < frames; ++i, block += frameSize)
+    {
+        putSample(block, wide, nextSample());
+    }
+}
+
+int32_t SignalGenerator::sine (uint32_t p)
+{
+    const uint32_t index = p >> (32 - TABLE_BITS);
+    const int32_t frac = (int32_t) ((p >> (32 - TABLE_BITS - 15)) & 0x7FFF);
+    const int32_t a = SINE_TABLE.values[index];
+    const int32_t b = SINE_TABLE.values[index + 1];
+    return a + (((b - a) * frac) >> 15);
+}
+
+uint32_t SignalGenerator::toIncrement (float freq) const
+{
+    const float f = std::max(0.0f, std::min(freq, sampleRate / 2.0f));
+    return (uint32_t) (f / sampleRate * 4294967296.0f);
+}
+
+int32_t SignalGenerator::toGain (float amplitude)
+{
+    return (int32_t) (std::max(0.0f, std::min(amplitude, 1.0f)) * 32767.0f);
+}
+
+int32_t SignalGenerator::nextSample ()
+{
+    int32_t v = 0;
+    switch (waveform)
+    {
+    case Waveform::SINE:
+        v = sine(phase[0]);
+        phase[0] += increment[0];
+        break;
+
+    case Waveform::RAMP:
+        v = (int32_t) (int16_t) (phase[0] >> 16);
+        phase[0] += increment[0];
+        break;
+
+    case Waveform::MULTITONE:
+        for (uint32_t t = 0; t < tones; ++t)
+        {
+            v += sine(phase[t]);
+            phase[t] += increment[t];
+        }
+        break;
+
+    case Waveform::SWEEP:
+        v = sine(phase[0]);
+        phase[0] += (uint32_t) sweepIncrement;
+        sweepIncrement *= sweepFactor;
+        if ((sweepFactor >= 1.0f) ? sweepIncrement > sweepStop : sweepIncrement < sweepStop)
+        {
+            sweepIncrement = sweepStart;
+        }
+        break;
+
+    case Waveform::PINK_NOISE:
+    {
+        // xorshift32 white noise, shaped by the Paul Kellet's economy filter (-3 dB/octave)
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        const float white = (float) (int32_t) seed * (1.0f / 2147483648.0f);
+        pink[0] = 0.99765f * pink[0] + white * 0.0990460f;
+        pink[1] = 0.96300f * pink[1] + white * 0.2965164f;
+        pink[2] = 0.57000f * pink[2] + white * 1.0526913f;
+        const float p = (pink[0] + pink[1] + pink[2] + white * 0.1848f) * 0.25f;
+        v = (int32_t) (std::max(-1.0f, std::min(1.0f, p)) * 32767.0f);
+        break;
+    }
+
+    default:
+        break;
+    }
+    v = (v * gain) >> 15;
+    return wide ? v * 65536 : v;
+}
@@ -0,0 +1,132 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#ifndef DRIVERS_SIGNALGENERATOR_H_
+#define DRIVERS_SIGNALGENERATOR_H_
+
+#include "../I2S.h"
+
+namespace Stm32async
+{
+namespace Drivers
+{
+
+/**
+ * @brief Test-signal generator based on numerically controlled oscillators.
+ *
+ * Every oscillator is a 32-bit phase accumulator. The upper TABLE_BITS of the phase index a
+ * sine table that is computed at compile time, the following 15 bits interpolate linearly
+ * between two table entries. The state is kept between the calls of generate(), so the
+ * signal is phase continuous across DMA buffer refills and the frequency is not bound to
+ * the block length.
+ *
+ * Supported signals are a sine, a sawtooth ramp, up to MAX_TONES summed sines, a repeating
+ * logarithmic sweep and pink noise. Apart from the sweep and noise shaping that use single
+ * precision (hardware FPU), all per-sample arithmetic is integer.
+ */
+class SignalGenerator final
+{
+public:
+
+    static constexpr uint32_t TABLE_BITS = 10;
+    static constexpr uint32_t TABLE_SIZE = 1 << TABLE_BITS;
+    static constexpr uint32_t MAX_TONES = 4;
+
+    enum class Waveform
+    {
+        SILENCE = 0, SINE = 1, RAMP = 2, MULTITONE = 3, SWEEP = 4, PINK_NOISE = 5
+    };
+
+    SignalGenerator ();
+
+    /**
+     * @brief Sets the sample rate and the I2S data format of the generated frames.
+     */
+    void configure (uint32_t sampleRate, uint32_t dataFormat);
+
+    void setSilence ();
+
+    /**
+     * @brief Sine of given frequency (Hz) and amplitude (1.0 is full scale).
+     */
+    void setSine (float freq, float amplitude);
+
+    /**
+     * @brief Sawtooth ramp of given frequency and amplitude.
+     */
+    void setRamp (float freq, float amplitude);
+
+    /**
+     * @brief Sum of up to MAX_TONES sines with equal amplitude; the sum does not exceed the amplitude.
+     */
+    void setMultitone (const float * freqs, uint32_t n, float amplitude);
+
+    /**
+     * @brief Logarithmic sweep from freq1 to freq2 within given time, repeated.
+     */
+    void setSweep (float freq1, float freq2, float seconds, float amplitude);
+
+    /**
+     * @brief Pink (1/f) noise of given RMS-like amplitude.
+     */
+    void setPinkNoise (float amplitude);
+
+    /**
+     * @brief Writes given number of stereo frames in the I2S DMA layout.
+     */
+    void generate (uint16_t * block, uint32_t frames);
+
+    inline Waveform getWaveform () const
+    {
+        return waveform;
+    }
+
+    /**
+     * @brief Returns the table sine of a 32-bit phase in Q15.
+     */
+    static int32_t sine (uint32_t phase);
+
+private:
+
+    Waveform waveform;
+    float sampleRate;
+    bool wide;
+    int32_t gain;
+
+    // Oscillators
+    uint32_t phase[MAX_TONES];
+    uint32_t increment[MAX_TONES];
+    uint32_t tones;
+
+    // Sweep
+    float sweepIncrement, sweepStart, sweepStop, sweepFactor;
+
+    // Noise
+    uint32_t seed;
+    float pink[3];
+
+    uint32_t toIncrement (float freq) const;
+    static int32_t toGain (float amplitude);
+    int32_t nextSample ();
+};
+
+} // end of namespace Drivers
+} // end of namespace Stm32async
+
+#endif
@@ -0,0 +1,215 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#include "SpectrumAnalyzer.h"
+
+#include <cmath>
+
+#ifdef HAL_I2S_MODULE_ENABLED
+
+using namespace Stm32async::Drivers;
+
+/************************************************************************
+ * Class SpectrumAnalyzer
+ ************************************************************************/
+
+constexpr uint32_t SpectrumAnalyzer::FFT_SIZE;
+constexpr uint32_t SpectrumAnalyzer::BANDS;
+constexpr uint32_t SpectrumAnalyzer::LEVELS;
+constexpr uint32_t SpectrumAnalyzer::MAX_ANALYSIS_RATE;
+constexpr uint32_t SpectrumAnalyzer::MIN_INTERVAL;
+constexpr float SpectrumAnalyzer::MIN_FREQ;
+constexpr float SpectrumAnalyzer::RANGE_DB;
+
+SpectrumAnalyzer::SpectrumAnalyzer () :
+    rfft {  },
+    wide { false },
+    decimation { 1 },
+    analysisRate { 0 },
+    window {  },
+    samples {  },
+    spectrum {  },
+    decimationSum { 0 },
+    decimationCount { 0 },
+    filled { 0 },
+    ready { false },
+    lastTime { 0 },
+    skipped { 0 },
+    cycles { 0 },
+    bandEdges {  },
+    bandDb {  },
+    levels {  },
+    glyphsDefined { false },
+    renderLine { 0 },
+    lines {  }
+{
+    // Hann window
+    for (uint32_t i = 0; i < FFT_SIZE; ++i)
+    {
+        const float w = 0.5f - 0.5f * ::cosf(2.0f * PI * (float) i / (float) FFT_SIZE);
+        window[i] = (q15_t) std::min(32767.0f, ::roundf(w * 32768.0f));
+    }
+}
+
+bool SpectrumAnalyzer::configure (uint32_t sampleRate, uint32_t dataFormat)
+{
+    ready = false;
+    filled = decimationSum = decimationCount = 0;
+    skipped = 0;
+    if (sampleRate == 0 || arm_rfft_init_q15(&rfft, FFT_SIZE, 0, 1) != ARM_MATH_SUCCESS)
+    {
+        return false;
+    }
+    wide = (dataFormat == I2S_DATAFORMAT_24B || dataFormat == I2S_DATAFORMAT_32B);
+    decimation = (sampleRate + MAX_ANALYSIS_RATE - 1) / MAX_ANALYSIS_RATE;
+    analysisRate = sampleRate / decimation;
+
+    // Enable the cycle counter used for the cost measurement
+    enableCycleCounter();
+
+    // Log-spaced band edges between MIN_FREQ and the Nyquist frequency. Every band has at
+    // least one bin, the DC bin is not used.
+    const float binWidth = (float) analysisRate / (float) FFT_SIZE;
+    const float ratio = ((float) analysisRate / 2.0f) / MIN_FREQ;
+    bandEdges[0] = (uint16_t) std::max(1.0f, ::roundf(MIN_FREQ / binWidth));
+    for (uint32_t b = 1; b <= BANDS; ++b)
+    {
+        const float f = MIN_FREQ * ::powf(ratio, (float) b / (float) BANDS);
+        const uint32_t edge = (uint32_t) ::roundf(f / binWidth);
+        bandEdges[b] = (uint16_t) std::max((uint32_t) bandEdges[b - 1] + 1, edge);
+    }
+    bandEdges[BANDS] = FFT_SIZE / 2;
+    for (uint32_t b = BANDS; b > 0; --b)
+    {
+        bandEdges[b - 1] = std::min(bandEdges[b - 1], (uint16_t) (bandEdges[b] - 1));
+    }
+    return true;
+}
+
+void SpectrumAnalyzer::feed (const uint16_t * block, uint32_t frames)
+{
+    if (ready)
+    {
+        ++skipped;
+        return;
+    }
+    if (filled == 0 && decimationCount == 0 && HAL_GetTick() - lastTime < MIN_INTERVAL)
+    {
+        return;
+    }
+    const uint32_t frameSize = wide ? 4 : 2;
+    for (uint32_t i = 0; i < frames && filled < FFT_SIZE; ++i, block += frameSize)
+    {
+        // Mono mix of both channels; wide samples are used with their upper 16 bits
+        decimationSum += wide ? (int32_t) (int16_t) block[0] + (int32_t) (int16_t) block[2] :
+                                (int32_t) (int16_t) block[0] + (int32_t) (int16_t) block[1];
+        if (++decimationCount == decimation)
+        {
+            samples[filled++] = (q15_t) (decimationSum / (int32_t) (2 * decimation));
+            decimationSum = 0;
+            decimationCount = 0;
+        }
+    }
+    if (filled == FFT_SIZE)
+    {
+        ready = true;
+    }
+}
+
+bool SpectrumAnalyzer::periodic ()
+{
+    if (!ready)
+    {
+        return false;
+    }
+    const uint32_t start = DWT->CYCCNT;
+    analyze();
+    cycles = DWT->CYCCNT - start;
+    lastTime = HAL_GetTick();
+    filled = 0;
+    ready = false;
+    return true;
+}
+
+void SpectrumAnalyzer::analyze ()
+{
+    for (uint32_t i = 0; i < FFT_SIZE; ++i)
+    {
+        samples[i] = (q15_t) (((int32_t) samples[i] * window[i]) >> 15);
+    }
+
+    // For 512 points, the output is scaled down by 2^9 with respect to the input
+    arm_rfft_q15(&rfft, samples, spectrum);
+
+    // A full-scale sine gives a peak bin of 32768 * (N / 4) / 2^9 = 2^13 (Hann gain is 1/2),
+    // i.e. a bin power of 2^26, which is the 0 dBFS reference
+    static const float FULL_SCALE_DB = 10.0f * ::log10f((float) (1UL << 26));
+    for (uint32_t b = 0; b < BANDS; ++b)
+    {
+        uint64_t power = 0;
+        for (uint32_t k = bandEdges[b]; k < bandEdges[b + 1]; ++k)
+        {
+            uint32_t bin;
+            ::memcpy(&bin, &spectrum[2 * k], sizeof(bin));
+            power += __SMUAD(bin, bin);
+        }
+        bandDb[b] = 10.0f * ::log10f((float) power + 1.0f) - FULL_SCALE_DB;
+        const float level = (bandDb[b] + RANGE_DB) / RANGE_DB * (float) LEVELS;
+        levels[b] = (uint8_t) std::max(0.0f, std::min((float) LEVELS, ::roundf(level)));
+    }
+}
+
+void SpectrumAnalyzer::defineGlyphs (Lcd_DOGM162 & lcd)
+{
+    // Character k is a bar of k + 1 pixel rows, the rows are given from top to bottom
+    for (uint8_t k = 0; k < 8; ++k)
+    {
+        uint8_t pattern[8];
+        for (uint8_t row = 0; row < 8; ++row)
+        {
+            pattern[row] = (row >= 7 - k) ? 0x1F : 0x00;
+        }
+        lcd.defineChar(k, pattern);
+    }
+    glyphsDefined = true;
+}
+
+void SpectrumAnalyzer::render (Lcd_DOGM162 & lcd)
+{
+    if (!glyphsDefined || lcd.isBusy())
+    {
+        return;
+    }
+    if (renderLine == 0)
+    {
+        for (uint32_t b = 0; b < BANDS; ++b)
+        {
+            const uint8_t l = levels[b];
+            lines[0][b] = (l > 8) ? (char) (l - 9) : ' ';
+            lines[1][b] = (l == 0) ? ' ' : (char) (std::min(l, (uint8_t) 8) - 1);
+        }
+    }
+    // A line that is not queued is repeated by the next call
+    if (lcd.putString(0, renderLine, lines[renderLine], BANDS) == HAL_OK)
+    {
+        renderLine = (renderLine + 1) % 2;
+    }
+}
+
+#endif
@@ -0,0 +1,180 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#ifndef DRIVERS_SPECTRUMANALYZER_H_
+#define DRIVERS_SPECTRUMANALYZER_H_
+
+#include "AudioDac_UDA1334.h"
+#include "Lcd_DOGM162.h"
+
+#ifdef HAL_I2S_MODULE_ENABLED
+
+#ifndef ARM_MATH_CM4
+#define ARM_MATH_CM4
+#endif
+#include "arm_math.h"
+
+namespace Stm32async
+{
+namespace Drivers
+{
+
+/**
+ * @brief Spectrum analyzer of the streamed audio with 16 log-spaced bands.
+ *
+ * The analyzer is split into three steps that are called from different places:
+ * - feed() taps the DAC blocks right after they are produced. It mixes both channels,
+ *   decimates the stream to at most MAX_ANALYSIS_RATE by averaging and collects FFT_SIZE
+ *   samples. This is the only part executed on the streaming path and it is cheap.
+ * - periodic() runs the Hann-windowed arm_rfft_q15 on a collected window and converts
+ *   the bins into band levels. A new window is only collected after MIN_INTERVAL ms
+ *   since the last analysis, and blocks that arrive while a window is still waiting for
+ *   periodic() are skipped. The FFT cost is therefore bounded by the analysis rate and
+ *   does not grow if the main loop is late.
+ * - render() shows the band levels as vertical bars on both lines of a DOGM162 display
+ *   using eight user-defined CGRAM characters (one to eight pixel rows), i.e. with 16
+ *   steps per bar. One line is sent per call, as an asynchronous SPI transfer.
+ *
+ * The CGRAM characters are written by blocking display commands that take several hundred
+ * milliseconds, so defineGlyphs() shall be called once before the streaming starts.
+ *
+ * The display lines are sent by DMA from the object, so it shall not be placed into the CCM.
+ */
+class SpectrumAnalyzer final
+{
+public:
+
+    static constexpr uint32_t FFT_SIZE = 512;
+    static constexpr uint32_t BANDS = 16;
+    static constexpr uint32_t LEVELS = 16;
+    static constexpr uint32_t MAX_ANALYSIS_RATE = 24000;
+    static constexpr uint32_t MIN_INTERVAL = 40;
+    static constexpr float MIN_FREQ = 50.0f;
+    static constexpr float RANGE_DB = 48.0f;
+
+    SpectrumAnalyzer ();
+
+    /**
+     * @brief Prepares the analyzer for the given stream.
+     *
+     * @return false if the FFT can not be initialized.
+     */
+    bool configure (uint32_t sampleRate, uint32_t dataFormat);
+
+    /**
+     * @brief Taps a block of interleaved stereo frames in the I2S DMA layout.
+     */
+    void feed (const uint16_t * block, uint32_t frames);
+
+    /**
+     * @brief Analyzes a collected window, if any.
+     *
+     * @return true if new band levels are available.
+     */
+    bool periodic ();
+
+    /**
+     * @brief Writes the bar characters into the CGRAM of the display; blocks for several
+     *        hundred milliseconds and shall not be called during the streaming.
+     */
+    void defineGlyphs (Lcd_DOGM162 & lcd);
+
+    /**
+     * @brief Shows the band levels on the display; nothing is shown before defineGlyphs().
+     */
+    void render (Lcd_DOGM162 & lcd);
+
+    /**
+     * @brief Returns the level of a band in dBFS.
+     */
+    inline float getBandDb (uint32_t band) const
+    {
+        return bandDb[band];
+    }
+
+    /**
+     * @brief Returns the level of a band in display steps, 0..LEVELS.
+     */
+    inline uint8_t getLevel (uint32_t band) const
+    {
+        return levels[band];
+    }
+
+    /**
+     * @brief Returns the lower FFT bin of a band; the band ends before the lower bin of the next one.
+     */
+    inline uint32_t getBandEdge (uint32_t band) const
+    {
+        return bandEdges[band];
+    }
+
+    inline uint32_t getAnalysisRate () const
+    {
+        return analysisRate;
+    }
+
+    /**
+     * @brief Returns the number of blocks that were skipped since a window was waiting.
+     */
+    inline uint32_t getSkipped () const
+    {
+        return skipped;
+    }
+
+    /**
+     * @brief Returns the number of CPU cycles spent in the last analysis.
+     */
+    inline uint32_t getCycles () const
+    {
+        return cycles;
+    }
+
+private:
+
+    arm_rfft_instance_q15 rfft;
+    bool wide;
+    uint32_t decimation, analysisRate;
+
+    // Window collection
+    q15_t window[FFT_SIZE];
+    q15_t samples[FFT_SIZE];
+    q15_t spectrum[2 * FFT_SIZE];
+    int32_t decimationSum;
+    uint32_t decimationCount, filled;
+    volatile bool ready;
+    uint32_t lastTime, skipped, cycles;
+
+    // Band levels
+    uint16_t bandEdges[BANDS + 1];
+    float bandDb[BANDS];
+    uint8_t levels[BANDS];
+
+    // Display
+    bool glyphsDefined;
+    uint8_t renderLine;
+    char lines[2][BANDS];
+
+    void analyze ();
+};
+
+} // end of namespace Drivers
+} // end of namespace Stm32async
+
+#endif
+#endif
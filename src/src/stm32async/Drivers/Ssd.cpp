@@ -19,6 +19,8 @@
 
 #include "Ssd.h"
 
+#include <cstring>
+
 using namespace Stm32async::Drivers;
 
 #define setBitToTrue(uInt8Val, bitNr)   (uInt8Val |= (1 << bitNr))
@@ -43,56 +45,87 @@ Ssd_74XX595::Ssd_74XX595 (AsyncSpi & _spi, const HardwareLayout::Port & _csPort,
     spi { _spi },
     csPin { _csPort, _csPin, GPIO_MODE_OUTPUT_PP },
     sm {},
-    inverse { _inverse }
+    inverse { _inverse },
+    segData {},
+    lastBuffer { 0 }
 {
     // empty
 }
 
-void Ssd_74XX595::putString (const char * str, const bool * dots, uint16_t segNumbers)
+HAL_StatusTypeDef Ssd_74XX595::putString (const char * str, const bool * dots, uint16_t segNumbers)
 {
     if (segNumbers >= SEG_NUMBER)
     {
-        return;
+        return HAL_ERROR;
+    }
+    uint8_t * data = getNextBuffer();
+    if (data == NULL)
+    {
+        return HAL_BUSY;
     }
     for (int i = 0; i < segNumbers; ++i)
     {
         bool d = dots == NULL ? false : dots[segNumbers - 1 - i];
-        segData[i] = getBits(str[segNumbers - 1 - i], d);
+        data[i] = getBits(str[segNumbers - 1 - i], d);
         if (inverse)
         {
-            segData[i] = ~segData[i];
+            data[i] = ~data[i];
         }
     }
-    csPin.setLow();
-    spi.transmit(this, &segData[0], segNumbers);
+    return transmitNextBuffer(segNumbers);
 }
 
-void Ssd_74XX595::putDots (const bool * dots, uint16_t segNumbers)
+HAL_StatusTypeDef Ssd_74XX595::putDots (const bool * dots, uint16_t segNumbers)
 {
     if (segNumbers >= SEG_NUMBER)
     {
-        return;
+        return HAL_ERROR;
+    }
+    uint8_t * data = getNextBuffer();
+    if (data == NULL)
+    {
+        return HAL_BUSY;
     }
+    // The digits are taken over from the last transmission
+    ::memcpy(data, segData[lastBuffer], SEG_NUMBER);
     for (int i = 0; i < segNumbers; ++i)
     {
         bool d = inverse ? !dots[segNumbers - 1 - i] : dots[segNumbers - 1 - i];
         if (d)
         {
-            setBitToTrue(segData[i], sm.dot);
+            setBitToTrue(data[i], sm.dot);
         }
         else
         {
-            setBitToFalse(segData[i], sm.dot);
+            setBitToFalse(data[i], sm.dot);
         }
     }
-    csPin.setLow();
-    spi.transmit(this, &segData[0], segNumbers);
+    return transmitNextBuffer(segNumbers);
+}
+
+uint8_t * Ssd_74XX595::getNextBuffer ()
+{
+    // The transmissions in flight use the buffers before the next one
+    if (getQueueStatistics().depth >= BUFFERS)
+    {
+        return NULL;
+    }
+    return segData[(lastBuffer + 1) % BUFFERS];
+}
+
+HAL_StatusTypeDef Ssd_74XX595::transmitNextBuffer (uint16_t segNumbers)
+{
+    const size_t next = (lastBuffer + 1) % BUFFERS;
+    HAL_StatusTypeDef status = spi.enqueueTransmit(this, segData[next], segNumbers, &csPin);
+    if (status == HAL_OK)
+    {
+        lastBuffer = next;
+    }
+    return status;
 }
 
 bool Ssd_74XX595::onTransmissionFinished (SharedDevice::State /*state*/)
 {
-    while (spi.isBusy());
-    csPin.setHigh();
     return true;
 }
 
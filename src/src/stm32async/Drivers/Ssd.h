@@ -68,9 +68,20 @@ public:
         csPin.stop();
     }
 
-    void putString (const char * str, const bool * dots, uint16_t segNumbers);
-
-    void putDots (const bool * dots, uint16_t segNumbers);
+    /**
+     * @brief Puts the transmission of the segments into the transaction queue of the SPI.
+     *
+     * Every queued transmission keeps its own buffer, so the calls do not wait for each other.
+     *
+     * @return HAL_BUSY if the queue is full; the display is not changed then and the call
+     *         shall be repeated later. HAL_ERROR if the number of segments is not supported.
+     */
+    HAL_StatusTypeDef putString (const char * str, const bool * dots, uint16_t segNumbers);
+
+    /**
+     * @brief Changes the dots of the last transmitted segments, see putString().
+     */
+    HAL_StatusTypeDef putDots (const bool * dots, uint16_t segNumbers);
 
     virtual bool onTransmissionFinished (SharedDevice::State state);
 
@@ -79,10 +90,16 @@ private:
     AsyncSpi & spi;
     IOPort csPin;
     SegmentsMask sm;
-    uint8_t segData[SEG_NUMBER];
     bool inverse;
 
+    // A buffer per transmission in flight: the queued ones and the running one
+    static constexpr size_t BUFFERS = SharedDevice::QUEUE_SIZE + 1;
+    uint8_t segData[BUFFERS][SEG_NUMBER];
+    size_t lastBuffer;
+
     char getBits (char c, bool dot) const;
+    uint8_t * getNextBuffer ();
+    HAL_StatusTypeDef transmitNextBuffer (uint16_t segNumbers);
 
 };
 
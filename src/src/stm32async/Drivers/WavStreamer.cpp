@@ -20,6 +20,7 @@
 
 #include "WavStreamer.h"
 #include "../UsartLogger.h"
+#include "../Profiler.h"
 
 #ifdef HAL_SD_MODULE_ENABLED
 #ifdef HAL_I2S_MODULE_ENABLED
@@ -32,23 +33,38 @@ using namespace Stm32async::Drivers;
  * Class WavStreamer
  ************************************************************************/
 
-#define WAV_HEADER_LENGTH sizeof(wavHeader)
+#define WAV_HEADER_LENGTH sizeof(WavHeader)
+
+constexpr uint32_t WavStreamer::CLMT_SIZE;
+constexpr uint32_t WavStreamer::RESUME_MAGIC;
+constexpr uint32_t WavStreamer::RESUME_INTERVAL;
+constexpr uint32_t WavStreamer::STAGES;
 
 WavStreamer::WavStreamer (SdCardFat & _sdCard, AudioDac_UDA1334 & _audioDac) :
     handler { NULL },
+    stageHandler { NULL },
     audioDac { _audioDac },
     sdCard { _sdCard },
     sdCardBlock {  },
-    wavHeader {  },
-    totalBytes { 0 },
-    totalBytesRead { 0 },
-    volume { 1.0 }
+    readAhead { _sdCard.getSdio() },
+    tracks {  },
+    current { &tracks[0] },
+    next { &tracks[1] },
+    playlist { NULL },
+    gaplessTransitions { 0 },
+    resumeFile { NULL },
+    resumeTime { 0 },
+    resampler { NULL },
+    resampling { false },
+    equalizer { NULL },
+    analyzer { NULL }
 {
     // empty
 }
 
 bool WavStreamer::start (AudioDac_UDA1334::SourceType s, const char * fileName)
 {
+    playlist = NULL;
     if (handler != NULL)
     {
         if (!handler->onStartSteaming(s))
@@ -57,30 +73,140 @@ bool WavStreamer::start (AudioDac_UDA1334::SourceType s, const char * fileName)
         }
     }
     
-    uint32_t standard, audioFreq;
     if (s == AudioDac_UDA1334::SourceType::STREAM)
     {
-        if (!startSdCard(fileName))
+        closeTrack(*current);
+        closeTrack(*next);
+        if (!openTrack(*current, fileName))
         {
             return false;
         }
-        standard = I2S_STANDARD_PHILIPS; //I2S_STANDARD_PCM_SHORT;
-        audioFreq = wavHeader.fields.samplesPerSec;
+        converter.getLevelMeter().reset();
+        gaplessTransitions = 0;
+        return startStream();
     }
-    else
+
+    resampling = false;
+    return audioDac.start(s, I2S_STANDARD_PHILIPS, I2S_AUDIOFREQ_96K, I2S_DATAFORMAT_16B);
+}
+
+bool WavStreamer::start (Playlist & _playlist)
+{
+    const char * fileName = _playlist.next();
+    if (fileName == NULL || !start(AudioDac_UDA1334::SourceType::STREAM, fileName))
     {
-        standard = I2S_STANDARD_PHILIPS;
-        audioFreq = I2S_AUDIOFREQ_96K;
+        return false;
     }
-    
-    return audioDac.start(s, standard, audioFreq, I2S_DATAFORMAT_16B);
+    // The next track is prefetched by periodic()
+    playlist = &_playlist;
+    return true;
+}
+
+bool WavStreamer::startStream ()
+{
+    converter.configure(current->header.fields.bitsPerSample, current->header.fields.numOfChan);
+    uint32_t audioFreq = current->header.fields.samplesPerSec;
+    const uint32_t dataFormat = current->dataFormat;
+    if (startResampler())
+    {
+        audioFreq = resampler->getOutputRate();
+    }
+    if (equalizer != NULL)
+    {
+        equalizer->configure(audioFreq, dataFormat);
+    }
+    if (analyzer != NULL)
+    {
+        analyzer->configure(audioFreq, dataFormat);
+    }
+    readAhead.start(current->file, current->bufferEnd);
+    resumeTime = HAL_GetTick();
+    return audioDac.start(AudioDac_UDA1334::SourceType::STREAM, I2S_STANDARD_PHILIPS, audioFreq, dataFormat);
+}
+
+bool WavStreamer::seek (uint32_t milliseconds)
+{
+    if (!audioDac.isActive() || audioDac.getSourceType() != AudioDac_UDA1334::SourceType::STREAM || !current->opened)
+    {
+        return false;
+    }
+    const uint64_t frames = (uint64_t) milliseconds * current->header.fields.samplesPerSec / 1000;
+    return seekTrack(*current, (uint32_t) std::min(frames * converter.getInputFrameSize(), (uint64_t) current->dataSize));
+}
+
+uint32_t WavStreamer::getPosition () const
+{
+    if (!current->opened || current->header.fields.samplesPerSec == 0)
+    {
+        return 0;
+    }
+    const uint64_t frames = current->bytesRead / converter.getInputFrameSize();
+    return (uint32_t) (frames * 1000 / current->header.fields.samplesPerSec);
+}
+
+bool WavStreamer::resume ()
+{
+    if (resumeFile == NULL)
+    {
+        return false;
+    }
+    FIL file;
+    if (f_open(&file, resumeFile, FA_READ) != FR_OK)
+    {
+        USART_DEBUG("No resume point found in " << resumeFile << UsartLogger::ENDL);
+        return false;
+    }
+    ResumePoint point;
+    UINT bytesRead = 0;
+    FRESULT code = f_read(&file, &point, sizeof(point), &bytesRead);
+    f_close(&file);
+    if (code != FR_OK || bytesRead != sizeof(point) || point.magic != RESUME_MAGIC)
+    {
+        USART_DEBUG("Invalid resume point in " << resumeFile << ": " << code << UsartLogger::ENDL);
+        return false;
+    }
+    point.fileName[Playlist::MAX_NAME_LENGTH - 1] = 0;
+    if (!start(AudioDac_UDA1334::SourceType::STREAM, point.fileName))
+    {
+        return false;
+    }
+    USART_DEBUG("Resuming " << point.fileName << " at byte " << point.position << UsartLogger::ENDL);
+    return seekTrack(*current, point.position);
 }
 
 void WavStreamer::stop ()
 {
     audioDac.stop();
-    totalBytes = totalBytesRead = 0;
+    // The write of the resume point shall not wait for a pending load of the ring
+    readAhead.stop();
+    saveResumePoint();
+    closeTrack(*current);
+    closeTrack(*next);
     USART_DEBUG("WAV streaming stopped." << UsartLogger::ENDL);
+    if (readAhead.getReads() > 0)
+    {
+        USART_DEBUG("Read-ahead: reads=" << readAhead.getReads() << ", bytes per read=" << readAhead.getBytesLoaded() / readAhead.getReads() << UsartLogger::ENDL);
+    }
+    LevelMeter::Snapshot levels;
+    if (converter.getLevelMeter().getSnapshot(levels) && levels.blocks > 0)
+    {
+        USART_DEBUG("Levels: blocks=" << levels.blocks
+                    << ", clipsL=" << levels.clips[0] << ", clipsR=" << levels.clips[1] << UsartLogger::ENDL);
+    }
+    if (equalizer != NULL && equalizer->getStages() > 0)
+    {
+        USART_DEBUG("Equalizer: stages=" << equalizer->getStages() << ", cycles per block=" << equalizer->getCycles() << UsartLogger::ENDL);
+    }
+    const SectorCache * cache = sdCard.getCache();
+    if (cache != NULL)
+    {
+        USART_DEBUG("Sector cache: hits=" << cache->getHits() << ", misses=" << cache->getMisses()
+                    << ", bypassed=" << cache->getBypassed() << UsartLogger::ENDL);
+    }
+    if (gaplessTransitions > 0)
+    {
+        USART_DEBUG("Gapless transitions: " << gaplessTransitions << UsartLogger::ENDL);
+    }
     if (handler != NULL)
     {
         handler->onFinishSteaming();
@@ -95,62 +221,224 @@ void WavStreamer::periodic ()
     }
     if (audioDac.getSourceType() == AudioDac_UDA1334::SourceType::STREAM)
     {
-        if (!sdCard.isCardInserted())
+        // The card-detect pin is checked directly: the card is not read any more while it is pulled
+        if (!sdCard.isCardInserted() || !sdCard.isMounted())
         {
             stop();
+            return;
         }
         if (audioDac.isBlockRequested())
         {
-            if (totalBytesRead >= totalBytes)
+            if (isFinished(*current))
             {
-                stop();
+                // Normally, the next track is already prefetched at this point
+                prefetchNext();
             }
-            else
+            if (!isFinished(*current) || isNextGapless())
             {
                 readBlock();
                 audioDac.confirmBlock();
             }
+            else if (!next->opened || !restartWithNext())
+            {
+                stop();
+            }
+        }
+        else
+        {
+            // The next track is opened and the ring is filled while the DMA is busy with the
+            // buffered blocks
+            prefetchNext();
+            readAhead.fill();
+
+            // The position is saved while no load is pending, so the write does not wait for it
+            if (resumeFile != NULL && !readAhead.isPending() && HAL_GetTick() - resumeTime >= RESUME_INTERVAL)
+            {
+                saveResumePoint();
+            }
         }
     }
+    else if (audioDac.isBlockRequested())
+    {
+        // Test signals are generated block by block, phase continuous
+        audioDac.generateBlock();
+        audioDac.confirmBlock();
+    }
 }
 
-void WavStreamer::readBlock ()
+void WavStreamer::prefetchNext ()
 {
-    UINT bytesRead = 0;
+    if (playlist == NULL || next->opened)
+    {
+        return;
+    }
+    const char * fileName = playlist->next();
+    if (fileName != NULL && openTrack(*next, fileName))
+    {
+        USART_DEBUG("Next track prefetched: " << fileName << UsartLogger::ENDL);
+    }
+}
+
+bool WavStreamer::isNextGapless () const
+{
+    if (!next->opened
+        || next->header.fields.samplesPerSec != current->header.fields.samplesPerSec
+        || next->dataFormat != current->dataFormat)
+    {
+        return false;
+    }
+    if (resampling)
+    {
+        // The input frames for a DAC block shall also fit into the SD card block for the next track
+        const uint32_t inputFrameSize = next->header.fields.numOfChan * next->header.fields.bitsPerSample / 8;
+        return resampler->getMaxRequiredFrames(audioDac.getBlockFrames()) * inputFrameSize <= BLOCK_SIZE;
+    }
+    return true;
+}
+
+void WavStreamer::switchTrack ()
+{
+    closeTrack(*current);
+    std::swap(current, next);
+    // The I2S data format is the same, but the input format can differ (e.g. mono and stereo)
+    converter.configure(current->header.fields.bitsPerSample, current->header.fields.numOfChan);
+    readAhead.start(current->file, current->bufferEnd);
+    ++gaplessTransitions;
+}
+
+bool WavStreamer::restartWithNext ()
+{
+    USART_DEBUG("Stream parameters of the next track differ, restarting the DAC" << UsartLogger::ENDL);
+    audioDac.stop();
+    closeTrack(*current);
+    std::swap(current, next);
+    return startStream();
+}
+
+uint32_t WavStreamer::readFrames (uint16_t * output, uint32_t frames)
+{
+    const uint32_t inputFrameSize = converter.getInputFrameSize();
+    const uint32_t bytes = std::min(frames, (current->dataSize - current->bytesRead) / inputFrameSize) * inputFrameSize;
+    if (bytes == 0)
+    {
+        // A trailing partial frame is not played
+        current->bytesRead = current->dataSize;
+        return 0;
+    }
+
+    // The data that was read together with the header is used first
+    startStage(Stage::READ);
     uint8_t * ptr = &(sdCardBlock.bytes[0]);
-    FRESULT code = f_read(&wavFile, ptr, BLOCK_SIZE, &bytesRead);
-    totalBytesRead += bytesRead;
-    if (code != FR_OK)
+    uint32_t bytesAvailable = std::min(bytes, current->bufferEnd - current->bufferPos);
+    ::memcpy(ptr, &(current->buffer.bytes[current->bufferPos]), bytesAvailable);
+    current->bufferPos += bytesAvailable;
+    bool endOfFile = false;
+    if (bytesAvailable < bytes)
     {
-        USART_DEBUG("Can not read next block: err=" << code << UsartLogger::ENDL);
+        // The rest comes from the read-ahead ring
+        const uint32_t bytesRead = readAhead.read(ptr + bytesAvailable, bytes - bytesAvailable);
+        bytesAvailable += bytesRead;
+        endOfFile = (bytesAvailable < bytes);
     }
-    else
+    current->bytesRead += bytesAvailable;
+    if (endOfFile)
     {
-        uint32_t wordsRead = bytesRead / 2;
-        uint32_t blockSize = std::min(wordsRead, audioDac.getBlockSize());
-        uint16_t * block = audioDac.getBlockPtr();
-        for (size_t i = 0; i < blockSize; ++i)
-        {
-            block[i] = (int16_t) (volume * (int16_t) sdCardBlock.words[i]);
-        }
-        if (blockSize == 0)
+        // The file is shorter than declared in its header
+        current->dataSize = current->bytesRead;
+    }
+    finishStage(Stage::READ);
+
+    const uint32_t framesRead = bytesAvailable / inputFrameSize;
+    startStage(Stage::CONVERT);
+    converter.convert(ptr, output, framesRead);
+    finishStage(Stage::CONVERT);
+    return framesRead;
+}
+
+void WavStreamer::readBlock ()
+{
+    PROFILE_SCOPE("WavStreamer::readBlock");
+    // The block is sized in frames: the number of frames that fit into the DAC block
+    // (or the number of frames the resampler needs for it) defines how many bytes are
+    // read from the file
+    const uint32_t blockFrames = audioDac.getBlockFrames();
+    const uint32_t inputFrames = resampling ? resampler->getRequiredFrames(blockFrames) : blockFrames;
+    uint16_t * block = audioDac.getBlockPtr();
+    uint16_t * input = resampling ? resampler->getInputPtr() : block;
+
+    uint32_t framesRead = readFrames(input, inputFrames);
+    if (framesRead < inputFrames && isFinished(*current))
+    {
+        prefetchNext();
+        if (isNextGapless())
         {
-            USART_DEBUG("Last block processed: totalBytesRead=" << totalBytesRead << ", totalBytes=" << totalBytes << UsartLogger::ENDL);
-            totalBytesRead = totalBytes;
+            // The next track continues at the frame where the current one ends
+            switchTrack();
+            framesRead += readFrames(input + framesRead * audioDac.getFrameSize(), inputFrames - framesRead);
         }
-        if (blockSize != audioDac.getBlockSize())
+        else
         {
-            for (size_t i = blockSize; i < audioDac.getBlockSize(); ++i)
-            {
-                block[i] = AudioDac_UDA1334::MSB_OFFSET;
-            }
+            USART_DEBUG("Last block processed: bytesRead=" << current->bytesRead << ", dataSize=" << current->dataSize << UsartLogger::ENDL);
         }
     }
+    fillSilence(input, framesRead, inputFrames);
+
+    if (resampling)
+    {
+        startStage(Stage::RESAMPLE);
+        resampler->process(block, blockFrames);
+        finishStage(Stage::RESAMPLE);
+    }
+    if (equalizer != NULL)
+    {
+        startStage(Stage::EQUALIZE);
+        equalizer->process(block, blockFrames);
+        finishStage(Stage::EQUALIZE);
+    }
+    if (analyzer != NULL)
+    {
+        startStage(Stage::ANALYZE);
+        analyzer->feed(block, blockFrames);
+        finishStage(Stage::ANALYZE);
+    }
 }
 
-bool WavStreamer::startSdCard (const char * fileName)
+void WavStreamer::fillSilence (uint16_t * block, uint32_t from, uint32_t to) const
 {
-    FRESULT code = f_open(&wavFile, fileName, FA_READ);
+    if (from < to)
+    {
+        const uint32_t frameSize = audioDac.getFrameSize();
+        ::memset(block + from * frameSize, 0, (to - from) * frameSize * sizeof(uint16_t));
+    }
+}
+
+bool WavStreamer::startResampler ()
+{
+    resampling = false;
+    if (resampler == NULL || !resampler->configure(current->header.fields.samplesPerSec, converter.getI2sDataFormat()))
+    {
+        return false;
+    }
+    // Input frames required for a single DAC block shall fit into the SD card block
+    const uint32_t blockFrames = AudioDac_UDA1334::BLOCK_SIZE2 / converter.getOutputFrameSize();
+    if (resampler->getMaxRequiredFrames(blockFrames) * converter.getInputFrameSize() > BLOCK_SIZE)
+    {
+        return false;
+    }
+    resampling = true;
+    USART_DEBUG("Resampling " << resampler->getInputRate() << " -> " << resampler->getOutputRate() << UsartLogger::ENDL);
+    return true;
+}
+
+bool WavStreamer::openTrack (Track & track, const char * fileName)
+{
+    // The name is stored in the track and in the resume point, it is not truncated
+    if (::strlen(fileName) >= Playlist::MAX_NAME_LENGTH)
+    {
+        USART_DEBUG("File name is too long: " << fileName << UsartLogger::ENDL);
+        return false;
+    }
+    FRESULT code = f_open(&track.file, fileName, FA_READ);
     if (code != FR_OK)
     {
         USART_DEBUG("Can not open WAV file " << fileName << ": " << code << UsartLogger::ENDL);
@@ -158,20 +446,46 @@ bool WavStreamer::startSdCard (const char * fileName)
         sdCard.listFiles();
         return false;
     }
-    
+    track.opened = true;
+    ::strcpy(track.fileName, fileName);
+
+    // The cluster link map table is built once, so that a seek does not walk the FAT chain
+    track.clmt[0] = CLMT_SIZE;
+    track.file.cltbl = track.clmt;
+    code = f_lseek(&track.file, CREATE_LINKMAP);
+    if (code == FR_NOT_ENOUGH_CORE)
+    {
+        USART_DEBUG("File " << fileName << " is too fragmented for fast seek: " << track.clmt[0]
+                    << " CLMT items required" << UsartLogger::ENDL);
+        track.file.cltbl = NULL;
+    }
+    else if (code != FR_OK)
+    {
+        USART_DEBUG("Can not create cluster link map for file " << fileName << ": " << code << UsartLogger::ENDL);
+        closeTrack(track);
+        return false;
+    }
+
     UINT bytesRead = 0;
-    code = f_read(&wavFile, &(sdCardBlock.block[0]), BLOCK_SIZE, &bytesRead);
-    if (code != FR_OK || bytesRead != BLOCK_SIZE)
+    code = f_read(&track.file, &(track.buffer.block[0]), BLOCK_SIZE, &bytesRead);
+    if (code != FR_OK || bytesRead < WAV_HEADER_LENGTH)
     {
         USART_DEBUG("Can not read WAV header from file " << fileName << ": " << code << UsartLogger::ENDL);
+        closeTrack(track);
         return false;
     }
-    
-    for (size_t i = 0; i < WAV_HEADER_LENGTH; ++i)
+    if (!parseHeader(track, fileName, bytesRead))
     {
-        wavHeader.header[i] = sdCardBlock.bytes[i];
-        sdCardBlock.bytes[i] = 0;
+        closeTrack(track);
+        return false;
     }
+    return true;
+}
+
+bool WavStreamer::parseHeader (Track & track, const char * fileName, uint32_t bytesRead)
+{
+    WavHeader & wavHeader = track.header;
+    ::memcpy(wavHeader.header, track.buffer.bytes, WAV_HEADER_LENGTH);
     
     // Check the file type
     if (::strncmp(wavHeader.fields.RIFF, "RIFF", 4) != 0 || ::strncmp(wavHeader.fields.WAVE, "WAVE", 4) != 0)
@@ -179,12 +493,36 @@ bool WavStreamer::startSdCard (const char * fileName)
         USART_DEBUG("File " << fileName << " if not a WAV file" << UsartLogger::ENDL);
         return false;
     }
+
+    // Check the sample format
+    // The "fmt" chunk body follows the first sub-chunk header at offset 20
+    const uint32_t fmtSize = std::min(wavHeader.fields.subchunk1Size, bytesRead - 20);
+    if (!PcmConverter::isPcmFormat(&(track.buffer.bytes[20]), fmtSize)
+        || !PcmConverter::getI2sDataFormat(wavHeader.fields.bitsPerSample, wavHeader.fields.numOfChan, track.dataFormat))
+    {
+        USART_DEBUG("File " << fileName << " has unsupported format: audioFormat=" << wavHeader.fields.audioFormat
+                    << ", bitsPerSample=" << wavHeader.fields.bitsPerSample
+                    << ", numOfChan=" << wavHeader.fields.numOfChan << UsartLogger::ENDL);
+        return false;
+    }
+
+    // Search the data chunk: the "fmt" chunk can be longer than 16 bytes and other chunks can
+    // be placed between "fmt" and "data"
+    if (!findDataChunk(track, bytesRead))
+    {
+        USART_DEBUG("File " << fileName << " does not contain data chunk" << UsartLogger::ENDL);
+        return false;
+    }
     
     // Number of bytes per sample
     uint16_t bytesPerSample = wavHeader.fields.numOfChan * wavHeader.fields.bitsPerSample / 8;
     
     // How many samples are in the wav file?
-    totalBytes = wavHeader.fields.chunkSize;
+    track.dataSize = wavHeader.fields.subchunk2Size;
+    track.bytesRead = 0;
+    
+    // The rest of the block behind the data chunk header is the beginning of the audio data
+    track.bufferEnd = bytesRead;
     
     if (IS_USART_DEBUG_ACTIVE())
     {
@@ -194,7 +532,7 @@ bool WavStreamer::startSdCard (const char * fileName)
         char waveString[5];
         ::strncpy(waveString, wavHeader.fields.WAVE, 4);
         waveString[4] = 0;
-        USART_DEBUG("WAV streaming from file started: " << fileName << UsartLogger::ENDL
+        USART_DEBUG("WAV file opened: " << fileName << UsartLogger::ENDL
                     << UsartLogger::TAB << "RIFF Header = " << riffString << UsartLogger::ENDL
                     << UsartLogger::TAB << "WAVE Header = " << waveString << UsartLogger::ENDL
                     << UsartLogger::TAB << "audioFormat = " << wavHeader.fields.audioFormat << UsartLogger::ENDL
@@ -203,16 +541,95 @@ bool WavStreamer::startSdCard (const char * fileName)
                     << UsartLogger::TAB << "bytesPerSec = " << wavHeader.fields.bytesPerSec << UsartLogger::ENDL
                     << UsartLogger::TAB << "blockAlign = " << wavHeader.fields.blockAlign << UsartLogger::ENDL
                     << UsartLogger::TAB << "bitsPerSample = " << wavHeader.fields.bitsPerSample << UsartLogger::ENDL
-                    << UsartLogger::TAB << "chunkSize = " << totalBytes << UsartLogger::ENDL
+                    << UsartLogger::TAB << "chunkSize = " << wavHeader.fields.chunkSize << UsartLogger::ENDL
+                    << UsartLogger::TAB << "dataOffset = " << track.dataOffset << UsartLogger::ENDL
+                    << UsartLogger::TAB << "dataSize = " << track.dataSize << UsartLogger::ENDL
                     << UsartLogger::TAB << "bytesPerSample = " << bytesPerSample << UsartLogger::ENDL
-                    << UsartLogger::TAB << "total samples = " << totalBytes / bytesPerSample << UsartLogger::ENDL);
+                    << UsartLogger::TAB << "total samples = " << track.dataSize / bytesPerSample << UsartLogger::ENDL);
     }
     
-    f_lseek(&wavFile, WAV_HEADER_LENGTH);
-    totalBytesRead = 0;
-    
     return true;
 }
 
+void WavStreamer::closeTrack (Track & track)
+{
+    if (track.opened)
+    {
+        f_close(&track.file);
+        track.opened = false;
+    }
+}
+
+bool WavStreamer::seekTrack (Track & track, uint32_t position)
+{
+    const uint32_t inputFrameSize = track.header.fields.numOfChan * track.header.fields.bitsPerSample / 8;
+    position = std::min(position, track.dataSize) / inputFrameSize * inputFrameSize;
+
+    // The beginning of the data is still available in the buffer; the read-ahead always
+    // continues behind the buffered data. With the link map, the restart of the read-ahead
+    // does not access the FAT
+    const uint32_t offset = track.dataOffset + position;
+    track.bufferPos = std::min(offset, track.bufferEnd);
+    track.bytesRead = position;
+    readAhead.start(track.file, std::max(offset, track.bufferEnd));
+    return true;
+}
+
+void WavStreamer::saveResumePoint ()
+{
+    resumeTime = HAL_GetTick();
+    if (resumeFile == NULL || !current->opened || !sdCard.isCardInserted() || !sdCard.isMounted())
+    {
+        return;
+    }
+    ResumePoint point;
+    ::memset(&point, 0, sizeof(point));
+    point.magic = RESUME_MAGIC;
+    ::strcpy(point.fileName, current->fileName);
+    // A finished track is resumed from its beginning
+    point.position = isFinished(*current) ? 0 : current->bytesRead;
+
+    FIL file;
+    UINT bytesWritten = 0;
+    // The file is not truncated: its cluster is neither freed nor allocated again
+    FRESULT code = f_open(&file, resumeFile, FA_OPEN_ALWAYS | FA_WRITE);
+    if (code == FR_OK)
+    {
+        code = f_write(&file, &point, sizeof(point), &bytesWritten);
+        f_close(&file);
+    }
+    if (code != FR_OK || bytesWritten != sizeof(point))
+    {
+        USART_DEBUG("Can not save resume point into " << resumeFile << ": " << code << UsartLogger::ENDL);
+    }
+}
+
+bool WavStreamer::findDataChunk (Track & track, uint32_t bytesRead)
+{
+    // The first sub-chunk starts after "RIFF", chunk size and "WAVE"
+    uint32_t offset = 12;
+    while (offset + 8 <= bytesRead)
+    {
+        uint32_t chunkSize;
+        ::memcpy(&chunkSize, &(track.buffer.bytes[offset + 4]), sizeof(chunkSize));
+        if (::strncmp((const char *) &(track.buffer.bytes[offset]), "data", 4) == 0)
+        {
+            ::memcpy(track.header.fields.subchunk2ID, &(track.buffer.bytes[offset]), 4);
+            track.header.fields.subchunk2Size = chunkSize;
+            track.dataOffset = track.bufferPos = offset + 8;
+            return true;
+        }
+        // A chunk that ends beyond the header buffer can not precede the data chunk; the check
+        // also rejects corrupt sizes that would wrap the offset around
+        if (chunkSize > bytesRead - offset - 8)
+        {
+            return false;
+        }
+        // Chunks are word-aligned
+        offset += 8 + chunkSize + (chunkSize & 1);
+    }
+    return false;
+}
+
 #endif
 #endif
@@ -23,6 +23,12 @@
 
 #include "SdCardFat.h"
 #include "AudioDac_UDA1334.h"
+#include "PcmConverter.h"
+#include "Resampler.h"
+#include "ParametricEq.h"
+#include "SpectrumAnalyzer.h"
+#include "Playlist.h"
+#include "ReadAhead.h"
 
 #ifdef HAL_SD_MODULE_ENABLED
 #ifdef HAL_I2S_MODULE_ENABLED
@@ -37,6 +43,11 @@ class WavStreamer final
 public:
     
     static constexpr uint32_t BLOCK_SIZE = 2048;
+    static constexpr uint16_t WAVE_FORMAT_PCM = PcmConverter::WAVE_FORMAT_PCM;
+    static constexpr uint16_t WAVE_FORMAT_EXTENSIBLE = PcmConverter::WAVE_FORMAT_EXTENSIBLE;
+    static constexpr uint32_t CLMT_SIZE = 64;
+    static constexpr uint32_t RESUME_MAGIC = 0x52564157;
+    static constexpr uint32_t RESUME_INTERVAL = 10000;
 
     class EventHandler
     {
@@ -46,6 +57,34 @@ public:
         virtual void onFinishSteaming () =0;
     };
 
+    /**
+     * @brief Processing stages of a DAC block, in the order of their execution.
+     *
+     * READ copies the input frames from the track buffer and the read-ahead ring, CONVERT
+     * converts them into the I2S layout, followed by the optional resampler, equalizer and
+     * analyzer.
+     */
+    enum class Stage
+    {
+        READ = 0, CONVERT = 1, RESAMPLE = 2, EQUALIZE = 3, ANALYZE = 4
+    };
+
+    static constexpr uint32_t STAGES = 5;
+
+    /**
+     * @brief Optional observer of the block processing, called around every stage.
+     *
+     * It allows a profiler to measure the stages with its own clock, e.g. on a host
+     * where the DWT cycle counter is not available.
+     */
+    class StageHandler
+    {
+    public:
+
+        virtual void onStageStarted (Stage s) =0;
+        virtual void onStageFinished (Stage s) =0;
+    };
+
     typedef union
     {
         uint8_t header[44];
@@ -77,8 +116,85 @@ public:
         uint8_t bytes[BLOCK_SIZE];
     } Block;
 
+    /**
+     * @brief An opened WAV file.
+     *
+     * The first block read from the file contains the header and the beginning of the audio
+     * data; this data is kept in the buffer and played before the rest of the file is read.
+     */
+    typedef struct
+    {
+        FIL file;
+        bool opened;
+        char fileName[Playlist::MAX_NAME_LENGTH];
+        DWORD clmt[CLMT_SIZE];
+        WavHeader header;
+        uint32_t dataFormat;
+        uint32_t dataOffset, dataSize, bytesRead;
+        uint32_t bufferPos, bufferEnd;
+        Block buffer;
+    } Track;
+
+    /**
+     * @brief Playback position that is saved in the resume file.
+     */
+    typedef struct
+    {
+        uint32_t magic;
+        char fileName[Playlist::MAX_NAME_LENGTH];
+        uint32_t position;
+    } ResumePoint;
+
     WavStreamer (SdCardFat & _sdCard, AudioDac_UDA1334 & _audioDac);
     bool start (AudioDac_UDA1334::SourceType s, const char * fileName);
+
+    /**
+     * @brief Plays the files of a playlist.
+     *
+     * The next file is opened and parsed while the current one is still playing. If it has
+     * the same sample rate and I2S data format, its first frames are placed into the DAC block
+     * directly after the last frame of the current file, i.e. without a gap and without the
+     * restart of the DAC. Otherwise, the DAC is restarted with the parameters of the next file.
+     */
+    bool start (Playlist & _playlist);
+
+    /**
+     * @brief Moves the playback of the current track to the given time, in milliseconds.
+     *
+     * A cluster link map table is built for every file when it is opened, so the seek
+     * does not walk the FAT chain. Files with more than (CLMT_SIZE - 2) / 2 fragments
+     * fall back to the normal seek.
+     */
+    bool seek (uint32_t milliseconds);
+
+    /**
+     * @brief Returns the position of the current track, in milliseconds.
+     *
+     * This is the read position; it is ahead of the audible one by up to two DAC blocks.
+     */
+    uint32_t getPosition () const;
+
+    /**
+     * @brief Starts the file saved in the resume file at its saved position.
+     *
+     * The application calls it instead of start() when the card is mounted, e.g. from
+     * SdCardFat::EventHandler::onSdCardAttach(), after setResumeFile(). If it returns false,
+     * the playback is started from the beginning as usual.
+     */
+    bool resume ();
+
+    /**
+     * @brief Sets the file where the playback position is saved.
+     *
+     * The position is saved every RESUME_INTERVAL milliseconds while a file is streamed,
+     * so that it survives a reset or a power loss, and when the streaming is stopped. The
+     * file is overwritten in place, so a save writes the data sector and the directory entry
+     * only. NULL disables saving.
+     */
+    inline void setResumeFile (const char * _resumeFile)
+    {
+        resumeFile = _resumeFile;
+    }
     void stop ();
     void periodic ();
     
@@ -86,35 +202,138 @@ public:
     {
         handler = _handler;
     }
+
+    inline void setStageHandler (StageHandler * _stageHandler)
+    {
+        stageHandler = _stageHandler;
+    }
     
     inline bool isActive () const
     {
         return audioDac.isActive();
     }
     
+    /**
+     * @brief Sets an optional sample-rate converter.
+     *
+     * If set, streams with a lower sample rate than the converter output rate are
+     * up-sampled and the I2S clock is started with the fixed output rate.
+     */
+    inline void setResampler (Resampler * _resampler)
+    {
+        resampler = _resampler;
+    }
+
+    /**
+     * @brief Sets an optional software equalizer that is applied to the streamed blocks.
+     */
+    inline void setEqualizer (ParametricEq * _equalizer)
+    {
+        equalizer = _equalizer;
+    }
+
+    /**
+     * @brief Sets an optional spectrum analyzer that is fed with the streamed blocks.
+     */
+    inline void setAnalyzer (SpectrumAnalyzer * _analyzer)
+    {
+        analyzer = _analyzer;
+    }
+
     inline void setVolume (float v)
     {
-        volume = v;
+        converter.setVolume(v);
+    }
+
+    /**
+     * @brief Returns the level meter of the streamed signal.
+     *
+     * Its snapshot can be read from any context without stopping the playback.
+     */
+    inline LevelMeter & getLevelMeter ()
+    {
+        return converter.getLevelMeter();
+    }
+
+    inline const WavHeader & getWavHeader () const
+    {
+        return current->header;
+    }
+
+    /**
+     * @brief Returns the number of tracks that were joined without a gap.
+     */
+    inline uint32_t getGaplessTransitions () const
+    {
+        return gaplessTransitions;
     }
     
 private:
     
     // Interfaces
     EventHandler * handler;
+    StageHandler * stageHandler;
     AudioDac_UDA1334 & audioDac;
 
     // SD card handling
     SdCardFat & sdCard;
     Block sdCardBlock;
-    WavHeader wavHeader;
-    uint32_t totalBytes, totalBytesRead;
+    ReadAhead readAhead;
 
-    // File handling
-    FIL wavFile;
-    float volume;
+    // File handling: the current track and the prefetched next one
+    Track tracks[2];
+    Track * current;
+    Track * next;
+    Playlist * playlist;
+    uint32_t gaplessTransitions;
+    const char * resumeFile;
+    uint32_t resumeTime;
 
-    bool startSdCard (const char * fileName);
+    // Sample format and sample rate conversion
+    PcmConverter converter;
+    Resampler * resampler;
+    bool resampling;
+
+    // Software equalizer and analyzer
+    ParametricEq * equalizer;
+    SpectrumAnalyzer * analyzer;
+
+    bool startStream ();
+    bool openTrack (Track & track, const char * fileName);
+    bool parseHeader (Track & track, const char * fileName, uint32_t bytesRead);
+    void closeTrack (Track & track);
+    bool seekTrack (Track & track, uint32_t position);
+    void saveResumePoint ();
+    static bool findDataChunk (Track & track, uint32_t bytesRead);
+    bool startResampler ();
+    void prefetchNext ();
+    bool isNextGapless () const;
+    void switchTrack ();
+    bool restartWithNext ();
+    void fillSilence (uint16_t * block, uint32_t from, uint32_t to) const;
+    uint32_t readFrames (uint16_t * output, uint32_t frames);
     void readBlock ();
+
+    inline bool isFinished (const Track & track) const
+    {
+        return track.bytesRead >= track.dataSize;
+    }
+
+    inline void startStage (Stage s)
+    {
+        if (stageHandler != NULL)
+        {
+            stageHandler->onStageStarted(s);
+        }
+    }
+
+    inline void finishStage (Stage s)
+    {
+        if (stageHandler != NULL)
+        {
+            stageHandler->onStageFinished(s);
+        }
+    }
 };
 
 } // end of namespace Drivers
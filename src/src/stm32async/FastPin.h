@@ -0,0 +1,160 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#ifndef STM32ASYNC_FASTPIN_H_
+#define STM32ASYNC_FASTPIN_H_
+
+#include "Stm32async.h"
+
+namespace Stm32async
+{
+
+/**
+ * @brief Output pin with the port, the pin and the active level given at compile time.
+ *
+ * All methods are static and write the BSRR register of the port directly: setting or
+ * resetting the pin is a single store, without a HAL call. The pin shall be configured
+ * as an output by an IOPort (or a Drivers::Led), for example
+ *
+ *     typedef FastPin<HardwareLayout::PortC, GPIO_PIN_1, GPIO_PIN_RESET> LedBluePin;
+ *     Drivers::Led ledBlue { portC, LedBluePin::PIN, Drivers::Led::ConnectionType::CATHODE };
+ *     ledBlue.start();
+ *     LedBluePin::turnOn();
+ *
+ * @param PORT a port class from namespace HardwareLayout that provides the constant BASE.
+ * @param PIN_MASK the pin mask, for example GPIO_PIN_1.
+ * @param ACTIVE the level of the pin when it is "on".
+ */
+template<typename PORT, uint16_t PIN_MASK, GPIO_PinState ACTIVE = GPIO_PIN_SET> class FastPin
+{
+public:
+
+    static constexpr uint32_t PORT_BASE = PORT::BASE;
+    static constexpr uint16_t PIN = PIN_MASK;
+
+    /**
+     * @brief BSRR values that set and reset the pin, and that turn it on and off.
+     */
+    static constexpr uint32_t BSRR_SET = PIN_MASK;
+    static constexpr uint32_t BSRR_RESET = (uint32_t) PIN_MASK << 16;
+    static constexpr uint32_t BSRR_ON = (ACTIVE == GPIO_PIN_SET) ? BSRR_SET : BSRR_RESET;
+    static constexpr uint32_t BSRR_OFF = (ACTIVE == GPIO_PIN_SET) ? BSRR_RESET : BSRR_SET;
+
+    static inline GPIO_TypeDef * getPort ()
+    {
+        return (GPIO_TypeDef *) PORT_BASE;
+    }
+
+    static inline void store (uint32_t bsrr)
+    {
+        getPort()->BSRR = bsrr;
+    }
+
+    static inline void setHigh ()
+    {
+        store(BSRR_SET);
+    }
+
+    static inline void setLow ()
+    {
+        store(BSRR_RESET);
+    }
+
+    static inline void turnOn ()
+    {
+        store(BSRR_ON);
+    }
+
+    static inline void turnOff ()
+    {
+        store(BSRR_OFF);
+    }
+
+    static inline void putBit (bool value)
+    {
+        store(value ? BSRR_SET : BSRR_RESET);
+    }
+
+    /**
+     * @brief Toggles the pin by a read of ODR and a single store to BSRR. Unlike a write
+     *        of ODR, the other pins of the port are not affected by an interrupt between.
+     */
+    static inline void toggle ()
+    {
+        store((getPort()->ODR & PIN_MASK) ? BSRR_RESET : BSRR_SET);
+    }
+
+    static inline bool isOn ()
+    {
+        return ((getPort()->ODR & PIN_MASK) != 0) == (ACTIVE == GPIO_PIN_SET);
+    }
+};
+
+/**
+ * @brief Group of FastPin outputs at the same port that are updated by a single store to
+ *        BSRR, i.e. atomically.
+ *
+ *     typedef PinGroup<Led1Pin, Led2Pin, Led3Pin> Leds;
+ *     Leds::write(0b010); // Led2Pin on, the others off
+ */
+template<typename FIRST, typename... PINS> class PinGroup
+{
+public:
+
+    static constexpr size_t SIZE = 1 + sizeof...(PINS);
+
+    /**
+     * @brief Returns the BSRR value that turns the pins on whose bits are set in the
+     *        given states (bit 0 for the first pin), and the other pins off.
+     */
+    static inline uint32_t getBsrr (uint32_t states)
+    {
+        const uint32_t on[SIZE] = { FIRST::BSRR_ON, PINS::BSRR_ON... };
+        const uint32_t off[SIZE] = { FIRST::BSRR_OFF, PINS::BSRR_OFF... };
+        uint32_t bsrr = 0;
+        for (size_t i = 0; i < SIZE; ++i)
+        {
+            bsrr |= ((states >> i) & 1) ? on[i] : off[i];
+        }
+        return bsrr;
+    }
+
+    static inline void write (uint32_t states)
+    {
+        FIRST::store(getBsrr(states));
+    }
+
+    static inline void turnOff ()
+    {
+        write(0);
+    }
+
+private:
+
+    static constexpr bool isSamePort (size_t i = 0)
+    {
+        constexpr uint32_t bases[SIZE] = { FIRST::PORT_BASE, PINS::PORT_BASE... };
+        return i >= SIZE || (bases[i] == FIRST::PORT_BASE && isSamePort(i + 1));
+    }
+
+    static_assert(isSamePort(), "all pins of a PinGroup shall be at the same port");
+};
+
+} // end namespace
+#endif
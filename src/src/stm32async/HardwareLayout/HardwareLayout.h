@@ -65,7 +65,7 @@ public:
      * @param _prio The preemption priority for the IRQn channel. This parameter can be a value between 0 and 15.
      * @param _subPrio The sub-priority level for the IRQ channel. This parameter can be a value between 0 and 15.
      */
-    Interrupt (IRQn_Type _irqn, uint32_t _prio, uint32_t _subPrio = 0) :
+    constexpr Interrupt (IRQn_Type _irqn, uint32_t _prio, uint32_t _subPrio = 0) :
         irqn { _irqn },
         prio { _prio },
         subPrio { _subPrio }
@@ -114,6 +114,110 @@ public:
     uint32_t subPrio;
 };
 
+/**
+ * @brief Compile-time descriptor of an interrupt used by a device.
+ */
+class IrqAllocation final
+{
+public:
+
+    Interrupt irq;
+
+    /**
+     * @brief The name of the device, used in the allocation report.
+     */
+    const char * owner;
+
+    constexpr IrqAllocation (const char * _owner, IRQn_Type _irqn, uint32_t _prio, uint32_t _subPrio = 0) :
+        irq { _irqn, _prio, _subPrio },
+        owner { _owner }
+    {
+        // empty
+    }
+};
+
+/**
+ * @brief Compile-time descriptor of a DMA stream used by a device.
+ *
+ * The stream is given by its base address (for example DMA2_Stream7_BASE) since a pointer
+ * to the registers is not a constant expression. The allocations of an application are
+ * collected in arrays and checked by static_assert:
+ *
+ *     static_assert(HardwareLayout::hasUniqueStreams(DMA_ALLOCATION), "...");
+ *     static_assert(HardwareLayout::hasStreamIrqs(DMA_ALLOCATION), "...");
+ *     static_assert(HardwareLayout::hasUniqueIrqs(IRQ_ALLOCATION, DMA_ALLOCATION), "...");
+ */
+class DmaAllocation final
+{
+public:
+
+    uint32_t streamBase;
+    uint32_t channel;
+    IrqAllocation irq;
+
+    constexpr DmaAllocation (const char * _owner, uint32_t _streamBase, uint32_t _channel,
+                             IRQn_Type _irqn, uint32_t _prio, uint32_t _subPrio = 0) :
+        streamBase { _streamBase },
+        channel { _channel },
+        irq { _owner, _irqn, _prio, _subPrio }
+    {
+        // empty
+    }
+};
+
+/**
+ * @brief Checks that no DMA stream is allocated twice.
+ */
+template<size_t N> constexpr bool hasUniqueStreams (const DmaAllocation (&dma)[N])
+{
+    for (size_t i = 0; i < N; ++i)
+    {
+        for (size_t j = i + 1; j < N; ++j)
+        {
+            if (dma[i].streamBase == dma[j].streamBase)
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Checks that the interrupt of every DMA allocation belongs to its stream.
+ */
+template<size_t N> constexpr bool hasStreamIrqs (const DmaAllocation (&dma)[N])
+{
+    for (size_t i = 0; i < N; ++i)
+    {
+        const IRQn_Type irqn = getDmaStreamIrq(dma[i].streamBase);
+        if (irqn != UNKNOWN_DMA_IRQ && irqn != dma[i].irq.irq.irqn)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Checks that no interrupt is used by two devices or two DMA streams.
+ */
+template<size_t N, size_t M> constexpr bool hasUniqueIrqs (const IrqAllocation (&irq)[N], const DmaAllocation (&dma)[M])
+{
+    for (size_t i = 0; i < N + M; ++i)
+    {
+        const IRQn_Type a = (i < N) ? irq[i].irq.irqn : dma[i - N].irq.irq.irqn;
+        for (size_t j = i + 1; j < N + M; ++j)
+        {
+            if (a == ((j < N) ? irq[j].irq.irqn : dma[j - N].irq.irq.irqn))
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
 /**
  * @brief Class provides an interface for any HAL device that have a clock.
  */
@@ -357,6 +461,18 @@ public:
     {
         // empty
     }
+
+    /**
+     * @brief Initialization constructor from a compile-time allocation, see DmaAllocation.
+     */
+    DmaStream (const Dma * _dma, const DmaAllocation & _allocation) :
+        dma { _dma },
+        stream { (DMA_Stream_Struct *) (size_t) _allocation.streamBase },
+        channel { _allocation.channel },
+        dmaIrq { _allocation.irq.irq }
+    {
+        // empty
+    }
 };
 
 /**
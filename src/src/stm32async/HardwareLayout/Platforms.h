@@ -45,6 +45,31 @@
 
         typedef DMA_Stream_TypeDef DMA_Stream_Struct;
 
+        static constexpr IRQn_Type UNKNOWN_DMA_IRQ = NonMaskableInt_IRQn;
+
+        /**
+         * @brief Returns the interrupt of a DMA stream given by its base address.
+         */
+        constexpr IRQn_Type getDmaStreamIrq (uint32_t streamBase)
+        {
+            return (streamBase == DMA1_Stream0_BASE) ? DMA1_Stream0_IRQn :
+                   (streamBase == DMA1_Stream1_BASE) ? DMA1_Stream1_IRQn :
+                   (streamBase == DMA1_Stream2_BASE) ? DMA1_Stream2_IRQn :
+                   (streamBase == DMA1_Stream3_BASE) ? DMA1_Stream3_IRQn :
+                   (streamBase == DMA1_Stream4_BASE) ? DMA1_Stream4_IRQn :
+                   (streamBase == DMA1_Stream5_BASE) ? DMA1_Stream5_IRQn :
+                   (streamBase == DMA1_Stream6_BASE) ? DMA1_Stream6_IRQn :
+                   (streamBase == DMA1_Stream7_BASE) ? DMA1_Stream7_IRQn :
+                   (streamBase == DMA2_Stream0_BASE) ? DMA2_Stream0_IRQn :
+                   (streamBase == DMA2_Stream1_BASE) ? DMA2_Stream1_IRQn :
+                   (streamBase == DMA2_Stream2_BASE) ? DMA2_Stream2_IRQn :
+                   (streamBase == DMA2_Stream3_BASE) ? DMA2_Stream3_IRQn :
+                   (streamBase == DMA2_Stream4_BASE) ? DMA2_Stream4_IRQn :
+                   (streamBase == DMA2_Stream5_BASE) ? DMA2_Stream5_IRQn :
+                   (streamBase == DMA2_Stream6_BASE) ? DMA2_Stream6_IRQn :
+                   (streamBase == DMA2_Stream7_BASE) ? DMA2_Stream7_IRQn : UNKNOWN_DMA_IRQ;
+        }
+
     } // end of namespace HardwareLayout
     } // end of namespace Stm32async
 
@@ -121,6 +146,23 @@
 
         typedef DMA_Channel_TypeDef DMA_Stream_Struct;
 
+        static constexpr IRQn_Type UNKNOWN_DMA_IRQ = NonMaskableInt_IRQn;
+
+        /**
+         * @brief Returns the interrupt of a DMA1 channel given by its base address; the
+         *        DMA2 channels are not checked since some of them share an interrupt.
+         */
+        constexpr IRQn_Type getDmaStreamIrq (uint32_t streamBase)
+        {
+            return (streamBase == DMA1_Channel1_BASE) ? DMA1_Channel1_IRQn :
+                   (streamBase == DMA1_Channel2_BASE) ? DMA1_Channel2_IRQn :
+                   (streamBase == DMA1_Channel3_BASE) ? DMA1_Channel3_IRQn :
+                   (streamBase == DMA1_Channel4_BASE) ? DMA1_Channel4_IRQn :
+                   (streamBase == DMA1_Channel5_BASE) ? DMA1_Channel5_IRQn :
+                   (streamBase == DMA1_Channel6_BASE) ? DMA1_Channel6_IRQn :
+                   (streamBase == DMA1_Channel7_BASE) ? DMA1_Channel7_IRQn : UNKNOWN_DMA_IRQ;
+        }
+
     } // end of namespace HardwareLayout
     } // end of namespace Stm32async
 
@@ -37,6 +37,7 @@ namespace HardwareLayout
 class PortA : public HardwareLayout::Port
 {
 public:
+    static constexpr uint32_t BASE = GPIOA_BASE;
     PortA () :
         Port { 0, GPIOA }
     {
@@ -37,6 +37,7 @@ namespace HardwareLayout
 class PortB : public HardwareLayout::Port
 {
 public:
+    static constexpr uint32_t BASE = GPIOB_BASE;
     PortB () :
         Port { 1, GPIOB }
     {
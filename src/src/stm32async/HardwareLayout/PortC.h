@@ -37,6 +37,7 @@ namespace HardwareLayout
 class PortC : public HardwareLayout::Port
 {
 public:
+    static constexpr uint32_t BASE = GPIOC_BASE;
     PortC () :
         Port { 2, GPIOC }
     {
@@ -37,6 +37,7 @@ namespace HardwareLayout
 class PortD : public HardwareLayout::Port
 {
 public:
+    static constexpr uint32_t BASE = GPIOD_BASE;
     PortD () :
         Port { 4, GPIOD }
     {
@@ -37,6 +37,7 @@ namespace HardwareLayout
 class PortH : public HardwareLayout::Port
 {
 public:
+    static constexpr uint32_t BASE = GPIOH_BASE;
     PortH () :
         Port { 8, GPIOH }
     {
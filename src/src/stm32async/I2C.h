@@ -58,7 +58,9 @@ public:
      */
     inline HAL_StatusTypeDef masterTransmitBlocking (uint16_t address, uint8_t * buffer, uint16_t n, uint32_t timeout = __UINT32_MAX__)
     {
+        TRACE_DEVICE(BEGIN, "TX", (uint32_t) (size_t) parameters.Instance);
         halStatus = HAL_I2C_Master_Transmit(&parameters, address, buffer, n, timeout);
+        TRACE_DEVICE(END, (halStatus == HAL_OK) ? "TX_CMPL" : "ERROR", (uint32_t) (size_t) parameters.Instance);
         return halStatus;
     }
 
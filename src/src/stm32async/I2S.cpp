@@ -18,11 +18,74 @@
  ******************************************************************************/
 
 #include "I2S.h"
+#include "SystemClock.h"
+
+#include <cmath>
 
 #ifdef HAL_I2S_MODULE_ENABLED
 
 using namespace Stm32async;
 
+#ifdef STM32F4
+
+/************************************************************************
+ * Class I2SClock
+ ************************************************************************/
+
+constexpr uint32_t I2SClock::I2SDIV_MIN;
+constexpr uint32_t I2SClock::I2SDIV_MAX;
+
+bool I2SClock::solve (uint32_t audioFreq, uint32_t dataFormat, uint32_t mclkOutput, Settings & settings) const
+{
+    if (audioFreq == 0 || pllM == 0)
+    {
+        return false;
+    }
+    const uint64_t frameDiv = getFrameDivider(dataFormat, mclkOutput);
+    bool found = false;
+    float bestError = 0.0f;
+    for (uint32_t n = PLLI2SN_MIN; n <= PLLI2SN_MAX; ++n)
+    {
+        const uint64_t vco = (uint64_t) pllSourceFreq * n / pllM;
+        if (vco < VCO_OUTPUT_MIN || vco > VCO_OUTPUT_MAX)
+        {
+            continue;
+        }
+        for (uint32_t r = PLLI2SR_MIN; r <= PLLI2SR_MAX; ++r)
+        {
+            // Total prescaler 2 * I2SDIV + ODD rounded to the nearest integer
+            const uint64_t num = (uint64_t) pllSourceFreq * n;
+            const uint64_t den = (uint64_t) pllM * r * frameDiv * audioFreq;
+            const uint32_t div = std::max(2 * I2SDIV_MIN, std::min(2 * I2SDIV_MAX + 1, (uint32_t) ((num + den / 2) / den)));
+            const float achieved = (float) num / (float) ((uint64_t) pllM * r * frameDiv * div);
+            const float error = (achieved - (float) audioFreq) / (float) audioFreq * 1.0e6f;
+            if (!found || ::fabsf(error) < ::fabsf(bestError))
+            {
+                found = true;
+                bestError = error;
+                settings.PLLI2SN = n;
+                settings.PLLI2SR = r;
+                settings.I2SDIV = div / 2;
+                settings.ODD = div % 2;
+                settings.MCLKOutput = mclkOutput;
+                settings.audioFreq = audioFreq;
+                settings.achievedFreq = achieved;
+                settings.ppmError = error;
+            }
+        }
+    }
+    return found;
+}
+
+float I2SClock::getAudioFreq (const Settings & settings, uint32_t dataFormat) const
+{
+    const uint64_t den = (uint64_t) pllM * settings.PLLI2SR * getFrameDivider(dataFormat, settings.MCLKOutput)
+                         * (2 * settings.I2SDIV + settings.ODD);
+    return (den == 0) ? 0.0f : (float) ((uint64_t) pllSourceFreq * settings.PLLI2SN) / (float) den;
+}
+
+#endif /* STM32F4 */
+
 /************************************************************************
  * Class AsyncI2S
  ************************************************************************/
@@ -82,6 +145,27 @@ DeviceStart::Status AsyncI2S::start (uint32_t standard, uint32_t audioFreq, uint
 }
 
 
+#ifdef STM32F4
+DeviceStart::Status AsyncI2S::start (uint32_t standard, const I2SClock::Settings & clock, uint32_t dataFormat)
+{
+    SystemClock * sysClock = SystemClock::getInstance();
+    if (sysClock == NULL || !sysClock->reconfigureI2S(clock.PLLI2SN, clock.PLLI2SR))
+    {
+        return DeviceStart::I2S_CLOCK_ERROR;
+    }
+
+    parameters.Init.MCLKOutput = clock.MCLKOutput;
+    DeviceStart::Status status = start(standard, clock.audioFreq, dataFormat);
+    if (status == DeviceStart::OK)
+    {
+        // HAL rounds the prescaler on its own, the solver result is used instead
+        parameters.Instance->I2SPR = clock.I2SDIV | (clock.ODD << 8) | clock.MCLKOutput;
+    }
+    return status;
+}
+#endif
+
+
 void AsyncI2S::stop ()
 {
     device.disableIrq();
@@ -30,6 +30,89 @@
 namespace Stm32async
 {
 
+#ifdef STM32F4
+
+/**
+ * @brief Helper class that searches PLLI2S and I2S prescaler settings for a given sample rate.
+ *
+ * The sample rate is given by the following formula (see RM0090, SPI/I2S chapter):
+ *
+ *     I2SCLK = PLL source / PLLM * PLLI2SN / PLLI2SR
+ *     Fs = I2SCLK / (256 * (2 * I2SDIV + ODD))              if MCLK output is enabled
+ *     Fs = I2SCLK / (32 * (2 * I2SDIV + ODD))               for 16-bit channels, MCLK disabled
+ *     Fs = I2SCLK / (64 * (2 * I2SDIV + ODD))               for 32-bit channels, MCLK disabled
+ *
+ * Since PLLM is shared with the main PLL, it is an input parameter of the solver. All valid
+ * PLLI2SN/PLLI2SR pairs are checked, the prescaler is rounded to the nearest value and the
+ * combination with the smallest error is returned.
+ */
+class I2SClock final
+{
+public:
+
+    static constexpr uint32_t PLLI2SN_MIN = 192;
+    static constexpr uint32_t PLLI2SN_MAX = 432;
+    static constexpr uint32_t PLLI2SR_MIN = 2;
+    static constexpr uint32_t PLLI2SR_MAX = 7;
+    static constexpr uint32_t VCO_OUTPUT_MIN = 100000000;
+    static constexpr uint32_t VCO_OUTPUT_MAX = 432000000;
+    static constexpr uint32_t I2SDIV_MIN = 2;
+    static constexpr uint32_t I2SDIV_MAX = 255;
+
+    typedef struct
+    {
+        uint32_t PLLI2SN;
+        uint32_t PLLI2SR;
+        uint32_t I2SDIV;
+        uint32_t ODD;
+        uint32_t MCLKOutput;
+        uint32_t audioFreq;    /* Requested sample rate in Hz */
+        float achievedFreq;    /* Achieved sample rate in Hz */
+        float ppmError;        /* Relative error of the achieved sample rate in ppm */
+    } Settings;
+
+    /**
+     * @brief Standard initialization constructor.
+     *
+     * @param _pllSourceFreq frequency of the PLL clock source (HSE or HSI) in Hz.
+     * @param _pllM the PLL input divider shared by the main PLL and PLLI2S.
+     */
+    I2SClock (uint32_t _pllSourceFreq, uint32_t _pllM) :
+        pllSourceFreq { _pllSourceFreq },
+        pllM { _pllM }
+    {
+        // empty
+    }
+
+    /**
+     * @brief Searches the best settings for the given sample rate.
+     *
+     * @param audioFreq requested sample rate in Hz.
+     * @param dataFormat I2S data format (I2S_DATAFORMAT_16B, ...) that defines the frame length.
+     * @param mclkOutput I2S_MCLKOUTPUT_ENABLE or I2S_MCLKOUTPUT_DISABLE.
+     * @param settings the best found settings.
+     * @return false if no valid settings exist.
+     */
+    bool solve (uint32_t audioFreq, uint32_t dataFormat, uint32_t mclkOutput, Settings & settings) const;
+
+    /**
+     * @brief Returns the sample rate for given settings according to the datasheet formula.
+     */
+    float getAudioFreq (const Settings & settings, uint32_t dataFormat) const;
+
+private:
+
+    uint32_t pllSourceFreq;
+    uint32_t pllM;
+
+    static inline uint32_t getFrameDivider (uint32_t dataFormat, uint32_t mclkOutput)
+    {
+        return (mclkOutput == I2S_MCLKOUTPUT_ENABLE) ? 256 : (dataFormat == I2S_DATAFORMAT_16B) ? 32 : 64;
+    }
+};
+
+#endif /* STM32F4 */
+
 /**
  * @brief Class that implements I2S interface
  */
@@ -47,6 +130,16 @@ public:
      */
     DeviceStart::Status start (uint32_t standard, uint32_t audioFreq, uint32_t dataFormat);
 
+#ifdef STM32F4
+    /**
+     * @brief Open transmission session with the exact clock settings found by I2SClock.
+     *
+     * The PLLI2S is reconfigured, the I2S is initialized and the prescaler found by
+     * the solver is written into the I2SPR register.
+     */
+    DeviceStart::Status start (uint32_t standard, const I2SClock::Settings & clock, uint32_t dataFormat);
+#endif
+
     /**
      * @brief Close the transmission session.
      */
@@ -57,7 +150,7 @@ public:
      */
     inline HAL_StatusTypeDef transmit (DeviceClient * _client, uint16_t * pData, uint16_t size)
     {
-        startCommunication(_client, State::TX, State::TX_CMPL);
+        startCommunication(_client, State::TX, State::TX_CMPL, getTransferBytes(size));
         halStatus = HAL_I2S_Transmit_DMA(&parameters, pData, size);
         return halStatus;
     }
@@ -67,10 +160,29 @@ public:
      */
     inline HAL_StatusTypeDef receive (DeviceClient * _client, uint16_t * pData, uint16_t size)
     {
-        startCommunication(_client, State::RX, State::RX_CMPL);
+        startCommunication(_client, State::RX, State::RX_CMPL, getTransferBytes(size));
         halStatus = HAL_I2S_Receive_DMA(&parameters, pData, size);
         return halStatus;
     }
+
+protected:
+
+    virtual void abortTransfer () override
+    {
+        HAL_I2S_DMAStop(&parameters);
+    }
+
+private:
+
+    /**
+     * @brief The HAL counts 16-bit items for the 16-bit data formats and 32-bit items for
+     *        the 24-bit and 32-bit ones.
+     */
+    inline uint32_t getTransferBytes (uint16_t size) const
+    {
+        return (parameters.Init.DataFormat == I2S_DATAFORMAT_24B || parameters.Init.DataFormat == I2S_DATAFORMAT_32B) ?
+               size * sizeof(uint32_t) : size * sizeof(uint16_t);
+    }
 };
 
 } // end namespace
@@ -38,5 +38,6 @@ const char * DeviceStart::strings[] = {
     "Can not configure DAC channel",
     "Can not start DAC channel",
     "Can not start timer",
+    "Can not configure I2S clock",
     "Unknown error"
 };
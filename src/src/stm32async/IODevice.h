@@ -52,6 +52,7 @@ public:
         DAC_CHANNEL_ERROR,
         DAC_START_ERROR,
         TIMER_START_ERROR,
+        I2S_CLOCK_ERROR,
         UNDEFINED_ERROR
     };
 
@@ -0,0 +1,95 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#include "Profiler.h"
+#include "UsartLogger.h"
+
+#ifdef HAL_SIMULATION
+#include <chrono>
+#endif
+
+using namespace Stm32async;
+
+#define USART_DEBUG_MODULE "PROF: "
+
+/************************************************************************
+ * Class Profiler
+ ************************************************************************/
+
+Profiler::Region * Profiler::regions[Profiler::MAX_REGIONS] = { NULL };
+uint32_t Profiler::regionsCount = 0;
+
+#ifdef HAL_SIMULATION
+uint32_t Profiler::getCycles ()
+{
+    static const auto origin = std::chrono::steady_clock::now();
+    const uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - origin).count();
+    return (uint32_t) (ns * (SystemCoreClock / 1000) / 1000000);
+}
+#endif
+
+void Profiler::registerRegion (Region & region)
+{
+    const uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (!region.registered && regionsCount < MAX_REGIONS)
+    {
+        if (regionsCount == 0)
+        {
+            enableCycleCounter();
+        }
+        regions[regionsCount++] = &region;
+    }
+    // A region that does not fit into the table is still measured, but never dumped
+    region.registered = true;
+    __set_PRIMASK(primask);
+}
+
+void Profiler::reset ()
+{
+    const uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    for (uint32_t i = 0; i < regionsCount; ++i)
+    {
+        Region & r = *regions[i];
+        r.calls = 0;
+        r.total = 0;
+        r.min = __UINT32_MAX__;
+        r.max = 0;
+    }
+    __set_PRIMASK(primask);
+}
+
+void Profiler::dump ()
+{
+    USART_DEBUG((int) regionsCount << " regions, cycles at " << (int) (SystemCoreClock / 1000000) << " MHz" << UsartLogger::ENDL);
+    for (uint32_t i = 0; i < regionsCount; ++i)
+    {
+        // The statistics are copied at once, the logger lets the interrupts update them meanwhile
+        const uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        const Region r = *regions[i];
+        __set_PRIMASK(primask);
+        USART_DEBUG(r.getName() << ": calls=" << (int) r.getCalls()
+                    << ", min=" << (int) r.getMin()
+                    << ", avg=" << (int) r.getAverage()
+                    << ", max=" << (int) r.getMax() << UsartLogger::ENDL);
+    }
+}
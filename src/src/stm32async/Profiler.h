@@ -0,0 +1,205 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#ifndef STM32ASYNC_PROFILER_H_
+#define STM32ASYNC_PROFILER_H_
+
+#include "Stm32async.h"
+
+#include <algorithm>
+
+namespace Stm32async
+{
+
+/**
+ * @brief Profiling macros. They are only compiled if STM32ASYNC_PROFILING is defined,
+ *        otherwise they expand to nothing and cost neither code nor RAM.
+ *
+ * PROFILE_SCOPE(name) measures the rest of the enclosing block as a region with the given
+ * name; PROFILE_DUMP() writes the statistics of all regions to the logger; PROFILE_RESET()
+ * clears them.
+ */
+#ifdef STM32ASYNC_PROFILING
+
+#define PROFILE_CONCAT_(a, b) a ## b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+
+#define PROFILE_SCOPE(name) \
+    static Stm32async::Profiler::Region PROFILE_CONCAT(profileRegion, __LINE__) { name }; \
+    Stm32async::Profiler::Scope PROFILE_CONCAT(profileScope, __LINE__) { PROFILE_CONCAT(profileRegion, __LINE__) }
+
+#define PROFILE_DUMP() Stm32async::Profiler::dump()
+#define PROFILE_RESET() Stm32async::Profiler::reset()
+
+#else
+
+#define PROFILE_SCOPE(name)
+#define PROFILE_DUMP()
+#define PROFILE_RESET()
+
+#endif
+
+/**
+ * @brief Static class that collects the execution time of code regions in CPU cycles.
+ *
+ * The time is taken from the DWT cycle counter, which is enabled when the first region is
+ * entered. In the host simulation, the host clock is used instead and converted into
+ * cycles-equivalent at SystemCoreClock. A region is registered in a static table when it
+ * is entered the first time; it is not thread-safe between an interrupt and the main loop,
+ * i.e. a region shall be entered from one context only.
+ */
+class Profiler final
+{
+public:
+
+    static constexpr uint32_t MAX_REGIONS = 24;
+
+    /**
+     * @brief Statistics of a code region.
+     *
+     * The constructor is constexpr, so a static region is initialized at compile time and
+     * does not need a guard variable.
+     */
+    class Region
+    {
+        friend class Profiler;
+
+    public:
+
+        constexpr Region (const char * _name) :
+            name { _name },
+            calls { 0 },
+            total { 0 },
+            min { __UINT32_MAX__ },
+            max { 0 },
+            registered { false }
+        {
+            // empty
+        }
+
+        inline void add (uint32_t cycles)
+        {
+            if (!registered)
+            {
+                registerRegion(*this);
+            }
+            ++calls;
+            total += cycles;
+            min = std::min(min, cycles);
+            max = std::max(max, cycles);
+        }
+
+        inline const char * getName () const
+        {
+            return name;
+        }
+
+        inline uint32_t getCalls () const
+        {
+            return calls;
+        }
+
+        inline uint32_t getMin () const
+        {
+            return calls == 0 ? 0 : min;
+        }
+
+        inline uint32_t getAverage () const
+        {
+            return calls == 0 ? 0 : (uint32_t) (total / calls);
+        }
+
+        inline uint32_t getMax () const
+        {
+            return max;
+        }
+
+    private:
+
+        const char * name;
+        uint32_t calls;
+        uint64_t total;
+        uint32_t min, max;
+        bool registered;
+    };
+
+    /**
+     * @brief Measures the time between its construction and destruction.
+     */
+    class Scope
+    {
+    public:
+
+        inline Scope (Region & _region) :
+            region { _region },
+            start { getCycles() }
+        {
+            // empty
+        }
+
+        inline ~Scope ()
+        {
+            region.add(getCycles() - start);
+        }
+
+    private:
+
+        Region & region;
+        uint32_t start;
+    };
+
+#ifdef HAL_SIMULATION
+    static uint32_t getCycles ();
+#else
+    static inline uint32_t getCycles ()
+    {
+        return DWT->CYCCNT;
+    }
+#endif
+
+    static inline uint32_t getRegionsCount ()
+    {
+        return regionsCount;
+    }
+
+    static inline const Region & getRegion (uint32_t i)
+    {
+        return *regions[i];
+    }
+
+    /**
+     * @brief Clears the statistics of all registered regions.
+     */
+    static void reset ();
+
+    /**
+     * @brief Writes the statistics of all registered regions to the logger.
+     */
+    static void dump ();
+
+private:
+
+    static Region * regions[MAX_REGIONS];
+    static uint32_t regionsCount;
+
+    static void registerRegion (Region & region);
+};
+
+} // end namespace
+#endif
@@ -29,13 +29,27 @@ using namespace Stm32async;
 /************************************************************************
  * Class Sdio
  ************************************************************************/
+
+constexpr uint32_t Sdio::STATIC_FLAGS;
+constexpr uint32_t Sdio::BLOCK_SIZE;
+constexpr uint32_t Sdio::TUNING_ROUNDS;
+
 Sdio::Sdio (const HardwareLayout::Sdio & _device, uint32_t _clockDiv) :
     IODevice { _device, {
               IOPort { _device.pins1.port, _device.pins1.pins, GPIO_MODE_AF_PP,
                        GPIO_NOPULL, GPIO_SPEED_FREQ_VERY_HIGH },
               IOPort { _device.pins2.port, _device.pins2.pins, GPIO_MODE_AF_PP,
                        GPIO_NOPULL, GPIO_SPEED_FREQ_VERY_HIGH } } },
-    SharedDevice { &device.txDma, &device.rxDma, DMA_PDATAALIGN_WORD, DMA_MDATAALIGN_WORD }
+    SharedDevice { &device.txDma, &device.rxDma, DMA_PDATAALIGN_WORD, DMA_MDATAALIGN_WORD },
+    lastError { SD_OK },
+    defaultClockDiv { _clockDiv },
+    tuningBuffer { NULL },
+    tuningBlocks { 0 },
+    clockCache { NULL },
+    tuning { 0, _clockDiv, 0 },
+    tuningActive { false },
+    tuningClockDiv { _clockDiv },
+    tuningReference { 0 }
 {
     parameters.Instance = device.getInstance();
     parameters.Init.ClockEdge = SDIO_CLOCK_EDGE_RISING;
@@ -47,17 +61,41 @@ Sdio::Sdio (const HardwareLayout::Sdio & _device, uint32_t _clockDiv) :
 }
 
 DeviceStart::Status Sdio::start ()
+{
+    DeviceStart::Status status = initCard();
+    if (status == DeviceStart::OK)
+    {
+        status = configureBus();
+    }
+    if (status == DeviceStart::OK)
+    {
+        status = startTransfers();
+    }
+    if (status == DeviceStart::OK)
+    {
+        tuneClock();
+    }
+    return status;
+}
+
+DeviceStart::Status Sdio::initCard ()
 {
     device.enableClock();
     IODevice::enablePorts();
 
+    // A new card is always initialized with the default clock
+    parameters.Init.ClockDiv = defaultClockDiv;
     HAL_SD_ErrorTypedef sdErrorStatus = HAL_SD_Init(&parameters, &cardInfo);
     if (sdErrorStatus != SD_OK)
     {
         return DeviceStart::DEVICE_INIT_ERROR;
     }
+    return DeviceStart::OK;
+}
 
-    sdErrorStatus = HAL_SD_WideBusOperation_Config(&parameters, SDIO_BUS_WIDE_4B);
+DeviceStart::Status Sdio::configureBus ()
+{
+    HAL_SD_ErrorTypedef sdErrorStatus = HAL_SD_WideBusOperation_Config(&parameters, SDIO_BUS_WIDE_4B);
     if (sdErrorStatus != SD_OK)
     {
         return DeviceStart::SD_WIDE_BUS_ERROR;
@@ -68,7 +106,11 @@ DeviceStart::Status Sdio::start ()
     {
         return DeviceStart::SD_READ_STATUS_ERROR;
     }
+    return DeviceStart::OK;
+}
 
+DeviceStart::Status Sdio::startTransfers ()
+{
     txDma.Init.Mode = DMA_PFCTRL;
     txDma.Init.Priority = DMA_PRIORITY_LOW;
     txDma.Init.FIFOMode = DMA_FIFOMODE_ENABLE;
@@ -95,6 +137,7 @@ DeviceStart::Status Sdio::start ()
 
 void Sdio::stop ()
 {
+    tuningActive = false;
     device.disableIrq();
     stopDma();
     HAL_SD_DeInit(&parameters);
@@ -112,51 +155,293 @@ void Sdio::printInfo ()
              << UsartLogger::TAB << "SPEED_CLASS = " << cardStatus.SPEED_CLASS << UsartLogger::ENDL);
 }
 
-HAL_SD_ErrorTypedef Sdio::readBlocks (uint32_t *pData, uint64_t addr, uint32_t blockSize, uint32_t numOfBlocks)
+void Sdio::setClockDiv (uint32_t clockDiv)
 {
-    HAL_SD_ErrorTypedef status = HAL_SD_ReadBlocks_DMA(&parameters, pData, addr, blockSize, numOfBlocks);
-    if (status == SD_OK)
+    parameters.Init.ClockDiv = clockDiv;
+    MODIFY_REG(parameters.Instance->CLKCR, SDIO_CLKCR_CLKDIV, clockDiv);
+}
+
+void Sdio::tuneClock ()
+{
+    startClockTuning();
+    while (tuningActive)
+    {
+        tuneClockStep();
+    }
+}
+
+void Sdio::startClockTuning ()
+{
+    tuningActive = false;
+    if (tuningBuffer == NULL)
+    {
+        return;
+    }
+    tuning.cardSerial = cardInfo.SD_cid.ProdSN;
+    if (clockCache != NULL && clockCache->loadClockTuning(tuning.cardSerial, tuning))
     {
-        uint8_t repeatNr = 0xFF;
-        do
+        setClockDiv(tuning.clockDiv);
+        USART_DEBUG("Card " << tuning.cardSerial << ": cached clock divider " << tuning.clockDiv
+                    << " (" << tuning.throughput << " KB/s)" << UsartLogger::ENDL);
+        return;
+    }
+
+    // Enable the cycle counter used for the throughput measurement
+    enableCycleCounter();
+
+    // The reference data is read at the default clock by the first step
+    tuning.clockDiv = defaultClockDiv;
+    tuning.throughput = 0;
+    tuningClockDiv = defaultClockDiv;
+    tuningReference = 0;
+    tuningActive = true;
+}
+
+void Sdio::tuneClockStep ()
+{
+    if (!tuningActive)
+    {
+        return;
+    }
+    uint32_t throughput = 0;
+    if (measureClock(tuningClockDiv, tuningReference, throughput))
+    {
+        if (tuningReference == 0)
+        {
+            tuningReference = getTuningChecksum();
+        }
+        tuning.clockDiv = tuningClockDiv;
+        tuning.throughput = throughput;
+
+        // Every step roughly doubles the bus clock, up to 24 MHz at the divider 0
+        if (tuningClockDiv > 0)
         {
-            status = HAL_SD_CheckReadOperation(&parameters, TIMEOUT);
+            tuningClockDiv /= 2;
+            return;
         }
-        while (status == SD_DATA_TIMEOUT && --repeatNr > 0);
+    }
+
+    tuningActive = false;
+    setClockDiv(tuning.clockDiv);
+    if (tuningReference == 0)
+    {
+        // The reference read failed, so the default clock is kept but not stored
+        return;
+    }
+    USART_DEBUG("Card " << tuning.cardSerial << ": clock divider " << tuning.clockDiv
+                << " (" << tuning.throughput << " KB/s)" << UsartLogger::ENDL);
+    if (clockCache != NULL)
+    {
+        clockCache->storeClockTuning(tuning);
+    }
+}
 
-        if (status != SD_OK)
+bool Sdio::measureClock (uint32_t clockDiv, uint32_t reference, uint32_t & throughput)
+{
+    // The reads bypass readBlocks, which would fall back to the default clock on a CRC error
+    setClockDiv(clockDiv);
+    uint32_t cycles = 0;
+    const uint32_t rounds = (reference == 0)? 1 : TUNING_ROUNDS;
+    for (uint32_t i = 0; i < rounds; ++i)
+    {
+        ::memset(tuningBuffer, 0, tuningBlocks * BLOCK_SIZE);
+        const uint32_t start = DWT->CYCCNT;
+        HAL_SD_ErrorTypedef status = readBlocksAsync(NULL, tuningBuffer, 0, BLOCK_SIZE, tuningBlocks);
+        if (status == SD_OK)
+        {
+            waitForRelease();
+            status = lastError;
+        }
+        cycles += DWT->CYCCNT - start;
+        if (status != SD_OK || (reference != 0 && getTuningChecksum() != reference))
         {
-            USART_DEBUG("Error at reading blocks (operation finish): " << status << UsartLogger::ENDL);
+            USART_DEBUG("Clock divider " << clockDiv << " failed: " << status << UsartLogger::ENDL);
+            return false;
         }
     }
-    else
+    throughput = (uint32_t) ((uint64_t) rounds * tuningBlocks * BLOCK_SIZE * SystemCoreClock / 1024 / std::max(cycles, (uint32_t) 1));
+    return true;
+}
+
+uint32_t Sdio::getTuningChecksum () const
+{
+    // Never zero, since zero marks the reference read
+    uint32_t sum = 1;
+    for (uint32_t i = 0; i < tuningBlocks * BLOCK_SIZE / sizeof(uint32_t); ++i)
+    {
+        sum = ((sum << 5) | (sum >> 27)) ^ tuningBuffer[i];
+    }
+    return (sum == 0)? 1 : sum;
+}
+
+bool Sdio::fallBack (HAL_SD_ErrorTypedef status)
+{
+    // A CRC error or a FIFO error at a tuned clock is repeated once with the default clock
+    if ((status != SD_DATA_CRC_FAIL && status != SD_RX_OVERRUN && status != SD_TX_UNDERRUN)
+        || parameters.Init.ClockDiv == defaultClockDiv)
+    {
+        return false;
+    }
+    USART_DEBUG("Error " << status << " at clock divider " << parameters.Init.ClockDiv
+                << ", falling back to " << defaultClockDiv << UsartLogger::ENDL);
+    setClockDiv(defaultClockDiv);
+    tuning.clockDiv = defaultClockDiv;
+    tuning.throughput = 0;
+    if (clockCache != NULL)
+    {
+        clockCache->storeClockTuning(tuning);
+    }
+    return true;
+}
+
+HAL_SD_ErrorTypedef Sdio::readBlocks (uint32_t *pData, uint64_t addr, uint32_t blockSize, uint32_t numOfBlocks)
+{
+    HAL_SD_ErrorTypedef status = SD_OK;
+    do
+    {
+        while (isOccupied())
+        {
+            // wait for the asynchronous read of an other client
+            __NOP();
+        }
+        status = readBlocksAsync(NULL, pData, addr, blockSize, numOfBlocks);
+        if (status == SD_OK)
+        {
+            waitForRelease();
+            status = lastError;
+        }
+    }
+    while (fallBack(status));
+    return status;
+}
+
+HAL_SD_ErrorTypedef Sdio::readBlocksAsync (DeviceClient * _client, uint32_t *pData, uint64_t addr, uint32_t blockSize,
+                                           uint32_t numOfBlocks)
+{
+    if (isOccupied())
+    {
+        return SD_REQUEST_PENDING;
+    }
+    if (!isDmaAccessible(pData))
+    {
+        return SD_INVALID_PARAMETER;
+    }
+    lastError = SD_OK;
+    startCommunication(_client, State::RX, State::RX_CMPL, blockSize * numOfBlocks);
+    HAL_SD_ErrorTypedef status = HAL_SD_ReadBlocks_DMA(&parameters, pData, addr, blockSize, numOfBlocks);
+    if (status != SD_OK)
     {
         USART_DEBUG("Error at reading blocks (operation start): " << status << UsartLogger::ENDL);
+        lastError = status;
+        client = NULL;
+        currState = State::ERROR;
     }
     return status;
 }
 
+void Sdio::processXferCpltCallback ()
+{
+    if (currState != State::RX)
+    {
+        return;
+    }
+
+    // The data path of the SDIO is finished at DATAEND, so the multi-block read is stopped
+    // here; the DMA interrupt only remains to be waited for
+    if (parameters.SdOperation == SD_READ_MULTIPLE_BLOCK)
+    {
+        lastError = HAL_SD_StopTransfer(&parameters);
+    }
+}
+
+void Sdio::processRxCpltCallback ()
+{
+    if (currState != State::RX)
+    {
+        return;
+    }
+
+    // This is the remaining part of HAL_SD_CheckReadOperation: the DMA and the SDIO transfer
+    // are finished and the stop command is already sent by processXferCpltCallback()
+    __HAL_SD_SDIO_CLEAR_FLAG(&parameters, STATIC_FLAGS);
+    if (parameters.SdTransferErr != SD_OK)
+    {
+        lastError = (HAL_SD_ErrorTypedef) parameters.SdTransferErr;
+    }
+    processCallback(lastError == SD_OK ? State::RX_CMPL : State::ERROR);
+}
+
+void Sdio::processErrorCallback ()
+{
+    if (currState != State::RX)
+    {
+        return;
+    }
+    abortTransfer();
+    lastError = (HAL_SD_ErrorTypedef) parameters.SdTransferErr;
+    processCallback(State::ERROR);
+}
+
+void Sdio::abortTransfer ()
+{
+    const bool write = parameters.SdOperation == SD_WRITE_SINGLE_BLOCK
+                       || parameters.SdOperation == SD_WRITE_MULTIPLE_BLOCK;
+    HAL_DMA_Abort(write ? &txDma : &rxDma);
+    if (parameters.SdOperation == SD_READ_MULTIPLE_BLOCK || parameters.SdOperation == SD_WRITE_MULTIPLE_BLOCK)
+    {
+        HAL_SD_StopTransfer(&parameters);
+    }
+    __HAL_SD_SDIO_CLEAR_FLAG(&parameters, STATIC_FLAGS);
+    lastError = SD_DATA_TIMEOUT;
+}
+
 HAL_SD_ErrorTypedef Sdio::writeBlocks (uint32_t *pData, uint64_t addr, uint32_t blockSize, uint32_t numOfBlocks)
 {
-    HAL_SD_ErrorTypedef status = HAL_SD_WriteBlocks_DMA(&parameters, pData, addr, blockSize, numOfBlocks);
-    if (status == SD_OK)
+    if (!isDmaAccessible(pData))
+    {
+        return SD_INVALID_PARAMETER;
+    }
+    HAL_SD_ErrorTypedef status = SD_OK;
+    do
     {
-        uint8_t repeatNr = 0xFF;
-        do
+        while (isOccupied())
         {
-            status = HAL_SD_CheckWriteOperation(&parameters, TIMEOUT);
+            // wait for the asynchronous read of an other client
+            __NOP();
         }
-        while (status == SD_DATA_TIMEOUT && --repeatNr > 0);
+        lastError = SD_OK;
+        startCommunication(NULL, State::TX, State::TX_CMPL, blockSize * numOfBlocks);
+        status = HAL_SD_WriteBlocks_DMA(&parameters, pData, addr, blockSize, numOfBlocks);
+        if (status == SD_OK)
+        {
+            // A timeout of the supervisor aborts the transfer, the check is not repeated then
+            uint8_t repeatNr = 0xFF;
+            do
+            {
+                status = HAL_SD_CheckWriteOperation(&parameters, TIMEOUT);
+            }
+            while (status == SD_DATA_TIMEOUT && currState == State::TX && --repeatNr > 0);
 
-        if (status != SD_OK)
+            if (status != SD_OK)
+            {
+                USART_DEBUG("Error at writing blocks (operation finish): " << status << UsartLogger::ENDL);
+            }
+        }
+        else
         {
-            USART_DEBUG("Error at writing blocks (operation finish): " << status << UsartLogger::ENDL);
+            USART_DEBUG("Error at writing blocks (operation start): " << status << UsartLogger::ENDL);
+        }
+        if (currState == State::TIMEOUT)
+        {
+            status = SD_DATA_TIMEOUT;
+        }
+        else
+        {
+            lastError = status;
+            processCallback(status == SD_OK ? State::TX_CMPL : State::ERROR);
         }
     }
-    else
-    {
-        USART_DEBUG("Error at writing blocks (operation start): " << status << UsartLogger::ENDL);
-    }
+    while (fallBack(status));
     return status;
 }
 
@@ -38,9 +38,34 @@ class Sdio : public IODevice<HardwareLayout::Sdio, SD_HandleTypeDef, 2>, public
 public:
 
     static constexpr uint32_t TIMEOUT = 10000;
+    static constexpr uint32_t BLOCK_SIZE = 512;
+    static constexpr uint32_t TUNING_ROUNDS = 4;
+
+    /**
+     * @brief Result of the bus clock tuning for a card.
+     */
+    typedef struct
+    {
+        uint32_t cardSerial;
+        uint32_t clockDiv;
+        uint32_t throughput; // KB/s, measured at clockDiv
+    } ClockTuning;
+
+    /**
+     * @brief Persistent storage of the tuning results, so that a known card is not tuned again.
+     */
+    class ClockCache
+    {
+    public:
+        virtual bool loadClockTuning (uint32_t cardSerial, ClockTuning & tuning) =0;
+        virtual void storeClockTuning (const ClockTuning & tuning) =0;
+    };
 
     /**
      * @brief Default constructor.
+     *
+     * The clock divider is the reliable one that is used if the tuning is not enabled and
+     * that is restored after CRC errors.
      */
     Sdio (const HardwareLayout::Sdio & _device, uint32_t _clockDiv);
 
@@ -48,7 +73,116 @@ public:
     void stop ();
     void printInfo ();
 
+    /**
+     * @brief Steps of start(), for a caller that spreads the start over several calls:
+     *        initCard(), configureBus(), startTransfers() and tuneClock() or its steps.
+     */
+    DeviceStart::Status initCard ();
+    DeviceStart::Status configureBus ();
+    DeviceStart::Status startTransfers ();
+
+    /**
+     * @brief Tunes the bus clock if enabled by enableClockTuning(); does nothing otherwise.
+     */
+    void tuneClock ();
+
+    /**
+     * @brief Stepwise alternative to tuneClock(): startClockTuning() applies a cached divider or
+     *        prepares the tuning, and every tuneClockStep() measures one divider while
+     *        isClockTuning() is true.
+     */
+    void startClockTuning ();
+    void tuneClockStep ();
+
+    inline bool isClockTuning () const
+    {
+        return tuningActive;
+    }
+
+    /**
+     * @brief Enables the bus clock tuning by tuneClock() at the end of start().
+     *
+     * The first numOfBlocks blocks of the card are read at the default divider and then
+     * TUNING_ROUNDS times at every faster divider, until a CRC error, a timeout or a data mismatch
+     * occurs. The fastest divider without errors is used and stored in the optional cache under the
+     * product serial number of the card. The buffer is used by DMA, so it shall not be placed
+     * into the CCM.
+     */
+    inline void enableClockTuning (uint32_t * _buffer, uint32_t _numOfBlocks, ClockCache * _cache = NULL)
+    {
+        tuningBuffer = _buffer;
+        tuningBlocks = _numOfBlocks;
+        clockCache = _cache;
+    }
+
+    /**
+     * @brief Changes the bus clock of the started device: SDIO_CK = 48 MHz / (clockDiv + 2).
+     */
+    void setClockDiv (uint32_t clockDiv);
+
+    inline uint32_t getClockDiv () const
+    {
+        return parameters.Init.ClockDiv;
+    }
+
+    inline const ClockTuning & getClockTuning () const
+    {
+        return tuning;
+    }
+
+    /**
+     * @brief Blocking read that is used by FatFS.
+     *
+     * An asynchronous read in progress is finished first. The read is then started asynchronously
+     * and the method waits for its completion.
+     */
     HAL_SD_ErrorTypedef readBlocks (uint32_t *pData, uint64_t addr, uint32_t blockSize, uint32_t numOfBlocks);
+
+    /**
+     * @brief Starts an asynchronous read of numOfBlocks blocks into pData.
+     *
+     * The method returns as soon as the DMA transfer is started. The client is notified from the
+     * interrupt context by onTransmissionFinished with RX_CMPL or ERROR; the error code is then
+     * available by getLastError(). The read completion requires the following interrupt handlers
+     * and callbacks, where the SDIO interrupt shall have a higher priority than the RX DMA stream
+     * (HAL waits within the DMA interrupt for the end of the SDIO transfer):
+     *
+     *     extern "C" {
+     *         void SDIO_IRQHandler (void)
+     *         {
+     *             sdio.processSdIOInterrupt();
+     *         }
+     *         void DMA2_Stream3_IRQHandler (void)
+     *         {
+     *             sdio.processDmaRxInterrupt();
+     *         }
+     *         void HAL_SD_XferCpltCallback (SD_HandleTypeDef * )
+     *         {
+     *             sdio.processXferCpltCallback();
+     *         }
+     *         void HAL_SD_DMA_RxCpltCallback (DMA_HandleTypeDef * )
+     *         {
+     *             sdio.processRxCpltCallback();
+     *         }
+     *         void HAL_SD_XferErrorCallback (SD_HandleTypeDef * )
+     *         {
+     *             sdio.processErrorCallback();
+     *         }
+     *     }
+     *
+     * @return SD_REQUEST_PENDING if the device is occupied by another client, SD_INVALID_PARAMETER
+     *         if the buffer is in the CCM, which is not accessible by DMA.
+     */
+    HAL_SD_ErrorTypedef readBlocksAsync (DeviceClient * _client, uint32_t *pData, uint64_t addr, uint32_t blockSize,
+                                         uint32_t numOfBlocks);
+
+    /**
+     * @brief Blocking write that is used by FatFS.
+     *
+     * Like readBlocks(), an asynchronous read in progress is finished first. The write is a
+     * transaction of the device, so it is counted in the statistics and supervised by the
+     * timeout.
+     */
     HAL_SD_ErrorTypedef writeBlocks (uint32_t *pData, uint64_t addr, uint32_t blockSize, uint32_t numOfBlocks);
 
     inline const HAL_SD_CardInfoTypedef & getCardInfo () const
@@ -66,10 +200,45 @@ public:
         HAL_SD_IRQHandler(&parameters);
     }
 
+    /**
+     * @brief Sends the stop command of a multi-block read at the end of the data transfer
+     *        (DATAEND), so that the DMA interrupt does not wait for the SDIO.
+     */
+    void processXferCpltCallback ();
+    void processRxCpltCallback ();
+    void processErrorCallback ();
+
+    inline HAL_SD_ErrorTypedef getLastError () const
+    {
+        return lastError;
+    }
+
 private:
 
+    // Static flags that are cleared after a transfer, as defined in the HAL SD driver
+    static constexpr uint32_t STATIC_FLAGS = SDIO_FLAG_CCRCFAIL | SDIO_FLAG_DCRCFAIL | SDIO_FLAG_CTIMEOUT
+                                             | SDIO_FLAG_DTIMEOUT | SDIO_FLAG_TXUNDERR | SDIO_FLAG_RXOVERR
+                                             | SDIO_FLAG_CMDREND | SDIO_FLAG_CMDSENT | SDIO_FLAG_DATAEND
+                                             | SDIO_FLAG_DBCKEND;
+
+    virtual void abortTransfer () override;
+
     HAL_SD_CardInfoTypedef cardInfo;
     HAL_SD_CardStatusTypedef cardStatus;
+    volatile HAL_SD_ErrorTypedef lastError;
+
+    // Bus clock tuning
+    uint32_t defaultClockDiv;
+    uint32_t * tuningBuffer;
+    uint32_t tuningBlocks;
+    ClockCache * clockCache;
+    ClockTuning tuning;
+    bool tuningActive;
+    uint32_t tuningClockDiv, tuningReference;
+
+    bool measureClock (uint32_t clockDiv, uint32_t reference, uint32_t & throughput);
+    uint32_t getTuningChecksum () const;
+    bool fallBack (HAL_SD_ErrorTypedef status);
 };
 
 } // end namespace
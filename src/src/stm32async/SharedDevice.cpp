@@ -18,13 +18,57 @@
  ******************************************************************************/
 
 #include "SharedDevice.h"
+#include "UsartLogger.h"
+
+#include <algorithm>
 
 using namespace Stm32async;
 
+#define USART_DEBUG_MODULE "DEV: "
+
+/************************************************************************
+ * Class SharedDevice::Statistics
+ ************************************************************************/
+
+void SharedDevice::Statistics::add (State state, uint32_t size, uint32_t us)
+{
+    ++transactions;
+    if (state == State::ERROR)
+    {
+        ++errors;
+        return;
+    }
+    if (state == State::TIMEOUT)
+    {
+        ++timeouts;
+        return;
+    }
+    bytes += size;
+    minLatency = std::min(minLatency, us);
+    maxLatency = std::max(maxLatency, us);
+    totalLatency += us;
+    size_t bucket = 0;
+    while (bucket < LATENCY_BUCKETS - 1 && us >= getBucketLimit(bucket))
+    {
+        ++bucket;
+    }
+    ++latency[bucket];
+}
+
 /************************************************************************
  * Class SharedDevice
  ************************************************************************/
 
+const char * SharedDevice::stateStrings[] = {
+    "NONE",
+    "TX",
+    "TX_CMPL",
+    "RX",
+    "RX_CMPL",
+    "ERROR",
+    "TIMEOUT"
+};
+
 SharedDevice::SharedDevice (const HardwareLayout::DmaStream * _txStream, const HardwareLayout::DmaStream * _rxStream,
                             uint32_t _periphDataAlignment, uint32_t _memDataAlignment) :
     client { NULL },
@@ -33,8 +77,20 @@ SharedDevice::SharedDevice (const HardwareLayout::DmaStream * _txStream, const H
     startTime { __UINT32_MAX__ },
     timeout { __UINT32_MAX__ },
     txStream { _txStream },
-    rxStream { _rxStream }
+    rxStream { _rxStream },
+    queue {  },
+    queueHead { 0 },
+    queueLength { 0 },
+    active {  },
+    queued { false },
+    statistics {  },
+    measuring { false },
+    startCycles { 0 },
+    transferSize { 0 },
+    supervised { false },
+    sequence { 0 }
 {
+    statistics.minLatency = __UINT32_MAX__;
     if (txStream != NULL)
     {
         txDma.Instance = txStream->stream;
@@ -64,12 +120,21 @@ SharedDevice::SharedDevice (const HardwareLayout::DmaStream * _txStream, const H
     }
 }
 
-void SharedDevice::startCommunication (DeviceClient * client, State currState, State targetState)
+void SharedDevice::startCommunication (DeviceClient * client, State currState, State targetState, uint32_t size)
 {
     this->client = client;
     this->currState = currState;
     this->targetState = targetState;
     startTime = HAL_GetTick();
+    ++sequence;
+    if (timeout != __UINT32_MAX__)
+    {
+        TimeoutSupervisor::add(*this, startTime + timeout + 1, sequence);
+    }
+    transferSize = size;
+    startCycles = DWT->CYCCNT;
+    measuring = true;
+    TRACE_DEVICE(BEGIN, stateStrings[(size_t) currState], getTraceId());
 }
 
 void SharedDevice::waitForRelease ()
@@ -80,8 +145,186 @@ void SharedDevice::waitForRelease ()
     }
 }
 
+HAL_StatusTypeDef SharedDevice::enqueue (const Transaction & t)
+{
+    HAL_StatusTypeDef status = HAL_OK;
+    const uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (queueLength == QUEUE_SIZE)
+    {
+        if (t.client != NULL)
+        {
+            ++t.client->queueStatistics.rejected;
+        }
+        status = HAL_BUSY;
+    }
+    else
+    {
+        if (t.client != NULL)
+        {
+            QueueStatistics & s = t.client->queueStatistics;
+            ++s.transactions;
+            ++s.depth;
+            s.maxDepth = std::max(s.maxDepth, s.depth);
+        }
+        queue[(queueHead + queueLength) % QUEUE_SIZE] = t;
+        ++queueLength;
+        if (!isOccupied())
+        {
+            status = startNext();
+        }
+    }
+    __set_PRIMASK(primask);
+    return status;
+}
+
+void SharedDevice::waitForQueue ()
+{
+    while (!isIdle())
+    {
+        periodic();
+    }
+}
+
+HAL_StatusTypeDef SharedDevice::startNext ()
+{
+    const uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    active = queue[queueHead];
+    queueHead = (queueHead + 1) % QUEUE_SIZE;
+    --queueLength;
+    queued = true;
+    if (active.csPin != NULL)
+    {
+        active.csPin->setLow();
+    }
+    startCommunication(active.client, active.currState, active.targetState, active.size);
+    const HAL_StatusTypeDef status = startTransfer(active);
+    __set_PRIMASK(primask);
+    if (status != HAL_OK)
+    {
+        // Notifies the client and continues with the next transaction
+        processCallback(State::ERROR);
+    }
+    return status;
+}
+
+void SharedDevice::finishQueued (State state)
+{
+    if (active.csPin != NULL)
+    {
+        finishTransfer();
+        active.csPin->setHigh();
+    }
+    DeviceClient * c = active.client;
+    client = NULL;
+    queued = false;
+    if (c != NULL)
+    {
+        --c->queueStatistics.depth;
+        // A queued transaction always releases the device, the return value is not used
+        c->onTransmissionFinished(state);
+    }
+
+    // The client may have enqueued (and so started) a further transaction
+    const uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (!isOccupied() && queueLength > 0)
+    {
+        startNext();
+    }
+    __set_PRIMASK(primask);
+}
+
+void SharedDevice::expire (uint32_t _sequence)
+{
+    // The transaction is claimed with disabled interrupts: if its completion interrupt comes
+    // meanwhile, either the completion or the timeout finishes it, but not both
+    const uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    const bool expired = sequence == _sequence && !isFinished();
+    if (expired)
+    {
+        currState = State::TIMEOUT;
+    }
+    __set_PRIMASK(primask);
+    if (expired)
+    {
+        abortTransfer();
+        processCallback(State::TIMEOUT);
+    }
+}
+
+void SharedDevice::abortTransfer ()
+{
+    if (txStream != NULL)
+    {
+        HAL_DMA_Abort(&txDma);
+    }
+    if (rxStream != NULL)
+    {
+        HAL_DMA_Abort(&rxDma);
+    }
+}
+
+void SharedDevice::finishMeasurement (State state)
+{
+    // A callback that does not finish the transaction (like a half-complete one) is not counted
+    if (state != targetState && state != State::ERROR && state != State::TIMEOUT)
+    {
+        return;
+    }
+    measuring = false;
+    const uint32_t cycles = DWT->CYCCNT - startCycles;
+    statistics.add(state, transferSize, cycles / std::max(SystemCoreClock / 1000000U, (uint32_t) 1));
+}
+
+void SharedDevice::resetStatistics ()
+{
+    const uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    statistics = Statistics {};
+    statistics.minLatency = __UINT32_MAX__;
+    __set_PRIMASK(primask);
+}
+
+void SharedDevice::dumpStatistics (const char * name) const
+{
+    // The statistics are copied at once, the logger lets the interrupts update them meanwhile
+    const uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    const Statistics s = statistics;
+    __set_PRIMASK(primask);
+    const bool any = s.transactions > s.errors + s.timeouts;
+    USART_DEBUG(name << ": transactions=" << (int) s.transactions
+                << ", bytes=" << (int) s.bytes
+                << ", errors=" << (int) s.errors
+                << ", timeouts=" << (int) s.timeouts
+                << ", latency us min=" << (int) (any ? s.minLatency : 0)
+                << ", avg=" << (int) s.getAverageLatency()
+                << ", max=" << (int) s.maxLatency << UsartLogger::ENDL);
+    for (size_t i = 0; i < Statistics::LATENCY_BUCKETS; ++i)
+    {
+        if (s.latency[i] == 0)
+        {
+            continue;
+        }
+        if (i < Statistics::LATENCY_BUCKETS - 1)
+        {
+            USART_DEBUG(name << ":   <" << (int) Statistics::getBucketLimit(i) << " us: " << (int) s.latency[i] << UsartLogger::ENDL);
+        }
+        else
+        {
+            USART_DEBUG(name << ":  >=" << (int) Statistics::getBucketLimit(i - 1) << " us: " << (int) s.latency[i] << UsartLogger::ENDL);
+        }
+    }
+}
+
 DeviceStart::Status SharedDevice::startDma (HAL_StatusTypeDef & halStatus)
 {
+    // The cycle counter gives the latency of the transactions
+    enableCycleCounter();
+
     if (txStream != NULL)
     {
         txStream->dma->enableClock();
@@ -21,6 +21,8 @@
 #define STM32ASYNC_SHARED_DEVICE_H_
 
 #include "IODevice.h"
+#include "Tracer.h"
+#include "TimeoutSupervisor.h"
 
 namespace Stm32async
 {
@@ -30,7 +32,21 @@ namespace Stm32async
  *
  * This class implements a state machine for a transmit/receive sequence,
  * handles the device occupation and monitors transmit/receive times in
- * order to process a communication timeout
+ * order to process a communication timeout.
+ *
+ * Several clients can share the device without waiting for each other by the
+ * transaction queue: enqueue() starts a transaction immediately if the device is
+ * free, otherwise it is stored in a queue of QUEUE_SIZE entries. The next entry is
+ * started from processCallback(), i.e. from the completion interrupt, without the
+ * main loop. A device supports the queue by implementing startTransfer().
+ *
+ * Every device collects Statistics of its transactions, see getStatistics() and
+ * dumpStatistics().
+ *
+ * A transaction of a device with a limited timeout (see setTimeout()) is supervised by the
+ * TimeoutSupervisor: if it is not finished in time, it is aborted by abortTransfer() and
+ * finished with State::TIMEOUT from the supervisor timer interrupt. periodic() does the
+ * same from the calling context, as far as no supervisor timer runs.
  */
 class SharedDevice
 {
@@ -50,6 +66,63 @@ public:
         TIMEOUT
     };
 
+    /**
+     * @brief String representations of the states
+     */
+    static const char * stateStrings[];
+
+    /**
+     * @brief Queue statistics of a client.
+     */
+    class QueueStatistics
+    {
+    public:
+
+        uint32_t transactions; // transactions passed to enqueue()
+        uint32_t rejected;     // transactions rejected since the queue was full
+        uint16_t depth;        // transactions of the client that are waiting or running
+        uint16_t maxDepth;     // maximum of depth
+    };
+
+    /**
+     * @brief Transaction statistics of a device.
+     *
+     * A transaction is counted when processCallback() finishes it. The latency is the time from
+     * startCommunication() to processCallback() of a successful transaction, taken from the DWT
+     * cycle counter. The histogram has logarithmic buckets: bucket 0 counts the latencies below
+     * FIRST_BUCKET_US, bucket i the latencies below FIRST_BUCKET_US * 2^i and the last bucket all
+     * longer ones.
+     */
+    class Statistics
+    {
+    public:
+
+        static const size_t LATENCY_BUCKETS = 12;
+        static const uint32_t FIRST_BUCKET_US = 16;
+
+        uint32_t transactions; // finished transactions, including errors and timeouts
+        uint32_t bytes;        // bytes of the successful transactions
+        uint32_t errors;
+        uint32_t timeouts;
+        uint32_t minLatency;   // in microseconds
+        uint32_t maxLatency;   // in microseconds
+        uint64_t totalLatency; // in microseconds
+        uint32_t latency[LATENCY_BUCKETS];
+
+        static inline uint32_t getBucketLimit (size_t bucket)
+        {
+            return FIRST_BUCKET_US << bucket;
+        }
+
+        inline uint32_t getAverageLatency () const
+        {
+            const uint32_t n = transactions - errors - timeouts;
+            return n == 0 ? 0 : (uint32_t) (totalLatency / n);
+        }
+
+        void add (State state, uint32_t size, uint32_t us);
+    };
+
     /**
      * @brief An abstract interface of some device client.
      */
@@ -60,8 +133,39 @@ public:
         virtual ~DeviceClient () = default;
 
         virtual bool onTransmissionFinished (State state) =0;
+
+        inline const QueueStatistics & getQueueStatistics () const
+        {
+            return queueStatistics;
+        }
+
+    private:
+
+        friend class SharedDevice;
+        QueueStatistics queueStatistics {};
+    };
+
+    /**
+     * @brief An entry of the transaction queue.
+     *
+     * The buffer shall be valid until the client is notified by onTransmissionFinished(), which is
+     * the completion callback of the transaction. If a chip select pin is given, it is set low before
+     * the transfer is started and set high when the transfer is finished, before the notification.
+     */
+    class Transaction
+    {
+    public:
+
+        DeviceClient * client;
+        State currState;
+        State targetState;
+        void * buffer;
+        uint16_t size;
+        IOPort * csPin;
     };
 
+    static const size_t QUEUE_SIZE = 4;
+
     /**
      * @brief Default constructor.
      *
@@ -70,6 +174,8 @@ public:
     SharedDevice (const HardwareLayout::DmaStream * _txStream, const HardwareLayout::DmaStream * _rxStream,
                   uint32_t _periphDataAlignment, uint32_t _memDataAlignment);
 
+    virtual ~SharedDevice () = default;
+
     /**
      * @brief Communication start handler.
      *
@@ -80,14 +186,39 @@ public:
      * - current state will be equal to the target state
      * - an error occurs (current state is ERROR)
      * - a timeout occurs (current state is TIMEOUT)
+     *
+     * The size of the transfer in bytes is only used for the statistics.
      */
-    void startCommunication (DeviceClient * client, State currState, State targetState);
+    void startCommunication (DeviceClient * client, State currState, State targetState, uint32_t size = 0);
 
     /**
      * @brief The method waits until communication is finished in a blocking mode.
      */
     void waitForRelease ();
 
+    /**
+     * @brief Starts the given transaction or puts it into the queue if the device is occupied.
+     *
+     * May be called from an interrupt handler, also from onTransmissionFinished().
+     *
+     * @return HAL_BUSY if the queue is full, HAL_ERROR if the transfer could not be started (the
+     *         client is notified by State::ERROR in this case), HAL_OK otherwise.
+     */
+    HAL_StatusTypeDef enqueue (const Transaction & t);
+
+    /**
+     * @brief The method checks whether the device is free and no transaction is waiting.
+     */
+    inline bool isIdle () const
+    {
+        return !isOccupied() && queueLength == 0;
+    }
+
+    /**
+     * @brief The method waits until all queued transactions are finished.
+     */
+    void waitForQueue ();
+
     /**
      * @brief This setter allows to set a timeout for the communication sessions. Use __UINT32_MAX__ for unlimited timeout.
      */
@@ -130,10 +261,14 @@ public:
 
     /**
      * @brief The method checks whether this device is occupied by any other device.
+     *
+     * The device is occupied by a client until it is released by onTransmissionFinished(), by
+     * a queued transaction, and by a running transfer without a client (like the blocking
+     * reads and writes of the SDIO) until the transfer is finished.
      */
     inline bool isOccupied () const
     {
-        return client != NULL;
+        return client != NULL || queued || !isFinished();
     }
 
     /**
@@ -194,27 +329,71 @@ public:
      */
     inline void processCallback (State state)
     {
+        if (currState == State::TIMEOUT && state != State::TIMEOUT)
+        {
+            // A late completion of an expired transaction, the client is already notified
+            return;
+        }
+        TRACE_DEVICE(END, stateStrings[(size_t) state], getTraceId());
         currState = state;
+        if (supervised && isFinished())
+        {
+            TimeoutSupervisor::remove(*this);
+        }
+        if (measuring)
+        {
+            finishMeasurement(state);
+        }
+        if (queued)
+        {
+            finishQueued(state);
+            return;
+        }
         if (client != NULL && client->onTransmissionFinished(state))
         {
             client = NULL;
         }
+        if (!isOccupied() && queueLength > 0)
+        {
+            startNext();
+        }
     }
 
     /**
      * @brief Handling of communication timeout.
      *
-     * In order to allow timeout handling for this device, the user program shall periodically
-     * (either from a main loop or timer-based) call this method.
+     * The timeouts are handled by the TimeoutSupervisor if its timer runs. Otherwise, the user
+     * program shall periodically call this method, like waitForRelease() does.
      */
     inline void periodic ()
     {
-        if (HAL_GetTick() - startTime > timeout)
+        if (!isFinished() && HAL_GetTick() - startTime > timeout)
         {
-            processCallback(State::TIMEOUT);
+            expire(sequence);
         }
     }
 
+    /**
+     * @brief The method returns the transaction statistics of this device.
+     *
+     * The statistics are updated from the interrupt handlers, so a caller in the main loop
+     * shall copy them with disabled interrupts, like dumpStatistics() does.
+     */
+    inline const Statistics & getStatistics () const
+    {
+        return statistics;
+    }
+
+    /**
+     * @brief Clears the transaction statistics.
+     */
+    void resetStatistics ();
+
+    /**
+     * @brief Writes the transaction statistics to the logger, prefixed by the given device name.
+     */
+    void dumpStatistics (const char * name) const;
+
 protected:
 
     DeviceClient * client;
@@ -227,10 +406,68 @@ protected:
     DeviceStart::Status startDma (HAL_StatusTypeDef & halStatus);
     void stopDma ();
 
+    /**
+     * @brief Starts the transfer of a queued transaction, the communication session is already
+     *        started. A device that supports the queue shall implement this method.
+     */
+    virtual HAL_StatusTypeDef startTransfer (const Transaction & /*t*/)
+    {
+        return HAL_ERROR;
+    }
+
+    /**
+     * @brief Aborts the running transfer at the HAL level when its timeout is expired, so that
+     *        the peripheral accepts the next one. The default implementation stops the DMA
+     *        streams; a device shall also reset the state of its HAL handle.
+     */
+    virtual void abortTransfer ();
+
+    /**
+     * @brief Waits until the last data of a finished transfer have left the peripheral, so that
+     *        the chip select can be released.
+     */
+    virtual void finishTransfer ()
+    {
+        // empty
+    }
+
 private:
 
+    friend class TimeoutSupervisor;
+
     const HardwareLayout::DmaStream * txStream;
     const HardwareLayout::DmaStream * rxStream;
+
+    // Transaction queue: a ring buffer, modified with disabled interrupts
+    Transaction queue[QUEUE_SIZE];
+    volatile size_t queueHead, queueLength;
+    Transaction active;
+    volatile bool queued;
+
+    HAL_StatusTypeDef startNext ();
+    void finishQueued (State state);
+
+    // Statistics of the transaction started by startCommunication()
+    Statistics statistics;
+    volatile bool measuring;
+    uint32_t startCycles, transferSize;
+
+    void finishMeasurement (State state);
+
+    // Timeout supervision: the sequence number identifies the transaction of a deadline
+    volatile bool supervised;
+    volatile uint32_t sequence;
+
+    void expire (uint32_t _sequence);
+
+    /**
+     * @brief The transactions are traced at the DMA stream that carries them.
+     */
+    inline uint32_t getTraceId () const
+    {
+        const HardwareLayout::DmaStream * s = (targetState == State::RX_CMPL) ? rxStream : txStream;
+        return (uint32_t) (size_t) ((s != NULL) ? (const void *) s->stream : (const void *) this);
+    }
 };
 
 } // end namespace
@@ -129,4 +129,32 @@ void AsyncSpi::stop ()
     BaseSpi::stop();
 }
 
+HAL_StatusTypeDef AsyncSpi::startTransfer (const Transaction & t)
+{
+    if (t.currState == State::RX)
+    {
+        halStatus = HAL_SPI_Receive_DMA(&parameters, (uint8_t *) t.buffer, t.size);
+    }
+    else
+    {
+        halStatus = HAL_SPI_Transmit_DMA(&parameters, (uint8_t *) t.buffer, t.size);
+    }
+    return halStatus;
+}
+
+void AsyncSpi::abortTransfer ()
+{
+    HAL_SPI_DMAStop(&parameters);
+    __HAL_SPI_DISABLE_IT(&parameters, SPI_IT_TXE | SPI_IT_RXNE | SPI_IT_ERR);
+}
+
+void AsyncSpi::finishTransfer ()
+{
+    // The DMA is complete when the last byte is written into the data register
+    while (isBusy())
+    {
+        __NOP();
+    }
+}
+
 #endif
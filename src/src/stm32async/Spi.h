@@ -145,7 +145,7 @@ public:
      */
     inline HAL_StatusTypeDef transmit (DeviceClient * _client, uint8_t * buffer, uint16_t n)
     {
-        startCommunication(_client, State::TX, State::TX_CMPL);
+        startCommunication(_client, State::TX, State::TX_CMPL, n);
         halStatus = HAL_SPI_Transmit_DMA(&parameters, buffer, n);
         return halStatus;
     }
@@ -155,7 +155,7 @@ public:
      */
     inline HAL_StatusTypeDef transmitIt (DeviceClient * _client, uint8_t * buffer, uint16_t n)
     {
-        startCommunication(_client, State::TX, State::TX_CMPL);
+        startCommunication(_client, State::TX, State::TX_CMPL, n);
         halStatus = HAL_SPI_Transmit_IT(&parameters, buffer, n);
         return halStatus;
     }
@@ -165,7 +165,7 @@ public:
      */
     inline HAL_StatusTypeDef receive (DeviceClient * _client, uint8_t * buffer, uint16_t n)
     {
-        startCommunication(_client, State::RX, State::RX_CMPL);
+        startCommunication(_client, State::RX, State::RX_CMPL, n);
         halStatus = HAL_SPI_Receive_DMA(&parameters, buffer, n);
         return halStatus;
     }
@@ -175,11 +175,31 @@ public:
      */
     inline HAL_StatusTypeDef receiveIt (DeviceClient * _client, uint8_t * buffer, uint16_t n)
     {
-        startCommunication(_client, State::RX, State::RX_CMPL);
+        startCommunication(_client, State::RX, State::RX_CMPL, n);
         halStatus = HAL_SPI_Receive_IT(&parameters, buffer, n);
         return halStatus;
     }
 
+    /**
+     * @brief Puts a DMA transmission into the transaction queue, see SharedDevice::enqueue().
+     *        The chip select pin is low during the transmission.
+     */
+    inline HAL_StatusTypeDef enqueueTransmit (DeviceClient * _client, uint8_t * buffer, uint16_t n,
+                                              IOPort * csPin = NULL)
+    {
+        return enqueue(Transaction { _client, State::TX, State::TX_CMPL, buffer, n, csPin });
+    }
+
+    /**
+     * @brief Puts a DMA reception into the transaction queue, see SharedDevice::enqueue().
+     *        The chip select pin is low during the reception.
+     */
+    inline HAL_StatusTypeDef enqueueReceive (DeviceClient * _client, uint8_t * buffer, uint16_t n,
+                                             IOPort * csPin = NULL)
+    {
+        return enqueue(Transaction { _client, State::RX, State::RX_CMPL, buffer, n, csPin });
+    }
+
     /**
      * @brief Interrupt handling.
      */
@@ -187,6 +207,12 @@ public:
     {
         HAL_SPI_IRQHandler(&parameters);
     }
+
+protected:
+
+    virtual HAL_StatusTypeDef startTransfer (const Transaction & t) override;
+    virtual void abortTransfer () override;
+    virtual void finishTransfer () override;
 };
 
 
@@ -41,6 +41,52 @@ typedef int64_t duration_ms;
 #define FIRST_CALENDAR_YEAR 1900
 #define MILLIS_IN_SEC 1000L
 
+/**
+ * @brief Helper define that places a variable into the core-coupled memory (CCM) of STM32F4.
+ *
+ * CCM is not accessible by DMA and it is not initialized by the startup code. It suits the
+ * state of the DSP drivers and other buffers that are only accessed by the CPU. The main
+ * stack is also placed into the CCM by LinkerScript.ld, so a local variable shall never be
+ * the source or the target of a DMA transfer.
+ */
+#define CCM_RAM __attribute__((section(".ccmram")))
+
+/**
+ * @brief Helper define that places a function into the SRAM: it is copied there from the flash
+ *        together with the initialized data and runs without flash wait states.
+ *
+ * Intended for hot interrupt handlers and DSP kernels. A call from the flash needs a long
+ * branch, the linker adds a veneer for the callers that do not see this attribute. GCC ignores
+ * the section of a template instance: a template kernel shall be inlined into a RAM_FUNC.
+ */
+#ifdef __arm__
+#define RAM_FUNC __attribute__((section(".ramfunc"), long_call, noinline))
+#else
+#define RAM_FUNC __attribute__((section(".ramfunc"), noinline))
+#endif
+
+/**
+ * @brief Checks whether a buffer can be transferred by DMA, i.e. that it is not in the CCM.
+ */
+inline bool isDmaAccessible (const void * buffer)
+{
+#ifdef CCMDATARAM_BASE
+    return (size_t) buffer < CCMDATARAM_BASE || (size_t) buffer > CCMDATARAM_END;
+#else
+    (void) buffer;
+    return true;
+#endif
+}
+
+/**
+ * @brief Enables the DWT cycle counter used by the time and cost measurements.
+ */
+inline void enableCycleCounter ()
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
 /**
  * @brief Helper define that allows us to declare a static "instance" attribute within a device
  */
@@ -150,6 +150,21 @@ void SystemClock::setI2S (uint32_t PLLI2SN, uint32_t PLLI2SR)
     #endif
 }
 
+bool SystemClock::reconfigureI2S (uint32_t PLLI2SN, uint32_t PLLI2SR)
+{
+    #ifdef HAL_I2S_MODULE_ENABLED
+        setI2S(PLLI2SN, PLLI2SR);
+        // Only the I2S clock is touched here: a repeated RTC selection could reset the backup domain
+        RCC_PeriphCLKInitTypeDef i2sParameters = periphClkParameters;
+        i2sParameters.PeriphClockSelection = RCC_PERIPHCLK_I2S;
+        return HAL_RCCEx_PeriphCLKConfig(&i2sParameters) == HAL_OK;
+    #else
+        UNUSED(PLLI2SN);
+        UNUSED(PLLI2SR);
+        return false;
+    #endif
+}
+
 void SystemClock::setADC (uint32_t clock)
 {
     #ifdef RCC_PERIPHCLK_ADC
@@ -47,6 +47,7 @@ public:
     void setAHB (uint32_t AHBCLKDivider, uint32_t APB1CLKDivider, uint32_t APB2CLKDivider);
     void setRTC ();
     void setI2S (uint32_t PLLI2SN, uint32_t PLLI2SR);
+    bool reconfigureI2S (uint32_t PLLI2SN, uint32_t PLLI2SR);
     void setADC (uint32_t clock);
 
     void start ();
@@ -87,6 +88,24 @@ public:
         return mcuFreq;
     }
 
+#ifdef STM32F4
+    /**
+     * @brief Frequency of the PLL clock source (HSE or HSI), shared by the main PLL and the PLLI2S.
+     */
+    inline uint32_t getPllSourceFreq () const
+    {
+        return (oscParameters.PLL.PLLSource == RCC_PLLSOURCE_HSE) ? HSE_VALUE : HSI_VALUE;
+    }
+
+    /**
+     * @brief PLL input divider, shared by the main PLL and the PLLI2S.
+     */
+    inline uint32_t getPllM () const
+    {
+        return oscParameters.PLL.PLLM;
+    }
+#endif /* STM32F4 */
+
     inline bool isRtcActivated () const
     {
         return periphClkParameters.RTCClockSelection == RCC_RTCCLKSOURCE_LSI ||
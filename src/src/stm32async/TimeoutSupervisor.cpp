@@ -0,0 +1,135 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#include "TimeoutSupervisor.h"
+#include "SharedDevice.h"
+
+#include <utility>
+
+using namespace Stm32async;
+
+/************************************************************************
+ * Class TimeoutSupervisor
+ ************************************************************************/
+
+TimeoutSupervisor::Entry TimeoutSupervisor::heap[TimeoutSupervisor::MAX_DEVICES];
+volatile uint32_t TimeoutSupervisor::size = 0;
+uint32_t TimeoutSupervisor::expired = 0;
+
+bool TimeoutSupervisor::add (SharedDevice & device, uint32_t deadline, uint32_t sequence)
+{
+    const uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (device.supervised)
+    {
+        remove(device);
+    }
+    const bool added = size < MAX_DEVICES;
+    if (added)
+    {
+        heap[size] = Entry { deadline, sequence, &device };
+        siftUp(size++);
+        device.supervised = true;
+    }
+    __set_PRIMASK(primask);
+    return added;
+}
+
+void TimeoutSupervisor::remove (SharedDevice & device)
+{
+    const uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    for (uint32_t i = 0; i < size; ++i)
+    {
+        if (heap[i].device == &device)
+        {
+            removeAt(i);
+            break;
+        }
+    }
+    __set_PRIMASK(primask);
+}
+
+void TimeoutSupervisor::processTick ()
+{
+    const uint32_t now = HAL_GetTick();
+    while (true)
+    {
+        const uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        if (size == 0 || isBefore(now, heap[0].deadline))
+        {
+            __set_PRIMASK(primask);
+            return;
+        }
+        const Entry e = heap[0];
+        removeAt(0);
+        ++expired;
+        __set_PRIMASK(primask);
+
+        // The device checks by the sequence whether the transaction is still running
+        e.device->expire(e.sequence);
+    }
+}
+
+void TimeoutSupervisor::removeAt (uint32_t i)
+{
+    heap[i].device->supervised = false;
+    heap[i] = heap[--size];
+    if (i < size)
+    {
+        siftUp(i);
+        siftDown(i);
+    }
+}
+
+void TimeoutSupervisor::siftUp (uint32_t i)
+{
+    while (i > 0)
+    {
+        const uint32_t parent = (i - 1) / 2;
+        if (!isBefore(heap[i].deadline, heap[parent].deadline))
+        {
+            break;
+        }
+        std::swap(heap[i], heap[parent]);
+        i = parent;
+    }
+}
+
+void TimeoutSupervisor::siftDown (uint32_t i)
+{
+    while (true)
+    {
+        uint32_t first = i;
+        for (uint32_t child = 2 * i + 1; child <= 2 * i + 2 && child < size; ++child)
+        {
+            if (isBefore(heap[child].deadline, heap[first].deadline))
+            {
+                first = child;
+            }
+        }
+        if (first == i)
+        {
+            break;
+        }
+        std::swap(heap[i], heap[first]);
+        i = first;
+    }
+}
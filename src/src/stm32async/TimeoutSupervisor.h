@@ -0,0 +1,115 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#ifndef STM32ASYNC_TIMEOUT_SUPERVISOR_H_
+#define STM32ASYNC_TIMEOUT_SUPERVISOR_H_
+
+#include "Stm32async.h"
+
+namespace Stm32async
+{
+
+class SharedDevice;
+
+/**
+ * @brief Static class that supervises the timeouts of the active SharedDevice transactions.
+ *
+ * SharedDevice::startCommunication() registers the deadline of a transaction if the device
+ * has a limited timeout, processCallback() removes it when the transaction is finished. The
+ * deadlines (in HAL ticks) are kept in a min-heap, so processTick() only compares the nearest
+ * one with the current tick as long as nothing expires. processTick() shall be called from a
+ * periodic timer interrupt whose priority is not higher than the priorities of the supervised
+ * devices, so that it never preempts their completion handlers:
+ *
+ *     extern "C" {
+ *         void HAL_TIM_PeriodElapsedCallback (TIM_HandleTypeDef * htim)
+ *         {
+ *             TimeoutSupervisor::processTick();
+ *         }
+ *     }
+ *
+ * An expired transaction is aborted at the HAL level and its client is notified by
+ * State::TIMEOUT, see SharedDevice::expire().
+ */
+class TimeoutSupervisor final
+{
+public:
+
+    static constexpr uint32_t MAX_DEVICES = 8;
+
+    /**
+     * @brief Registers (or moves) the deadline of the current transaction of a device.
+     *
+     * @return false if MAX_DEVICES devices are already supervised.
+     */
+    static bool add (SharedDevice & device, uint32_t deadline, uint32_t sequence);
+
+    /**
+     * @brief Removes the deadline of a device, if any.
+     */
+    static void remove (SharedDevice & device);
+
+    /**
+     * @brief Expires all transactions whose deadline is reached.
+     */
+    static void processTick ();
+
+    static inline uint32_t getSize ()
+    {
+        return size;
+    }
+
+    /**
+     * @brief Returns the number of the expired transactions.
+     */
+    static inline uint32_t getExpired ()
+    {
+        return expired;
+    }
+
+private:
+
+    class Entry
+    {
+    public:
+
+        uint32_t deadline;
+        uint32_t sequence;
+        SharedDevice * device;
+    };
+
+    static Entry heap[MAX_DEVICES];
+    static volatile uint32_t size;
+    static uint32_t expired;
+
+    /**
+     * @brief Compares two ticks, also across the overflow of the tick counter.
+     */
+    static inline bool isBefore (uint32_t a, uint32_t b)
+    {
+        return (int32_t) (a - b) < 0;
+    }
+
+    static void removeAt (uint32_t i);
+    static void siftUp (uint32_t i);
+    static void siftDown (uint32_t i);
+};
+
+} // end namespace
+#endif
@@ -0,0 +1,96 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#include "Tracer.h"
+#include "UsartLogger.h"
+
+using namespace Stm32async;
+
+#define USART_DEBUG_MODULE "TRC: "
+
+/************************************************************************
+ * Class Tracer
+ ************************************************************************/
+
+// CCM is not initialized by the startup code: only the events below count are valid
+Tracer::Event Tracer::events[Tracer::CAPACITY] CCM_RAM;
+uint32_t Tracer::head = 0;
+uint32_t Tracer::count = 0;
+uint32_t Tracer::lost = 0;
+bool Tracer::suspended = false;
+
+void Tracer::record (Type type, const char * name, uint32_t id)
+{
+    const uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (!suspended)
+    {
+        if (count == 0 && lost == 0)
+        {
+            enableCycleCounter();
+        }
+        Event & e = events[head];
+        e.time = DWT->CYCCNT;
+        e.name = name;
+        e.id = id;
+        e.type = type;
+        e.context = (uint8_t) __get_IPSR();
+        head = (head + 1) % CAPACITY;
+        if (count < CAPACITY)
+        {
+            ++count;
+        }
+        else
+        {
+            ++lost;
+        }
+    }
+    __set_PRIMASK(primask);
+}
+
+void Tracer::dump ()
+{
+    const uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    suspended = true;
+    __set_PRIMASK(primask);
+
+    USART_DEBUG("trace " << (int) count << " events, " << (int) lost << " lost, cycles at "
+                << (int) (SystemCoreClock / 1000000) << " MHz" << UsartLogger::ENDL);
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        const Event & e = events[(head + CAPACITY - count + i) % CAPACITY];
+        // The logger transmits the string itself, it shall not be a temporary
+        const char * type = (e.type == Type::BEGIN) ? "B" : (e.type == Type::END) ? "E" : "i";
+        USART_DEBUG((int) e.time << " " << type << " " << (int) e.context << " " << (int) e.id << " "
+                    << e.name << UsartLogger::ENDL);
+    }
+    clear();
+}
+
+void Tracer::clear ()
+{
+    const uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    head = 0;
+    count = 0;
+    lost = 0;
+    suspended = false;
+    __set_PRIMASK(primask);
+}
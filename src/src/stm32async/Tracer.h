@@ -0,0 +1,112 @@
+/*******************************************************************************
+ * stm32async: Asynchronous I/O C++ library for STM32
+ * *****************************************************************************
+ * Copyright (C) 2018 Mikhail Kulesh, Denis Makarov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#ifndef STM32ASYNC_TRACER_H_
+#define STM32ASYNC_TRACER_H_
+
+#include "Stm32async.h"
+
+namespace Stm32async
+{
+
+/**
+ * @brief Tracing macros. They are only compiled if STM32ASYNC_TRACING is defined,
+ *        otherwise they expand to nothing.
+ *
+ * TRACE_BEGIN(name) and TRACE_END(name) enclose a span of the current context (the main
+ * loop or an interrupt handler), TRACE_INSTANT(name) marks a point in time. TRACE_DUMP()
+ * writes the recorded events to the logger.
+ */
+#ifdef STM32ASYNC_TRACING
+
+#define TRACE_BEGIN(name) Stm32async::Tracer::record(Stm32async::Tracer::Type::BEGIN, name)
+#define TRACE_END(name) Stm32async::Tracer::record(Stm32async::Tracer::Type::END, name)
+#define TRACE_INSTANT(name) Stm32async::Tracer::record(Stm32async::Tracer::Type::INSTANT, name)
+#define TRACE_DEVICE(type, name, id) Stm32async::Tracer::record(Stm32async::Tracer::Type::type, name, id)
+#define TRACE_DUMP() Stm32async::Tracer::dump()
+
+#else
+
+#define TRACE_BEGIN(name)
+#define TRACE_END(name)
+#define TRACE_INSTANT(name)
+#define TRACE_DEVICE(type, name, id)
+#define TRACE_DUMP()
+
+#endif
+
+/**
+ * @brief Static class that records events into a ring buffer in the CCM RAM.
+ *
+ * An event holds the value of the DWT cycle counter, the active exception number (0 for
+ * the main loop) and an optional ID; events with an ID are shown on an own track, e.g.
+ * the transactions of a SharedDevice at its DMA stream. When the ring is full, the oldest
+ * events are overwritten. The events are written with disabled interrupts, so they may
+ * be recorded from any context. In the host simulation, the cycle counter follows the
+ * virtual clock.
+ *
+ * The dump consists of the lines
+ *
+ *     TRC: trace <events> events, <lost> lost, cycles at <MHz> MHz
+ *     TRC: <cycles> <B|E|i> <exception> <ID> <name>
+ *
+ * where the numbers are signed decimals of the 32-bit values. HAL_Sim/Tools/trace_json.cpp
+ * converts a log containing them into the Chrome trace_event format.
+ */
+class Tracer final
+{
+public:
+
+    static constexpr uint32_t CAPACITY = 1024;
+
+    enum class Type : char
+    {
+        BEGIN = 'B',
+        END = 'E',
+        INSTANT = 'i'
+    };
+
+    typedef struct
+    {
+        uint32_t time;
+        const char * name;
+        uint32_t id;
+        Type type;
+        uint8_t context;
+    } Event;
+
+    static void record (Type type, const char * name, uint32_t id = 0);
+
+    /**
+     * @brief Writes the recorded events to the logger and clears the ring. The recording
+     *        is suspended meanwhile, i.e. the logger transactions are not traced.
+     */
+    static void dump ();
+
+    static void clear ();
+
+private:
+
+    static Event events[CAPACITY];
+    static uint32_t head, count, lost;
+    static bool suspended;
+};
+
+} // end namespace
+#endif
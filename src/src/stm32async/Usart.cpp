@@ -116,4 +116,13 @@ void AsyncUsart::stop ()
     BaseUsart::stop();
 }
 
+void AsyncUsart::abortTransfer ()
+{
+    HAL_UART_DMAStop(&parameters);
+    // The interrupt mode and the end of a DMA transmission use these interrupts
+    __HAL_UART_DISABLE_IT(&parameters, UART_IT_TXE);
+    __HAL_UART_DISABLE_IT(&parameters, UART_IT_TC);
+    __HAL_UART_DISABLE_IT(&parameters, UART_IT_RXNE);
+}
+
 #endif
@@ -143,7 +143,7 @@ public:
      */
     inline HAL_StatusTypeDef transmit (DeviceClient * _client, const char * buffer, size_t n)
     {
-        startCommunication(_client, State::TX, State::TX_CMPL);
+        startCommunication(_client, State::TX, State::TX_CMPL, n);
         halStatus = HAL_UART_Transmit_DMA(&parameters, (unsigned char *) buffer, n);
         return halStatus;
     }
@@ -153,7 +153,7 @@ public:
      */
     inline HAL_StatusTypeDef transmitIt (DeviceClient * _client, const char * buffer, size_t n)
     {
-        startCommunication(_client, State::TX, State::TX_CMPL);
+        startCommunication(_client, State::TX, State::TX_CMPL, n);
         halStatus = HAL_UART_Transmit_IT(&parameters, (unsigned char *) buffer, n);
         return halStatus;
     }
@@ -163,7 +163,7 @@ public:
      */
     inline HAL_StatusTypeDef receive (DeviceClient * _client, const char * buffer, size_t n)
     {
-        startCommunication(_client, State::RX, State::RX_CMPL);
+        startCommunication(_client, State::RX, State::RX_CMPL, n);
         halStatus = HAL_UART_Receive_DMA(&parameters, (unsigned char *) buffer, n);
         return halStatus;
     }
@@ -173,7 +173,7 @@ public:
      */
     inline HAL_StatusTypeDef receiveIt (DeviceClient * _client, const char * buffer, size_t n)
     {
-        startCommunication(_client, State::RX, State::RX_CMPL);
+        startCommunication(_client, State::RX, State::RX_CMPL, n);
         halStatus = HAL_UART_Receive_IT(&parameters, (unsigned char *) buffer, n);
         return halStatus;
     }
@@ -185,6 +185,10 @@ public:
     {
         HAL_UART_IRQHandler(&parameters);
     }
+
+protected:
+
+    virtual void abortTransfer () override;
 };
 
 
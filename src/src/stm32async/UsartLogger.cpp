@@ -52,6 +52,12 @@ UsartLogger & UsartLogger::operator << (const char * buffer)
     {
         #ifndef BLOCKING_TRANSMITION
         usart.waitForRelease();
+        if (!isDmaAccessible(buffer))
+        {
+            // A string on the stack (in the CCM) is not accessible by DMA
+            usart.transmitBlocking(buffer, bSize);
+            return *this;
+        }
         usart.transmit(NULL, buffer, bSize);
         #else
         usart.transmitBlocking(buffer, bSize);
@@ -62,13 +68,17 @@ UsartLogger & UsartLogger::operator << (const char * buffer)
 
 UsartLogger & UsartLogger::operator << (int n)
 {
-    char buffer[256];
+    // The DMA reads the digits after the return: the buffer is static and it is only
+    // reused when the previous transmission is finished
+    static char buffer[16];
+    #ifndef BLOCKING_TRANSMITION
+    usart.waitForRelease();
+    #endif
     ::__itoa(n, buffer, 10);
     size_t bSize = ::strlen(buffer);
     if (bSize > 0)
     {
         #ifndef BLOCKING_TRANSMITION
-        usart.waitForRelease();
         usart.transmit(NULL, buffer, bSize);
         #else
         usart.transmitBlocking(buffer, bSize);
@@ -114,6 +114,7 @@ int _write(int file, char *ptr, int len)
 caddr_t _sbrk(int incr)
 {
 	extern char end asm("end");
+	extern char _heap_limit asm("_heap_limit"); /* end of RAM, the stack is in CCMRAM */
 	static char *heap_end;
 	char *prev_heap_end;
 
@@ -121,7 +122,7 @@ caddr_t _sbrk(int incr)
 		heap_end = &end;
 
 	prev_heap_end = heap_end;
-	if (heap_end + incr > stack_ptr)
+	if (heap_end + incr > &_heap_limit)
 	{
 //		write(1, "Heap and stack collision\n", 25);
 //		abort();